@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for the lookup and bulk operations of BinarySearchTree and
+// AVLTree, each checked against std::map or against the plain lookups.
+// The unbalanced tree is filled in random order so that it stays shallow
+// enough for the recursive helpers.
+
+/**
+* Fills tree and ref with the same random entries.
+*/
+template <typename Tree>
+void fill(Tree& tree, map<int, int>& ref, int count, int range, unsigned seed)
+{
+    srand(seed);
+    for(int i = 0; i < count; ++i)
+    {
+        int key = rand() % range;
+        tree.insert(make_pair(key, i));
+        ref[key] = i;
+    }
+}
+
+/**
+* find_many must answer exactly like find for batches of every size around
+* the lookup group, sorted or not, with repeats and absent keys.
+*/
+template <typename Tree>
+void checkFindMany(const char* name, const Tree& tree, int range)
+{
+    bool same = true;
+    for(size_t count = 0; count < 40; ++count)
+    {
+        for(int sorted = 0; sorted < 2; ++sorted)
+        {
+            vector<int> keys;
+            for(size_t i = 0; i < count; ++i)
+                keys.push_back(rand() % (range + 10) - 5);
+            if(sorted)
+                sort(keys.begin(), keys.end());
+            vector<typename Tree::iterator> found;
+            tree.find_many(keys, found);
+            same = same && found.size() == keys.size();
+            for(size_t i = 0; same && i < keys.size(); ++i)
+                same = found[i] == tree.find(keys[i]);
+        }
+    }
+
+    vector<int> keys;
+    for(int i = 0; i < 5000; ++i)
+        keys.push_back(rand() % (range + 10) - 5);
+    vector<typename Tree::iterator> found(keys.size());
+    tree.find_many(keys.data(), keys.size(), found.data());
+    for(size_t i = 0; same && i < keys.size(); ++i)
+        same = found[i] == tree.find(keys[i]);
+    sort(keys.begin(), keys.end());
+    tree.find_many(keys.data(), keys.size(), found.data());
+    for(size_t i = 0; same && i < keys.size(); ++i)
+        same = found[i] == tree.find(keys[i]);
+    check(same, name, "find_many differs from find");
+}
+
+void testFindMany()
+{
+    BinarySearchTree<int, int> bst;
+    AVLTree<int, int> avl;
+    map<int, int> ref;
+    fill(bst, ref, 3000, 6000, 41);
+    ref.clear();
+    fill(avl, ref, 3000, 6000, 42);
+    checkFindMany("BinarySearchTree find_many", bst, 6000);
+    checkFindMany("AVLTree find_many", avl, 6000);
+
+    AVLTree<int, int> empty;
+    vector<int> keys(20, 1);
+    vector<AVLTree<int, int>::iterator> found;
+    empty.find_many(keys, found);
+    check(found.size() == keys.size() && count(found.begin(), found.end(), empty.end()) == (long)keys.size(),
+          "AVLTree find_many", "lookups in an empty tree found something");
+}
+
+/**
+* find_from and lower_bound_from must agree with find and lower_bound from
+* any finger: every entry, end(), and fingers near and far from the key.
+*/
+template <typename Tree>
+void checkFingers(const char* name, const Tree& tree, const map<int, int>& ref, int range)
+{
+    vector<typename Tree::iterator> fingers(1, tree.end());
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it)
+        fingers.push_back(it);
+    bool same = true;
+    for(int i = 0; same && i < 20000; ++i)
+    {
+        size_t f = rand() % fingers.size();
+        typename Tree::iterator finger = fingers[f];
+        int key;
+        if(finger != tree.end() && i % 2 == 0)
+            key = finger->first + rand() % 21 - 10;
+        else
+            key = rand() % (range + 10) - 5;
+        same = tree.find_from(finger, key) == tree.find(key) &&
+               tree.lower_bound_from(finger, key) == tree.lower_bound(key);
+    }
+    check(same, name, "finger search differs from search from the root");
+
+    // Walking up through the keys with each hit as the next finger.
+    typename Tree::iterator finger = tree.end();
+    bool walk = true;
+    for(int key = -5; key < range + 5; ++key)
+    {
+        typename Tree::iterator lb = tree.lower_bound_from(finger, key);
+        map<int, int>::const_iterator r = ref.lower_bound(key);
+        walk = walk && (r == ref.end() ? lb == tree.end() : (lb != tree.end() && lb->first == r->first));
+        if(lb != tree.end())
+            finger = lb;
+    }
+    check(walk, name, "ascending finger walk differs from std::map");
+}
+
+void testFingers()
+{
+    BinarySearchTree<int, int> bst;
+    AVLTree<int, int> avl;
+    map<int, int> bstRef;
+    map<int, int> avlRef;
+    fill(bst, bstRef, 2000, 4000, 51);
+    fill(avl, avlRef, 2000, 4000, 52);
+    checkFingers("BinarySearchTree finger search", bst, bstRef, 4000);
+    checkFingers("AVLTree finger search", avl, avlRef, 4000);
+
+    AVLTree<int, int> empty;
+    check(empty.find_from(empty.end(), 1) == empty.end() && empty.lower_bound_from(empty.end(), 1) == empty.end(),
+          "AVLTree finger search", "search in an empty tree found something");
+}
+
+template <typename Tree>
+bool balancedOk(const Tree& tree)
+{
+    return tree.isBalanced();
+}
+
+/**
+* True if the tree's nodes sit back to back in key order, as compaction
+* leaves them.
+*/
+template <typename Tree>
+bool contiguous(const Tree& tree)
+{
+    const char* prev = NULL;
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it)
+    {
+        const char* at = reinterpret_cast<const char*>(&*it);
+        if(prev != NULL && at - prev != (ptrdiff_t)sizeof(AVLNode<int, int>))
+            return false;
+        prev = at;
+    }
+    return true;
+}
+
+/**
+* compact must keep the contents and balance while packing the nodes into
+* one allocation; compact_step must do the same a slice at a time while
+* the tree keeps changing between slices, and leave the tree as it was if
+* a slice cannot allocate its region.
+*/
+void testCompact()
+{
+    const char* name = "AVLTree compact";
+    AVLTree<int, int> tree;
+    map<int, int> ref;
+    fill(tree, ref, 6000, 4000, 61);
+    for(int key = 0; key < 4000; key += 3)
+    {
+        tree.remove(key);
+        ref.erase(key);
+    }
+    TreeMemoryUsage before = tree.memory_usage();
+    tree.compact();
+    check(tree.isBalanced() && sameContents(tree, ref), name, "compact changed the tree");
+    check(contiguous(tree), name, "compacted nodes not back to back in key order");
+    check(tree.memory_usage().allocatorOverhead < before.allocatorOverhead, name,
+          "compacted nodes still counted as separate allocations");
+
+    // Slices of 50 with changes in between, including removals of the
+    // node the next slice starts from.
+    srand(62);
+    int passes = 0;
+    for(int i = 0; i < 4000 && passes < 3; ++i)
+    {
+        int key = rand() % 4000;
+        if(rand() % 2 == 0)
+        {
+            tree.insert(make_pair(key, -i));
+            ref[key] = -i;
+        }
+        else
+        {
+            tree.remove(key);
+            ref.erase(key);
+        }
+        if(i % 10 == 0 && tree.compact_step(50))
+            ++passes;
+    }
+    check(passes == 3, name, "compact_step passes did not finish");
+    check(tree.isBalanced() && sameContents(tree, ref), name, "compact_step changed the tree");
+
+    size_t nodes = tree.live_nodes();
+    allocationsLeft() = 0;
+    bool thrown = false;
+    try
+    {
+        tree.compact_step(100);
+    }
+    catch(std::bad_alloc&)
+    {
+        thrown = true;
+    }
+    allocationsLeft() = -1;
+    check(thrown, name, "compact_step without memory did not throw");
+    check(tree.live_nodes() == nodes && tree.isBalanced() && sameContents(tree, ref), name,
+          "failed compact_step changed the tree");
+
+    // Freeing every node must give back every region.
+    for(map<int, int>::iterator it = ref.begin(); it != ref.end(); ++it)
+        tree.remove(it->first);
+    check(tree.empty() && tree.memory_usage().total() == 0, name, "regions outlived their nodes");
+}
+
+/**
+* Node handles move entries between trees without copying, compaction
+* included, and merge moves every entry whose key is not taken.
+*/
+void testHandlesAndMerge()
+{
+    const char* name = "AVLTree handles";
+    AVLTree<int, int> a;
+    AVLTree<int, int> b;
+    map<int, int> refA;
+    map<int, int> refB;
+    srand(7);
+    for(int i = 0; i < 20000; ++i)
+    {
+        int key = rand() % 3000;
+        switch(rand() % 6)
+        {
+        case 0:
+        case 1:
+            a.insert(make_pair(key, i));
+            refA[key] = i;
+            break;
+        case 2:
+            a.remove(key);
+            refA.erase(key);
+            break;
+        case 3:
+            b.insert(make_pair(key, -i));
+            refB[key] = -i;
+            break;
+        case 4:
+        {
+            AVLTree<int, int>::node_type handle = a.extract(key);
+            check(bool(handle) == (refA.count(key) == 1), name, "extract found the wrong key");
+            if(handle)
+            {
+                int value = handle.mapped();
+                refA.erase(key);
+                bool moved = b.insert(std::move(handle));
+                check(moved == (refB.count(key) == 0), name, "node-handle insert misreported");
+                check(moved == handle.empty(), name, "node-handle insert left the handle wrong");
+                if(moved)
+                    refB[key] = value;
+            }
+            break;
+        }
+        default:
+            a.compact_step(64);
+            break;
+        }
+    }
+    check(a.isBalanced() && sameContents(a, refA), name, "extract differs from std::map");
+    check(b.isBalanced() && sameContents(b, refB), name, "node-handle inserts differ from std::map");
+
+    // A handle that is dropped or overwritten frees its node.
+    size_t nodes = a.live_nodes();
+    int first = refA.begin()->first;
+    int second = (++refA.begin())->first;
+    {
+        AVLTree<int, int>::node_type kept = a.extract(first);
+        AVLTree<int, int>::node_type other = a.extract(second);
+        kept = std::move(other);
+        check(kept.key() == second && other.empty() && a.live_nodes() == nodes - 2, name, "handle move wrong");
+        kept.mapped() = 99;
+        check(a.insert(std::move(kept)) && a.find(second)->second == 99, name, "handle lost its value");
+    }
+    refA.erase(first);
+    refA[second] = 99;
+    check(!a.insert(AVLTree<int, int>::node_type()) && a.live_nodes() == nodes - 1, name,
+          "empty handle inserted something");
+
+    map<int, int> merged(refB);
+    map<int, int> left;
+    for(map<int, int>::iterator it = refA.begin(); it != refA.end(); ++it)
+    {
+        if(!merged.insert(*it).second)
+            left.insert(*it);
+    }
+    a.compact();
+    b.merge(a);
+    check(b.isBalanced() && sameContents(b, merged), name, "merge produced the wrong tree");
+    check(a.isBalanced() && sameContents(a, left), name, "merge left the wrong entries behind");
+    check(b.live_nodes() == merged.size() && a.live_nodes() == left.size(), name, "merge miscounted the nodes");
+    b.merge(b);
+    check(sameContents(b, merged), name, "merge with itself changed the tree");
+}
+
+/**
+* export_range over ranges that are empty, cut by the ends of the tree or
+* inside it, through buffers smaller and larger than the range, before
+* and after compaction.
+*/
+void testExport()
+{
+    BinarySearchTree<int, int> bst;
+    AVLTree<int, int> avl;
+    map<int, int> bstRef;
+    map<int, int> ref;
+    fill(bst, bstRef, 2000, 4000, 43);
+    fill(avl, ref, 6000, 8000, 44);
+    const int bounds[][2] = { { 0, 4000 }, { -100, 100 }, { 1234, 5678 }, { 7900, 9000 }, { 500, 500 }, { 600, 200 } };
+    const size_t capacities[] = { 1, 7, 256, 10000 };
+    for(size_t b = 0; b < sizeof(bounds) / sizeof(bounds[0]); ++b)
+    {
+        for(size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); ++c)
+        {
+            checkExport("BinarySearchTree export_range", bst, bstRef, bounds[b][0], bounds[b][1], capacities[c]);
+            checkExport("AVLTree export_range", avl, ref, bounds[b][0], bounds[b][1], capacities[c]);
+        }
+    }
+    avl.compact();
+    for(size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); ++c)
+        checkExport("AVLTree export_range compacted", avl, ref, 1234, 5678, capacities[c]);
+
+    AVLTree<int, int>::iterator from = avl.lower_bound(100);
+    int key;
+    check(avl.export_range(from, 200, &key, NULL, 0) == 0 && from == avl.lower_bound(100), "AVLTree export_range",
+          "zero capacity moved the iterator");
+    from = avl.end();
+    check(avl.export_range(from, 9000, &key, NULL, 1) == 0, "AVLTree export_range", "export from end() wrote");
+}
+
+int main()
+{
+    AVLTree<int, int> avl;
+    stressMap("AVLTree", avl, 1, balancedOk<AVLTree<int, int> >);
+    testFindMany();
+    testFingers();
+    testCompact();
+    testHandlesAndMerge();
+    testExport();
+    return testSummary("AVLTree");
+}
@@ -5,7 +5,12 @@
 #include <exception>
 #include <cstdlib>
 #include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 #include "bst.h"
+#include "balancedbst.h"
 
 struct KeyError { };
 
@@ -25,6 +30,9 @@ public:
     signed char getBalance () const;
     void setBalance (signed char balance);
     void updateBalance(signed char diff);
+    // The balance under the name AVLPolicy uses for every node type.
+    int getRank() const;
+    void setRank(int rank);
 
     // Getters for parent, left, and right. These need to be redefined since they
     // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
@@ -86,6 +94,18 @@ void AVLNode<Key, Value>::updateBalance(signed char diff)
     balance_ += diff;
 }
 
+template<class Key, class Value>
+int AVLNode<Key, Value>::getRank() const
+{
+    return balance_;
+}
+
+template<class Key, class Value>
+void AVLNode<Key, Value>::setRank(int rank)
+{
+    balance_ = (signed char) rank;
+}
+
 /**
 * An overridden function for getting the parent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
@@ -118,35 +138,545 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Alloc>
+class AVLTree;
+
+/**
+* Owns a node taken out of an AVLTree by extract, until it is inserted
+* into a tree again; a handle still holding its node frees it when it is
+* destroyed. Handles can be moved but not copied.
+*/
+template <class Key, class Value, class Alloc>
+class AVLNodeHandle
+{
+public:
+    AVLNodeHandle();
+    AVLNodeHandle(AVLNodeHandle<Key, Value, Alloc>&& other);
+    AVLNodeHandle<Key, Value, Alloc>& operator=(AVLNodeHandle<Key, Value, Alloc>&& other);
+    ~AVLNodeHandle();
+
+    bool empty() const;
+    explicit operator bool() const;
+    const Key& key() const;
+    Value& mapped() const;
+
+private:
+    friend class AVLTree<Key, Value, Alloc>;
+    AVLNodeHandle(AVLNode<Key, Value>* node, const Alloc& alloc);
+    AVLNodeHandle(const AVLNodeHandle<Key, Value, Alloc>&);
+    AVLNodeHandle<Key, Value, Alloc>& operator=(const AVLNodeHandle<Key, Value, Alloc>&);
+    void reset();
+
+    AVLNode<Key, Value>* node_;
+    Alloc alloc_;
+};
+
+template <class Key, class Value, class Alloc>
+AVLNodeHandle<Key, Value, Alloc>::AVLNodeHandle() :
+    node_(NULL),
+    alloc_()
+{
+
+}
+
+template <class Key, class Value, class Alloc>
+AVLNodeHandle<Key, Value, Alloc>::AVLNodeHandle(AVLNode<Key, Value>* node, const Alloc& alloc) :
+    node_(node),
+    alloc_(alloc)
+{
+
+}
+
+template <class Key, class Value, class Alloc>
+AVLNodeHandle<Key, Value, Alloc>::AVLNodeHandle(AVLNodeHandle<Key, Value, Alloc>&& other) :
+    node_(other.node_),
+    alloc_(other.alloc_)
+{
+    other.node_ = NULL;
+}
+
+template <class Key, class Value, class Alloc>
+AVLNodeHandle<Key, Value, Alloc>&
+AVLNodeHandle<Key, Value, Alloc>::operator=(AVLNodeHandle<Key, Value, Alloc>&& other)
+{
+    if(this != &other)
+    {
+        reset();
+        node_ = other.node_;
+        alloc_ = other.alloc_;
+        other.node_ = NULL;
+    }
+    return *this;
+}
+
+template <class Key, class Value, class Alloc>
+AVLNodeHandle<Key, Value, Alloc>::~AVLNodeHandle()
+{
+    reset();
+}
+
+template <class Key, class Value, class Alloc>
+bool AVLNodeHandle<Key, Value, Alloc>::empty() const
+{
+    return node_ == NULL;
+}
+
+template <class Key, class Value, class Alloc>
+AVLNodeHandle<Key, Value, Alloc>::operator bool() const
+{
+    return node_ != NULL;
+}
+
+/**
+* @precondition The handle is not empty
+*/
+template <class Key, class Value, class Alloc>
+const Key& AVLNodeHandle<Key, Value, Alloc>::key() const
+{
+    return node_->getKey();
+}
+
+/**
+* @precondition The handle is not empty
+*/
+template <class Key, class Value, class Alloc>
+Value& AVLNodeHandle<Key, Value, Alloc>::mapped() const
+{
+    return node_->getValue();
+}
+
+/**
+* Frees the node, if the handle still owns one.
+*/
+template <class Key, class Value, class Alloc>
+void AVLNodeHandle<Key, Value, Alloc>::reset()
+{
+    if(node_ == NULL)
+        return;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<AVLNode<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(alloc_);
+    NodeTraits::destroy(alloc, node_);
+    NodeTraits::deallocate(alloc, node_, 1);
+    node_ = NULL;
+}
+
+
+template <class Key, class Value, class Alloc = std::allocator<std::pair<const Key, Value> > >
+class AVLTree : public BinarySearchTree<Key, Value, Alloc>
 {
 public:
+    explicit AVLTree(const Alloc& alloc = Alloc());
+    virtual ~AVLTree();
     virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
     virtual void remove(const Key& key);  // TODO
+    template <typename InputIt>
+    void buildFromSorted(InputIt first, size_t count);
+    virtual TreeMemoryUsage memory_usage() const override;
+    virtual void compact();
+    bool compact_step(size_t maxNodes);
+
+    typedef AVLNodeHandle<Key, Value, Alloc> node_type;
+    node_type extract(const Key& key);
+    bool insert(node_type&& handle);
+    void merge(AVLTree<Key, Value, Alloc>& other);
 protected:
+    /**
+    * A block of nodes laid out back to back in key order by compaction.
+    * It is returned to the allocator when its last node is freed.
+    */
+    struct NodeRegion
+    {
+        std::max_align_t* memory;
+        size_t units;
+        char* begin;
+        char* end;
+        size_t live;
+    };
+
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent) override;
+    virtual void destroyNode(Node<Key, Value>* n) override;
+    virtual size_t nodeSize() const override;
+    virtual bool plainNodes() const;
+    // Compaction hooks for trees with their own node type or node index.
+    virtual AVLNode<Key, Value>* copyNodeTo(void* where, AVLNode<Key, Value>* from);
+    virtual void nodeMoved(AVLNode<Key, Value>* to);
+    // Transfer hooks for trees that index their nodes. adoptNode runs
+    // before n is linked and may throw; disownNode runs after n is
+    // unlinked and must not.
+    virtual void adoptNode(AVLNode<Key, Value>* n);
+    virtual void disownNode(AVLNode<Key, Value>* n);
+    bool releaseNode(Node<Key, Value>* n);
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
-    // Add helper functions here
-    void rotateRight(AVLNode<Key,Value>* x);
-    void rotateLeft(AVLNode<Key,Value>* x);
-    void insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n);
+    // Rebalancing is AVLPolicy's, shared with BalancedAVLTree and AVLSet.
+    // Rotations are virtual so augmented trees can refresh their data.
+    friend struct AVLPolicy;
+    virtual void rotateRight(AVLNode<Key,Value>* x);
+    virtual void rotateLeft(AVLNode<Key,Value>* x);
+    void linkLeaf(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* n, bool left);
+    void removeNode(AVLNode<Key, Value>* curr);
+    void unlinkNode(AVLNode<Key, Value>* curr);
     bool isRightChild(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n);
     bool isLeftChild(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n);
-    void removeFix(AVLNode<Key, Value> *n, signed char diff);
+    template <typename InputIt>
+    AVLNode<Key, Value>* buildHelp(InputIt& first, size_t count, int& height);
+    void relocate(AVLNode<Key, Value>* from, void* where);
+    void substitute(AVLNode<Key, Value>* from, AVLNode<Key, Value>* to);
+    AVLNode<Key, Value>* unregion(AVLNode<Key, Value>* n);
+    bool findSlot(const Key& key, AVLNode<Key, Value>*& parent, bool& left) const;
+    void requirePlainNodes() const;
+    AVLNode<Key, Value>* linkRegion(char* first, size_t stride, size_t count, AVLNode<Key, Value>* parent, int& height);
+    NodeRegion* regionOf(const void* p);
+    void freeRegion(NodeRegion* region);
 
+    std::vector<NodeRegion> regions_;
+    AVLNode<Key, Value>* compactNext_;
 };
 
+template<class Key, class Value, class Alloc>
+AVLTree<Key, Value, Alloc>::AVLTree(const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Alloc>(alloc),
+    compactNext_(NULL)
+{
+
+}
+
+/**
+* Frees the nodes here rather than in the base destructor, where the
+* virtual destroyNode would no longer reach the AVLNode version.
+*/
+template<class Key, class Value, class Alloc>
+AVLTree<Key, Value, Alloc>::~AVLTree()
+{
+    this->clear();
+}
+
+/**
+* Allocates and constructs an AVLNode through the tree's allocator.
+*/
+template<class Key, class Value, class Alloc>
+Node<Key, Value>*
+AVLTree<Key, Value, Alloc>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<AVLNode<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    AVLNode<Key, Value> *n = NodeTraits::allocate(alloc, 1);
+    try
+    {
+        NodeTraits::construct(alloc, n, key, value, static_cast<AVLNode<Key, Value>*>(parent));
+    }
+    catch(...)
+    {
+        NodeTraits::deallocate(alloc, n, 1);
+        throw;
+    }
+    this->nodeAdded(sizeof(AVLNode<Key, Value>));
+    return n;
+}
+
+/**
+* Destroys and frees a node made by createNode or moved by compaction.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::destroyNode(Node<Key, Value>* n)
+{
+    this->nodeRemoved(sizeof(AVLNode<Key, Value>));
+    if(releaseNode(n))
+        return;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<AVLNode<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    AVLNode<Key, Value> *node = static_cast<AVLNode<Key, Value>*>(n);
+    NodeTraits::destroy(alloc, node);
+    NodeTraits::deallocate(alloc, node, 1);
+}
+
+template<class Key, class Value, class Alloc>
+size_t AVLTree<Key, Value, Alloc>::nodeSize() const
+{
+    return sizeof(AVLNode<Key, Value>);
+}
+
+/**
+* Like the base version, but nodes in compaction regions share one
+* allocation per region and the unused tail of a region is reported as
+* auxiliary bytes.
+*/
+template<class Key, class Value, class Alloc>
+TreeMemoryUsage AVLTree<Key, Value, Alloc>::memory_usage() const
+{
+    TreeMemoryUsage usage = BinarySearchTree<Key, Value, Alloc>::memory_usage();
+    size_t node = nodeSize();
+    for(size_t i = 0; i < regions_.size(); ++i)
+    {
+        const NodeRegion& r = regions_[i];
+        size_t bytes = r.units * sizeof(std::max_align_t);
+        usage.allocatorOverhead -= r.live * AllocatorOverhead<Alloc>::perAllocation(node);
+        usage.allocatorOverhead += AllocatorOverhead<Alloc>::perAllocation(bytes);
+        usage.auxiliaryBytes += bytes - r.live * node;
+    }
+    return usage;
+}
+
+/**
+* Moves every node into one new contiguous region in key order, frees the
+* old nodes and relinks the tree into the shape buildFromSorted gives, so
+* that scans and lookups after heavy churn run as they did after a fresh
+* load. Invalidates iterators. Abandons any compaction pass in progress.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::compact()
+{
+    compactNext_ = NULL;
+    compact_step((size_t)-1);
+    if(this->root_ == NULL)
+        return;
+
+    // Every node is now in the newest region, in key order, at the same
+    // offset within its slot.
+    NodeRegion *region = regionOf(this->root_);
+    size_t stride = nodeSize();
+    char *root = reinterpret_cast<char*>(static_cast<AVLNode<Key, Value>*>(this->root_));
+    char *first = region->begin + (root - region->begin) % stride;
+    int height;
+    this->root_ = linkRegion(first, stride, region->live, NULL, height);
+}
+
+/**
+* Links count nodes stored stride bytes apart in key order into a
+* balanced subtree, as buildHelp does, and returns its root.
+*/
+template<class Key, class Value, class Alloc>
+AVLNode<Key, Value>* AVLTree<Key, Value, Alloc>::linkRegion(char* first, size_t stride, size_t count,
+                                                            AVLNode<Key, Value>* parent, int& height)
+{
+    if(count == 0)
+    {
+        height = 0;
+        return NULL;
+    }
+    size_t leftCount = count / 2;
+    AVLNode<Key, Value> *n = reinterpret_cast<AVLNode<Key, Value>*>(first + leftCount * stride);
+    int leftHeight;
+    int rightHeight;
+    n->setParent(parent);
+    n->setLeft(linkRegion(first, stride, leftCount, n, leftHeight));
+    n->setRight(linkRegion(first + (leftCount + 1) * stride, stride, count - leftCount - 1, n, rightHeight));
+    n->setBalance((signed char)(rightHeight - leftHeight));
+    height = 1 + std::max(leftHeight, rightHeight);
+    return n;
+}
+
+/**
+* Does one time-sliced slice of a compaction pass: moves up to maxNodes
+* nodes, continuing in key order from where the previous step stopped,
+* into a new contiguous region. Returns true when the pass has reached
+* the largest key; the next call starts a new pass. The tree may be used
+* and modified between steps, but each step invalidates iterators.
+*/
+template<class Key, class Value, class Alloc>
+bool AVLTree<Key, Value, Alloc>::compact_step(size_t maxNodes)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<std::max_align_t> RegionAlloc;
+    typedef std::allocator_traits<RegionAlloc> RegionTraits;
+
+    Node<Key, Value> *first = compactNext_ != NULL ? compactNext_ : this->getSmallestNode();
+    size_t count = 0;
+    for(Node<Key, Value> *n = first; n != NULL && count < maxNodes; n = this->successor(n))
+        ++count;
+    if(count == 0)
+    {
+        compactNext_ = NULL;
+        return first == NULL;
+    }
+
+    size_t stride = nodeSize();
+    NodeRegion region;
+    region.units = (count * stride + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+    RegionAlloc alloc(this->alloc_);
+    region.memory = RegionTraits::allocate(alloc, region.units);
+    region.begin = reinterpret_cast<char*>(region.memory);
+    region.end = region.begin + count * stride;
+    region.live = 0;
+    try
+    {
+        size_t at = 0;
+        while(at < regions_.size() && regions_[at].begin < region.begin)
+            ++at;
+        regions_.insert(regions_.begin() + at, region);
+    }
+    catch(...)
+    {
+        RegionTraits::deallocate(alloc, region.memory, region.units);
+        throw;
+    }
+
+    AVLNode<Key, Value> *curr = static_cast<AVLNode<Key, Value>*>(first);
+    try
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            AVLNode<Key, Value> *next = static_cast<AVLNode<Key, Value>*>(this->successor(curr));
+            relocate(curr, region.begin + i * stride);
+            curr = next;
+        }
+    }
+    catch(...)
+    {
+        NodeRegion *r = regionOf(region.begin);
+        if(r->live == 0)
+            freeRegion(r);
+        compactNext_ = curr;
+        throw;
+    }
+    compactNext_ = curr;
+    return curr == NULL;
+}
+
+/**
+* Copies from into the raw node storage at where. The copy has from's
+* parent and balance; relocate moves the child links.
+*/
+template<class Key, class Value, class Alloc>
+AVLNode<Key, Value>* AVLTree<Key, Value, Alloc>::copyNodeTo(void* where, AVLNode<Key, Value>* from)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<AVLNode<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    AVLNode<Key, Value> *n = static_cast<AVLNode<Key, Value>*>(where);
+    NodeTraits::construct(alloc, n, from->getKey(), from->getValue(), from->getParent());
+    n->setBalance(from->getBalance());
+    return n;
+}
+
+/**
+* Called once a node has been moved to to and the old node freed.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::nodeMoved(AVLNode<Key, Value>*)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::adoptNode(AVLNode<Key, Value>*)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::disownNode(AVLNode<Key, Value>*)
+{
+
+}
+
+/**
+* Replaces from by a copy at where.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::relocate(AVLNode<Key, Value>* from, void* where)
+{
+    AVLNode<Key, Value> *to = copyNodeTo(where, from);
+    ++regionOf(to)->live;
+    substitute(from, to);
+}
+
+/**
+* Puts to, a copy of from, in from's place in the tree and frees from.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::substitute(AVLNode<Key, Value>* from, AVLNode<Key, Value>* to)
+{
+    AVLNode<Key, Value> *parent = from->getParent();
+    to->setLeft(from->getLeft());
+    to->setRight(from->getRight());
+    if(to->getLeft() != NULL)
+        to->getLeft()->setParent(to);
+    if(to->getRight() != NULL)
+        to->getRight()->setParent(to);
+    if(parent == NULL)
+        this->root_ = to;
+    else if(parent->getLeft() == from)
+        parent->setLeft(to);
+    else
+        parent->setRight(to);
+
+    from->setParent(NULL);
+    from->setLeft(NULL);
+    from->setRight(NULL);
+    this->nodeAdded(nodeSize());
+    this->destroyNode(from);
+    nodeMoved(to);
+}
+
+/**
+* Bookkeeping for a node about to be freed. Forgets it as the compaction
+* cursor, and if it lives in a region destroys it in place and returns
+* true; otherwise the caller deallocates it.
+*/
+template<class Key, class Value, class Alloc>
+bool AVLTree<Key, Value, Alloc>::releaseNode(Node<Key, Value>* n)
+{
+    if(n == compactNext_)
+        compactNext_ = NULL;
+    if(regions_.empty())
+        return false;
+    NodeRegion *region = regionOf(n);
+    if(region == NULL)
+        return false;
+
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<AVLNode<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    NodeTraits::destroy(alloc, static_cast<AVLNode<Key, Value>*>(n));
+    if(--region->live == 0)
+        freeRegion(region);
+    return true;
+}
+
+/**
+* Finds the region holding p, or NULL. Regions are sorted by address.
+*/
+template<class Key, class Value, class Alloc>
+typename AVLTree<Key, Value, Alloc>::NodeRegion* AVLTree<Key, Value, Alloc>::regionOf(const void* p)
+{
+    const char *c = static_cast<const char*>(p);
+    size_t lo = 0;
+    size_t hi = regions_.size();
+    while(lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if(regions_[mid].begin <= c)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo == 0 || c >= regions_[lo - 1].end)
+        return NULL;
+    return &regions_[lo - 1];
+}
+
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::freeRegion(NodeRegion* region)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<std::max_align_t> RegionAlloc;
+    typedef std::allocator_traits<RegionAlloc> RegionTraits;
+    RegionAlloc alloc(this->alloc_);
+    RegionTraits::deallocate(alloc, region->memory, region->units);
+    regions_.erase(regions_.begin() + (region - &regions_[0]));
+}
+
 /*
  * Recall: If key is already in the tree, you should 
  * overwrite the current value with the updated value.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::insert (const std::pair<const Key, Value> &new_item)
 {
     // TODO        
-    AVLNode<Key, Value> *key = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-    std::cout << key->getKey() << std::endl;
+    AVLNode<Key, Value> *key = static_cast<AVLNode<Key, Value>*>(this->createNode(new_item.first, new_item.second, nullptr));
     key->setBalance(0);
     if(this->root_ == nullptr){
         this->root_ = key;
@@ -179,62 +709,70 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
             }
             else{
                 curr->setValue(key->getValue());
-                delete key;
+                this->destroyNode(key);
                 return;
             }
             
         }
-        curr = key;
-        if(x == -1)
-        {
-            curr->setParent(prev);
-            prev->setLeft(curr);
-            //std::cout << "i set " << curr->getKey() << "parent to " << prev->getKey() <<std::endl;
-            //std::cout << "added left: " << keyValuePair.first << std::endl;
-        }
-        else if(x == 1)
-        {
-            curr->setParent(prev);
-            prev->setRight(curr);
-            //std::cout << "i set " << curr->getKey() << "parent to " << prev->getKey() <<std::endl;
-            //std::cout << "added right: " << keyValuePair.first << std::endl;
-        }
-        //std::cout << prev->getKey() <<" balance: " << (int)prev->getBalance() << std::endl;
-        if(prev->getBalance() == -1 ||prev->getBalance() == 1)
-        {
-            prev->setBalance( 0);
-            //this->printRoot(this->root_);
-            return;
-        }
-        else if(prev->getBalance() == 0)
-        {
-            //std::cout << "im here!" << std::endl;
-            if(isLeftChild(prev, curr))
-                prev->setBalance((signed char) -1);
-            else if(isRightChild(prev, curr))
-                prev->setBalance(1);
-            //
-            this->insertFix(prev, curr);
-            //this->printRoot(this->root_);
-            return;
-        }
+        linkLeaf(prev, key, x == -1);
     }
 }   
 
+/**
+* Links the new leaf n below parent, on the left if left is set, or as the
+* root if parent is NULL, and rebalances.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::linkLeaf(AVLNode<Key, Value>* parent, AVLNode<Key, Value>* n, bool left)
+{
+    n->setBalance(0);
+    if(parent == nullptr)
+    {
+        this->root_ = n;
+        return;
+    }
+    n->setParent(parent);
+    if(left)
+        parent->setLeft(n);
+    else
+        parent->setRight(n);
+    AVLPolicy::inserted(*this, n);
+}
 
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>:: remove(const Key& key)
 {
     // TODo
-    if(this->internalFind(key) == NULL){
+    AVLNode<Key, Value> *curr = static_cast<AVLNode<Key,Value>*>(this->internalFind(key));
+    if(curr == NULL){
         return;
     }
-    AVLNode<Key, Value> *curr = static_cast<AVLNode<Key,Value>*>(this->internalFind(key));
+    removeNode(curr);
+}
+
+/**
+* Unlinks and frees curr, then rebalances.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::removeNode(AVLNode<Key, Value>* curr)
+{
+    unlinkNode(curr);
+    this->destroyNode(curr);
+}
+
+/**
+* Unlinks curr and rebalances, leaving curr allocated with no links.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::unlinkNode(AVLNode<Key, Value>* curr)
+{
+    // Keep a compaction pass in progress off the node about to go.
+    if(compactNext_ == curr)
+        compactNext_ = static_cast<AVLNode<Key, Value>*>(this->successor(compactNext_));
     int diff = 0;
     bool rt = false;
     AVLNode<Key, Value> *pred;
-    std::cout << curr->getKey() << std::endl;
-    this->printRoot(this->root_);
     if(curr != nullptr)
     {
         if(curr == this->root_)
@@ -273,7 +811,6 @@ void AVLTree<Key, Value>:: remove(const Key& key)
             }
         }
         //delete curr;
-        this->printRoot(this->root_);
         AVLNode<Key, Value> *par = curr->getParent();
         if(par != nullptr ){
             bool left = false;
@@ -308,152 +845,22 @@ void AVLTree<Key, Value>:: remove(const Key& key)
         }
         if(curr == this->root_)
             this->root_ = nullptr;
-        delete curr;
-        this->printRoot(this->root_);
-        removeFix(p, diff);
+        curr->setParent(nullptr);
+        AVLPolicy::removed(*this, p, diff == 1);
     }
 
 }
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value> *n, signed char diff)
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
 {
-    if(n == nullptr)
-        return;
-    AVLNode<Key, Value> *p = n->getParent();
-    signed char ndiff = 0;
-    if(p != nullptr)
-    {
-        if(isLeftChild(p, n))
-        {
-            ndiff = 1;
-        }
-        else if(isRightChild(p, n))
-        {
-            ndiff = -1;
-        }
-    }
-    if(diff == -1)
-    {
-        if(n->getBalance() + diff == -2)
-        {
-            AVLNode<Key, Value> *c = n->getLeft();
-            if(c->getBalance() == -1)
-            {
-                rotateRight(n);
-                n->setBalance((signed char) 0);
-                c->setBalance((signed char) 0);
-                removeFix(p, ndiff);
-            }
-            else if(c->getBalance() == 0)
-            {
-                rotateRight(n);
-                n->setBalance((signed char) -1);
-                c->setBalance((signed char) 1);
-            }
-            else if(c->getBalance() == 1)
-            {
-                AVLNode<Key, Value> *g = c->getRight();
-                rotateLeft(c);
-                rotateRight(n);
-                if(g->getBalance() == 1)
-                {
-                    n->setBalance((signed char) 0);
-                    c->setBalance((signed char) -1);
-                    g->setBalance((signed char) 0);
-                }
-                else if(g->getBalance() == 0)
-                {
-                    n->setBalance((signed char) 0);
-                    c->setBalance((signed char) 0);
-                    g->setBalance((signed char) 0);
-                }
-                else if(g->getBalance() == -1)
-                {
-                    n->setBalance((signed char) 1);
-                    c->setBalance((signed char) 0);
-                    g->setBalance((signed char) 0);
-                }
-                removeFix(p, ndiff);
-            }
-        }
-        else if(n->getBalance() + diff == -1)
-        {
-            n->setBalance((signed char) -1);
-        }
-        else if(n->getBalance() + diff == 0)
-        {
-            n->setBalance((signed char) 0);
-            removeFix(p, ndiff);
-        }
-    }
-    else if(diff == 1)
-    {
-        if(n->getBalance() + diff == 2)
-        {
-            AVLNode<Key, Value> *c = n->getRight();
-            if(c->getBalance() == 1)
-            {
-                rotateLeft(n);
-                n->setBalance((signed char) 0);
-                c->setBalance((signed char) 0);
-                removeFix(p, ndiff);
-            }
-            else if(c->getBalance() == 0)
-            {
-                rotateLeft(n);
-                n->setBalance((signed char) 1);
-                c->setBalance((signed char) -1);
-            }
-            else if(c->getBalance() == -1)
-            {
-                AVLNode<Key, Value> *g = c->getLeft();
-                rotateRight(c);
-                rotateLeft(n);
-                if(g->getBalance() == -1)
-                {
-                    n->setBalance((signed char) 0);
-                    c->setBalance((signed char) 1);
-                    g->setBalance((signed char) 0);
-                }
-                else if(g->getBalance() == 0)
-                {
-                    n->setBalance((signed char) 0);
-                    c->setBalance((signed char) 0);
-                    g->setBalance((signed char) 0);
-                }
-                else if(g->getBalance() == 1)
-                {
-                    n->setBalance((signed char) -1);
-                    c->setBalance((signed char) 0);
-                    g->setBalance((signed char) 0);
-                }
-                removeFix(p, ndiff);
-            }
-        }
-        else if(n->getBalance() + diff == 1)
-        {
-            n->setBalance((signed char) 1);
-        }
-        else if(n->getBalance() + diff == 0)
-        {
-            n->setBalance((signed char) 0);
-            removeFix(p, ndiff);
-        }
-    }
-
-}
-
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
-{
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Alloc>::nodeSwap(n1, n2);
     signed char tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* x){
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::rotateRight(AVLNode<Key,Value>* x){
     AVLNode<Key,Value>* p;
     AVLNode<Key,Value>* g;
     //AVLNode<Key,Value>* n;
@@ -485,8 +892,8 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key,Value>* x){
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* x){
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::rotateLeft(AVLNode<Key,Value>* x){
     AVLNode<Key,Value>* p;
     AVLNode<Key,Value>* g;
     //AVLNode<Key,Value>* n;
@@ -517,8 +924,8 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key,Value>* x){
     }
 }
 
-template<class Key, class Value>
-bool AVLTree<Key, Value>::isLeftChild(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n){
+template<class Key, class Value, class Alloc>
+bool AVLTree<Key, Value, Alloc>::isLeftChild(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n){
     if(p != nullptr  && n != nullptr){
         if(p->getLeft() == n && n->getParent() == p)
             return true;
@@ -529,8 +936,8 @@ bool AVLTree<Key, Value>::isLeftChild(AVLNode<Key,Value>* p, AVLNode<Key,Value>*
         return false;
 }
 
-template<class Key, class Value>
-bool AVLTree<Key, Value>::isRightChild(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n){
+template<class Key, class Value, class Alloc>
+bool AVLTree<Key, Value, Alloc>::isRightChild(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n){
     if(p != nullptr  && n != nullptr){
         if(p->getRight() == n && n->getParent() == p)
             return true;
@@ -541,96 +948,236 @@ bool AVLTree<Key, Value>::isRightChild(AVLNode<Key,Value>* p, AVLNode<Key,Value>
         return false;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key,Value>* p, AVLNode<Key,Value>* n){
-    if(p == nullptr)
-        return;
-    AVLNode<Key,Value>* g = p->getParent();
-    //std::cout << n->getKey() <<" balance: " << (int)n->getBalance() << std::endl;
-    //std::cout << p->getKey() <<" balance: " << (int)p->getBalance() << std::endl;
-    if(g == nullptr){
-        return;
-        //std::cout << g->getKey() <<" balance: " << (int)g->getBalance() << std::endl;
+/**
+* Replaces the contents of the tree with count pairs read from first, which
+* must yield strictly increasing keys. The tree is built bottom-up in the
+* shape of a perfectly balanced tree, so this runs in O(n) instead of the
+* O(n log n) of repeated inserts. If reading from first throws, the tree
+* is left empty and the exception is propagated.
+*/
+template<class Key, class Value, class Alloc>
+template<typename InputIt>
+void AVLTree<Key, Value, Alloc>::buildFromSorted(InputIt first, size_t count)
+{
+    this->clear();
+    int height = 0;
+    this->root_ = buildHelp(first, count, height);
+}
+
+/**
+* Builds a subtree from the next count pairs, consuming them in order, and
+* reports its height so the parent can set its balance.
+*/
+template<class Key, class Value, class Alloc>
+template<typename InputIt>
+AVLNode<Key, Value>* AVLTree<Key, Value, Alloc>::buildHelp(InputIt& first, size_t count, int& height)
+{
+    if(count == 0)
+    {
+        height = 0;
+        return nullptr;
     }
-    if(isLeftChild(g, p)){
-        g->updateBalance((signed char)-1);
-        if(g->getBalance() == 0)
-            return;
-        else if(g->getBalance() == -1)
-            insertFix(g, p);
-        else if(g->getBalance() == -2)
+    int leftHeight = 0;
+    int rightHeight = 0;
+    AVLNode<Key, Value> *left = buildHelp(first, count / 2, leftHeight);
+    AVLNode<Key, Value> *n = nullptr;
+    AVLNode<Key, Value> *right = nullptr;
+    try
+    {
         {
-            if(isLeftChild(p, n)){
-                rotateRight(g);
-                p->setBalance((signed char) 0);
-                g->setBalance((signed char) 0);
-            }
-            else if(isRightChild(p, n)){
-                rotateLeft(p);
-                rotateRight(g);
-                if(p->getKey() > g->getKey())
-                    std::cout << "wtfleft" << std::endl;
-                if(n->getBalance() == -1)
-                {
-                    p->setBalance((signed char) 0);
-                    g->setBalance((signed char) 1);
-                    n->setBalance((signed char) 0); 
-                }
-                else if(n->getBalance() == 0){
-                    p->setBalance((signed char) 0);
-                    g->setBalance((signed char) 0);
-                    n->setBalance((signed char) 0); 
-                }
-                else if(n->getBalance() == 1){
-                    p->setBalance((signed char) -1);
-                    g->setBalance((signed char) 0);
-                    n->setBalance((signed char) 0); 
-                }
-            }
+            const std::pair<const Key, Value>& item = *first;
+            n = static_cast<AVLNode<Key, Value>*>(this->createNode(item.first, item.second, nullptr));
         }
+        ++first;
+        right = buildHelp(first, count - count / 2 - 1, rightHeight);
+    }
+    catch(...)
+    {
+        this->clearHelp(left);
+        if(n != nullptr)
+            this->destroyNode(n);
+        throw;
     }
-    else if(isRightChild(g, p)){
-        //std::cout << " we out heeere" << std::endl;
-        g->updateBalance((signed char)1);
-        if(g->getBalance() == 0)
-            return;
-        else if(g->getBalance() == 1)
-            insertFix(g, p);
-        else if(g->getBalance() == 2)
+
+    n->setLeft(left);
+    n->setRight(right);
+    if(left != nullptr)
+        left->setParent(n);
+    if(right != nullptr)
+        right->setParent(n);
+    n->setBalance((signed char)(rightHeight - leftHeight));
+    height = 1 + std::max(leftHeight, rightHeight);
+    return n;
+}
+
+
+/**
+* Unlinks the node with the given key and hands it over without copying
+* or freeing it, or returns an empty handle if the key is not present.
+* A node that compaction placed in a shared region is copied out first,
+* since it cannot be freed on its own.
+*/
+template<class Key, class Value, class Alloc>
+typename AVLTree<Key, Value, Alloc>::node_type AVLTree<Key, Value, Alloc>::extract(const Key& key)
+{
+    requirePlainNodes();
+    AVLNode<Key, Value> *n = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
+    if(n == NULL)
+        return node_type();
+    n = unregion(n);
+    unlinkNode(n);
+    disownNode(n);
+    this->nodeRemoved(sizeof(AVLNode<Key, Value>));
+    return node_type(n, this->alloc_);
+}
+
+/**
+* Links the node owned by handle into the tree and empties the handle.
+* If the key is already present, or the handle is empty, returns false
+* and leaves the handle as it was.
+*/
+template<class Key, class Value, class Alloc>
+bool AVLTree<Key, Value, Alloc>::insert(node_type&& handle)
+{
+    if(handle.empty())
+        return false;
+    requirePlainNodes();
+    if(!(handle.alloc_ == this->alloc_))
+        throw std::logic_error("Node handle allocator does not match the tree's");
+    AVLNode<Key, Value> *parent;
+    bool left;
+    if(findSlot(handle.key(), parent, left))
+        return false;
+    adoptNode(handle.node_);
+    linkLeaf(parent, handle.node_, left);
+    this->nodeAdded(sizeof(AVLNode<Key, Value>));
+    handle.node_ = NULL;
+    return true;
+}
+
+/**
+* Moves every node of other whose key is not in this tree across,
+* relinking rather than copying; nodes with keys already here stay in
+* other. Costs O(m log(n + m)) for m nodes in other. If a hook throws,
+* the nodes moved so far stay moved.
+*/
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::merge(AVLTree<Key, Value, Alloc>& other)
+{
+    if(&other == this || other.root_ == NULL)
+        return;
+    requirePlainNodes();
+    other.requirePlainNodes();
+    if(!(other.alloc_ == this->alloc_))
+        throw std::logic_error("Cannot merge trees with different allocators");
+
+    Node<Key, Value> *n = other.root_;
+    while(n->getLeft() != NULL)
+        n = n->getLeft();
+    while(n != NULL)
+    {
+        Node<Key, Value> *next = this->successor(n);
+        AVLNode<Key, Value> *parent;
+        bool left;
+        if(!findSlot(n->getKey(), parent, left))
         {
-            if(isRightChild(p, n)){
-                //std::cout << " we out heeere again" << std::endl;
-                rotateLeft(g);
-                p->setBalance((signed char) 0);
-                g->setBalance((signed char) 0);
-            }
-            else if(isLeftChild(p, n)){
-                rotateRight(p);
-                rotateLeft(g);
-                if(p->getKey() < g->getKey())
-                    std::cout << "wtfright" << std::endl;
-                if(n->getBalance() == 1)
-                {
-                    p->setBalance((signed char) 0);
-                    g->setBalance((signed char) -1);
-                    n->setBalance((signed char) 0); 
-                }
-                else if(n->getBalance() == 0){
-                    p->setBalance((signed char) 0);
-                    g->setBalance((signed char) 0);
-                    n->setBalance((signed char) 0); 
-                }
-                else if(n->getBalance() == -1){
-                    p->setBalance((signed char) 1);
-                    g->setBalance((signed char) 0);
-                    n->setBalance((signed char) 0); 
-                }
-            }
+            AVLNode<Key, Value> *moved = other.unregion(static_cast<AVLNode<Key, Value>*>(n));
+            adoptNode(moved);
+            other.unlinkNode(moved);
+            other.disownNode(moved);
+            other.nodeRemoved(sizeof(AVLNode<Key, Value>));
+            linkLeaf(parent, moved, left);
+            this->nodeAdded(sizeof(AVLNode<Key, Value>));
         }
+        n = next;
     }
-    
+}
 
+/**
+* Nodes in compaction regions share one allocation, so before one leaves
+* the tree it is replaced in place by an individually allocated copy,
+* which is returned. Other nodes are returned as they are.
+*/
+template<class Key, class Value, class Alloc>
+AVLNode<Key, Value>* AVLTree<Key, Value, Alloc>::unregion(AVLNode<Key, Value>* n)
+{
+    if(regions_.empty() || regionOf(n) == NULL)
+        return n;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<AVLNode<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    AVLNode<Key, Value> *copy = NodeTraits::allocate(alloc, 1);
+    try
+    {
+        NodeTraits::construct(alloc, copy, n->getKey(), n->getValue(), n->getParent());
+    }
+    catch(...)
+    {
+        NodeTraits::deallocate(alloc, copy, 1);
+        throw;
+    }
+    copy->setBalance(n->getBalance());
+    substitute(n, copy);
+    return copy;
 }
 
+/**
+* Descends to where key belongs. Returns true if it is present; otherwise
+* parent and left say where a new leaf for it goes.
+*/
+template<class Key, class Value, class Alloc>
+bool AVLTree<Key, Value, Alloc>::findSlot(const Key& key, AVLNode<Key, Value>*& parent, bool& left) const
+{
+    AVLNode<Key, Value> *curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+    parent = NULL;
+    left = false;
+    while(curr != NULL)
+    {
+        if(key < curr->getKey())
+        {
+            parent = curr;
+            curr = curr->getLeft();
+            left = true;
+        }
+        else if(curr->getKey() < key)
+        {
+            parent = curr;
+            curr = curr->getRight();
+            left = false;
+        }
+        else
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Whether the tree's nodes are plain AVLNodes. Trees with a node type of
+* their own return false, and node handles and merge refuse them.
+*/
+template<class Key, class Value, class Alloc>
+bool AVLTree<Key, Value, Alloc>::plainNodes() const
+{
+    return true;
+}
+
+template<class Key, class Value, class Alloc>
+void AVLTree<Key, Value, Alloc>::requirePlainNodes() const
+{
+    if(!plainNodes())
+        throw std::logic_error("Tree's node type cannot be moved by node handles");
+}
+
+#if __cplusplus >= 201703L
+/**
+* An AVLTree whose nodes come from a std::pmr::memory_resource, e.g. a
+* monotonic_buffer_resource for per-request maps or an
+* unsynchronized_pool_resource for long-lived ones.
+*/
+template <class Key, class Value>
+using PmrAVLTree = AVLTree<Key, Value, std::pmr::polymorphic_allocator<std::pair<const Key, Value> > >;
+#endif
 
 #endif
@@ -0,0 +1,156 @@
+#include <csignal>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "avlimage.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for MappedAVLTree images: a saved tree reads back unchanged,
+// damaged images are rejected with an exception rather than a crash or a
+// wrong answer, and a save that runs out of space throws.
+
+static vector<char> readFile(const string& path)
+{
+    ifstream in(path.c_str(), ios::binary);
+    return vector<char>((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+static void writeFile(const string& path, const vector<char>& data)
+{
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    out.write(data.empty() ? NULL : &data[0], data.size());
+}
+
+void testRoundTrip(TestDir& dir)
+{
+    const char* name = "MappedAVLTree";
+    string path = dir.file("tree.img");
+    AVLTree<long, long> tree;
+    for(long i = 0; i < 5000; ++i)
+        tree.insert(make_pair(i * 3, i));
+    MappedAVLTree<long, long>::save(tree, path);
+
+    MappedAVLTree<long, long> image(path);
+    bool found = image.mapped() && image.size() == 5000;
+    for(long key = -1; key < 15001; ++key)
+    {
+        MappedAVLTree<long, long>::iterator it = image.find(key);
+        found = found && (it != image.end()) == (key >= 0 && key < 15000 && key % 3 == 0);
+        if(it != image.end())
+            found = found && it.value() == key / 3;
+    }
+    check(found, name, "loaded image differs from the saved tree");
+    map<long, long> ref;
+    for(long i = 0; i < 5000; ++i)
+        ref[i * 3] = i;
+    checkExport(name, image, ref, 100, 9000, 1000);
+    checkExport(name, image, ref, -10, 20000, 7);
+    checkExport(name, image, ref, 300, 300, 4);
+    image.insert(make_pair(1L, -1L));
+    check(!image.mapped() && image.size() == 5001 && image[1] == -1, name, "insert did not promote the image");
+    ref[1] = -1;
+    checkExport(name, image, ref, 0, 100, 8);
+}
+
+/**
+* Random damage, concentrated on the header every third round. Each
+* damaged image must either fail to load, fail a lookup with
+* runtime_error, or answer lookups without faulting.
+*/
+void testDamage(TestDir& dir)
+{
+    const char* name = "MappedAVLTree damage";
+    string path = dir.file("original.img");
+    AVLTree<long, long> tree;
+    for(long i = 0; i < 5000; ++i)
+        tree.insert(make_pair(i * 3, i));
+    MappedAVLTree<long, long>::save(tree, path);
+
+    vector<char> original = readFile(path);
+    string damagedPath = dir.file("damaged.img");
+    mt19937 rng(5);
+    int rejected = 0;
+    for(int round = 0; round < 1500; ++round)
+    {
+        vector<char> damaged = original;
+        int flips = 1 + rng() % 4;
+        for(int f = 0; f < flips; ++f)
+        {
+            size_t pos = round % 3 == 0 ? rng() % sizeof(AVLImageHeader) : rng() % damaged.size();
+            damaged[pos] = (char)rng();
+        }
+        if(round % 50 == 0)
+            damaged.resize(rng() % damaged.size());
+        writeFile(damagedPath, damaged);
+        MappedAVLTree<long, long> image;
+        try
+        {
+            image.load(damagedPath);
+            for(long key = -1; key < 15001; key += 7)
+            {
+                image.find(key);
+                image.lower_bound(key);
+            }
+        }
+        catch(runtime_error&)
+        {
+            ++rejected;
+        }
+    }
+    check(rejected > 0, name, "no damaged image was rejected");
+}
+
+/**
+* A save that cannot get the space for the image throws and leaves no
+* file behind. The file size limit stands in for a full disk.
+*/
+void testNoSpace(TestDir& dir)
+{
+    const char* name = "MappedAVLTree save";
+    string path = dir.file("full.img");
+    dir.file("full.img.tmp");
+    AVLTree<long, long> tree;
+    for(long i = 0; i < 20000; ++i)
+        tree.insert(make_pair(i, i));
+
+    rlimit saved;
+    getrlimit(RLIMIT_FSIZE, &saved);
+    rlimit limit = saved;
+    limit.rlim_cur = 4096;
+    void (*handler)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    bool thrown = false;
+    try
+    {
+        MappedAVLTree<long, long>::save(tree, path);
+    }
+    catch(runtime_error&)
+    {
+        thrown = true;
+    }
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, handler);
+    check(thrown, name, "save past the file size limit did not throw");
+    check(access(path.c_str(), F_OK) != 0 && access((path + ".tmp").c_str(), F_OK) != 0, name,
+          "failed save left a file behind");
+}
+
+int main()
+{
+    TestDir dir;
+    testRoundTrip(dir);
+    testDamage(dir);
+    testNoSpace(dir);
+    return testSummary("MappedAVLTree");
+}
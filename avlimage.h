@@ -0,0 +1,612 @@
+#ifndef AVLIMAGE_H
+#define AVLIMAGE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* Binary tree image format
+* ------------------------
+* An image starts with a fixed header:
+*
+*     char     magic[8]      "AVLIMG1\0"
+*     uint32_t keySize       sizeof(Key) of the saved tree
+*     uint32_t valueSize     sizeof(Value) of the saved tree
+*     uint64_t count         number of entries
+*     uint64_t root          index of the root entry (NO_CHILD if empty)
+*     uint64_t keysOffset    file offset of Key keys[count]
+*     uint64_t valuesOffset  file offset of Value values[count]
+*     uint64_t leftOffset    file offset of uint32_t left[count]
+*     uint64_t rightOffset   file offset of uint32_t right[count]
+*     uint64_t fileSize      total size of the image
+*
+* Entries are stored in key order, one array per field, and each section
+* starts on a 64-byte boundary. left[i] and right[i] are the indices of
+* entry i's children (NO_CHILD for none), so a mapped image is a complete,
+* balanced search tree that can be queried in place.
+*
+* Like the trace format, keys and values are raw bytes: only trivially
+* copyable types can be saved, and an image is only portable between
+* machines with the same endianness and type layout.
+*/
+
+static const char IMAGE_MAGIC[8] = { 'A', 'V', 'L', 'I', 'M', 'G', '1', '\0' };
+
+struct AVLImageHeader
+{
+    char magic[8];
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t count;
+    uint64_t root;
+    uint64_t keysOffset;
+    uint64_t valuesOffset;
+    uint64_t leftOffset;
+    uint64_t rightOffset;
+    uint64_t fileSize;
+};
+
+/**
+* A read-only view of a tree image mapped straight from disk. load() costs
+* one mmap; pages are faulted in as queries touch them. The first mutation
+* promotes the view to an ordinary AVLTree, built in linear time from the
+* sorted image, and the mapping is dropped.
+*/
+template <typename Key, typename Value>
+class MappedAVLTree
+{
+public:
+    static const uint32_t NO_CHILD = 0xffffffffu;
+
+    MappedAVLTree();
+    explicit MappedAVLTree(const std::string& path);
+    ~MappedAVLTree();
+
+    template <typename Alloc>
+    static void save(const BinarySearchTree<Key, Value, Alloc>& tree, const std::string& path);
+    void load(const std::string& path);
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    AVLTree<Key, Value>& promote();
+    bool mapped() const;
+    bool empty() const;
+    size_t size() const;
+
+    /**
+    * An in-order iterator over either the mapped arrays or, once promoted,
+    * the tree. Entries are returned by value since keys and values are
+    * stored apart in the image.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key, Value> operator*() const;
+        const Key& key() const;
+        const Value& value() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class MappedAVLTree<Key, Value>;
+        iterator(const MappedAVLTree<Key, Value>* tree, size_t index);
+        iterator(typename BinarySearchTree<Key, Value>::iterator it);
+
+        const MappedAVLTree<Key, Value>* tree_;
+        size_t index_;
+        typename BinarySearchTree<Key, Value>::iterator it_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+    size_t export_range(const Key& lo, const Key& hi, Key* keyOut, Value* valueOut, size_t capacity) const;
+    size_t export_range(iterator& from, const Key& hi, Key* keyOut, Value* valueOut, size_t capacity) const;
+
+private:
+    MappedAVLTree(const MappedAVLTree&);
+    MappedAVLTree& operator=(const MappedAVLTree&);
+
+    /**
+    * Reads entries in key order straight out of the mapping.
+    */
+    struct Cursor
+    {
+        const Key* keys;
+        const Value* values;
+
+        std::pair<const Key, Value> operator*() const { return std::pair<const Key, Value>(*keys, *values); }
+        Cursor& operator++() { ++keys; ++values; return *this; }
+    };
+
+    static uint64_t alignUp(uint64_t offset);
+    static bool sectionFits(uint64_t offset, uint64_t count, size_t size, size_t align, uint64_t end);
+    static uint32_t link(size_t lo, size_t hi, uint32_t* left, uint32_t* right);
+    size_t lowerBoundIndex(const Key& key) const;
+    void unmap();
+
+    void* map_;
+    size_t mapSize_;
+    const Key* keys_;
+    const Value* values_;
+    const uint32_t* left_;
+    const uint32_t* right_;
+    uint64_t root_;
+    size_t count_;
+
+    AVLTree<Key, Value> tree_;
+    bool promoted_;
+};
+
+template <typename Key, typename Value>
+MappedAVLTree<Key, Value>::MappedAVLTree() :
+    map_(NULL),
+    mapSize_(0),
+    keys_(NULL),
+    values_(NULL),
+    left_(NULL),
+    right_(NULL),
+    root_(NO_CHILD),
+    count_(0),
+    promoted_(false)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "tree images require trivially copyable keys and values");
+}
+
+template <typename Key, typename Value>
+MappedAVLTree<Key, Value>::MappedAVLTree(const std::string& path) :
+    MappedAVLTree()
+{
+    load(path);
+}
+
+template <typename Key, typename Value>
+MappedAVLTree<Key, Value>::~MappedAVLTree()
+{
+    unmap();
+}
+
+template <typename Key, typename Value>
+uint64_t MappedAVLTree<Key, Value>::alignUp(uint64_t offset)
+{
+    return (offset + 63) & ~uint64_t(63);
+}
+
+/**
+* Links the in-order entries [lo, hi) into a perfectly balanced subtree and
+* returns the index of its root.
+*/
+template <typename Key, typename Value>
+uint32_t MappedAVLTree<Key, Value>::link(size_t lo, size_t hi, uint32_t* left, uint32_t* right)
+{
+    if(lo >= hi)
+        return NO_CHILD;
+    size_t mid = lo + (hi - lo) / 2;
+    left[mid] = link(lo, mid, left, right);
+    right[mid] = link(mid + 1, hi, left, right);
+    return (uint32_t)mid;
+}
+
+/**
+* Writes tree to path as an image. The image is written to a temporary
+* file next to path and renamed over it, so readers never see a partial
+* image. Throws std::runtime_error on I/O errors. The file's blocks are
+* allocated before it is mapped, so a full disk is reported here rather
+* than as SIGBUS when a store through the mapping finds no space.
+*/
+template <typename Key, typename Value>
+template <typename Alloc>
+void MappedAVLTree<Key, Value>::save(const BinarySearchTree<Key, Value, Alloc>& tree, const std::string& path)
+{
+    size_t count = 0;
+    for(typename BinarySearchTree<Key, Value, Alloc>::iterator it = tree.begin(); it != tree.end(); ++it)
+        ++count;
+    if(count >= NO_CHILD)
+        throw std::runtime_error("tree too large for an image: " + path);
+
+    AVLImageHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.count = count;
+    header.keysOffset = alignUp(sizeof(header));
+    header.valuesOffset = alignUp(header.keysOffset + count * sizeof(Key));
+    header.leftOffset = alignUp(header.valuesOffset + count * sizeof(Value));
+    header.rightOffset = alignUp(header.leftOffset + count * sizeof(uint32_t));
+    header.fileSize = header.rightOffset + count * sizeof(uint32_t);
+
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        throw std::runtime_error("cannot create image file " + tmp);
+    if(::posix_fallocate(fd, 0, (off_t)header.fileSize) != 0)
+    {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("cannot allocate space for image file " + tmp);
+    }
+    void* map = ::mmap(NULL, header.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        ::close(fd);
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("cannot map image file " + tmp);
+    }
+
+    char* base = static_cast<char*>(map);
+    Key* keys = reinterpret_cast<Key*>(base + header.keysOffset);
+    Value* values = reinterpret_cast<Value*>(base + header.valuesOffset);
+    uint32_t* left = reinterpret_cast<uint32_t*>(base + header.leftOffset);
+    uint32_t* right = reinterpret_cast<uint32_t*>(base + header.rightOffset);
+    size_t i = 0;
+    for(typename BinarySearchTree<Key, Value, Alloc>::iterator it = tree.begin(); it != tree.end(); ++it, ++i)
+    {
+        std::memcpy(&keys[i], &it->first, sizeof(Key));
+        std::memcpy(&values[i], &it->second, sizeof(Value));
+    }
+    header.root = count == 0 ? NO_CHILD : link(0, count, left, right);
+    std::memcpy(base, &header, sizeof(header));
+
+    bool ok = ::msync(map, header.fileSize, MS_SYNC) == 0;
+    ::munmap(map, header.fileSize);
+    ok = ::fsync(fd) == 0 && ok;
+    ::close(fd);
+    if(!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        ::unlink(tmp.c_str());
+        throw std::runtime_error("cannot write image file " + path);
+    }
+}
+
+/**
+* Maps the image at path, replacing whatever this object held. Nothing is
+* read beyond the header until queries touch it. Throws
+* std::runtime_error if the file is missing, truncated, has a header whose
+* sections do not fit the file or was saved with different key/value
+* sizes. The child links are checked as lookups follow them, so a lookup
+* that reaches a corrupt link throws std::runtime_error instead.
+*/
+template <typename Key, typename Value>
+void MappedAVLTree<Key, Value>::load(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error("cannot open image file " + path);
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(AVLImageHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error("not an image file: " + path);
+    }
+    void* map = ::mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED)
+        throw std::runtime_error("cannot map image file " + path);
+
+    AVLImageHeader header;
+    std::memcpy(&header, map, sizeof(header));
+    const char* error = NULL;
+    if(std::memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+        error = "not an image file: ";
+    else if(header.keySize != sizeof(Key) || header.valueSize != sizeof(Value))
+        error = "image key/value sizes do not match: ";
+    else if(header.fileSize != (uint64_t)st.st_size ||
+            header.count >= NO_CHILD ||
+            header.keysOffset < sizeof(AVLImageHeader) ||
+            !sectionFits(header.keysOffset, header.count, sizeof(Key), alignof(Key), header.valuesOffset) ||
+            !sectionFits(header.valuesOffset, header.count, sizeof(Value), alignof(Value), header.leftOffset) ||
+            !sectionFits(header.leftOffset, header.count, sizeof(uint32_t), alignof(uint32_t), header.rightOffset) ||
+            !sectionFits(header.rightOffset, header.count, sizeof(uint32_t), alignof(uint32_t), header.fileSize) ||
+            (header.count != 0 && header.root >= header.count))
+        error = "corrupt image file: ";
+    if(error != NULL)
+    {
+        ::munmap(map, (size_t)st.st_size);
+        throw std::runtime_error(error + path);
+    }
+
+    unmap();
+    tree_.clear();
+    promoted_ = false;
+    map_ = map;
+    mapSize_ = (size_t)st.st_size;
+    const char* base = static_cast<const char*>(map);
+    keys_ = reinterpret_cast<const Key*>(base + header.keysOffset);
+    values_ = reinterpret_cast<const Value*>(base + header.valuesOffset);
+    left_ = reinterpret_cast<const uint32_t*>(base + header.leftOffset);
+    right_ = reinterpret_cast<const uint32_t*>(base + header.rightOffset);
+    root_ = header.count == 0 ? NO_CHILD : header.root;
+    count_ = header.count;
+}
+
+/**
+* Whether count elements of the given size, starting at offset, end by
+* end without overflowing, with offset suitably aligned for them.
+*/
+template <typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::sectionFits(uint64_t offset, uint64_t count, size_t size, size_t align,
+                                            uint64_t end)
+{
+    return offset % align == 0 && offset <= end && count <= (end - offset) / size;
+}
+
+template <typename Key, typename Value>
+void MappedAVLTree<Key, Value>::unmap()
+{
+    if(map_ != NULL)
+        ::munmap(map_, mapSize_);
+    map_ = NULL;
+    mapSize_ = 0;
+    keys_ = NULL;
+    values_ = NULL;
+    left_ = NULL;
+    right_ = NULL;
+    root_ = NO_CHILD;
+}
+
+/**
+* Turns the mapped image into a mutable AVLTree and releases the mapping.
+* Does nothing if the tree was already promoted.
+*/
+template <typename Key, typename Value>
+AVLTree<Key, Value>& MappedAVLTree<Key, Value>::promote()
+{
+    if(!promoted_)
+    {
+        Cursor cursor = { keys_, values_ };
+        tree_.buildFromSorted(cursor, count_);
+        unmap();
+        promoted_ = true;
+    }
+    return tree_;
+}
+
+template <typename Key, typename Value>
+void MappedAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    AVLTree<Key, Value>& tree = promote();
+    if(tree.find(keyValuePair.first) == tree.end())
+        ++count_;
+    tree.insert(keyValuePair);
+}
+
+template <typename Key, typename Value>
+void MappedAVLTree<Key, Value>::remove(const Key& key)
+{
+    AVLTree<Key, Value>& tree = promote();
+    if(tree.find(key) != tree.end())
+        --count_;
+    tree.remove(key);
+}
+
+/**
+* Returns true while queries are still served from the mapped image.
+*/
+template <typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::mapped() const
+{
+    return !promoted_;
+}
+
+template <typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::empty() const
+{
+    return count_ == 0;
+}
+
+template <typename Key, typename Value>
+size_t MappedAVLTree<Key, Value>::size() const
+{
+    return count_;
+}
+
+/**
+* Descends the image links and returns the index of the smallest key not
+* less than key, or count_ if there is none. Entries are stored in key
+* order, so every step must land strictly inside the index range left
+* open by the steps before it; a link that does not is corrupt, and
+* checking this also bounds the descent to count_ steps.
+*/
+template <typename Key, typename Value>
+size_t MappedAVLTree<Key, Value>::lowerBoundIndex(const Key& key) const
+{
+    size_t best = count_;
+    uint64_t lo = 0;
+    uint64_t hi = count_;
+    uint64_t curr = root_;
+    while(curr != NO_CHILD)
+    {
+        if(curr < lo || curr >= hi)
+            throw std::runtime_error("corrupt image file: child link out of range");
+        if(keys_[curr] < key)
+        {
+            lo = curr + 1;
+            curr = right_[curr];
+        }
+        else
+        {
+            best = curr;
+            hi = curr;
+            curr = left_[curr];
+        }
+    }
+    return best;
+}
+
+template <typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator
+MappedAVLTree<Key, Value>::begin() const
+{
+    if(promoted_)
+        return iterator(tree_.begin());
+    return iterator(this, 0);
+}
+
+template <typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator
+MappedAVLTree<Key, Value>::end() const
+{
+    if(promoted_)
+        return iterator(tree_.end());
+    return iterator(this, count_);
+}
+
+template <typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator
+MappedAVLTree<Key, Value>::find(const Key& key) const
+{
+    if(promoted_)
+        return iterator(tree_.find(key));
+    size_t index = lowerBoundIndex(key);
+    if(index == count_ || key < keys_[index])
+        return end();
+    return iterator(this, index);
+}
+
+template <typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator
+MappedAVLTree<Key, Value>::lower_bound(const Key& key) const
+{
+    if(promoted_)
+        return iterator(tree_.lower_bound(key));
+    return iterator(this, lowerBoundIndex(key));
+}
+
+/**
+* @precondition The key exists in the map
+* Returns the value associated with the key
+*/
+template <typename Key, typename Value>
+const Value& MappedAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it.value();
+}
+
+/**
+* As BinarySearchTree::export_range. While mapped, the image already holds
+* keys and values in separate sorted arrays, so a batch is two memcpys.
+*/
+template <typename Key, typename Value>
+size_t MappedAVLTree<Key, Value>::export_range(const Key& lo, const Key& hi, Key* keyOut,
+                                               Value* valueOut, size_t capacity) const
+{
+    iterator from = lower_bound(lo);
+    return export_range(from, hi, keyOut, valueOut, capacity);
+}
+
+template <typename Key, typename Value>
+size_t MappedAVLTree<Key, Value>::export_range(iterator& from, const Key& hi, Key* keyOut,
+                                               Value* valueOut, size_t capacity) const
+{
+    if(from.tree_ == NULL)
+        return tree_.export_range(from.it_, hi, keyOut, valueOut, capacity);
+    size_t last = lowerBoundIndex(hi);
+    if(from.index_ >= last)
+        return 0;
+    size_t count = std::min(capacity, last - from.index_);
+    if(keyOut != NULL)
+        std::memcpy(keyOut, keys_ + from.index_, count * sizeof(Key));
+    if(valueOut != NULL)
+        std::memcpy(valueOut, values_ + from.index_, count * sizeof(Value));
+    from.index_ += count;
+    return count;
+}
+
+template <typename Key, typename Value>
+MappedAVLTree<Key, Value>::iterator::iterator() :
+    tree_(NULL),
+    index_(0)
+{
+
+}
+
+template <typename Key, typename Value>
+MappedAVLTree<Key, Value>::iterator::iterator(const MappedAVLTree<Key, Value>* tree, size_t index) :
+    tree_(tree),
+    index_(index)
+{
+
+}
+
+template <typename Key, typename Value>
+MappedAVLTree<Key, Value>::iterator::iterator(typename BinarySearchTree<Key, Value>::iterator it) :
+    tree_(NULL),
+    index_(0),
+    it_(it)
+{
+
+}
+
+template <typename Key, typename Value>
+std::pair<const Key, Value> MappedAVLTree<Key, Value>::iterator::operator*() const
+{
+    return std::pair<const Key, Value>(key(), value());
+}
+
+template <typename Key, typename Value>
+const Key& MappedAVLTree<Key, Value>::iterator::key() const
+{
+    if(tree_ != NULL)
+        return tree_->keys_[index_];
+    return it_->first;
+}
+
+template <typename Key, typename Value>
+const Value& MappedAVLTree<Key, Value>::iterator::value() const
+{
+    if(tree_ != NULL)
+        return tree_->values_[index_];
+    return it_->second;
+}
+
+template <typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    return tree_ == rhs.tree_ && index_ == rhs.index_ && it_ == rhs.it_;
+}
+
+template <typename Key, typename Value>
+bool MappedAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Entries are stored in key order, so advancing over the image is just a
+* step to the next index.
+*/
+template <typename Key, typename Value>
+typename MappedAVLTree<Key, Value>::iterator&
+MappedAVLTree<Key, Value>::iterator::operator++()
+{
+    if(tree_ != NULL)
+        ++index_;
+    else
+        ++it_;
+    return *this;
+}
+
+#endif
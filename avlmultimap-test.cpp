@@ -0,0 +1,119 @@
+#include <cstdlib>
+#include <map>
+#include <utility>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "avlmultimap.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for AVLMultiMap against std::multimap: equal keys must stay in
+// insertion order through inserts, removals, the split-and-join erase and
+// compaction, with valid balance factors throughout.
+
+/**
+* Exposes the root so that the balance factors erase's joins leave can be
+* checked, not only the heights.
+*/
+class PeekMultiMap : public AVLMultiMap<int, int>
+{
+public:
+    bool factorsOk() const
+    {
+        return AVLPolicy::check(static_cast<AVLNode<int, int>*>(this->root_));
+    }
+};
+
+void testRandom()
+{
+    const char* name = "AVLMultiMap";
+    PeekMultiMap tree;
+    multimap<int, int> ref;
+    srand(11);
+    for(int i = 0; i < 30000; ++i)
+    {
+        int key = rand() % 300;
+        int op = rand() % 10;
+        if(op < 6)
+        {
+            tree.insert(make_pair(key, i));
+            ref.insert(make_pair(key, i));
+        }
+        else if(op < 8)
+        {
+            multimap<int, int>::iterator r = ref.lower_bound(key);
+            bool had = r != ref.end() && r->first == key;
+            check(tree.erase_one(key) == had, name, "erase_one misreported");
+            if(had)
+                ref.erase(r);
+        }
+        else if(op == 8)
+        {
+            check(tree.erase(key) == ref.erase(key), name, "erase removed the wrong count");
+        }
+        else
+        {
+            check(tree.count(key) == ref.count(key), name, "count differs");
+            multimap<int, int>::iterator r = ref.find(key);
+            AVLMultiMap<int, int>::iterator it = tree.find(key);
+            check(r == ref.end() ? it == tree.end() : (it != tree.end() && it->second == r->second), name,
+                  "find did not reach the oldest entry");
+        }
+        if(i % 3000 == 0)
+            check(tree.isBalanced() && tree.factorsOk(), name, "tree not balanced");
+        if(i % 10000 == 5000)
+            tree.compact();
+    }
+    check(tree.isBalanced() && tree.factorsOk(), name, "tree not balanced");
+    check(sameContents(tree, ref), name, "contents or order of equal keys differ");
+}
+
+/**
+* Long runs of one key: equal_range and erase must handle runs that span
+* many levels of the tree, and erase must leave its neighbours alone.
+*/
+void testRuns()
+{
+    const char* name = "AVLMultiMap runs";
+    PeekMultiMap tree;
+    multimap<int, int> ref;
+    for(int i = 0; i < 3000; ++i)
+    {
+        int key = i % 3;
+        tree.insert(make_pair(key, i));
+        ref.insert(make_pair(key, i));
+    }
+    pair<AVLMultiMap<int, int>::iterator, AVLMultiMap<int, int>::iterator> range = tree.equal_range(1);
+    int expected = 1;
+    bool ordered = true;
+    for(AVLMultiMap<int, int>::iterator it = range.first; it != range.second; ++it, expected += 3)
+        ordered = ordered && it->first == 1 && it->second == expected;
+    check(ordered && expected == 3001, name, "equal_range not the whole run in insertion order");
+    check(tree[2] == 2, name, "subscript did not reach the oldest entry");
+
+    check(tree.erase(1) == 1000 && tree.count(1) == 0, name, "erase left part of a run");
+    ref.erase(1);
+    check(tree.isBalanced() && tree.factorsOk() && sameContents(tree, ref), name, "erase broke the neighbours");
+    tree.remove(0);
+    ref.erase(0);
+    check(tree.isBalanced() && tree.factorsOk() && sameContents(tree, ref), name, "remove broke the tree");
+
+    vector<pair<int, int> > sorted;
+    for(int i = 0; i < 500; ++i)
+        sorted.push_back(make_pair(i / 50, i));
+    AVLMultiMap<int, int> built;
+    built.buildFromSorted(sorted.begin(), sorted.size());
+    multimap<int, int> builtRef(sorted.begin(), sorted.end());
+    check(built.isBalanced() && sameContents(built, builtRef) && built.count(3) == 50, name,
+          "buildFromSorted mishandled runs of equal keys");
+}
+
+int main()
+{
+    testRandom();
+    testRuns();
+    return testSummary("AVLMultiMap");
+}
@@ -0,0 +1,416 @@
+#ifndef AVLMULTIMAP_H
+#define AVLMULTIMAP_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* An AVLTree that keeps equal keys as separate nodes instead of
+* overwriting the value. Entries with equal keys sit next to each other in
+* iteration order, oldest first: a new entry is linked after every entry
+* with the same key, and rotations, removals and compaction all preserve
+* in-order position.
+*
+* find, operator[] and erase_one reach the oldest entry with a key.
+* equal_range costs O(log n); count and erase cost O(log n + k) for k
+* entries with the key. erase cuts the run of entries out by splitting
+* the tree around it and joining the two sides, so it does not pay a
+* rebalancing walk per entry. buildFromSorted accepts runs of equal keys.
+*/
+template <typename Key, typename Value, typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class AVLMultiMap : public AVLTree<Key, Value, Alloc>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, Alloc>::iterator iterator;
+
+    explicit AVLMultiMap(const Alloc& alloc = Alloc());
+
+    virtual void insert(const std::pair<const Key, Value>& new_item) override;
+    virtual void remove(const Key& key) override;
+    size_t erase(const Key& key);
+    bool erase_one(const Key& key);
+
+    size_t count(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+
+protected:
+    typedef AVLNode<Key, Value> NodeT;
+
+    virtual Node<Key, Value>* internalFind(const Key& key) const override;
+
+    static int heightOf(NodeT* n);
+    static void childHeights(NodeT* n, int height, int& left, int& right);
+    NodeT* fixAt(NodeT* n, int left, int right, int& height);
+    NodeT* join(NodeT* l, int lh, NodeT* k, NodeT* r, int rh, int& height);
+    NodeT* join(NodeT* l, int lh, NodeT* r, int rh, int& height);
+    NodeT* removeMax(NodeT* n, int h, NodeT*& max, int& height);
+    void cut(NodeT* n, int h, const Key& key, NodeT*& less, int& lh, NodeT*& greater, int& gh, size_t& removed);
+};
+
+template <typename Key, typename Value, typename Alloc>
+AVLMultiMap<Key, Value, Alloc>::AVLMultiMap(const Alloc& alloc) :
+    AVLTree<Key, Value, Alloc>(alloc)
+{
+
+}
+
+/**
+* Adds the pair as a new entry after any entries with the same key.
+*/
+template <typename Key, typename Value, typename Alloc>
+void AVLMultiMap<Key, Value, Alloc>::insert(const std::pair<const Key, Value>& new_item)
+{
+    NodeT *n = static_cast<NodeT*>(this->createNode(new_item.first, new_item.second, NULL));
+    NodeT *curr = static_cast<NodeT*>(this->root_);
+    NodeT *parent = NULL;
+    bool left = false;
+    while(curr != NULL)
+    {
+        parent = curr;
+        left = new_item.first < curr->getKey();
+        curr = left ? curr->getLeft() : curr->getRight();
+    }
+    this->linkLeaf(parent, n, left);
+}
+
+/**
+* Removes every entry with the key, as erase does.
+*/
+template <typename Key, typename Value, typename Alloc>
+void AVLMultiMap<Key, Value, Alloc>::remove(const Key& key)
+{
+    erase(key);
+}
+
+/**
+* Removes every entry with the key and returns how many there were.
+* Invalidates iterators to those entries only.
+*/
+template <typename Key, typename Value, typename Alloc>
+size_t AVLMultiMap<Key, Value, Alloc>::erase(const Key& key)
+{
+    NodeT *root = static_cast<NodeT*>(this->root_);
+    if(root == NULL)
+        return 0;
+
+    // The pieces are detached while the tree is cut apart, so that the
+    // rotations never mistake one of them for the root.
+    this->root_ = NULL;
+    NodeT *less;
+    NodeT *greater;
+    int lh;
+    int gh;
+    size_t removed = 0;
+    cut(root, heightOf(root), key, less, lh, greater, gh, removed);
+    int height;
+    root = join(less, lh, greater, gh, height);
+    if(root != NULL)
+        root->setParent(NULL);
+    this->root_ = root;
+    return removed;
+}
+
+/**
+* Removes the oldest entry with the key. Returns false if there was none.
+*/
+template <typename Key, typename Value, typename Alloc>
+bool AVLMultiMap<Key, Value, Alloc>::erase_one(const Key& key)
+{
+    NodeT *n = static_cast<NodeT*>(internalFind(key));
+    if(n == NULL)
+        return false;
+    this->removeNode(n);
+    return true;
+}
+
+/**
+* Number of entries with the key.
+*/
+template <typename Key, typename Value, typename Alloc>
+size_t AVLMultiMap<Key, Value, Alloc>::count(const Key& key) const
+{
+    size_t total = 0;
+    for(Node<Key, Value> *n = internalFind(key); n != NULL && !(key < n->getKey()); n = this->successor(n))
+        ++total;
+    return total;
+}
+
+/**
+* The entries with the key, oldest first, as [first, second).
+*/
+template <typename Key, typename Value, typename Alloc>
+std::pair<typename AVLMultiMap<Key, Value, Alloc>::iterator, typename AVLMultiMap<Key, Value, Alloc>::iterator>
+AVLMultiMap<Key, Value, Alloc>::equal_range(const Key& key) const
+{
+    return std::make_pair(this->lower_bound(key), this->upper_bound(key));
+}
+
+/**
+* Finds the oldest entry with the key: the leftmost of the run.
+*/
+template <typename Key, typename Value, typename Alloc>
+Node<Key, Value>* AVLMultiMap<Key, Value, Alloc>::internalFind(const Key& key) const
+{
+    Node<Key, Value> *curr = this->root_;
+    Node<Key, Value> *found = NULL;
+    while(curr != NULL)
+    {
+        if(key < curr->getKey())
+            curr = curr->getLeft();
+        else if(curr->getKey() < key)
+            curr = curr->getRight();
+        else
+        {
+            found = curr;
+            curr = curr->getLeft();
+        }
+    }
+    return found;
+}
+
+/**
+* Height of the subtree at n, following the taller side down.
+*/
+template <typename Key, typename Value, typename Alloc>
+int AVLMultiMap<Key, Value, Alloc>::heightOf(NodeT* n)
+{
+    int height = 0;
+    for(; n != NULL; n = n->getBalance() > 0 ? n->getRight() : n->getLeft())
+        ++height;
+    return height;
+}
+
+/**
+* Heights of n's subtrees, given n's height and balance.
+*/
+template <typename Key, typename Value, typename Alloc>
+void AVLMultiMap<Key, Value, Alloc>::childHeights(NodeT* n, int height, int& left, int& right)
+{
+    left = height - 1 - (n->getBalance() > 0 ? 1 : 0);
+    right = height - 1 - (n->getBalance() < 0 ? 1 : 0);
+}
+
+/**
+* Sets n's balance from the heights of its subtrees, rotating if they
+* differ by two, and returns the root of the subtree afterwards with its
+* height. The caller links the returned root to its parent.
+*/
+template <typename Key, typename Value, typename Alloc>
+AVLNode<Key, Value>* AVLMultiMap<Key, Value, Alloc>::fixAt(NodeT* n, int left, int right, int& height)
+{
+    if(right - left > 1)
+    {
+        NodeT *r = n->getRight();
+        int rl;
+        int rr;
+        childHeights(r, right, rl, rr);
+        if(rr >= rl)
+        {
+            this->rotateLeft(n);
+            int nh = 1 + std::max(left, rl);
+            n->setBalance((signed char)(rl - left));
+            r->setBalance((signed char)(rr - nh));
+            height = 1 + std::max(nh, rr);
+            return r;
+        }
+        NodeT *m = r->getLeft();
+        int ml;
+        int mr;
+        childHeights(m, rl, ml, mr);
+        this->rotateRight(r);
+        this->rotateLeft(n);
+        int nh = 1 + std::max(left, ml);
+        int rh = 1 + std::max(mr, rr);
+        n->setBalance((signed char)(ml - left));
+        r->setBalance((signed char)(rr - mr));
+        m->setBalance((signed char)(rh - nh));
+        height = 1 + std::max(nh, rh);
+        return m;
+    }
+    if(left - right > 1)
+    {
+        NodeT *l = n->getLeft();
+        int ll;
+        int lr;
+        childHeights(l, left, ll, lr);
+        if(ll >= lr)
+        {
+            this->rotateRight(n);
+            int nh = 1 + std::max(lr, right);
+            n->setBalance((signed char)(right - lr));
+            l->setBalance((signed char)(nh - ll));
+            height = 1 + std::max(ll, nh);
+            return l;
+        }
+        NodeT *m = l->getRight();
+        int ml;
+        int mr;
+        childHeights(m, lr, ml, mr);
+        this->rotateLeft(l);
+        this->rotateRight(n);
+        int lh = 1 + std::max(ll, ml);
+        int nh = 1 + std::max(mr, right);
+        l->setBalance((signed char)(ml - ll));
+        n->setBalance((signed char)(right - mr));
+        m->setBalance((signed char)(nh - lh));
+        height = 1 + std::max(lh, nh);
+        return m;
+    }
+    n->setBalance((signed char)(right - left));
+    height = 1 + std::max(left, right);
+    return n;
+}
+
+/**
+* Joins l, k and r, where every key of l orders before k and every key of
+* r after it, into one AVL subtree. Descends the spine of the taller side
+* to a subtree of r's (or l's) height, so it costs O(|lh - rh| + 1).
+*/
+template <typename Key, typename Value, typename Alloc>
+AVLNode<Key, Value>* AVLMultiMap<Key, Value, Alloc>::join(NodeT* l, int lh, NodeT* k, NodeT* r, int rh, int& height)
+{
+    if(lh > rh + 1)
+    {
+        int ll;
+        int lr;
+        childHeights(l, lh, ll, lr);
+        int th;
+        NodeT *t = join(l->getRight(), lr, k, r, rh, th);
+        l->setRight(t);
+        t->setParent(l);
+        return fixAt(l, ll, th, height);
+    }
+    if(rh > lh + 1)
+    {
+        int rl;
+        int rr;
+        childHeights(r, rh, rl, rr);
+        int th;
+        NodeT *t = join(l, lh, k, r->getLeft(), rl, th);
+        r->setLeft(t);
+        t->setParent(r);
+        return fixAt(r, th, rr, height);
+    }
+    k->setLeft(l);
+    k->setRight(r);
+    if(l != NULL)
+        l->setParent(k);
+    if(r != NULL)
+        r->setParent(k);
+    k->setBalance((signed char)(rh - lh));
+    height = 1 + std::max(lh, rh);
+    return k;
+}
+
+/**
+* Joins l and r without a middle node, using l's largest entry as one.
+*/
+template <typename Key, typename Value, typename Alloc>
+AVLNode<Key, Value>* AVLMultiMap<Key, Value, Alloc>::join(NodeT* l, int lh, NodeT* r, int rh, int& height)
+{
+    if(l == NULL)
+    {
+        height = rh;
+        return r;
+    }
+    if(r == NULL)
+    {
+        height = lh;
+        return l;
+    }
+    NodeT *max;
+    int h;
+    l = removeMax(l, lh, max, h);
+    if(l != NULL)
+        l->setParent(NULL);
+    return join(l, h, max, r, rh, height);
+}
+
+/**
+* Unlinks the rightmost node of the subtree at n into max and returns the
+* rebalanced remainder with its height.
+*/
+template <typename Key, typename Value, typename Alloc>
+AVLNode<Key, Value>* AVLMultiMap<Key, Value, Alloc>::removeMax(NodeT* n, int h, NodeT*& max, int& height)
+{
+    int left;
+    int right;
+    childHeights(n, h, left, right);
+    if(n->getRight() == NULL)
+    {
+        max = n;
+        NodeT *l = n->getLeft();
+        n->setLeft(NULL);
+        height = left;
+        return l;
+    }
+    int th;
+    NodeT *t = removeMax(n->getRight(), right, max, th);
+    n->setRight(t);
+    if(t != NULL)
+        t->setParent(n);
+    return fixAt(n, left, th, height);
+}
+
+/**
+* Splits the subtree at n, of height h, into the entries with keys less
+* than key and those with keys greater, freeing the entries with the key
+* itself and counting them in removed. Only nodes on the two boundary
+* paths and the freed nodes are visited.
+*/
+template <typename Key, typename Value, typename Alloc>
+void AVLMultiMap<Key, Value, Alloc>::cut(NodeT* n, int h, const Key& key, NodeT*& less, int& lh,
+                                         NodeT*& greater, int& gh, size_t& removed)
+{
+    if(n == NULL)
+    {
+        less = greater = NULL;
+        lh = gh = 0;
+        return;
+    }
+    int left;
+    int right;
+    childHeights(n, h, left, right);
+    NodeT *l = n->getLeft();
+    NodeT *r = n->getRight();
+    if(l != NULL)
+        l->setParent(NULL);
+    if(r != NULL)
+        r->setParent(NULL);
+    n->setParent(NULL);
+    n->setLeft(NULL);
+    n->setRight(NULL);
+
+    if(n->getKey() < key)
+    {
+        NodeT *mid;
+        int mh;
+        cut(r, right, key, mid, mh, greater, gh, removed);
+        less = join(l, left, n, mid, mh, lh);
+        less->setParent(NULL);
+    }
+    else if(key < n->getKey())
+    {
+        NodeT *mid;
+        int mh;
+        cut(l, left, key, less, lh, mid, mh, removed);
+        greater = join(mid, mh, n, r, right, gh);
+        greater->setParent(NULL);
+    }
+    else
+    {
+        // Everything in l orders at or before n and everything in r at
+        // or after it, so each side has entries on one side of key only.
+        NodeT *none;
+        int nh;
+        cut(l, left, key, less, lh, none, nh, removed);
+        cut(r, right, key, none, nh, greater, gh, removed);
+        this->destroyNode(n);
+        ++removed;
+    }
+}
+
+#endif
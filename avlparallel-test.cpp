@@ -0,0 +1,264 @@
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "avlparallel.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for avlparallel.h: the work-stealing pool on its own, chunk_bounds,
+// and the parallel traversals checked against sequential ones, for pools
+// of several sizes. Build with -pthread; run under -fsanitize=thread to
+// check the pool for races.
+
+/**
+* Counts the calls for each index, and throws on throwAt if it is set.
+*/
+struct CountCalls
+{
+    vector<atomic<int> >* calls;
+    size_t throwAt;
+
+    void operator()(size_t i)
+    {
+        ++(*calls)[i];
+        if(i == throwAt)
+            throw runtime_error("task failed");
+    }
+};
+
+/**
+* Runs a batch from inside each task of an outer batch.
+*/
+struct Nested
+{
+    WorkStealingPool* pool;
+    vector<atomic<int> >* calls;
+
+    void operator()(size_t)
+    {
+        CountCalls inner = { calls, (size_t)-1 };
+        pool->run(10, inner);
+    }
+};
+
+void testPool(size_t workers)
+{
+    const char* name = "WorkStealingPool";
+    WorkStealingPool pool(workers);
+    check(pool.concurrency() == workers + 1, name, "concurrency does not count the caller");
+
+    const size_t counts[] = { 0, 1, 5, 1000 };
+    for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c)
+    {
+        vector<atomic<int> > calls(counts[c]);
+        CountCalls body = { &calls, (size_t)-1 };
+        pool.run(counts[c], body);
+        bool once = true;
+        for(size_t i = 0; i < counts[c]; ++i)
+            once = once && calls[i].load() == 1;
+        check(once, name, "a task did not run exactly once");
+    }
+
+    vector<atomic<int> > calls(500);
+    CountCalls failing = { &calls, 17 };
+    bool thrown = false;
+    try
+    {
+        pool.run(calls.size(), failing);
+    }
+    catch(runtime_error&)
+    {
+        thrown = true;
+    }
+    bool atMostOnce = calls[17].load() == 1;
+    for(size_t i = 0; i < calls.size(); ++i)
+        atMostOnce = atMostOnce && calls[i].load() <= 1;
+    check(thrown && atMostOnce, name, "exception not rethrown or tasks run twice");
+
+    vector<atomic<int> > inner(10);
+    Nested nested = { &pool, &inner };
+    pool.run(20, nested);
+    bool all = true;
+    for(size_t i = 0; i < inner.size(); ++i)
+        all = all && inner[i].load() == 20;
+    check(all, name, "nested batches did not all run");
+}
+
+/**
+* The ranges chunk_bounds returns are in key order and together cover the
+* tree; there are at least one for a tree that is not empty and no more
+* than the number asked for rounded up to a power of two.
+*/
+void testChunkBounds()
+{
+    const char* name = "chunk_bounds";
+    AVLTree<int, int> tree;
+    vector<AVLTree<int, int>::iterator> bounds;
+    tree.chunk_bounds(8, bounds);
+    check(bounds.empty(), name, "empty tree has ranges");
+
+    const int sizes[] = { 1, 2, 3, 100, 5000 };
+    const size_t chunks[] = { 1, 2, 7, 64 };
+    int filled = 0;
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        for(; filled < sizes[s]; ++filled)
+            tree.insert(make_pair(filled, filled));
+        for(size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); ++c)
+        {
+            tree.chunk_bounds(chunks[c], bounds);
+            bool ok = !bounds.empty() && bounds.size() < 2 * chunks[c] && bounds[0] == tree.begin();
+            for(size_t i = 1; i < bounds.size() && ok; ++i)
+                ok = bounds[i] != tree.end() && bounds[i - 1]->first < bounds[i]->first;
+            check(ok, name, "ranges out of order or not covering the tree");
+        }
+    }
+}
+
+/**
+* Appends keys as text, to check that a fold keeps key order.
+*/
+struct Concat
+{
+    string operator()(const string& a, const string& b) const
+    {
+        return a + b;
+    }
+};
+
+struct KeyText
+{
+    string operator()(const pair<const int, int>& entry) const
+    {
+        return to_string(entry.first) + ",";
+    }
+};
+
+struct Sum
+{
+    long operator()(long a, long b) const
+    {
+        return a + b;
+    }
+};
+
+struct Both
+{
+    bool operator()(bool a, bool b) const
+    {
+        return a && b;
+    }
+};
+
+struct Positive
+{
+    bool operator()(const pair<const int, int>& entry) const
+    {
+        return entry.second > 0;
+    }
+};
+
+struct Increment
+{
+    void operator()(pair<const int, int>& entry) const
+    {
+        entry.second += 1;
+    }
+};
+
+struct ThrowOn
+{
+    int key;
+
+    void operator()(pair<const int, int>& entry) const
+    {
+        if(entry.first == key)
+            throw runtime_error("entry failed");
+    }
+};
+
+template <typename Tree>
+void checkTraversals(const char* name, Tree& tree, const map<int, int>& ref, WorkStealingPool& pool)
+{
+    long sum = 0;
+    string text;
+    for(map<int, int>::const_iterator r = ref.begin(); r != ref.end(); ++r)
+    {
+        sum += r->second;
+        text += to_string(r->first) + ",";
+    }
+    check(parallel_reduce(tree, 0L, Sum(), pool) == sum, name, "parallel_reduce sum differs");
+    check(parallel_transform_reduce(tree, string(), KeyText(), Concat(), pool) == text, name,
+          "parallel_transform_reduce did not fold in key order");
+    check(parallel_transform_reduce(tree, true, Positive(), Both(), pool), name, "bool fold differs");
+
+    parallel_for_each(tree, Increment(), pool);
+    map<int, int> bumped(ref);
+    for(map<int, int>::iterator r = bumped.begin(); r != bumped.end(); ++r)
+        r->second += 1;
+    check(sameContents(tree, bumped), name, "parallel_for_each did not visit every entry once");
+
+    if(!ref.empty())
+    {
+        ThrowOn fail = { ref.rbegin()->first };
+        bool thrown = false;
+        try
+        {
+            parallel_for_each(tree, fail, pool);
+        }
+        catch(runtime_error&)
+        {
+            thrown = true;
+        }
+        check(thrown, name, "exception from parallel_for_each lost");
+    }
+}
+
+void testTraversals(size_t workers)
+{
+    WorkStealingPool pool(workers);
+    const int sizes[] = { 0, 1, 2, 17, 20000 };
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        AVLTree<int, int> avl;
+        BinarySearchTree<int, int> bst;
+        map<int, int> ref;
+        srand(61 + s);
+        while((int)ref.size() < sizes[s])
+        {
+            int key = rand() % (4 * sizes[s]);
+            int value = 1 + rand() % 1000;
+            if(ref.insert(make_pair(key, value)).second)
+            {
+                avl.insert(make_pair(key, value));
+                bst.insert(make_pair(key, value));
+            }
+        }
+        checkTraversals("AVLTree parallel", avl, ref, pool);
+        checkTraversals("BinarySearchTree parallel", bst, ref, pool);
+    }
+}
+
+int main()
+{
+    const size_t workers[] = { 0, 1, 3, 7 };
+    for(size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w)
+    {
+        testPool(workers[w]);
+        testTraversals(workers[w]);
+    }
+    testChunkBounds();
+
+    AVLTree<int, int> tree;
+    for(int key = 0; key < 1000; ++key)
+        tree.insert(make_pair(key, key));
+    check(parallel_reduce(tree, 0L, Sum()) == 999L * 1000 / 2, "shared pool", "default pool sum differs");
+    return testSummary("parallel traversal");
+}
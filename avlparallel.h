@@ -0,0 +1,391 @@
+#ifndef AVLPARALLEL_H
+#define AVLPARALLEL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A fixed set of worker threads running fork-join batches of tasks.
+*
+* run() deals the tasks of a batch out over one deque per worker. A worker
+* takes its own tasks from the back and, once its deque is empty, steals
+* from the front of the others, so uneven tasks even out without a central
+* queue. The thread calling run() works on the batch too rather than
+* blocking, which also makes it safe to call run() from inside a task.
+* Build with -pthread.
+*/
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(size_t workers = defaultWorkers());
+    ~WorkStealingPool();
+
+    size_t concurrency() const;
+
+    template <typename F>
+    void run(size_t count, F& body);
+
+    static WorkStealingPool& instance();
+    static size_t defaultWorkers();
+
+    // Ranges a traversal splits into per thread, so that stealing can
+    // absorb ranges of uneven size.
+    static const size_t SPLIT_FACTOR = 8;
+
+private:
+    WorkStealingPool(const WorkStealingPool&);
+    WorkStealingPool& operator=(const WorkStealingPool&);
+
+    // One run() call. Lives on the caller's stack until every task is done.
+    struct Batch
+    {
+        void (*call)(void*, size_t);
+        void* body;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed;
+        std::exception_ptr error;
+        bool finished;
+        std::mutex lock;
+        std::condition_variable done;
+    };
+
+    struct Task
+    {
+        Batch* batch;
+        size_t index;
+    };
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    template <typename F>
+    static void invoke(void* body, size_t index);
+
+    void submit(Batch& batch, size_t count);
+    void finish(Batch& batch);
+    bool take(size_t self, Task& task);
+    static void execute(const Task& task);
+    void work(size_t self);
+
+    // queues_[i] belongs to worker i; the last one is shared by callers.
+    std::vector<std::unique_ptr<Queue> > queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> queued_;
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+    bool stop_;
+};
+
+/**
+* One worker per hardware thread besides the caller.
+*/
+inline size_t WorkStealingPool::defaultWorkers()
+{
+    size_t threads = std::thread::hardware_concurrency();
+    return threads > 1 ? threads - 1 : 0;
+}
+
+/**
+* A process-wide pool with defaultWorkers() workers, started on first use.
+*/
+inline WorkStealingPool& WorkStealingPool::instance()
+{
+    static WorkStealingPool pool;
+    return pool;
+}
+
+inline WorkStealingPool::WorkStealingPool(size_t workers) :
+    queued_(0),
+    stop_(false)
+{
+    for(size_t i = 0; i <= workers; ++i)
+        queues_.push_back(std::unique_ptr<Queue>(new Queue));
+    for(size_t i = 0; i < workers; ++i)
+        threads_.push_back(std::thread(&WorkStealingPool::work, this, i));
+}
+
+/**
+* Stops and joins the workers. No run() may be in progress.
+*/
+inline WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepLock_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for(size_t i = 0; i < threads_.size(); ++i)
+        threads_[i].join();
+}
+
+/**
+* Number of threads that work on a batch, counting the caller.
+*/
+inline size_t WorkStealingPool::concurrency() const
+{
+    return threads_.size() + 1;
+}
+
+/**
+* Calls body(i) for every i in [0, count) across the pool and returns once
+* all calls have finished. If a call throws, the tasks not yet started are
+* skipped and the first exception is rethrown here.
+*/
+template <typename F>
+void WorkStealingPool::run(size_t count, F& body)
+{
+    if(count == 0)
+        return;
+    Batch batch;
+    batch.call = &WorkStealingPool::invoke<F>;
+    batch.body = &body;
+    batch.remaining.store(count);
+    batch.failed.store(false);
+    batch.finished = false;
+    submit(batch, count);
+    finish(batch);
+    if(batch.error)
+        std::rethrow_exception(batch.error);
+}
+
+template <typename F>
+void WorkStealingPool::invoke(void* body, size_t index)
+{
+    (*static_cast<F*>(body))(index);
+}
+
+/**
+* Deals the tasks out in contiguous blocks, one block per queue, and wakes
+* the workers.
+*/
+inline void WorkStealingPool::submit(Batch& batch, size_t count)
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepLock_);
+        queued_ += count;
+    }
+    size_t queues = queues_.size();
+    for(size_t q = 0; q < queues; ++q)
+    {
+        size_t first = count * q / queues;
+        size_t last = count * (q + 1) / queues;
+        if(first == last)
+            continue;
+        std::lock_guard<std::mutex> lock(queues_[q]->lock);
+        for(size_t i = first; i < last; ++i)
+        {
+            Task task = { &batch, i };
+            queues_[q]->tasks.push_back(task);
+        }
+    }
+    wake_.notify_all();
+}
+
+/**
+* Runs tasks on the calling thread until batch is complete. Once nothing
+* is left to take, the remaining tasks are running elsewhere and the
+* caller sleeps until the last of them finishes. The flag is only read
+* under the batch lock, so the batch cannot go out of scope while the
+* thread finishing it still holds that lock.
+*/
+inline void WorkStealingPool::finish(Batch& batch)
+{
+    size_t self = queues_.size() - 1;
+    for(;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(batch.lock);
+            if(batch.finished)
+                return;
+        }
+        Task task;
+        if(take(self, task))
+        {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(batch.lock);
+        while(!batch.finished)
+            batch.done.wait(lock);
+        return;
+    }
+}
+
+/**
+* Takes a task from the back of queue self or, failing that, steals one
+* from the front of another queue.
+*/
+inline bool WorkStealingPool::take(size_t self, Task& task)
+{
+    size_t queues = queues_.size();
+    for(size_t i = 0; i < queues; ++i)
+    {
+        Queue& q = *queues_[(self + i) % queues];
+        std::lock_guard<std::mutex> lock(q.lock);
+        if(q.tasks.empty())
+            continue;
+        if(i == 0)
+        {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+        }
+        else
+        {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+        }
+        --queued_;
+        return true;
+    }
+    return false;
+}
+
+/**
+* Runs one task unless its batch has already failed, and completes the
+* batch if this was its last task.
+*/
+inline void WorkStealingPool::execute(const Task& task)
+{
+    Batch& batch = *task.batch;
+    if(!batch.failed.load())
+    {
+        try
+        {
+            batch.call(batch.body, task.index);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(batch.lock);
+            if(!batch.error)
+                batch.error = std::current_exception();
+            batch.failed.store(true);
+        }
+    }
+    if(batch.remaining.fetch_sub(1) == 1)
+    {
+        std::lock_guard<std::mutex> lock(batch.lock);
+        batch.finished = true;
+        batch.done.notify_all();
+    }
+}
+
+/**
+* Worker loop: run tasks while any can be taken, sleep otherwise.
+*/
+inline void WorkStealingPool::work(size_t self)
+{
+    for(;;)
+    {
+        Task task;
+        if(take(self, task))
+        {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepLock_);
+        while(!stop_ && queued_.load() == 0)
+            wake_.wait(lock);
+        if(stop_)
+            return;
+    }
+}
+
+/**
+* Calls fn(entry) for every entry of tree, where entry is the
+* std::pair<const Key, Value>& an iterator yields. The tree is cut into
+* contiguous key ranges (see chunk_bounds) that run as separate tasks on
+* pool. Within a range entries are visited in key order; across ranges
+* the calls run concurrently, so fn must be safe to call from several
+* threads at once. fn may modify values but the tree itself must not
+* change until this returns. The first exception thrown by fn is
+* rethrown once the running ranges have finished.
+*/
+template <typename Tree, typename F>
+void parallel_for_each(Tree& tree, F fn, WorkStealingPool& pool = WorkStealingPool::instance())
+{
+    typedef typename Tree::iterator iterator;
+    std::vector<iterator> bounds;
+    tree.chunk_bounds(pool.concurrency() * WorkStealingPool::SPLIT_FACTOR, bounds);
+    iterator end = tree.end();
+    auto body = [&](size_t i)
+    {
+        iterator last = i + 1 < bounds.size() ? bounds[i + 1] : end;
+        for(iterator it = bounds[i]; it != last; ++it)
+            fn(*it);
+    };
+    pool.run(bounds.size(), body);
+}
+
+/**
+* Folds map(entry) over every entry of tree with op, in key order:
+* op(...op(op(init, map(e1)), map(e2))..., map(en)). Each range of the
+* tree is folded on its own task and the partial results are then
+* combined left to right, so op must be associative but need not be
+* commutative; order-sensitive folds such as concatenation give the same
+* result as a sequential pass. map and op are called concurrently.
+*/
+template <typename Tree, typename T, typename Map, typename Op>
+T parallel_transform_reduce(const Tree& tree, T init, Map map, Op op,
+                            WorkStealingPool& pool = WorkStealingPool::instance())
+{
+    typedef typename Tree::iterator iterator;
+    // Wrapped so that a vector of bool partials is not bit-packed.
+    struct Partial
+    {
+        T value;
+    };
+    std::vector<iterator> bounds;
+    tree.chunk_bounds(pool.concurrency() * WorkStealingPool::SPLIT_FACTOR, bounds);
+    Partial seed = { init };
+    std::vector<Partial> partials(bounds.size(), seed);
+    iterator end = tree.end();
+    auto body = [&](size_t i)
+    {
+        iterator last = i + 1 < bounds.size() ? bounds[i + 1] : end;
+        iterator it = bounds[i];
+        T acc = map(*it);
+        for(++it; it != last; ++it)
+            acc = op(acc, map(*it));
+        partials[i].value = acc;
+    };
+    pool.run(bounds.size(), body);
+    T result = init;
+    for(size_t i = 0; i < partials.size(); ++i)
+        result = op(result, partials[i].value);
+    return result;
+}
+
+/**
+* Maps an entry to its value converted to T, for parallel_reduce.
+*/
+template <typename T>
+struct EntryValue
+{
+    template <typename Entry>
+    T operator()(const Entry& entry) const
+    {
+        return entry.second;
+    }
+};
+
+/**
+* Folds the values of tree with op in key order; see
+* parallel_transform_reduce.
+*/
+template <typename Tree, typename T, typename Op>
+T parallel_reduce(const Tree& tree, T init, Op op, WorkStealingPool& pool = WorkStealingPool::instance())
+{
+    return parallel_transform_reduce(tree, init, EntryValue<T>(), op, pool);
+}
+
+#endif
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <set>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "avlset.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for AVLSet: single-key operations against std::set, and the set
+// operations in both their probing and merging forms.
+
+bool sameKeys(const AVLSet<int>& a, const set<int>& ref)
+{
+    AVLSet<int>::iterator it = a.begin();
+    for(set<int>::const_iterator r = ref.begin(); r != ref.end(); ++r, ++it)
+    {
+        if(it == a.end() || *it != *r)
+            return false;
+    }
+    return it == a.end() && a.size() == ref.size();
+}
+
+/**
+* Fills a set and its reference with count random keys below range.
+*/
+void fill(AVLSet<int>& a, set<int>& ref, int count, int range)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        int key = rand() % range;
+        a.insert(key);
+        ref.insert(key);
+    }
+}
+
+void testKeys()
+{
+    const char* name = "AVLSet";
+    AVLSet<int> a;
+    set<int> ref;
+    srand(17);
+    for(int i = 0; i < 20000; ++i)
+    {
+        int key = rand() % 2000;
+        switch(rand() % 4)
+        {
+        case 0:
+            check(a.insert(key) == ref.insert(key).second, name, "insert misreported");
+            break;
+        case 1:
+            check(a.remove(key) == (ref.erase(key) == 1), name, "remove misreported");
+            break;
+        case 2:
+        {
+            AVLSet<int>::iterator it = a.lower_bound(key);
+            set<int>::iterator r = ref.lower_bound(key);
+            check(r == ref.end() ? it == a.end() : (it != a.end() && *it == *r), name, "lower_bound differs");
+            break;
+        }
+        default:
+            check(a.contains(key) == (ref.count(key) == 1), name, "contains differs");
+            break;
+        }
+        if(i % 2000 == 0)
+            check(a.checkInvariants(), name, "invariants broken");
+    }
+    check(a.checkInvariants() && sameKeys(a, ref), name, "keys differ from std::set");
+
+    AVLSet<int> copy(a);
+    AVLSet<int> assigned;
+    assigned.insert(-1);
+    assigned = a;
+    check(copy.checkInvariants() && sameKeys(copy, ref) && assigned.checkInvariants() && sameKeys(assigned, ref),
+          name, "copies differ from the original");
+    a.clear();
+    check(a.empty() && a.begin() == a.end() && sameKeys(copy, ref), name, "clear wrong or shared with a copy");
+
+    vector<int> sorted(ref.begin(), ref.end());
+    a.buildFromSorted(sorted.begin(), sorted.size());
+    check(a.checkInvariants() && sameKeys(a, ref), name, "buildFromSorted differs from its input");
+    check(sizeof(SetNode<long>) < sizeof(AVLNode<long, bool>), name, "set node not smaller than a map node");
+}
+
+/**
+* Runs every set operation on a and b, with b of otherSize keys, and
+* compares with the std algorithms. Keys of a that survive an operation
+* must keep their nodes.
+*/
+void checkOperations(const char* name, int size, int otherSize)
+{
+    AVLSet<int> a;
+    AVLSet<int> b;
+    set<int> refA;
+    set<int> refB;
+    fill(a, refA, size, 4 * size);
+    fill(b, refB, otherSize, 4 * size);
+
+    check(a.includes(b) == includes(refA.begin(), refA.end(), refB.begin(), refB.end()), name,
+          "includes differs");
+    AVLSet<int> sub(a);
+    check(sub.includes(sub) && a.includes(AVLSet<int>()), name, "a set does not include itself or the empty set");
+
+    int kept = *a.begin();
+    const int* node = &*a.find(kept);
+    AVLSet<int> united(a);
+    set<int> refUnited(refA);
+    refUnited.insert(refB.begin(), refB.end());
+    united.unite(b);
+    a.unite(b);
+    check(a.checkInvariants() && sameKeys(a, refUnited), name, "unite differs from std::set");
+    check(&*a.find(kept) == node, name, "unite moved a key that stayed");
+
+    set<int> refIntersected;
+    set_intersection(refUnited.begin(), refUnited.end(), refB.begin(), refB.end(),
+                     inserter(refIntersected, refIntersected.begin()));
+    united.intersect(b);
+    check(united.checkInvariants() && sameKeys(united, refIntersected), name, "intersect differs from std::set");
+
+    set<int> refSubtracted;
+    set_difference(refUnited.begin(), refUnited.end(), refB.begin(), refB.end(),
+                   inserter(refSubtracted, refSubtracted.begin()));
+    a.subtract(b);
+    check(a.checkInvariants() && sameKeys(a, refSubtracted), name, "subtract differs from std::set");
+    check(a.includes(a) && !b.empty() && (a.empty() || !a.includes(b)), name, "includes wrong after subtract");
+}
+
+/**
+* If a node cannot be allocated, the merging unite leaves the set as it
+* was.
+*/
+void testUniteFailure()
+{
+    const char* name = "AVLSet unite failure";
+    AVLSet<int> a;
+    AVLSet<int> b;
+    set<int> refA;
+    set<int> refB;
+    fill(a, refA, 3000, 8000);
+    fill(b, refB, 3000, 8000);
+    allocationsLeft() = 10;
+    bool thrown = false;
+    try
+    {
+        a.unite(b);
+    }
+    catch(bad_alloc&)
+    {
+        thrown = true;
+    }
+    allocationsLeft() = -1;
+    check(thrown, name, "unite did not run out of memory");
+    check(a.checkInvariants() && sameKeys(a, refA), name, "failed unite changed the set");
+}
+
+int main()
+{
+    testKeys();
+    srand(18);
+    checkOperations("AVLSet probing", 5000, 20);
+    checkOperations("AVLSet merging", 3000, 2000);
+    testUniteFailure();
+    return testSummary("AVLSet");
+}
@@ -0,0 +1,804 @@
+#ifndef AVLSET_H
+#define AVLSET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "treememory.h"
+#include "balancedbst.h"
+
+/**
+* A node of an AVLSet: links, balance and key. Unlike Node it has no value
+* and no virtual functions, so for an 8-byte key it takes 40 bytes where
+* an AVLNode<Key, bool> takes 56.
+*/
+template <typename Key>
+class SetNode
+{
+public:
+    SetNode(const Key& key, SetNode<Key>* parent);
+
+    const Key& getKey() const;
+    SetNode<Key>* getParent() const;
+    SetNode<Key>* getLeft() const;
+    SetNode<Key>* getRight() const;
+    int getRank() const;
+
+    void setParent(SetNode<Key>* parent);
+    void setLeft(SetNode<Key>* left);
+    void setRight(SetNode<Key>* right);
+    void setRank(int rank);
+
+protected:
+    SetNode<Key>* parent_;
+    SetNode<Key>* left_;
+    SetNode<Key>* right_;
+    int rank_;
+    const Key key_;
+};
+
+template <typename Key>
+SetNode<Key>::SetNode(const Key& key, SetNode<Key>* parent) :
+    parent_(parent),
+    left_(nullptr),
+    right_(nullptr),
+    rank_(0),
+    key_(key)
+{
+
+}
+
+template <typename Key>
+const Key& SetNode<Key>::getKey() const
+{
+    return key_;
+}
+
+template <typename Key>
+SetNode<Key>* SetNode<Key>::getParent() const
+{
+    return parent_;
+}
+
+template <typename Key>
+SetNode<Key>* SetNode<Key>::getLeft() const
+{
+    return left_;
+}
+
+template <typename Key>
+SetNode<Key>* SetNode<Key>::getRight() const
+{
+    return right_;
+}
+
+template <typename Key>
+int SetNode<Key>::getRank() const
+{
+    return rank_;
+}
+
+template <typename Key>
+void SetNode<Key>::setParent(SetNode<Key>* parent)
+{
+    parent_ = parent;
+}
+
+template <typename Key>
+void SetNode<Key>::setLeft(SetNode<Key>* left)
+{
+    left_ = left;
+}
+
+template <typename Key>
+void SetNode<Key>::setRight(SetNode<Key>* right)
+{
+    right_ = right;
+}
+
+template <typename Key>
+void SetNode<Key>::setRank(int rank)
+{
+    rank_ = rank;
+}
+
+
+/**
+* An ordered set of keys, balanced by the same AVLPolicy that
+* BalancedAVLTree uses, whose nodes store the key alone.
+*
+* unite, intersect and subtract update the set in place. When one side is
+* much smaller than the other they probe the larger side key by key, in
+* O(m log n); otherwise they merge both sets in one in-order pass and
+* relink the surviving nodes into a balanced tree, in O(n + m). Either way
+* nodes already in the set are kept, not copied, and iterators to keys
+* that remain in the set stay valid.
+*/
+template <typename Key, typename Alloc = std::allocator<Key> >
+class AVLSet : public TrackedTree
+{
+public:
+    typedef SetNode<Key> NodeT;
+
+    class iterator
+    {
+    public:
+        iterator();
+
+        const Key& operator*() const;
+        const Key* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class AVLSet<Key, Alloc>;
+        iterator(NodeT* ptr);
+        NodeT *current_;
+    };
+
+    explicit AVLSet(const Alloc& alloc = Alloc());
+    AVLSet(const AVLSet<Key, Alloc>& other);
+    AVLSet<Key, Alloc>& operator=(const AVLSet<Key, Alloc>& other);
+    virtual ~AVLSet();
+
+    bool insert(const Key& key);
+    bool remove(const Key& key);
+    void clear();
+    template <typename InputIt>
+    void buildFromSorted(InputIt first, size_t count);
+
+    bool contains(const Key& key) const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator begin() const;
+    iterator end() const;
+    size_t size() const;
+    bool empty() const;
+
+    void unite(const AVLSet<Key, Alloc>& other);
+    void intersect(const AVLSet<Key, Alloc>& other);
+    void subtract(const AVLSet<Key, Alloc>& other);
+    bool includes(const AVLSet<Key, Alloc>& other) const;
+
+    bool checkInvariants() const;
+    virtual TreeMemoryUsage memory_usage() const override;
+
+protected:
+    friend struct AVLPolicy;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+
+    NodeT* createNode(const Key& key, NodeT* parent);
+    void destroyNode(NodeT* n);
+    NodeT* internalFind(const Key& key) const;
+    static NodeT* first(NodeT* n);
+    static NodeT* successor(NodeT* n);
+    static bool preferProbing(size_t probes, size_t size);
+
+    void relink(const std::vector<NodeT*>& nodes);
+    NodeT* linkRange(NodeT* const* nodes, size_t count, NodeT* parent, int& height);
+    bool checkOrder(const NodeT* n, const NodeT* lo, const NodeT* hi) const;
+
+    // Structural primitives for AVLPolicy.
+    NodeT* root() const;
+    void rotateLeft(NodeT* x);
+    void rotateRight(NodeT* x);
+    void swapWithPredecessor(NodeT* n);
+    NodeT* splice(NodeT* n);
+
+    NodeT *root_;
+    size_t size_;
+    NodeAlloc alloc_;
+};
+
+template <typename Key, typename Alloc>
+AVLSet<Key, Alloc>::iterator::iterator() :
+    current_(nullptr)
+{
+
+}
+
+template <typename Key, typename Alloc>
+AVLSet<Key, Alloc>::iterator::iterator(NodeT* ptr) :
+    current_(ptr)
+{
+
+}
+
+template <typename Key, typename Alloc>
+const Key& AVLSet<Key, Alloc>::iterator::operator*() const
+{
+    return current_->getKey();
+}
+
+template <typename Key, typename Alloc>
+const Key* AVLSet<Key, Alloc>::iterator::operator->() const
+{
+    return &(current_->getKey());
+}
+
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::iterator& AVLSet<Key, Alloc>::iterator::operator++()
+{
+    current_ = successor(current_);
+    return *this;
+}
+
+template <typename Key, typename Alloc>
+AVLSet<Key, Alloc>::AVLSet(const Alloc& alloc) :
+    root_(nullptr),
+    size_(0),
+    alloc_(alloc)
+{
+
+}
+
+template <typename Key, typename Alloc>
+AVLSet<Key, Alloc>::AVLSet(const AVLSet<Key, Alloc>& other) :
+    TrackedTree(other),
+    root_(nullptr),
+    size_(0),
+    alloc_(std::allocator_traits<NodeAlloc>::select_on_container_copy_construction(other.alloc_))
+{
+    buildFromSorted(other.begin(), other.size());
+}
+
+template <typename Key, typename Alloc>
+AVLSet<Key, Alloc>& AVLSet<Key, Alloc>::operator=(const AVLSet<Key, Alloc>& other)
+{
+    if(this != &other)
+    {
+        TrackedTree::operator=(other);
+        buildFromSorted(other.begin(), other.size());
+    }
+    return *this;
+}
+
+template <typename Key, typename Alloc>
+AVLSet<Key, Alloc>::~AVLSet()
+{
+    clear();
+}
+
+/**
+* Adds key. Returns false, leaving the set unchanged, if it was present.
+*/
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::insert(const Key& key)
+{
+    NodeT *curr = root_;
+    NodeT *parent = nullptr;
+    bool left = false;
+    while(curr != nullptr)
+    {
+        parent = curr;
+        if(key < curr->getKey())
+        {
+            curr = curr->getLeft();
+            left = true;
+        }
+        else if(curr->getKey() < key)
+        {
+            curr = curr->getRight();
+            left = false;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    NodeT *n = createNode(key, parent);
+    AVLPolicy::init(n);
+    if(parent == nullptr)
+        root_ = n;
+    else if(left)
+        parent->setLeft(n);
+    else
+        parent->setRight(n);
+    ++size_;
+    AVLPolicy::inserted(*this, n);
+    return true;
+}
+
+/**
+* Removes key. Returns false if it was not present.
+*/
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::remove(const Key& key)
+{
+    NodeT *n = internalFind(key);
+    if(n == nullptr)
+        return false;
+    AVLPolicy::erase(*this, n);
+    destroyNode(n);
+    --size_;
+    return true;
+}
+
+/**
+* Frees every node in O(n) without rebalancing.
+*/
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::clear()
+{
+    NodeT *n = root_;
+    while(n != nullptr)
+    {
+        if(n->getLeft() != nullptr)
+            n = n->getLeft();
+        else if(n->getRight() != nullptr)
+            n = n->getRight();
+        else
+        {
+            NodeT *parent = n->getParent();
+            if(parent != nullptr)
+            {
+                if(parent->getLeft() == n)
+                    parent->setLeft(nullptr);
+                else
+                    parent->setRight(nullptr);
+            }
+            destroyNode(n);
+            n = parent;
+        }
+    }
+    root_ = nullptr;
+    size_ = 0;
+}
+
+/**
+* Replaces the contents of the set with count keys read from first, which
+* must be strictly increasing, in O(n). If reading a key or allocating a
+* node throws, the set is left empty.
+*/
+template <typename Key, typename Alloc>
+template <typename InputIt>
+void AVLSet<Key, Alloc>::buildFromSorted(InputIt first, size_t count)
+{
+    clear();
+    std::vector<NodeT*> nodes;
+    nodes.reserve(count);
+    try
+    {
+        for(size_t i = 0; i < count; ++i, ++first)
+            nodes.push_back(createNode(*first, nullptr));
+    }
+    catch(...)
+    {
+        for(size_t i = 0; i < nodes.size(); ++i)
+            destroyNode(nodes[i]);
+        throw;
+    }
+    relink(nodes);
+}
+
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::contains(const Key& key) const
+{
+    return internalFind(key) != nullptr;
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::iterator AVLSet<Key, Alloc>::find(const Key& key) const
+{
+    return iterator(internalFind(key));
+}
+
+/**
+* The first key not less than key, or end().
+*/
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::iterator AVLSet<Key, Alloc>::lower_bound(const Key& key) const
+{
+    NodeT *curr = root_;
+    NodeT *best = nullptr;
+    while(curr != nullptr)
+    {
+        if(curr->getKey() < key)
+            curr = curr->getRight();
+        else
+        {
+            best = curr;
+            curr = curr->getLeft();
+        }
+    }
+    return iterator(best);
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::iterator AVLSet<Key, Alloc>::begin() const
+{
+    return iterator(first(root_));
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::iterator AVLSet<Key, Alloc>::end() const
+{
+    return iterator(nullptr);
+}
+
+template <typename Key, typename Alloc>
+size_t AVLSet<Key, Alloc>::size() const
+{
+    return size_;
+}
+
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::empty() const
+{
+    return size_ == 0;
+}
+
+/**
+* Adds every key of other. If allocating a node throws, the merging pass
+* leaves the set unchanged and the probing pass leaves the keys inserted
+* so far.
+*/
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::unite(const AVLSet<Key, Alloc>& other)
+{
+    if(this == &other || other.empty())
+        return;
+    if(preferProbing(other.size_, size_))
+    {
+        for(NodeT *o = first(other.root_); o != nullptr; o = successor(o))
+            insert(o->getKey());
+        return;
+    }
+
+    std::vector<NodeT*> nodes;
+    std::vector<NodeT*> added;
+    nodes.reserve(size_ + other.size_);
+    added.reserve(other.size_);
+    NodeT *a = first(root_);
+    NodeT *b = first(other.root_);
+    try
+    {
+        while(b != nullptr)
+        {
+            if(a != nullptr && a->getKey() < b->getKey())
+            {
+                nodes.push_back(a);
+                a = successor(a);
+            }
+            else
+            {
+                if(a != nullptr && !(b->getKey() < a->getKey()))
+                {
+                    nodes.push_back(a);
+                    a = successor(a);
+                }
+                else
+                {
+                    added.push_back(createNode(b->getKey(), nullptr));
+                    nodes.push_back(added.back());
+                }
+                b = successor(b);
+            }
+        }
+    }
+    catch(...)
+    {
+        // The tree has not been relinked yet.
+        for(size_t i = 0; i < added.size(); ++i)
+            destroyNode(added[i]);
+        throw;
+    }
+    for(; a != nullptr; a = successor(a))
+        nodes.push_back(a);
+    relink(nodes);
+}
+
+/**
+* Removes every key that other does not contain.
+*/
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::intersect(const AVLSet<Key, Alloc>& other)
+{
+    if(this == &other)
+        return;
+    if(other.empty())
+    {
+        clear();
+        return;
+    }
+
+    std::vector<NodeT*> keep;
+    std::vector<NodeT*> drop;
+    if(preferProbing(size_, other.size_))
+    {
+        for(NodeT *a = first(root_); a != nullptr; a = successor(a))
+            (other.contains(a->getKey()) ? keep : drop).push_back(a);
+    }
+    else
+    {
+        NodeT *b = first(other.root_);
+        for(NodeT *a = first(root_); a != nullptr; a = successor(a))
+        {
+            while(b != nullptr && b->getKey() < a->getKey())
+                b = successor(b);
+            if(b != nullptr && !(a->getKey() < b->getKey()))
+                keep.push_back(a);
+            else
+                drop.push_back(a);
+        }
+    }
+    for(size_t i = 0; i < drop.size(); ++i)
+        destroyNode(drop[i]);
+    relink(keep);
+}
+
+/**
+* Removes every key that other contains.
+*/
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::subtract(const AVLSet<Key, Alloc>& other)
+{
+    if(this == &other)
+    {
+        clear();
+        return;
+    }
+    if(other.empty() || empty())
+        return;
+    if(preferProbing(other.size_, size_))
+    {
+        for(NodeT *o = first(other.root_); o != nullptr; o = successor(o))
+            remove(o->getKey());
+        return;
+    }
+
+    std::vector<NodeT*> keep;
+    keep.reserve(size_);
+    std::vector<NodeT*> drop;
+    NodeT *b = first(other.root_);
+    for(NodeT *a = first(root_); a != nullptr; a = successor(a))
+    {
+        while(b != nullptr && b->getKey() < a->getKey())
+            b = successor(b);
+        if(b != nullptr && !(a->getKey() < b->getKey()))
+            drop.push_back(a);
+        else
+            keep.push_back(a);
+    }
+    for(size_t i = 0; i < drop.size(); ++i)
+        destroyNode(drop[i]);
+    relink(keep);
+}
+
+/**
+* True if every key of other is in this set.
+*/
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::includes(const AVLSet<Key, Alloc>& other) const
+{
+    if(other.size_ > size_)
+        return false;
+    if(preferProbing(other.size_, size_))
+    {
+        for(NodeT *o = first(other.root_); o != nullptr; o = successor(o))
+        {
+            if(!contains(o->getKey()))
+                return false;
+        }
+        return true;
+    }
+
+    NodeT *a = first(root_);
+    for(NodeT *b = first(other.root_); b != nullptr; b = successor(b))
+    {
+        while(a != nullptr && a->getKey() < b->getKey())
+            a = successor(a);
+        if(a == nullptr || b->getKey() < a->getKey())
+            return false;
+    }
+    return true;
+}
+
+/**
+* Checks ordering, parent links, the size and the AVL balance factors.
+*/
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::checkInvariants() const
+{
+    if(root_ != nullptr && root_->getParent() != nullptr)
+        return false;
+    size_t count = 0;
+    for(NodeT *n = first(root_); n != nullptr; n = successor(n))
+        ++count;
+    return count == size_ && checkOrder(root_, nullptr, nullptr) && AVLPolicy::check(root_);
+}
+
+template <typename Key, typename Alloc>
+TreeMemoryUsage AVLSet<Key, Alloc>::memory_usage() const
+{
+    TreeMemoryUsage usage;
+    usage.nodes = size_;
+    usage.nodeBytes = size_ * sizeof(NodeT);
+    usage.allocatorOverhead = size_ * AllocatorOverhead<Alloc>::perAllocation(sizeof(NodeT));
+    for(NodeT *n = first(root_); n != nullptr; n = successor(n))
+        usage.ownedBytes += OwnedBytes<Key>::bytes(n->getKey());
+    return usage;
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::NodeT* AVLSet<Key, Alloc>::createNode(const Key& key, NodeT* parent)
+{
+    NodeT *n = NodeTraits::allocate(alloc_, 1);
+    try
+    {
+        NodeTraits::construct(alloc_, n, key, parent);
+    }
+    catch(...)
+    {
+        NodeTraits::deallocate(alloc_, n, 1);
+        throw;
+    }
+    nodeAdded(sizeof(NodeT));
+    return n;
+}
+
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::destroyNode(NodeT* n)
+{
+    nodeRemoved(sizeof(NodeT));
+    NodeTraits::destroy(alloc_, n);
+    NodeTraits::deallocate(alloc_, n, 1);
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::NodeT* AVLSet<Key, Alloc>::internalFind(const Key& key) const
+{
+    NodeT *curr = root_;
+    while(curr != nullptr)
+    {
+        if(key < curr->getKey())
+            curr = curr->getLeft();
+        else if(curr->getKey() < key)
+            curr = curr->getRight();
+        else
+            return curr;
+    }
+    return nullptr;
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::NodeT* AVLSet<Key, Alloc>::first(NodeT* n)
+{
+    if(n == nullptr)
+        return nullptr;
+    while(n->getLeft() != nullptr)
+        n = n->getLeft();
+    return n;
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::NodeT* AVLSet<Key, Alloc>::successor(NodeT* n)
+{
+    if(n->getRight() != nullptr)
+        return first(n->getRight());
+    NodeT *parent = n->getParent();
+    while(parent != nullptr && parent->getRight() == n)
+    {
+        n = parent;
+        parent = n->getParent();
+    }
+    return parent;
+}
+
+/**
+* True if probes lookups into a set of size keys cost less than a pass
+* over both sets: probes * log2(size) < size + probes.
+*/
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::preferProbing(size_t probes, size_t size)
+{
+    size_t depth = 1;
+    for(size_t s = size; s > 1; s >>= 1)
+        ++depth;
+    return probes * depth < size + probes;
+}
+
+/**
+* Makes nodes, which are in key order and include no node that has been
+* freed, the whole contents of the set, linked as a perfectly balanced
+* tree.
+*/
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::relink(const std::vector<NodeT*>& nodes)
+{
+    int height;
+    root_ = linkRange(nodes.data(), nodes.size(), nullptr, height);
+    size_ = nodes.size();
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::NodeT*
+AVLSet<Key, Alloc>::linkRange(NodeT* const* nodes, size_t count, NodeT* parent, int& height)
+{
+    if(count == 0)
+    {
+        height = 0;
+        return nullptr;
+    }
+    size_t leftCount = count / 2;
+    NodeT *n = nodes[leftCount];
+    int leftHeight;
+    int rightHeight;
+    n->setParent(parent);
+    n->setLeft(linkRange(nodes, leftCount, n, leftHeight));
+    n->setRight(linkRange(nodes + leftCount + 1, count - leftCount - 1, n, rightHeight));
+    n->setRank(rightHeight - leftHeight);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return n;
+}
+
+template <typename Key, typename Alloc>
+bool AVLSet<Key, Alloc>::checkOrder(const NodeT* n, const NodeT* lo, const NodeT* hi) const
+{
+    if(n == nullptr)
+        return true;
+    if((lo != nullptr && !(lo->getKey() < n->getKey())) || (hi != nullptr && !(n->getKey() < hi->getKey())))
+        return false;
+    if((n->getLeft() != nullptr && n->getLeft()->getParent() != n) ||
+       (n->getRight() != nullptr && n->getRight()->getParent() != n))
+        return false;
+    return checkOrder(n->getLeft(), lo, n) && checkOrder(n->getRight(), n, hi);
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::NodeT* AVLSet<Key, Alloc>::root() const
+{
+    return root_;
+}
+
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::rotateLeft(NodeT* x)
+{
+    TreeLinks::rotateLeft(root_, x);
+}
+
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::rotateRight(NodeT* x)
+{
+    TreeLinks::rotateRight(root_, x);
+}
+
+/**
+* Moves n to its predecessor's position; balances stay with the positions.
+*/
+template <typename Key, typename Alloc>
+void AVLSet<Key, Alloc>::swapWithPredecessor(NodeT* n)
+{
+    NodeT *p = TreeLinks::swapWithPredecessor(root_, n);
+    int rank = n->getRank();
+    n->setRank(p->getRank());
+    p->setRank(rank);
+}
+
+template <typename Key, typename Alloc>
+typename AVLSet<Key, Alloc>::NodeT* AVLSet<Key, Alloc>::splice(NodeT* n)
+{
+    return TreeLinks::splice(root_, n);
+}
+
+#endif
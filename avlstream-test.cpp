@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "avlstream.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for tree streams: exported trees import unchanged with and
+// without packing, the run-length coder round-trips, the writer rejects
+// entry counts that differ from its header, and damaged streams throw
+// and leave the target empty instead of building a wrong tree.
+
+/**
+* Packs runs and literals of every length around the control byte limits
+* and checks they unpack to the input, and not to any other length.
+*/
+void testPacking()
+{
+    const char* name = "packBytes";
+    mt19937 rng(31);
+    bool ok = true;
+    for(int round = 0; round < 500; ++round)
+    {
+        vector<char> data;
+        while(data.size() < (size_t)(round * 3))
+        {
+            size_t run = 1 + rng() % 300;
+            char byte = (char)rng();
+            bool repeat = rng() % 2 == 0;
+            for(size_t i = 0; i < run; ++i)
+                data.push_back(repeat ? byte : (char)rng());
+        }
+        vector<char> packed;
+        packBytes(data.data(), data.size(), packed);
+        vector<char> unpacked(data.size() + 1);
+        ok = ok && unpackBytes(packed.data(), packed.size(), unpacked.data(), data.size());
+        ok = ok && equal(data.begin(), data.end(), unpacked.begin());
+        ok = ok && !unpackBytes(packed.data(), packed.size(), unpacked.data(), data.size() + 1);
+    }
+    check(ok, name, "packed bytes did not unpack to the input");
+}
+
+void testRoundTrip()
+{
+    const char* name = "tree stream";
+    srand(33);
+    for(int compress = 0; compress < 2; ++compress)
+    {
+        AVLTree<int, long> tree;
+        for(int i = 0; i < 10000; ++i)
+            tree.insert(make_pair(i * 3 + rand() % 2, (long)i));
+        stringstream stream;
+        exportTree(tree, stream, compress != 0, 1000);
+        string data = stream.str();
+
+        AVLTree<int, long> copy;
+        importTree(stream, copy);
+        AVLTree<int, long>::iterator a = tree.begin();
+        AVLTree<int, long>::iterator b = copy.begin();
+        for(; a != tree.end() && b != copy.end(); ++a, ++b)
+        {
+            if(a->first != b->first || a->second != b->second)
+                break;
+        }
+        check(a == tree.end() && b == copy.end() && copy.isBalanced(), name, "import differs from the exported tree");
+
+        // Truncations and damaged bytes must throw and leave the target
+        // empty, never build a wrong tree silently.
+        mt19937 rng(compress + 1);
+        for(int round = 0; round < 200; ++round)
+        {
+            string damaged = data;
+            if(round % 2 == 0)
+                damaged.resize(rng() % damaged.size());
+            else
+                damaged[rng() % damaged.size()] ^= (char)(1 + rng() % 255);
+            stringstream in(damaged);
+            AVLTree<int, long> target;
+            target.insert(make_pair(-1, -1L));
+            try
+            {
+                importTree(in, target);
+                // A flipped value byte can still decode; the keys must not.
+                bool keysIntact = true;
+                a = tree.begin();
+                for(b = target.begin(); a != tree.end() && b != target.end(); ++a, ++b)
+                    keysIntact = keysIntact && a->first == b->first;
+                check(keysIntact && a == tree.end() && b == target.end(), name, "damaged stream built a wrong tree");
+            }
+            catch(runtime_error&)
+            {
+                check(target.empty(), name, "failed import left entries behind");
+            }
+        }
+    }
+}
+
+/**
+* A writer must not emit more or fewer entries than its header announced.
+*/
+void testWriterCount()
+{
+    const char* name = "TreeStreamWriter";
+    bool tooMany = false;
+    {
+        stringstream out;
+        TreeStreamWriter<int, int> writer(out, 2, true, 4);
+        writer.append(1, 1);
+        writer.append(2, 2);
+        try
+        {
+            writer.append(3, 3);
+        }
+        catch(logic_error&)
+        {
+            tooMany = true;
+        }
+    }
+    check(tooMany, name, "append past the announced count did not throw");
+
+    bool tooFew = false;
+    {
+        stringstream out;
+        TreeStreamWriter<int, int> writer(out, 3, true, 4);
+        writer.append(1, 1);
+        try
+        {
+            writer.finish();
+        }
+        catch(logic_error&)
+        {
+            tooFew = true;
+        }
+    }
+    check(tooFew, name, "finish before the announced count did not throw");
+
+    stringstream empty;
+    TreeStreamWriter<int, int> writer(empty, 0);
+    writer.finish();
+    AVLTree<int, int> target;
+    importTree(empty, target);
+    check(target.empty(), name, "empty stream did not import as an empty tree");
+}
+
+int main()
+{
+    testPacking();
+    testRoundTrip();
+    testWriterCount();
+    return testSummary("tree stream");
+}
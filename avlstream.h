@@ -0,0 +1,495 @@
+#ifndef AVLSTREAM_H
+#define AVLSTREAM_H
+
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* Chunked tree stream format
+* --------------------------
+* A stream starts with a fixed header:
+*
+*     char     magic[8]      "AVLSTM1\0"
+*     uint32_t keySize       sizeof(Key) of the exported tree
+*     uint32_t valueSize     sizeof(Value) of the exported tree
+*     uint64_t count         number of entries in the stream
+*     uint32_t chunkEntries  maximum number of entries in one chunk
+*
+* followed by chunks, in key order:
+*
+*     uint32_t entries       entries in this chunk; 0 ends the stream
+*     uint32_t storedSize    length of the payload that follows
+*     uint8_t  encoding      STREAM_RAW or STREAM_PACKED
+*     char     payload[storedSize]
+*
+* A decoded payload is the chunk's keys followed by its values, as raw
+* bytes. With STREAM_PACKED every key after the first is XORed with the one
+* before it, which turns the shared high bytes of neighbouring sorted keys
+* into zeros, and the result is run-length coded. A chunk is only stored
+* packed when that makes it smaller.
+*
+* Writer and reader each hold one chunk, so memory stays bounded by the
+* chunk size no matter how large the tree is. Keys and values are raw
+* bytes with the same portability limits as the trace and image formats.
+*/
+
+static const char STREAM_MAGIC[8] = { 'A', 'V', 'L', 'S', 'T', 'M', '1', '\0' };
+
+enum StreamEncoding
+{
+    STREAM_RAW = 0,
+    STREAM_PACKED = 1
+};
+
+/**
+* Run-length coding used for packed chunks. A control byte c below 128 is
+* followed by c + 1 literal bytes; c of 128 or more means the next byte is
+* repeated c - 126 times.
+*/
+inline void packBytes(const char* in, size_t len, std::vector<char>& out)
+{
+    out.clear();
+    size_t i = 0;
+    while(i < len)
+    {
+        size_t run = 1;
+        while(i + run < len && run < 129 && in[i + run] == in[i])
+            ++run;
+        if(run >= 3)
+        {
+            out.push_back((char)(run + 126));
+            out.push_back(in[i]);
+            i += run;
+            continue;
+        }
+
+        // Collect literals until the next run of three or the 128 limit.
+        size_t start = i;
+        while(i < len && i - start < 128)
+        {
+            if(i + 2 < len && in[i] == in[i + 1] && in[i] == in[i + 2])
+                break;
+            ++i;
+        }
+        out.push_back((char)(i - start - 1));
+        out.insert(out.end(), in + start, in + i);
+    }
+}
+
+/**
+* Reverses packBytes. Returns false if the input does not decode to
+* exactly len bytes.
+*/
+inline bool unpackBytes(const char* in, size_t inLen, char* out, size_t len)
+{
+    size_t i = 0;
+    size_t o = 0;
+    while(i < inLen)
+    {
+        unsigned char c = (unsigned char)in[i++];
+        if(c < 128)
+        {
+            size_t n = (size_t)c + 1;
+            if(i + n > inLen || o + n > len)
+                return false;
+            std::memcpy(out + o, in + i, n);
+            i += n;
+            o += n;
+        }
+        else
+        {
+            size_t n = (size_t)c - 126;
+            if(i >= inLen || o + n > len)
+                return false;
+            std::memset(out + o, in[i++], n);
+            o += n;
+        }
+    }
+    return o == len;
+}
+
+/**
+* Writes entries, which must arrive in increasing key order, to a chunked
+* stream.
+*/
+template <typename Key, typename Value>
+class TreeStreamWriter
+{
+public:
+    TreeStreamWriter(std::ostream& out, uint64_t count, bool compress = true, size_t chunkEntries = 4096);
+
+    void append(const Key& key, const Value& value);
+    void finish();
+
+private:
+    TreeStreamWriter(const TreeStreamWriter&);
+    TreeStreamWriter& operator=(const TreeStreamWriter&);
+
+    void flushChunk();
+    void write(const void* data, size_t len);
+
+    std::ostream& out_;
+    bool compress_;
+    size_t chunkEntries_;
+    size_t entries_;
+    uint64_t remaining_;
+    std::vector<char> chunk_;
+    std::vector<char> packed_;
+};
+
+/**
+* Reads entries back from a chunked stream, one chunk at a time.
+*/
+template <typename Key, typename Value>
+class TreeStreamReader
+{
+public:
+    explicit TreeStreamReader(std::istream& in);
+
+    uint64_t count() const;
+    bool next(Key& key, Value& value);
+
+private:
+    TreeStreamReader(const TreeStreamReader&);
+    TreeStreamReader& operator=(const TreeStreamReader&);
+
+    bool readChunk();
+    void read(void* data, size_t len);
+
+    std::istream& in_;
+    uint64_t count_;
+    uint64_t consumed_;
+    size_t chunkEntries_;
+    size_t entries_;
+    size_t pos_;
+    bool done_;
+    bool havePrev_;
+    Key prev_;
+    std::vector<char> chunk_;
+    std::vector<char> packed_;
+};
+
+template <typename Key, typename Value>
+TreeStreamWriter<Key, Value>::TreeStreamWriter(std::ostream& out, uint64_t count, bool compress, size_t chunkEntries) :
+    out_(out),
+    compress_(compress),
+    chunkEntries_(chunkEntries == 0 ? 1 : chunkEntries),
+    entries_(0),
+    remaining_(count)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "tree streams require trivially copyable keys and values");
+    chunk_.resize(chunkEntries_ * (sizeof(Key) + sizeof(Value)));
+
+    uint32_t keySize = sizeof(Key);
+    uint32_t valueSize = sizeof(Value);
+    uint32_t maxEntries = (uint32_t)chunkEntries_;
+    write(STREAM_MAGIC, sizeof(STREAM_MAGIC));
+    write(&keySize, sizeof(keySize));
+    write(&valueSize, sizeof(valueSize));
+    write(&count, sizeof(count));
+    write(&maxEntries, sizeof(maxEntries));
+}
+
+/**
+* Stages one entry, emitting a chunk whenever one fills up. Throws
+* std::logic_error if more entries arrive than the header announced.
+*/
+template <typename Key, typename Value>
+void TreeStreamWriter<Key, Value>::append(const Key& key, const Value& value)
+{
+    if(remaining_ == 0)
+        throw std::logic_error("more entries than announced in tree stream");
+    --remaining_;
+    std::memcpy(&chunk_[entries_ * sizeof(Key)], &key, sizeof(Key));
+    std::memcpy(&chunk_[chunkEntries_ * sizeof(Key) + entries_ * sizeof(Value)], &value, sizeof(Value));
+    if(++entries_ == chunkEntries_)
+        flushChunk();
+}
+
+/**
+* Emits the last partial chunk and the end marker. Throws std::logic_error
+* if fewer entries were appended than the header announced.
+*/
+template <typename Key, typename Value>
+void TreeStreamWriter<Key, Value>::finish()
+{
+    if(remaining_ != 0)
+        throw std::logic_error("fewer entries than announced in tree stream");
+    if(entries_ != 0)
+        flushChunk();
+    uint32_t zero = 0;
+    uint8_t encoding = STREAM_RAW;
+    write(&zero, sizeof(zero));
+    write(&zero, sizeof(zero));
+    write(&encoding, sizeof(encoding));
+    out_.flush();
+    if(!out_)
+        throw std::runtime_error("error writing tree stream");
+}
+
+/**
+* Lays the staged keys and values out back to back, packs them if that
+* helps, and writes the chunk.
+*/
+template <typename Key, typename Value>
+void TreeStreamWriter<Key, Value>::flushChunk()
+{
+    size_t keyBytes = entries_ * sizeof(Key);
+    size_t rawSize = keyBytes + entries_ * sizeof(Value);
+    if(entries_ != chunkEntries_)
+        std::memmove(&chunk_[keyBytes], &chunk_[chunkEntries_ * sizeof(Key)], entries_ * sizeof(Value));
+
+    const char* payload = &chunk_[0];
+    uint32_t storedSize = (uint32_t)rawSize;
+    uint8_t encoding = STREAM_RAW;
+    if(compress_)
+    {
+        // Delta the keys in place, last first, so each XOR sees the
+        // original previous key; undone below before the buffer is reused.
+        for(size_t i = keyBytes; i-- > sizeof(Key); )
+            chunk_[i] ^= chunk_[i - sizeof(Key)];
+        packBytes(&chunk_[0], rawSize, packed_);
+        for(size_t i = sizeof(Key); i < keyBytes; ++i)
+            chunk_[i] ^= chunk_[i - sizeof(Key)];
+        if(packed_.size() < rawSize)
+        {
+            payload = &packed_[0];
+            storedSize = (uint32_t)packed_.size();
+            encoding = STREAM_PACKED;
+        }
+    }
+
+    uint32_t entries = (uint32_t)entries_;
+    write(&entries, sizeof(entries));
+    write(&storedSize, sizeof(storedSize));
+    write(&encoding, sizeof(encoding));
+    write(payload, storedSize);
+    entries_ = 0;
+}
+
+template <typename Key, typename Value>
+void TreeStreamWriter<Key, Value>::write(const void* data, size_t len)
+{
+    out_.write(static_cast<const char*>(data), len);
+    if(!out_)
+        throw std::runtime_error("error writing tree stream");
+}
+
+/**
+* Reads and checks the stream header. Throws std::runtime_error if the
+* stream is not a tree stream or was written with different key/value
+* sizes.
+*/
+template <typename Key, typename Value>
+TreeStreamReader<Key, Value>::TreeStreamReader(std::istream& in) :
+    in_(in),
+    count_(0),
+    consumed_(0),
+    chunkEntries_(0),
+    entries_(0),
+    pos_(0),
+    done_(false),
+    havePrev_(false),
+    prev_()
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "tree streams require trivially copyable keys and values");
+    char magic[8];
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint32_t maxEntries;
+    read(magic, sizeof(magic));
+    if(std::memcmp(magic, STREAM_MAGIC, sizeof(STREAM_MAGIC)) != 0)
+        throw std::runtime_error("not a tree stream");
+    read(&keySize, sizeof(keySize));
+    read(&valueSize, sizeof(valueSize));
+    read(&count_, sizeof(count_));
+    read(&maxEntries, sizeof(maxEntries));
+    if(keySize != sizeof(Key) || valueSize != sizeof(Value))
+        throw std::runtime_error("tree stream key/value sizes do not match");
+    if(maxEntries == 0)
+        throw std::runtime_error("corrupt tree stream header");
+    chunkEntries_ = maxEntries;
+    chunk_.resize(chunkEntries_ * (sizeof(Key) + sizeof(Value)));
+}
+
+/**
+* Number of entries the writer announced.
+*/
+template <typename Key, typename Value>
+uint64_t TreeStreamReader<Key, Value>::count() const
+{
+    return count_;
+}
+
+/**
+* Fetches the next entry. Returns false at the end marker. Throws
+* std::runtime_error on a truncated or corrupt stream, including keys out
+* of order or an entry count that does not match the header.
+*/
+template <typename Key, typename Value>
+bool TreeStreamReader<Key, Value>::next(Key& key, Value& value)
+{
+    if(pos_ == entries_ && !readChunk())
+        return false;
+    std::memcpy(&key, &chunk_[pos_ * sizeof(Key)], sizeof(Key));
+    std::memcpy(&value, &chunk_[entries_ * sizeof(Key) + pos_ * sizeof(Value)], sizeof(Value));
+    ++pos_;
+    if(havePrev_ && !(prev_ < key))
+        throw std::runtime_error("tree stream keys out of order");
+    std::memcpy(&prev_, &key, sizeof(Key));
+    havePrev_ = true;
+    return true;
+}
+
+template <typename Key, typename Value>
+bool TreeStreamReader<Key, Value>::readChunk()
+{
+    if(done_)
+        return false;
+    uint32_t entries;
+    uint32_t storedSize;
+    uint8_t encoding;
+    read(&entries, sizeof(entries));
+    read(&storedSize, sizeof(storedSize));
+    read(&encoding, sizeof(encoding));
+    if(entries == 0)
+    {
+        if(storedSize != 0 || consumed_ != count_)
+            throw std::runtime_error("tree stream entry count does not match header");
+        done_ = true;
+        return false;
+    }
+
+    size_t rawSize = (size_t)entries * (sizeof(Key) + sizeof(Value));
+    if(entries > chunkEntries_ || consumed_ + entries > count_ ||
+       (encoding == STREAM_RAW && storedSize != rawSize) ||
+       (encoding == STREAM_PACKED && storedSize > rawSize) ||
+       encoding > STREAM_PACKED)
+        throw std::runtime_error("corrupt tree stream chunk");
+
+    if(encoding == STREAM_RAW)
+    {
+        read(&chunk_[0], rawSize);
+    }
+    else
+    {
+        packed_.resize(storedSize);
+        read(&packed_[0], storedSize);
+        if(!unpackBytes(&packed_[0], storedSize, &chunk_[0], rawSize))
+            throw std::runtime_error("corrupt tree stream chunk");
+        for(size_t i = sizeof(Key); i < entries * sizeof(Key); ++i)
+            chunk_[i] ^= chunk_[i - sizeof(Key)];
+    }
+    consumed_ += entries;
+    entries_ = entries;
+    pos_ = 0;
+    return true;
+}
+
+template <typename Key, typename Value>
+void TreeStreamReader<Key, Value>::read(void* data, size_t len)
+{
+    in_.read(static_cast<char*>(data), len);
+    if((size_t)in_.gcount() != len)
+        throw std::runtime_error("truncated tree stream");
+}
+
+/**
+* Streams the contents of tree to out in key order. Only one chunk is
+* buffered; the tree is walked twice, once to count the entries for the
+* header and once to write them.
+*/
+template <typename Key, typename Value, typename Alloc>
+void exportTree(const BinarySearchTree<Key, Value, Alloc>& tree, std::ostream& out,
+                bool compress = true, size_t chunkEntries = 4096)
+{
+    uint64_t count = 0;
+    for(typename BinarySearchTree<Key, Value, Alloc>::iterator it = tree.begin(); it != tree.end(); ++it)
+        ++count;
+    TreeStreamWriter<Key, Value> writer(out, count, compress, chunkEntries);
+    for(typename BinarySearchTree<Key, Value, Alloc>::iterator it = tree.begin(); it != tree.end(); ++it)
+        writer.append(it->first, it->second);
+    writer.finish();
+}
+
+/**
+* Adapts a TreeStreamReader to the input iterator AVLTree::buildFromSorted
+* expects. Entries are fetched lazily, so the iterator never reads past
+* the last entry it is asked for.
+*/
+template <typename Key, typename Value>
+class TreeStreamCursor
+{
+public:
+    explicit TreeStreamCursor(TreeStreamReader<Key, Value>& reader) :
+        reader_(&reader),
+        loaded_(false),
+        key_(),
+        value_()
+    {
+
+    }
+
+    std::pair<const Key, Value> operator*()
+    {
+        if(!loaded_)
+        {
+            if(!reader_->next(key_, value_))
+                throw std::runtime_error("truncated tree stream");
+            loaded_ = true;
+        }
+        return std::pair<const Key, Value>(key_, value_);
+    }
+
+    TreeStreamCursor& operator++()
+    {
+        if(!loaded_)
+            **this;
+        loaded_ = false;
+        return *this;
+    }
+
+private:
+    TreeStreamReader<Key, Value>* reader_;
+    bool loaded_;
+    Key key_;
+    Value value_;
+};
+
+/**
+* Replaces the contents of tree with the entries streamed from in, built
+* in linear time without staging the entries in memory. Throws
+* std::runtime_error on a malformed stream, leaving tree empty.
+*/
+template <typename Key, typename Value, typename Alloc>
+void importTree(std::istream& in, AVLTree<Key, Value, Alloc>& tree)
+{
+    TreeStreamReader<Key, Value> reader(in);
+    TreeStreamCursor<Key, Value> cursor(reader);
+    tree.buildFromSorted(cursor, (size_t)reader.count());
+    Key key;
+    Value value;
+    try
+    {
+        if(reader.next(key, value))
+            throw std::runtime_error("tree stream entry count does not match header");
+    }
+    catch(...)
+    {
+        tree.clear();
+        throw;
+    }
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "avltrace.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for trace recording: every operation made through a
+// RecordingAVLTree comes back from loadTrace in order, damaged files are
+// rejected, and write errors are reported rather than dropped.
+
+void testRoundTrip(TestDir& dir)
+{
+    const char* name = "trace round trip";
+    string path = dir.file("ops.trace");
+    vector<TraceRecord<int, int> > expected;
+    {
+        RecordingAVLTree<int, int> tree(path);
+        const RecordingAVLTree<int, int>& constTree = tree;
+        for(int i = 0; i < 50000; ++i)
+        {
+            TraceRecord<int, int> rec;
+            rec.key = i % 997;
+            rec.value = 0;
+            switch(i % 5)
+            {
+            case 0:
+            case 1:
+                rec.op = TRACE_INSERT;
+                rec.value = i;
+                tree.insert(make_pair(rec.key, rec.value));
+                break;
+            case 2:
+                rec.op = TRACE_REMOVE;
+                tree.remove(rec.key);
+                break;
+            case 3:
+                rec.op = TRACE_FIND;
+                constTree.find(rec.key);
+                break;
+            default:
+                rec.op = TRACE_SUBSCRIPT;
+                try
+                {
+                    constTree[rec.key];
+                }
+                catch(out_of_range&)
+                {
+                }
+                break;
+            }
+            expected.push_back(rec);
+        }
+        tree.flushTrace();
+    }
+    vector<TraceRecord<int, int> > records = loadTrace<int, int>(path);
+    bool same = records.size() == expected.size();
+    for(size_t i = 0; same && i < records.size(); ++i)
+    {
+        same = records[i].op == expected[i].op && records[i].key == expected[i].key &&
+               records[i].value == expected[i].value;
+    }
+    check(same, name, "loaded records differ from the operations made");
+
+    // A torn final record is dropped; a foreign header is rejected. The
+    // header is 16 bytes, inserts take 9 and the other records 5, so this
+    // cuts into the sixth record.
+    truncate(path.c_str(), 16 + 9 + 9 + 5 + 5 + 5 + 3);
+    check(loadTrace<int, int>(path).size() == 5, name, "torn final record was not dropped");
+    bool rejected = false;
+    try
+    {
+        loadTrace<long, int>(path);
+    }
+    catch(runtime_error&)
+    {
+        rejected = true;
+    }
+    check(rejected, name, "trace with other key size was accepted");
+}
+
+/**
+* On a full device the operation whose record cannot be written throws
+* before it runs, and flushTrace reports the failure too.
+*/
+void testWriteError()
+{
+    const char* name = "trace write error";
+    if(access("/dev/full", W_OK) != 0)
+        return;
+    RecordingAVLTree<int, int> tree("/dev/full");
+    int failedKey = -1;
+    for(int i = 0; i < 1000000 && failedKey < 0; ++i)
+    {
+        try
+        {
+            tree.insert(make_pair(i, i));
+        }
+        catch(runtime_error&)
+        {
+            failedKey = i;
+        }
+    }
+    check(failedKey >= 0, name, "writes to a full device did not throw");
+    check(failedKey < 0 || tree.AVLTree<int, int>::find(failedKey) == tree.end(), name,
+          "operation ran although its record was lost");
+    bool thrown = false;
+    try
+    {
+        tree.flushTrace();
+    }
+    catch(runtime_error&)
+    {
+        thrown = true;
+    }
+    check(thrown, name, "flushTrace did not report the failed stream");
+}
+
+int main()
+{
+    TestDir dir;
+    testRoundTrip(dir);
+    testWriteError();
+    return testSummary("trace");
+}
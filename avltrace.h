@@ -0,0 +1,302 @@
+#ifndef AVLTRACE_H
+#define AVLTRACE_H
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* Binary operation trace format
+* -----------------------------
+* A trace file starts with a fixed header:
+*
+*     char     magic[8]     "AVLTRC1\0"
+*     uint32_t keySize      sizeof(Key) of the recorded tree
+*     uint32_t valueSize    sizeof(Value) of the recorded tree
+*
+* followed by packed records, one per operation:
+*
+*     uint8_t  op           one of the TraceOp codes
+*     Key      key          raw bytes of the key
+*     Value    value        raw bytes of the value (TRACE_INSERT only)
+*
+* Keys and values are written as raw bytes, so only trivially copyable
+* types can be traced, and a trace is only portable between machines with
+* the same endianness and type layout.
+*/
+
+enum TraceOp
+{
+    TRACE_INSERT = 1,
+    TRACE_REMOVE = 2,
+    TRACE_FIND = 3,
+    TRACE_SUBSCRIPT = 4
+};
+
+static const char TRACE_MAGIC[8] = { 'A', 'V', 'L', 'T', 'R', 'C', '1', '\0' };
+
+/**
+* A single decoded trace record. The value is only meaningful for inserts.
+*/
+template <typename Key, typename Value>
+struct TraceRecord
+{
+    uint8_t op;
+    Key key;
+    Value value;
+};
+
+/**
+* Appends operation records to a trace file. Records are staged in a
+* memory buffer and written out in large blocks so that recording adds
+* as little as possible to the traced operation.
+*/
+template <typename Key, typename Value>
+class TraceWriter
+{
+public:
+    explicit TraceWriter(const std::string& path);
+    ~TraceWriter();
+
+    void record(uint8_t op, const Key& key);
+    void record(uint8_t op, const Key& key, const Value& value);
+    void flush();
+
+private:
+    TraceWriter(const TraceWriter&);
+    TraceWriter& operator=(const TraceWriter&);
+
+    void append(const void* data, size_t len);
+
+    std::ofstream out_;
+    std::vector<char> buffer_;
+};
+
+/**
+* Opens the trace file and writes the header.
+*/
+template <typename Key, typename Value>
+TraceWriter<Key, Value>::TraceWriter(const std::string& path) :
+    out_(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc)
+{
+    static_assert(std::is_trivially_copyable<Key>::value, "traced keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Value>::value, "traced values must be trivially copyable");
+    if(!out_)
+        throw std::runtime_error("cannot open trace file " + path);
+
+    buffer_.reserve(1 << 16);
+    uint32_t keySize = sizeof(Key);
+    uint32_t valueSize = sizeof(Value);
+    append(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    append(&keySize, sizeof(keySize));
+    append(&valueSize, sizeof(valueSize));
+}
+
+/**
+* Flushes any buffered records before closing the file. A write error is
+* dropped here; call flush() first to see it.
+*/
+template <typename Key, typename Value>
+TraceWriter<Key, Value>::~TraceWriter()
+{
+    try
+    {
+        flush();
+    }
+    catch(std::runtime_error&)
+    {
+    }
+}
+
+/**
+* Records an operation that only carries a key (remove, find, operator[]).
+*/
+template <typename Key, typename Value>
+void TraceWriter<Key, Value>::record(uint8_t op, const Key& key)
+{
+    append(&op, sizeof(op));
+    append(&key, sizeof(Key));
+}
+
+/**
+* Records an operation that carries a key and a value (insert).
+*/
+template <typename Key, typename Value>
+void TraceWriter<Key, Value>::record(uint8_t op, const Key& key, const Value& value)
+{
+    append(&op, sizeof(op));
+    append(&key, sizeof(Key));
+    append(&value, sizeof(Value));
+}
+
+/**
+* Writes the staged records to the file. Throws std::runtime_error if the
+* write fails, for instance on a full disk; the staged records are dropped
+* either way.
+*/
+template <typename Key, typename Value>
+void TraceWriter<Key, Value>::flush()
+{
+    if(!buffer_.empty())
+    {
+        out_.write(&buffer_[0], buffer_.size());
+        buffer_.clear();
+    }
+    out_.flush();
+    if(!out_)
+        throw std::runtime_error("error writing trace file");
+}
+
+template <typename Key, typename Value>
+void TraceWriter<Key, Value>::append(const void* data, size_t len)
+{
+    if(buffer_.size() + len > buffer_.capacity())
+        flush();
+    const char* bytes = static_cast<const char*>(data);
+    buffer_.insert(buffer_.end(), bytes, bytes + len);
+}
+
+/**
+* Reads a whole trace file into memory so that it can be replayed without
+* any I/O in the timed section. Throws std::runtime_error if the file is
+* missing, has a bad header, or was recorded with different key/value sizes.
+* A truncated final record is ignored.
+*/
+template <typename Key, typename Value>
+std::vector<TraceRecord<Key, Value> > loadTrace(const std::string& path)
+{
+    static_assert(std::is_trivially_copyable<Key>::value, "traced keys must be trivially copyable");
+    static_assert(std::is_trivially_copyable<Value>::value, "traced values must be trivially copyable");
+
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if(!in)
+        throw std::runtime_error("cannot open trace file " + path);
+    std::vector<char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    const size_t headerSize = sizeof(TRACE_MAGIC) + 2 * sizeof(uint32_t);
+    if(data.size() < headerSize || std::memcmp(&data[0], TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+        throw std::runtime_error("not a trace file: " + path);
+    uint32_t keySize, valueSize;
+    std::memcpy(&keySize, &data[sizeof(TRACE_MAGIC)], sizeof(keySize));
+    std::memcpy(&valueSize, &data[sizeof(TRACE_MAGIC) + sizeof(keySize)], sizeof(valueSize));
+    if(keySize != sizeof(Key) || valueSize != sizeof(Value))
+        throw std::runtime_error("trace key/value sizes do not match: " + path);
+
+    std::vector<TraceRecord<Key, Value> > records;
+    records.reserve((data.size() - headerSize) / (1 + sizeof(Key)));
+    size_t pos = headerSize;
+    while(pos + 1 + sizeof(Key) <= data.size())
+    {
+        TraceRecord<Key, Value> rec;
+        rec.op = static_cast<uint8_t>(data[pos]);
+        std::memcpy(&rec.key, &data[pos + 1], sizeof(Key));
+        pos += 1 + sizeof(Key);
+        if(rec.op == TRACE_INSERT)
+        {
+            if(pos + sizeof(Value) > data.size())
+                break;
+            std::memcpy(&rec.value, &data[pos], sizeof(Value));
+            pos += sizeof(Value);
+        }
+        else
+        {
+            rec.value = Value();
+        }
+        if(rec.op < TRACE_INSERT || rec.op > TRACE_SUBSCRIPT)
+            throw std::runtime_error("corrupt trace record in " + path);
+        records.push_back(rec);
+    }
+    return records;
+}
+
+/**
+* An AVLTree that records every insert, remove, find and operator[] call
+* to a trace file before performing it. The trace can later be replayed
+* with the trace-replay driver. find and operator[] are not virtual in the
+* base, so lookups are only recorded when made through the
+* RecordingAVLTree itself rather than an AVLTree or BinarySearchTree
+* reference. If the trace cannot be written, the operation whose record
+* overflowed the buffer throws std::runtime_error before it runs.
+*/
+template <typename Key, typename Value>
+class RecordingAVLTree : public AVLTree<Key, Value>
+{
+public:
+    typedef typename AVLTree<Key, Value>::iterator iterator;
+
+    explicit RecordingAVLTree(const std::string& tracePath);
+
+    virtual void insert(const std::pair<const Key, Value>& new_item);
+    virtual void remove(const Key& key);
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+    void flushTrace();
+
+private:
+    // Lookups are const but still append to the trace.
+    mutable TraceWriter<Key, Value> trace_;
+};
+
+template <typename Key, typename Value>
+RecordingAVLTree<Key, Value>::RecordingAVLTree(const std::string& tracePath) :
+    trace_(tracePath)
+{
+
+}
+
+template <typename Key, typename Value>
+void RecordingAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& new_item)
+{
+    trace_.record(TRACE_INSERT, new_item.first, new_item.second);
+    AVLTree<Key, Value>::insert(new_item);
+}
+
+template <typename Key, typename Value>
+void RecordingAVLTree<Key, Value>::remove(const Key& key)
+{
+    trace_.record(TRACE_REMOVE, key);
+    AVLTree<Key, Value>::remove(key);
+}
+
+template <typename Key, typename Value>
+typename RecordingAVLTree<Key, Value>::iterator
+RecordingAVLTree<Key, Value>::find(const Key& key) const
+{
+    trace_.record(TRACE_FIND, key);
+    return AVLTree<Key, Value>::find(key);
+}
+
+template <typename Key, typename Value>
+Value& RecordingAVLTree<Key, Value>::operator[](const Key& key)
+{
+    trace_.record(TRACE_SUBSCRIPT, key);
+    return AVLTree<Key, Value>::operator[](key);
+}
+
+template <typename Key, typename Value>
+Value const & RecordingAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    trace_.record(TRACE_SUBSCRIPT, key);
+    return AVLTree<Key, Value>::operator[](key);
+}
+
+/**
+* Forces buffered trace records out to the file. Throws
+* std::runtime_error if they cannot be written.
+*/
+template <typename Key, typename Value>
+void RecordingAVLTree<Key, Value>::flushTrace()
+{
+    trace_.flush();
+}
+
+#endif
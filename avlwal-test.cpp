@@ -0,0 +1,173 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "avlwal.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for the write-ahead log: a tree recovers what was logged, a torn
+// tail is dropped, a failed operation is neither applied nor logged, and
+// a log that cannot be opened is never replaced. Build with -pthread for
+// the log's flusher thread.
+
+static map<int, int> contents(const AVLTree<int, int>& tree)
+{
+    map<int, int> result;
+    for(AVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it)
+        result[it->first] = it->second;
+    return result;
+}
+
+void testLog(TestDir& dir)
+{
+    const char* name = "DurableAVLTree";
+    string path = dir.file("log");
+    dir.file("log.wal");
+    dir.file("log.ckpt");
+    map<int, int> ref;
+    srand(9);
+    {
+        DurableAVLTree<int, int> tree(path, WAL_SYNC_ASYNC, 2, 20000);
+        for(int i = 0; i < 20000; ++i)
+        {
+            int key = rand() % 3000;
+            if(i % 3 != 0)
+            {
+                tree.insert(make_pair(key, i));
+                ref[key] = i;
+            }
+            else
+            {
+                tree.remove(key);
+                ref.erase(key);
+            }
+        }
+    }
+    {
+        DurableAVLTree<int, int> tree(path);
+        check(contents(tree.tree()) == ref && tree.tree().isBalanced(), name, "recovery after checkpoints differs");
+        tree.insert(make_pair(100000, 1));
+        ref[100000] = 1;
+    }
+
+    // A torn record at the end of the log is dropped on recovery.
+    {
+        FILE* f = fopen((path + ".wal").c_str(), "ab");
+        fwrite("torn record", 1, 11, f);
+        fclose(f);
+    }
+    {
+        DurableAVLTree<int, int> tree(path);
+        check(contents(tree.tree()) == ref, name, "torn log tail was not dropped");
+        tree.insert(make_pair(-1, -1));
+        ref[-1] = -1;
+        tree.checkpoint();
+        tree.insert(make_pair(-2, -2));
+        ref[-2] = -2;
+    }
+    {
+        DurableAVLTree<int, int> tree(path);
+        check(contents(tree.tree()) == ref, name, "recovery after an explicit checkpoint differs");
+    }
+
+    // Allocation failures inside insert and remove must leave the tree and
+    // the log agreeing: an operation that throws is neither applied nor
+    // logged.
+    int thrown = 0;
+    {
+        DurableAVLTree<int, int> tree(path, WAL_SYNC_ASYNC);
+        for(int i = 0; i < 5000; ++i)
+        {
+            int key = rand() % 3000;
+            bool insert = rand() % 3 != 0;
+            allocationsLeft() = rand() % 2;
+            try
+            {
+                if(insert)
+                    tree.insert(make_pair(key, i));
+                else
+                    tree.remove(key);
+                allocationsLeft() = -1;
+                if(insert)
+                    ref[key] = i;
+                else
+                    ref.erase(key);
+            }
+            catch(bad_alloc&)
+            {
+                allocationsLeft() = -1;
+                ++thrown;
+            }
+            if(i % 500 == 0)
+                check(contents(tree.tree()) == ref, name, "failed operation changed the tree");
+        }
+        check(contents(tree.tree()) == ref, name, "failed operation changed the tree");
+    }
+    {
+        DurableAVLTree<int, int> tree(path);
+        check(contents(tree.tree()) == ref, name, "log disagrees with the tree after failed operations");
+    }
+    check(thrown > 0, name, "no allocation failed, so the failure path went untested");
+}
+
+/**
+* A log that exists but cannot be opened must make recovery throw, not be
+* replaced by an empty one. A directory in its place fails for anyone; a
+* read-only file only for users other than root.
+*/
+void testUnopenableLog(TestDir& dir)
+{
+    const char* name = "DurableAVLTree recovery";
+    string path = dir.file("blocked");
+    string wal = dir.file("blocked.wal");
+    bool thrown = false;
+    mkdir(wal.c_str(), 0755);
+    try
+    {
+        DurableAVLTree<int, int> tree(path);
+    }
+    catch(runtime_error&)
+    {
+        thrown = true;
+    }
+    rmdir(wal.c_str());
+    check(thrown, name, "a directory in place of the log did not make recovery throw");
+
+    if(geteuid() == 0)
+        return;
+    {
+        DurableAVLTree<int, int> tree(path);
+        tree.insert(make_pair(1, 1));
+    }
+    chmod(wal.c_str(), 0444);
+    thrown = false;
+    try
+    {
+        DurableAVLTree<int, int> tree(path);
+    }
+    catch(runtime_error&)
+    {
+        thrown = true;
+    }
+    chmod(wal.c_str(), 0644);
+    check(thrown, name, "a read-only log did not make recovery throw");
+    DurableAVLTree<int, int> tree(path);
+    check(tree.tree().find(1) != tree.tree().end(), name, "recovery replaced a log it could not open");
+}
+
+int main()
+{
+    TestDir dir;
+    testLog(dir);
+    testUnopenableLog(dir);
+    return testSummary("DurableAVLTree");
+}
@@ -0,0 +1,665 @@
+#ifndef AVLWAL_H
+#define AVLWAL_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "avlimage.h"
+
+/**
+* Write-ahead log format
+* ----------------------
+* A log file starts with a fixed header:
+*
+*     char     magic[8]     "AVLWAL1\0"
+*     uint32_t keySize      sizeof(Key) of the logged tree
+*     uint32_t valueSize    sizeof(Value) of the logged tree
+*     uint64_t baseLsn      last LSN already covered by the checkpoint
+*
+* followed by one record per mutation:
+*
+*     uint64_t lsn          log sequence number, increasing by one
+*     uint8_t  op           WAL_INSERT or WAL_REMOVE
+*     Key      key          raw bytes of the key
+*     Value    value        raw bytes of the value (WAL_INSERT only)
+*     uint32_t checksum     FNV-1a of the bytes above
+*
+* A checkpoint is a tree image (see avlimage.h) of the whole tree. Taking
+* one saves the image and then atomically replaces the log with an empty
+* one whose baseLsn is the image's LSN. Recovery loads the image and
+* replays the log, stopping at the first torn or corrupt record.
+*
+* If a crash lands between those two renames, the old log is replayed over
+* the newer image. That is harmless: every record sets or erases its key
+* outright, so replaying a log over any state it has already been applied
+* to ends in the same tree.
+*/
+
+static const char WAL_MAGIC[8] = { 'A', 'V', 'L', 'W', 'A', 'L', '1', '\0' };
+
+enum WalOp
+{
+    WAL_INSERT = 1,
+    WAL_REMOVE = 2
+};
+
+/**
+* When a mutation counts as done. WAL_SYNC_GROUP returns only after the
+* record is on disk; concurrent writers share each fsync. WAL_SYNC_ASYNC
+* returns at once and the background flusher makes records durable within
+* one flush interval, or at the next sync().
+*/
+enum WalSync
+{
+    WAL_SYNC_GROUP,
+    WAL_SYNC_ASYNC
+};
+
+/**
+* An AVLTree made durable by a write-ahead log and periodic checkpoints.
+* The log lives at path + ".wal" and the checkpoint at path + ".ckpt";
+* constructing the tree recovers whatever state they hold.
+*
+* Mutations are applied in memory and appended to a log buffer under one
+* lock, so the log order is the apply order. A background thread writes
+* the buffer out and fsyncs it; every record that arrived while the
+* previous fsync was running is covered by the next one, which is what
+* keeps the write path fast. Once the log grows past checkpointBytes the
+* same thread takes a checkpoint. A checkpoint blocks writers while the
+* image is written. A failed write or fsync on the flusher thread ends
+* the process, since the log can no longer be trusted after one.
+*/
+template <typename Key, typename Value>
+class DurableAVLTree
+{
+public:
+    DurableAVLTree(const std::string& path, WalSync mode = WAL_SYNC_GROUP,
+                   unsigned flushIntervalMs = 2, uint64_t checkpointBytes = 64u << 20);
+    ~DurableAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool empty() const;
+
+    void sync();
+    void checkpoint();
+    uint64_t lastLsn() const;
+    uint64_t durableLsn() const;
+
+    const AVLTree<Key, Value>& tree() const;
+
+private:
+    DurableAVLTree(const DurableAVLTree&);
+    DurableAVLTree& operator=(const DurableAVLTree&);
+
+    static uint32_t checksum(const char* data, size_t len);
+    static size_t headerSize();
+    static void writeAll(int fd, const char* data, size_t len);
+    static void syncDirectory(const std::string& path);
+
+    void recover();
+    int createLog(uint64_t baseLsn);
+    void append(uint8_t op, const Key& key, const Value* value);
+    void unstage(size_t mark);
+    void waitDurable(uint64_t lsn);
+    void flushOnce();
+    void flushLocked();
+    void checkpointLocked();
+    void flusherMain();
+
+    std::string walPath_;
+    std::string checkpointPath_;
+    WalSync mode_;
+    std::chrono::milliseconds flushInterval_;
+    uint64_t checkpointBytes_;
+
+    // Guards the tree, the log buffer and the LSN counters.
+    mutable std::mutex lock_;
+    // Held while the log file is written, synced or replaced, so buffers
+    // reach the file in the order they were taken. Always taken before lock_.
+    std::mutex ioLock_;
+    std::condition_variable flushCv_;
+    std::condition_variable durableCv_;
+
+    AVLTree<Key, Value> tree_;
+    std::vector<char> buffer_;
+    uint64_t nextLsn_;
+    uint64_t durableLsn_;
+    uint64_t logBytes_;
+    size_t waiters_;
+    bool stop_;
+    int fd_;
+    std::thread flusher_;
+};
+
+/**
+* Recovers the tree from path and starts the flusher. Throws
+* std::runtime_error if the files cannot be opened or do not belong to a
+* tree with these key/value types.
+*/
+template <typename Key, typename Value>
+DurableAVLTree<Key, Value>::DurableAVLTree(const std::string& path, WalSync mode,
+                                           unsigned flushIntervalMs, uint64_t checkpointBytes) :
+    walPath_(path + ".wal"),
+    checkpointPath_(path + ".ckpt"),
+    mode_(mode),
+    flushInterval_(flushIntervalMs),
+    checkpointBytes_(checkpointBytes),
+    nextLsn_(0),
+    durableLsn_(0),
+    logBytes_(0),
+    waiters_(0),
+    stop_(false),
+    fd_(-1)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "logged keys and values must be trivially copyable");
+    recover();
+    flusher_ = std::thread(&DurableAVLTree<Key, Value>::flusherMain, this);
+}
+
+/**
+* Stops the flusher after it has made every logged mutation durable.
+*/
+template <typename Key, typename Value>
+DurableAVLTree<Key, Value>::~DurableAVLTree()
+{
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stop_ = true;
+    }
+    flushCv_.notify_all();
+    flusher_.join();
+    if(fd_ >= 0)
+        ::close(fd_);
+}
+
+template <typename Key, typename Value>
+size_t DurableAVLTree<Key, Value>::headerSize()
+{
+    return sizeof(WAL_MAGIC) + 2 * sizeof(uint32_t) + sizeof(uint64_t);
+}
+
+template <typename Key, typename Value>
+uint32_t DurableAVLTree<Key, Value>::checksum(const char* data, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::writeAll(int fd, const char* data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = ::write(fd, data, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            throw std::runtime_error("error writing write-ahead log");
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+/**
+* Makes a rename inside path's directory durable.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::syncDirectory(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if(fd >= 0)
+    {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+/**
+* Loads the checkpoint, if any, replays the log over it and truncates a
+* torn tail so new records follow the last good one. Only a log that does
+* not exist is started afresh; one that exists but cannot be opened, or a
+* checkpoint that cannot be checked for, throws std::runtime_error rather
+* than being taken for empty and overwritten.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::recover()
+{
+    if(::access(checkpointPath_.c_str(), F_OK) == 0)
+    {
+        MappedAVLTree<Key, Value> image(checkpointPath_);
+        tree_.buildFromSorted(image.begin(), image.size());
+    }
+    else if(errno != ENOENT)
+    {
+        throw std::runtime_error("cannot check for checkpoint " + checkpointPath_);
+    }
+
+    int fd = ::open(walPath_.c_str(), O_RDWR);
+    if(fd < 0)
+    {
+        if(errno != ENOENT)
+            throw std::runtime_error("cannot open write-ahead log " + walPath_);
+        fd_ = createLog(0);
+        return;
+    }
+
+    std::vector<char> data;
+    char block[1 << 16];
+    for(;;)
+    {
+        ssize_t n = ::read(fd, block, sizeof(block));
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("cannot read write-ahead log " + walPath_);
+        }
+        if(n == 0)
+            break;
+        data.insert(data.end(), block, block + n);
+    }
+
+    uint32_t keySize = 0;
+    uint32_t valueSize = 0;
+    uint64_t baseLsn = 0;
+    if(data.size() < headerSize() || std::memcmp(&data[0], WAL_MAGIC, sizeof(WAL_MAGIC)) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("not a write-ahead log: " + walPath_);
+    }
+    std::memcpy(&keySize, &data[8], sizeof(keySize));
+    std::memcpy(&valueSize, &data[12], sizeof(valueSize));
+    std::memcpy(&baseLsn, &data[16], sizeof(baseLsn));
+    if(keySize != sizeof(Key) || valueSize != sizeof(Value))
+    {
+        ::close(fd);
+        throw std::runtime_error("write-ahead log key/value sizes do not match: " + walPath_);
+    }
+
+    uint64_t lsn = baseLsn;
+    size_t pos = headerSize();
+    const size_t fixed = sizeof(uint64_t) + 1 + sizeof(Key);
+    while(pos + fixed + sizeof(uint32_t) <= data.size())
+    {
+        uint64_t recLsn;
+        std::memcpy(&recLsn, &data[pos], sizeof(recLsn));
+        uint8_t op = (uint8_t)data[pos + sizeof(uint64_t)];
+        size_t len = fixed + (op == WAL_INSERT ? sizeof(Value) : 0);
+        if((op != WAL_INSERT && op != WAL_REMOVE) || recLsn != lsn + 1 ||
+           pos + len + sizeof(uint32_t) > data.size())
+            break;
+        uint32_t sum;
+        std::memcpy(&sum, &data[pos + len], sizeof(sum));
+        if(sum != checksum(&data[pos], len))
+            break;
+
+        Key key;
+        std::memcpy(&key, &data[pos + sizeof(uint64_t) + 1], sizeof(Key));
+        if(op == WAL_INSERT)
+        {
+            Value value;
+            std::memcpy(&value, &data[pos + fixed], sizeof(Value));
+            tree_.insert(std::pair<const Key, Value>(key, value));
+        }
+        else
+        {
+            tree_.remove(key);
+        }
+        lsn = recLsn;
+        pos += len + sizeof(uint32_t);
+    }
+
+    if(pos != data.size() && ::ftruncate(fd, (off_t)pos) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("cannot truncate write-ahead log " + walPath_);
+    }
+    if(::lseek(fd, (off_t)pos, SEEK_SET) < 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("cannot seek write-ahead log " + walPath_);
+    }
+    fd_ = fd;
+    nextLsn_ = lsn;
+    durableLsn_ = lsn;
+    logBytes_ = pos;
+}
+
+/**
+* Writes an empty log starting after baseLsn to a temporary file, syncs
+* it, renames it over the live log and returns a descriptor positioned
+* for appending.
+*/
+template <typename Key, typename Value>
+int DurableAVLTree<Key, Value>::createLog(uint64_t baseLsn)
+{
+    std::string tmp = walPath_ + ".tmp";
+    int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        throw std::runtime_error("cannot create write-ahead log " + tmp);
+
+    char header[sizeof(WAL_MAGIC) + 2 * sizeof(uint32_t) + sizeof(uint64_t)];
+    uint32_t keySize = sizeof(Key);
+    uint32_t valueSize = sizeof(Value);
+    std::memcpy(header, WAL_MAGIC, sizeof(WAL_MAGIC));
+    std::memcpy(header + 8, &keySize, sizeof(keySize));
+    std::memcpy(header + 12, &valueSize, sizeof(valueSize));
+    std::memcpy(header + 16, &baseLsn, sizeof(baseLsn));
+    try
+    {
+        writeAll(fd, header, sizeof(header));
+    }
+    catch(...)
+    {
+        ::close(fd);
+        throw;
+    }
+    if(::fsync(fd) != 0 || ::rename(tmp.c_str(), walPath_.c_str()) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("cannot install write-ahead log " + walPath_);
+    }
+    syncDirectory(walPath_);
+    logBytes_ = sizeof(header);
+    return fd;
+}
+
+/**
+* Stages a record for the mutation about to be applied. Called with lock_
+* held; if applying the mutation then fails, unstage drops the record.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::append(uint8_t op, const Key& key, const Value* value)
+{
+    size_t start = buffer_.size();
+    size_t len = sizeof(uint64_t) + 1 + sizeof(Key) + (value != NULL ? sizeof(Value) : 0);
+    buffer_.resize(start + len + sizeof(uint32_t));
+    uint64_t lsn = ++nextLsn_;
+    char* rec = &buffer_[start];
+    std::memcpy(rec, &lsn, sizeof(lsn));
+    rec[sizeof(uint64_t)] = (char)op;
+    std::memcpy(rec + sizeof(uint64_t) + 1, &key, sizeof(Key));
+    if(value != NULL)
+        std::memcpy(rec + sizeof(uint64_t) + 1 + sizeof(Key), value, sizeof(Value));
+    uint32_t sum = checksum(rec, len);
+    std::memcpy(rec + len, &sum, sizeof(sum));
+}
+
+/**
+* Drops the record append staged last, whose first byte is at mark.
+* Called with lock_ held.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::unstage(size_t mark)
+{
+    buffer_.resize(mark);
+    --nextLsn_;
+}
+
+/**
+* Logs and applies an insert. In WAL_SYNC_GROUP mode this returns once the
+* record is durable. The record is staged first, so that running out of
+* memory for it leaves the tree untouched; if the insert itself throws,
+* the record is dropped again.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        size_t mark = buffer_.size();
+        append(WAL_INSERT, keyValuePair.first, &keyValuePair.second);
+        try
+        {
+            tree_.insert(keyValuePair);
+        }
+        catch(...)
+        {
+            unstage(mark);
+            throw;
+        }
+        lsn = nextLsn_;
+    }
+    if(mode_ == WAL_SYNC_GROUP)
+        waitDurable(lsn);
+}
+
+/**
+* Logs and applies a remove, in the same order as insert. Removing a
+* missing key logs nothing.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::remove(const Key& key)
+{
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if(tree_.find(key) == tree_.end())
+            return;
+        size_t mark = buffer_.size();
+        append(WAL_REMOVE, key, NULL);
+        try
+        {
+            tree_.remove(key);
+        }
+        catch(...)
+        {
+            unstage(mark);
+            throw;
+        }
+        lsn = nextLsn_;
+    }
+    if(mode_ == WAL_SYNC_GROUP)
+        waitDurable(lsn);
+}
+
+template <typename Key, typename Value>
+bool DurableAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    typename AVLTree<Key, Value>::iterator it = tree_.find(key);
+    if(it == tree_.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+template <typename Key, typename Value>
+bool DurableAVLTree<Key, Value>::empty() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return tree_.empty();
+}
+
+/**
+* Blocks until every mutation made so far is durable.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::sync()
+{
+    uint64_t lsn;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        lsn = nextLsn_;
+    }
+    waitDurable(lsn);
+}
+
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::waitDurable(uint64_t lsn)
+{
+    std::unique_lock<std::mutex> lock(lock_);
+    if(durableLsn_ >= lsn)
+        return;
+    ++waiters_;
+    flushCv_.notify_one();
+    while(durableLsn_ < lsn)
+        durableCv_.wait(lock);
+    --waiters_;
+}
+
+/**
+* LSN of the most recent mutation.
+*/
+template <typename Key, typename Value>
+uint64_t DurableAVLTree<Key, Value>::lastLsn() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return nextLsn_;
+}
+
+/**
+* LSN up to which every mutation is known to be on disk.
+*/
+template <typename Key, typename Value>
+uint64_t DurableAVLTree<Key, Value>::durableLsn() const
+{
+    std::lock_guard<std::mutex> lock(lock_);
+    return durableLsn_;
+}
+
+/**
+* Direct access to the in-memory tree. Only safe while no other thread is
+* mutating it.
+*/
+template <typename Key, typename Value>
+const AVLTree<Key, Value>& DurableAVLTree<Key, Value>::tree() const
+{
+    return tree_;
+}
+
+/**
+* Writes out and syncs whatever is buffered. Taking the buffer while
+* holding ioLock_ keeps file order equal to LSN order.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::flushOnce()
+{
+    std::lock_guard<std::mutex> io(ioLock_);
+    std::vector<char> pending;
+    uint64_t target;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if(buffer_.empty())
+            return;
+        pending.swap(buffer_);
+        target = nextLsn_;
+    }
+
+    writeAll(fd_, &pending[0], pending.size());
+    if(::fdatasync(fd_) != 0)
+        throw std::runtime_error("cannot sync write-ahead log " + walPath_);
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        durableLsn_ = std::max(durableLsn_, target);
+        logBytes_ += pending.size();
+        // Hand the capacity back so the next batch does not reallocate.
+        if(buffer_.empty())
+        {
+            pending.clear();
+            buffer_.swap(pending);
+        }
+    }
+    durableCv_.notify_all();
+}
+
+/**
+* Same as flushOnce() for callers already holding both locks.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::flushLocked()
+{
+    if(buffer_.empty())
+        return;
+    writeAll(fd_, &buffer_[0], buffer_.size());
+    if(::fdatasync(fd_) != 0)
+        throw std::runtime_error("cannot sync write-ahead log " + walPath_);
+    logBytes_ += buffer_.size();
+    buffer_.clear();
+    durableLsn_ = nextLsn_;
+    durableCv_.notify_all();
+}
+
+/**
+* Saves the whole tree as a checkpoint and starts a fresh log after it.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::checkpoint()
+{
+    std::lock_guard<std::mutex> io(ioLock_);
+    std::lock_guard<std::mutex> lock(lock_);
+    checkpointLocked();
+}
+
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::checkpointLocked()
+{
+    flushLocked();
+    MappedAVLTree<Key, Value>::save(tree_, checkpointPath_);
+    syncDirectory(checkpointPath_);
+    int fd = createLog(nextLsn_);
+    ::close(fd_);
+    fd_ = fd;
+}
+
+/**
+* Flushes as soon as a writer is waiting, or every flush interval when
+* nobody is, and checkpoints once the log has grown too large.
+*/
+template <typename Key, typename Value>
+void DurableAVLTree<Key, Value>::flusherMain()
+{
+    for(;;)
+    {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            flushCv_.wait_for(lock, flushInterval_, [this]()
+            {
+                return stop_ || (waiters_ > 0 && !buffer_.empty());
+            });
+            stopping = stop_;
+        }
+        flushOnce();
+
+        std::lock_guard<std::mutex> io(ioLock_);
+        std::lock_guard<std::mutex> lock(lock_);
+        if(logBytes_ > checkpointBytes_)
+            checkpointLocked();
+        if(stopping)
+        {
+            flushLocked();
+            return;
+        }
+    }
+}
+
+#endif
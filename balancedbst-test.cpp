@@ -0,0 +1,109 @@
+#include <cstdlib>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "balancedbst.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for BalancedTree and its policies: each one against std::map, and
+// AVLPolicy against AVLTree, which rebalances through the same policy.
+
+template <typename Tree>
+bool invariantsOk(const Tree& tree)
+{
+    return tree.checkInvariants();
+}
+
+/**
+* Exposes the roots of the two AVL trees so that their shapes can be
+* compared node by node.
+*/
+class PeekAVLTree : public AVLTree<int, int>
+{
+public:
+    const AVLNode<int, int>* top() const
+    {
+        return static_cast<AVLNode<int, int>*>(this->root_);
+    }
+};
+
+class PeekBalancedAVLTree : public BalancedAVLTree<int, int>
+{
+public:
+    const BalancedNode<int, int>* top() const
+    {
+        return this->root();
+    }
+};
+
+/**
+* True if both subtrees have the same keys in the same places with the
+* same balance factors.
+*/
+bool sameShape(const AVLNode<int, int>* a, const BalancedNode<int, int>* b)
+{
+    if(a == nullptr || b == nullptr)
+        return a == nullptr && b == nullptr;
+    return a->getKey() == b->getKey() && a->getRank() == b->getRank() &&
+           sameShape(a->getLeft(), b->getLeft()) && sameShape(a->getRight(), b->getRight());
+}
+
+/**
+* AVLTree and BalancedAVLTree share one rebalancer, so the same operations
+* must leave them in the same shape, with valid balance factors.
+*/
+void testSharedRebalancer()
+{
+    const char* name = "AVLPolicy";
+    PeekAVLTree avl;
+    PeekBalancedAVLTree balanced;
+    bool same = true;
+    bool valid = true;
+    srand(8);
+    for(int i = 0; i < 40000; ++i)
+    {
+        int key = rand() % 2000;
+        if(rand() % 3 != 0)
+        {
+            avl.insert(make_pair(key, i));
+            balanced.insert(make_pair(key, i));
+        }
+        else
+        {
+            avl.remove(key);
+            balanced.remove(key);
+        }
+        if(i % 1000 == 0)
+        {
+            same = same && sameShape(avl.top(), balanced.top());
+            valid = valid && AVLPolicy::check(avl.top());
+        }
+    }
+    check(same && sameShape(avl.top(), balanced.top()), name, "AVLTree and BalancedAVLTree took different shapes");
+    check(valid && AVLPolicy::check(avl.top()), name, "AVLTree balance factors wrong");
+    check(balanced.rotations() > 0, name, "rotations not counted");
+
+    // Ascending inserts are the worst case for an unbalanced tree; 1023
+    // keys must end as a perfect tree of height 10.
+    PeekBalancedAVLTree sorted;
+    for(int key = 0; key < 1023; ++key)
+        sorted.insert(make_pair(key, key));
+    check(AVLPolicy::checkHeight(sorted.top()) == 10, name, "ascending inserts left the tree too tall");
+}
+
+int main()
+{
+    BalancedAVLTree<int, int> avl;
+    stressMap("BalancedAVLTree", avl, 3, invariantsOk<BalancedAVLTree<int, int> >);
+    RedBlackTree<int, int> redBlack;
+    stressMap("RedBlackTree", redBlack, 4, invariantsOk<RedBlackTree<int, int> >);
+    WAVLTree<int, int> wavl;
+    stressMap("WAVLTree", wavl, 5, invariantsOk<WAVLTree<int, int> >);
+    Treap<int, int> treap;
+    stressMap("Treap", treap, 6, invariantsOk<Treap<int, int> >);
+    testSharedRebalancer();
+    return testSummary("BalancedTree");
+}
@@ -0,0 +1,1031 @@
+#ifndef BALANCEDBST_H
+#define BALANCEDBST_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <stdint.h>
+#include "bst.h"
+
+/**
+* A node for a BalancedTree. The meaning of rank_ belongs to the balancing
+* policy: a height for AVL, a colour for red-black, a rank for WAVL and a
+* heap priority for a treap.
+*/
+template <typename Key, typename Value>
+class BalancedNode : public Node<Key, Value>
+{
+public:
+    BalancedNode(const Key& key, const Value& value, BalancedNode<Key, Value>* parent);
+    virtual ~BalancedNode();
+
+    int getRank() const;
+    void setRank(int rank);
+
+    virtual BalancedNode<Key, Value>* getParent() const override;
+    virtual BalancedNode<Key, Value>* getLeft() const override;
+    virtual BalancedNode<Key, Value>* getRight() const override;
+
+protected:
+    int rank_;
+};
+
+template <typename Key, typename Value>
+BalancedNode<Key, Value>::BalancedNode(const Key& key, const Value& value, BalancedNode<Key, Value>* parent) :
+    Node<Key, Value>(key, value, parent),
+    rank_(0)
+{
+
+}
+
+template <typename Key, typename Value>
+BalancedNode<Key, Value>::~BalancedNode()
+{
+
+}
+
+template <typename Key, typename Value>
+int BalancedNode<Key, Value>::getRank() const
+{
+    return rank_;
+}
+
+template <typename Key, typename Value>
+void BalancedNode<Key, Value>::setRank(int rank)
+{
+    rank_ = rank;
+}
+
+template <typename Key, typename Value>
+BalancedNode<Key, Value>* BalancedNode<Key, Value>::getParent() const
+{
+    return static_cast<BalancedNode<Key, Value>*>(this->parent_);
+}
+
+template <typename Key, typename Value>
+BalancedNode<Key, Value>* BalancedNode<Key, Value>::getLeft() const
+{
+    return static_cast<BalancedNode<Key, Value>*>(this->left_);
+}
+
+template <typename Key, typename Value>
+BalancedNode<Key, Value>* BalancedNode<Key, Value>::getRight() const
+{
+    return static_cast<BalancedNode<Key, Value>*>(this->right_);
+}
+
+
+/**
+* Pointer surgery on trees with parent links, for any node type with the
+* usual getters and setters. root is the tree's root pointer, updated when
+* the root changes; it may be of a base type of NodeT.
+*/
+struct TreeLinks
+{
+    /**
+    * Points whatever pointed at from, the parent's child link or the
+    * root, at to instead.
+    */
+    template <typename RootT, typename NodeT>
+    static void replaceChild(RootT& root, NodeT* parent, NodeT* from, NodeT* to)
+    {
+        if(parent == nullptr)
+            root = to;
+        else if(parent->getLeft() == from)
+            parent->setLeft(to);
+        else
+            parent->setRight(to);
+    }
+
+    /**
+    * Moves x's right child up into x's place.
+    */
+    template <typename RootT, typename NodeT>
+    static void rotateLeft(RootT& root, NodeT* x)
+    {
+        NodeT *y = x->getRight();
+        NodeT *parent = x->getParent();
+        x->setRight(y->getLeft());
+        if(y->getLeft() != nullptr)
+            y->getLeft()->setParent(x);
+        y->setParent(parent);
+        replaceChild(root, parent, x, y);
+        y->setLeft(x);
+        x->setParent(y);
+    }
+
+    /**
+    * Moves x's left child up into x's place.
+    */
+    template <typename RootT, typename NodeT>
+    static void rotateRight(RootT& root, NodeT* x)
+    {
+        NodeT *y = x->getLeft();
+        NodeT *parent = x->getParent();
+        x->setLeft(y->getRight());
+        if(y->getRight() != nullptr)
+            y->getRight()->setParent(x);
+        y->setParent(parent);
+        replaceChild(root, parent, x, y);
+        y->setRight(x);
+        x->setParent(y);
+    }
+
+    /**
+    * Unlinks n, which has at most one child, by linking its child to its
+    * parent. Returns the child. n itself is not freed.
+    */
+    template <typename RootT, typename NodeT>
+    static NodeT* splice(RootT& root, NodeT* n)
+    {
+        NodeT *child = n->getLeft() != nullptr ? n->getLeft() : n->getRight();
+        NodeT *parent = n->getParent();
+        if(child != nullptr)
+            child->setParent(parent);
+        replaceChild(root, parent, n, child);
+        n->setParent(nullptr);
+        n->setLeft(nullptr);
+        n->setRight(nullptr);
+        return child;
+    }
+
+    /**
+    * Exchanges the positions of n, which has two children, and its
+    * predecessor, so that n has at most one child. Nodes keep their
+    * identity and contents; callers swap any per-position data. Returns
+    * the predecessor.
+    */
+    template <typename RootT, typename NodeT>
+    static NodeT* swapWithPredecessor(RootT& root, NodeT* n)
+    {
+        NodeT *p = n->getLeft();
+        while(p->getRight() != nullptr)
+            p = p->getRight();
+
+        NodeT *parent = n->getParent();
+        NodeT *left = n->getLeft();
+        NodeT *right = n->getRight();
+        NodeT *pParent = p->getParent();
+        NodeT *pLeft = p->getLeft();
+
+        p->setParent(parent);
+        replaceChild(root, parent, n, p);
+        p->setRight(right);
+        right->setParent(p);
+        if(pParent == n)
+        {
+            p->setLeft(n);
+            n->setParent(p);
+        }
+        else
+        {
+            p->setLeft(left);
+            left->setParent(p);
+            pParent->setRight(n);
+            n->setParent(pParent);
+        }
+        n->setLeft(pLeft);
+        if(pLeft != nullptr)
+            pLeft->setParent(n);
+        n->setRight(nullptr);
+        return p;
+    }
+};
+
+
+/**
+* A binary search tree whose rebalancing is supplied by Policy. The tree
+* does the searching, linking and unlinking; the policy is told about
+* every new leaf and every node about to be removed, and restores its
+* invariant with the rotation and splice primitives below. All policies
+* share BinarySearchTree's iterators and lookup API.
+*
+* A policy is a class with static members:
+*
+*     void init(NodeT* n)                   set up the rank of a new node
+*     void inserted(Tree& t, NodeT* n)      rebalance after n was linked
+*     void erase(Tree& t, NodeT* n)         unlink n (via t.splice) and
+*                                           rebalance; n is freed after
+*     bool check(const NodeT* root)         verify the policy's invariant
+*/
+template <typename Key, typename Value, typename Policy,
+          typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class BalancedTree : public BinarySearchTree<Key, Value, Alloc>
+{
+public:
+    typedef BalancedNode<Key, Value> NodeT;
+
+    explicit BalancedTree(const Alloc& alloc = Alloc());
+    virtual ~BalancedTree();
+
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    virtual void remove(const Key& key);
+
+    bool checkInvariants() const;
+    size_t rotations() const;
+
+protected:
+    friend Policy;
+
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent) override;
+    virtual void destroyNode(Node<Key, Value>* n) override;
+    virtual size_t nodeSize() const override;
+    virtual void nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2) override;
+
+    // Structural primitives for the policies.
+    NodeT* root() const;
+    void rotateLeft(NodeT* x);
+    void rotateRight(NodeT* x);
+    void rotateUp(NodeT* n);
+    void swapWithPredecessor(NodeT* n);
+    NodeT* splice(NodeT* n);
+
+    bool checkOrder(const NodeT* n, const NodeT* lo, const NodeT* hi) const;
+
+    size_t rotations_;
+};
+
+template <typename Key, typename Value, typename Policy, typename Alloc>
+BalancedTree<Key, Value, Policy, Alloc>::BalancedTree(const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Alloc>(alloc),
+    rotations_(0)
+{
+
+}
+
+/**
+* Frees the nodes here, while destroyNode still resolves to this class.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+BalancedTree<Key, Value, Policy, Alloc>::~BalancedTree()
+{
+    this->clear();
+}
+
+template <typename Key, typename Value, typename Policy, typename Alloc>
+Node<Key, Value>*
+BalancedTree<Key, Value, Policy, Alloc>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    NodeT *n = NodeTraits::allocate(alloc, 1);
+    try
+    {
+        NodeTraits::construct(alloc, n, key, value, static_cast<NodeT*>(parent));
+    }
+    catch(...)
+    {
+        NodeTraits::deallocate(alloc, n, 1);
+        throw;
+    }
+    this->nodeAdded(sizeof(NodeT));
+    return n;
+}
+
+template <typename Key, typename Value, typename Policy, typename Alloc>
+void BalancedTree<Key, Value, Policy, Alloc>::destroyNode(Node<Key, Value>* n)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    NodeT *node = static_cast<NodeT*>(n);
+    this->nodeRemoved(sizeof(NodeT));
+    NodeTraits::destroy(alloc, node);
+    NodeTraits::deallocate(alloc, node, 1);
+}
+
+template <typename Key, typename Value, typename Policy, typename Alloc>
+size_t BalancedTree<Key, Value, Policy, Alloc>::nodeSize() const
+{
+    return sizeof(NodeT);
+}
+
+/**
+* Swaps the positions of two nodes. Ranks describe positions, not keys,
+* so they are swapped back.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+void BalancedTree<Key, Value, Policy, Alloc>::nodeSwap(Node<Key, Value>* n1, Node<Key, Value>* n2)
+{
+    BinarySearchTree<Key, Value, Alloc>::nodeSwap(n1, n2);
+    NodeT *a = static_cast<NodeT*>(n1);
+    NodeT *b = static_cast<NodeT*>(n2);
+    int rank = a->getRank();
+    a->setRank(b->getRank());
+    b->setRank(rank);
+}
+
+/**
+* Inserts a new leaf and lets the policy rebalance, or overwrites the
+* value if the key is already present.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+void BalancedTree<Key, Value, Policy, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    NodeT *curr = root();
+    NodeT *parent = nullptr;
+    bool left = false;
+    while(curr != nullptr)
+    {
+        parent = curr;
+        if(keyValuePair.first < curr->getKey())
+        {
+            curr = curr->getLeft();
+            left = true;
+        }
+        else if(curr->getKey() < keyValuePair.first)
+        {
+            curr = curr->getRight();
+            left = false;
+        }
+        else
+        {
+            curr->setValue(keyValuePair.second);
+            return;
+        }
+    }
+
+    NodeT *n = static_cast<NodeT*>(createNode(keyValuePair.first, keyValuePair.second, parent));
+    Policy::init(n);
+    if(parent == nullptr)
+        this->root_ = n;
+    else if(left)
+        parent->setLeft(n);
+    else
+        parent->setRight(n);
+    Policy::inserted(*this, n);
+}
+
+template <typename Key, typename Value, typename Policy, typename Alloc>
+void BalancedTree<Key, Value, Policy, Alloc>::remove(const Key& key)
+{
+    NodeT *n = static_cast<NodeT*>(this->internalFind(key));
+    if(n == nullptr)
+        return;
+    Policy::erase(*this, n);
+    destroyNode(n);
+}
+
+/**
+* Checks search order, parent links and the policy's balance invariant.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+bool BalancedTree<Key, Value, Policy, Alloc>::checkInvariants() const
+{
+    if(root() != nullptr && root()->getParent() != nullptr)
+        return false;
+    return checkOrder(root(), nullptr, nullptr) && Policy::check(root());
+}
+
+template <typename Key, typename Value, typename Policy, typename Alloc>
+bool BalancedTree<Key, Value, Policy, Alloc>::checkOrder(const NodeT* n, const NodeT* lo, const NodeT* hi) const
+{
+    if(n == nullptr)
+        return true;
+    if((lo != nullptr && !(lo->getKey() < n->getKey())) || (hi != nullptr && !(n->getKey() < hi->getKey())))
+        return false;
+    if((n->getLeft() != nullptr && n->getLeft()->getParent() != n) ||
+       (n->getRight() != nullptr && n->getRight()->getParent() != n))
+        return false;
+    return checkOrder(n->getLeft(), lo, n) && checkOrder(n->getRight(), n, hi);
+}
+
+/**
+* Number of rotations performed so far, for comparing policies.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+size_t BalancedTree<Key, Value, Policy, Alloc>::rotations() const
+{
+    return rotations_;
+}
+
+template <typename Key, typename Value, typename Policy, typename Alloc>
+typename BalancedTree<Key, Value, Policy, Alloc>::NodeT*
+BalancedTree<Key, Value, Policy, Alloc>::root() const
+{
+    return static_cast<NodeT*>(this->root_);
+}
+
+/**
+* Moves x's right child up into x's place.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+void BalancedTree<Key, Value, Policy, Alloc>::rotateLeft(NodeT* x)
+{
+    TreeLinks::rotateLeft(this->root_, x);
+    ++rotations_;
+}
+
+/**
+* Moves x's left child up into x's place.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+void BalancedTree<Key, Value, Policy, Alloc>::rotateRight(NodeT* x)
+{
+    TreeLinks::rotateRight(this->root_, x);
+    ++rotations_;
+}
+
+/**
+* Rotates n above its parent.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+void BalancedTree<Key, Value, Policy, Alloc>::rotateUp(NodeT* n)
+{
+    NodeT *parent = n->getParent();
+    if(parent->getLeft() == n)
+        rotateRight(parent);
+    else
+        rotateLeft(parent);
+}
+
+/**
+* Moves a node with two children to its predecessor's position, so that
+* it has at most one child and can be spliced out.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+void BalancedTree<Key, Value, Policy, Alloc>::swapWithPredecessor(NodeT* n)
+{
+    nodeSwap(n, this->predecessor(n));
+}
+
+/**
+* Unlinks n, which has at most one child, by linking its child to its
+* parent. Returns the child. n itself is not freed.
+*/
+template <typename Key, typename Value, typename Policy, typename Alloc>
+typename BalancedTree<Key, Value, Policy, Alloc>::NodeT*
+BalancedTree<Key, Value, Policy, Alloc>::splice(NodeT* n)
+{
+    return TreeLinks::splice(this->root_, n);
+}
+
+
+/**
+* Height-balanced (AVL) policy. rank is the balance factor, the height of
+* the right subtree minus that of the left, kept within -1..1. AVLTree's
+* nodes keep the same factor, so AVLTree and AVLSet rebalance through this
+* policy too. Inserts rotate at most twice; removals may rotate at every
+* level.
+*/
+struct AVLPolicy
+{
+    template <typename NodeT>
+    static void init(NodeT* n)
+    {
+        n->setRank(0);
+    }
+
+    /**
+    * Rotates n, whose balance has reached 2 or -2, back into balance and
+    * returns the new root of its subtree. That root has balance 0 exactly
+    * when the rotation made the subtree one shorter.
+    */
+    template <typename Tree, typename NodeT>
+    static NodeT* rotate(Tree& t, NodeT* n)
+    {
+        if(n->getRank() > 0)
+        {
+            NodeT *c = n->getRight();
+            if(c->getRank() >= 0)
+            {
+                t.rotateLeft(n);
+                int b = c->getRank() == 0 ? 1 : 0;
+                n->setRank(b);
+                c->setRank(-b);
+                return c;
+            }
+            NodeT *g = c->getLeft();
+            t.rotateRight(c);
+            t.rotateLeft(n);
+            n->setRank(g->getRank() > 0 ? -1 : 0);
+            c->setRank(g->getRank() < 0 ? 1 : 0);
+            g->setRank(0);
+            return g;
+        }
+        NodeT *c = n->getLeft();
+        if(c->getRank() <= 0)
+        {
+            t.rotateRight(n);
+            int b = c->getRank() == 0 ? -1 : 0;
+            n->setRank(b);
+            c->setRank(-b);
+            return c;
+        }
+        NodeT *g = c->getRight();
+        t.rotateLeft(c);
+        t.rotateRight(n);
+        n->setRank(g->getRank() < 0 ? 1 : 0);
+        c->setRank(g->getRank() > 0 ? -1 : 0);
+        g->setRank(0);
+        return g;
+    }
+
+    /**
+    * Walks up from the new leaf n until a subtree keeps its old height.
+    */
+    template <typename Tree, typename NodeT>
+    static void inserted(Tree& t, NodeT* n)
+    {
+        NodeT *child = n;
+        NodeT *p = n->getParent();
+        while(p != nullptr)
+        {
+            int b = p->getRank() + (p->getLeft() == child ? -1 : 1);
+            p->setRank(b);
+            if(b == 0)
+                return;
+            if(b == 2 || b == -2)
+            {
+                rotate(t, p);
+                return;
+            }
+            child = p;
+            p = p->getParent();
+        }
+    }
+
+    /**
+    * Walks up from p, whose left (if left is set) or right subtree has
+    * just become one shorter, until a subtree keeps its old height.
+    */
+    template <typename Tree, typename NodeT>
+    static void removed(Tree& t, NodeT* p, bool left)
+    {
+        while(p != nullptr)
+        {
+            int b = p->getRank() + (left ? 1 : -1);
+            p->setRank(b);
+            if(b == 1 || b == -1)
+                return;
+            if(b == 2 || b == -2)
+            {
+                p = rotate(t, p);
+                if(p->getRank() != 0)
+                    return;
+            }
+            NodeT *parent = p->getParent();
+            left = parent != nullptr && parent->getLeft() == p;
+            p = parent;
+        }
+    }
+
+    template <typename Tree, typename NodeT>
+    static void erase(Tree& t, NodeT* n)
+    {
+        if(n->getLeft() != nullptr && n->getRight() != nullptr)
+            t.swapWithPredecessor(n);
+        NodeT *parent = n->getParent();
+        bool left = parent != nullptr && parent->getLeft() == n;
+        t.splice(n);
+        removed(t, parent, left);
+    }
+
+    /**
+    * Returns the height of n's subtree, or -1 if a balance factor in it is
+    * out of range or does not match the heights.
+    */
+    template <typename NodeT>
+    static int checkHeight(const NodeT* n)
+    {
+        if(n == nullptr)
+            return 0;
+        int l = checkHeight(n->getLeft());
+        int r = checkHeight(n->getRight());
+        if(l < 0 || r < 0 || l - r > 1 || r - l > 1 || n->getRank() != r - l)
+            return -1;
+        return 1 + std::max(l, r);
+    }
+
+    template <typename NodeT>
+    static bool check(const NodeT* root)
+    {
+        return checkHeight(root) >= 0;
+    }
+};
+
+/**
+* Red-black policy. rank is the colour. At most two rotations per insert
+* and three per removal, at the price of a tree up to twice as tall as
+* the ideal instead of AVL's 1.44.
+*/
+struct RedBlackPolicy
+{
+    enum { RED = 0, BLACK = 1 };
+
+    template <typename NodeT>
+    static bool isRed(const NodeT* n)
+    {
+        return n != nullptr && n->getRank() == RED;
+    }
+
+    template <typename NodeT>
+    static void init(NodeT* n)
+    {
+        n->setRank(RED);
+    }
+
+    template <typename Tree, typename NodeT>
+    static void inserted(Tree& t, NodeT* z)
+    {
+        while(isRed(z->getParent()))
+        {
+            NodeT *p = z->getParent();
+            NodeT *g = p->getParent();
+            if(p == g->getLeft())
+            {
+                NodeT *u = g->getRight();
+                if(isRed(u))
+                {
+                    p->setRank(BLACK);
+                    u->setRank(BLACK);
+                    g->setRank(RED);
+                    z = g;
+                    continue;
+                }
+                if(z == p->getRight())
+                {
+                    t.rotateLeft(p);
+                    z = p;
+                    p = z->getParent();
+                }
+                p->setRank(BLACK);
+                g->setRank(RED);
+                t.rotateRight(g);
+            }
+            else
+            {
+                NodeT *u = g->getLeft();
+                if(isRed(u))
+                {
+                    p->setRank(BLACK);
+                    u->setRank(BLACK);
+                    g->setRank(RED);
+                    z = g;
+                    continue;
+                }
+                if(z == p->getLeft())
+                {
+                    t.rotateRight(p);
+                    z = p;
+                    p = z->getParent();
+                }
+                p->setRank(BLACK);
+                g->setRank(RED);
+                t.rotateLeft(g);
+            }
+        }
+        t.root()->setRank(BLACK);
+    }
+
+    template <typename Tree, typename NodeT>
+    static void erase(Tree& t, NodeT* z)
+    {
+        if(z->getLeft() != nullptr && z->getRight() != nullptr)
+            t.swapWithPredecessor(z);
+        NodeT *parent = z->getParent();
+        bool black = z->getRank() == BLACK;
+        NodeT *x = t.splice(z);
+        if(black)
+            eraseFix(t, x, parent);
+    }
+
+    /**
+    * x, possibly null, carries an extra black after its black parent's
+    * child was removed. Standard fix-up, tracking the parent explicitly
+    * since x may be null.
+    */
+    template <typename Tree, typename NodeT>
+    static void eraseFix(Tree& t, NodeT* x, NodeT* parent)
+    {
+        while(x != t.root() && !isRed(x))
+        {
+            if(x == parent->getLeft())
+            {
+                NodeT *w = parent->getRight();
+                if(isRed(w))
+                {
+                    w->setRank(BLACK);
+                    parent->setRank(RED);
+                    t.rotateLeft(parent);
+                    w = parent->getRight();
+                }
+                if(!isRed(w->getLeft()) && !isRed(w->getRight()))
+                {
+                    w->setRank(RED);
+                    x = parent;
+                    parent = x->getParent();
+                    continue;
+                }
+                if(!isRed(w->getRight()))
+                {
+                    w->getLeft()->setRank(BLACK);
+                    w->setRank(RED);
+                    t.rotateRight(w);
+                    w = parent->getRight();
+                }
+                w->setRank(parent->getRank());
+                parent->setRank(BLACK);
+                w->getRight()->setRank(BLACK);
+                t.rotateLeft(parent);
+                x = t.root();
+            }
+            else
+            {
+                NodeT *w = parent->getLeft();
+                if(isRed(w))
+                {
+                    w->setRank(BLACK);
+                    parent->setRank(RED);
+                    t.rotateRight(parent);
+                    w = parent->getLeft();
+                }
+                if(!isRed(w->getLeft()) && !isRed(w->getRight()))
+                {
+                    w->setRank(RED);
+                    x = parent;
+                    parent = x->getParent();
+                    continue;
+                }
+                if(!isRed(w->getLeft()))
+                {
+                    w->getRight()->setRank(BLACK);
+                    w->setRank(RED);
+                    t.rotateLeft(w);
+                    w = parent->getLeft();
+                }
+                w->setRank(parent->getRank());
+                parent->setRank(BLACK);
+                w->getLeft()->setRank(BLACK);
+                t.rotateRight(parent);
+                x = t.root();
+            }
+        }
+        if(x != nullptr)
+            x->setRank(BLACK);
+    }
+
+    template <typename NodeT>
+    static int blackHeight(const NodeT* n)
+    {
+        if(n == nullptr)
+            return 1;
+        if(isRed(n) && (isRed(n->getLeft()) || isRed(n->getRight())))
+            return -1;
+        int l = blackHeight(n->getLeft());
+        int r = blackHeight(n->getRight());
+        if(l < 0 || l != r)
+            return -1;
+        return l + (isRed(n) ? 0 : 1);
+    }
+
+    template <typename NodeT>
+    static bool check(const NodeT* root)
+    {
+        return !isRed(root) && blackHeight(root) >= 0;
+    }
+};
+
+/**
+* Weak AVL (rank-balanced) policy. Every rank difference between parent
+* and child is 1 or 2, missing children have rank -1 and leaves rank 0.
+* Without removals the tree is exactly an AVL tree; removals do at most
+* two rotations, like red-black, while the height stays within AVL's
+* bound for insert-only histories.
+*/
+struct WAVLPolicy
+{
+    template <typename NodeT>
+    static int rank(const NodeT* n)
+    {
+        return n == nullptr ? -1 : n->getRank();
+    }
+
+    template <typename NodeT>
+    static void shift(NodeT* n, int by)
+    {
+        n->setRank(n->getRank() + by);
+    }
+
+    template <typename NodeT>
+    static void init(NodeT* n)
+    {
+        n->setRank(0);
+    }
+
+    template <typename Tree, typename NodeT>
+    static void inserted(Tree& t, NodeT* x)
+    {
+        NodeT *p = x->getParent();
+        while(p != nullptr && rank(p) == rank(x))
+        {
+            bool xLeft = p->getLeft() == x;
+            NodeT *s = xLeft ? p->getRight() : p->getLeft();
+            if(rank(p) - rank(s) == 1)
+            {
+                shift(p, 1);
+                x = p;
+                p = p->getParent();
+                continue;
+            }
+
+            // p is a 0,2 node: one or two rotations finish the job.
+            NodeT *inner = xLeft ? x->getRight() : x->getLeft();
+            if(rank(x) - rank(inner) == 2)
+            {
+                if(xLeft)
+                    t.rotateRight(p);
+                else
+                    t.rotateLeft(p);
+                shift(p, -1);
+            }
+            else
+            {
+                if(xLeft)
+                {
+                    t.rotateLeft(x);
+                    t.rotateRight(p);
+                }
+                else
+                {
+                    t.rotateRight(x);
+                    t.rotateLeft(p);
+                }
+                shift(inner, 1);
+                shift(x, -1);
+                shift(p, -1);
+            }
+            return;
+        }
+    }
+
+    template <typename Tree, typename NodeT>
+    static void erase(Tree& t, NodeT* n)
+    {
+        if(n->getLeft() != nullptr && n->getRight() != nullptr)
+            t.swapWithPredecessor(n);
+        NodeT *p = n->getParent();
+        NodeT *x = t.splice(n);
+        if(p == nullptr)
+            return;
+
+        // x is null whenever p is left without children; remember its side.
+        bool xLeft = p->getLeft() == x && (x != nullptr || p->getRight() != nullptr);
+        if(p->getLeft() == nullptr && p->getRight() == nullptr && rank(p) == 1)
+        {
+            // A 2,2 leaf is not allowed.
+            shift(p, -1);
+            x = p;
+            p = p->getParent();
+            if(p != nullptr)
+                xLeft = p->getLeft() == x;
+        }
+
+        while(p != nullptr && rank(p) - rank(x) == 3)
+        {
+            NodeT *s = xLeft ? p->getRight() : p->getLeft();
+            if(rank(p) - rank(s) == 2)
+            {
+                shift(p, -1);
+            }
+            else
+            {
+                NodeT *near = xLeft ? s->getLeft() : s->getRight();
+                NodeT *far = xLeft ? s->getRight() : s->getLeft();
+                if(rank(s) - rank(near) == 2 && rank(s) - rank(far) == 2)
+                {
+                    shift(p, -1);
+                    shift(s, -1);
+                }
+                else if(rank(s) - rank(far) == 1)
+                {
+                    if(xLeft)
+                        t.rotateLeft(p);
+                    else
+                        t.rotateRight(p);
+                    shift(s, 1);
+                    shift(p, -1);
+                    if(p->getLeft() == nullptr && p->getRight() == nullptr)
+                        shift(p, -1);
+                    return;
+                }
+                else
+                {
+                    if(xLeft)
+                    {
+                        t.rotateRight(s);
+                        t.rotateLeft(p);
+                    }
+                    else
+                    {
+                        t.rotateLeft(s);
+                        t.rotateRight(p);
+                    }
+                    shift(near, 2);
+                    shift(s, -1);
+                    shift(p, -2);
+                    return;
+                }
+            }
+            x = p;
+            p = p->getParent();
+            if(p != nullptr)
+                xLeft = p->getLeft() == x;
+        }
+    }
+
+    template <typename NodeT>
+    static bool checkRanks(const NodeT* n)
+    {
+        if(n == nullptr)
+            return true;
+        int dl = rank(n) - rank(n->getLeft());
+        int dr = rank(n) - rank(n->getRight());
+        if(dl < 1 || dl > 2 || dr < 1 || dr > 2)
+            return false;
+        if(n->getLeft() == nullptr && n->getRight() == nullptr && rank(n) != 0)
+            return false;
+        return checkRanks(n->getLeft()) && checkRanks(n->getRight());
+    }
+
+    template <typename NodeT>
+    static bool check(const NodeT* root)
+    {
+        return checkRanks(root);
+    }
+};
+
+/**
+* Treap policy. rank is a random heap priority; the tree is the one a
+* sequence of inserts in priority order would build, so its shape is
+* random and O(log n) deep in expectation whatever the input order.
+* Updates do fewer than two rotations on average.
+*/
+struct TreapPolicy
+{
+    static int nextPriority()
+    {
+        static thread_local uint32_t state = 2463534242u;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (int)(state >> 1);
+    }
+
+    template <typename NodeT>
+    static void init(NodeT* n)
+    {
+        n->setRank(nextPriority());
+    }
+
+    template <typename Tree, typename NodeT>
+    static void inserted(Tree& t, NodeT* n)
+    {
+        while(n->getParent() != nullptr && n->getParent()->getRank() < n->getRank())
+            t.rotateUp(n);
+    }
+
+    /**
+    * Rotates n down below its higher-priority child until it has at most
+    * one child, then splices it out.
+    */
+    template <typename Tree, typename NodeT>
+    static void erase(Tree& t, NodeT* n)
+    {
+        while(n->getLeft() != nullptr && n->getRight() != nullptr)
+        {
+            if(n->getLeft()->getRank() > n->getRight()->getRank())
+                t.rotateUp(n->getLeft());
+            else
+                t.rotateUp(n->getRight());
+        }
+        t.splice(n);
+    }
+
+    template <typename NodeT>
+    static bool check(const NodeT* n)
+    {
+        if(n == nullptr)
+            return true;
+        if((n->getLeft() != nullptr && n->getLeft()->getRank() > n->getRank()) ||
+           (n->getRight() != nullptr && n->getRight()->getRank() > n->getRank()))
+            return false;
+        return check(n->getLeft()) && check(n->getRight());
+    }
+};
+
+template <typename Key, typename Value>
+using BalancedAVLTree = BalancedTree<Key, Value, AVLPolicy>;
+
+template <typename Key, typename Value>
+using RedBlackTree = BalancedTree<Key, Value, RedBlackPolicy>;
+
+template <typename Key, typename Value>
+using WAVLTree = BalancedTree<Key, Value, WAVLPolicy>;
+
+template <typename Key, typename Value>
+using Treap = BalancedTree<Key, Value, TreapPolicy>;
+
+#endif
@@ -2,9 +2,15 @@
 #define BST_H
 
 #include <iostream>
+#include <memory>
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#endif
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <vector>
+#include "treememory.h"
 
 /**
  * A templated class for a Node in a search tree.
@@ -177,12 +183,18 @@ void Node<Key, Value>::setValue(const Value& value)
 
 /**
 * A templated unbalanced binary search tree.
+*
+* Nodes are obtained from Alloc through std::allocator_traits, rebound to
+* the node type the tree actually uses, so any standard-conforming
+* allocator (including std::pmr::polymorphic_allocator) can back a tree.
 */
-template <typename Key, typename Value>
-class BinarySearchTree
+template<typename Key, typename Value, typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class BinarySearchTree : public TrackedTree
 {
 public:
-    BinarySearchTree(); 
+    typedef Alloc allocator_type;
+
+    explicit BinarySearchTree(const Alloc& alloc = Alloc()); 
     virtual ~BinarySearchTree(); 
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); 
     virtual void remove(const Key& key); 
@@ -190,9 +202,11 @@ public:
     bool isBalanced() const; 
     void print() const;
     bool empty() const;
+    allocator_type get_allocator() const;
+    virtual TreeMemoryUsage memory_usage() const override;
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPAlloc>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPAlloc> & tree);
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
@@ -211,7 +225,7 @@ public:
         iterator& operator++();
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
+        friend class BinarySearchTree<Key, Value, Alloc>;
         iterator(Node<Key,Value>* ptr);
         Node<Key, Value> *current_;
     };
@@ -220,16 +234,37 @@ public:
     iterator begin() const;
     iterator end() const;
     iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    iterator find_from(iterator finger, const Key& key) const;
+    iterator lower_bound_from(iterator finger, const Key& key) const;
+    void find_many(const Key* keys, size_t count, iterator* out) const;
+    void find_many(const std::vector<Key>& keys, std::vector<iterator>& out) const;
+    size_t export_range(const Key& lo, const Key& hi, Key* keyOut, Value* valueOut, size_t capacity) const;
+    size_t export_range(iterator& from, const Key& hi, Key* keyOut, Value* valueOut, size_t capacity) const;
+    void chunk_bounds(size_t chunks, std::vector<iterator>& bounds) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
 protected:
     //helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; 
+    // Point lookup behind find, operator[] and remove; trees that keep a
+    // side index override it.
+    virtual Node<Key, Value>* internalFind(const Key& k) const; 
+    Node<Key, Value>* fingerClimb(Node<Key, Value>* finger, const Key& k, Node<Key, Value>*& bound) const;
+    Node<Key, Value>* fingerFind(Node<Key, Value>* finger, const Key& k) const;
+    void groupFind(const Key* keys, size_t count, iterator* out) const;
+    void collectBounds(Node<Key, Value>* curr, size_t depth, std::vector<iterator>& bounds) const;
     Node<Key, Value> *getSmallestNode() const;  
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); 
+    static Node<Key, Value>* successor(Node<Key, Value>* current);
    
 
+    // Node allocation; trees with their own node type override both.
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent);
+    virtual void destroyNode(Node<Key, Value>* n);
+    virtual size_t nodeSize() const;
+
     // Provided helper functions
     virtual void printRoot (Node<Key, Value> *r) const;
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
@@ -241,7 +276,11 @@ protected:
     void removeHelp(Node<Key, Value>* curr);
 
 protected:
+    // Number of lookups find_many walks in lockstep.
+    static const size_t FIND_GROUP = 8;
+
     Node<Key, Value>* root_;
+    Alloc alloc_;
     
 };
 
@@ -250,8 +289,8 @@ protected:
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Alloc>
+BinarySearchTree<Key, Value, Alloc>::iterator::iterator(Node<Key,Value> *ptr)
 {
     
     current_ = ptr;
@@ -260,8 +299,8 @@ BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Alloc>
+BinarySearchTree<Key, Value, Alloc>::iterator::iterator() 
 {
     
     current_ = NULL;
@@ -270,9 +309,9 @@ BinarySearchTree<Key, Value>::iterator::iterator()
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Alloc>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -280,9 +319,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Alloc>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -291,10 +330,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Alloc>::iterator& rhs) const
 {
     
     // if(rhs->second == NULL || this->current_ == NULL)
@@ -311,10 +350,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Alloc>::iterator& rhs) const
 {
     
     // if(rhs->second == NULL)
@@ -330,9 +369,9 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator&
+BinarySearchTree<Key, Value, Alloc>::iterator::operator++()
 {
 
 
@@ -376,31 +415,109 @@ BinarySearchTree<Key, Value>::iterator::operator++()
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Alloc>
+BinarySearchTree<Key, Value, Alloc>::BinarySearchTree(const Alloc& alloc) :
+    alloc_(alloc)
 {
     
     root_ = NULL;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+template<typename Key, typename Value, typename Alloc>
+BinarySearchTree<Key, Value, Alloc>::~BinarySearchTree()
 {
     
     clear();
 }
 
+/**
+* Returns a copy of the allocator the tree was constructed with.
+*/
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::allocator_type
+BinarySearchTree<Key, Value, Alloc>::get_allocator() const
+{
+    return alloc_;
+}
+
+/**
+* Reports the memory the tree is responsible for. Walks every entry, so it
+* is linear in the size of the tree; keys and values contribute through
+* OwnedBytes and the per-node allocator cost through AllocatorOverhead.
+*/
+template<class Key, class Value, class Alloc>
+TreeMemoryUsage BinarySearchTree<Key, Value, Alloc>::memory_usage() const
+{
+    TreeMemoryUsage usage;
+    for(iterator it = begin(); it != end(); ++it)
+    {
+        ++usage.nodes;
+        usage.ownedBytes += OwnedBytes<Key>::bytes(it->first) + OwnedBytes<Value>::bytes(it->second);
+    }
+    size_t node = nodeSize();
+    usage.nodeBytes = usage.nodes * node;
+    usage.allocatorOverhead = usage.nodes * AllocatorOverhead<Alloc>::perAllocation(node);
+    return usage;
+}
+
+/**
+* Size of the node type createNode allocates.
+*/
+template<class Key, class Value, class Alloc>
+size_t BinarySearchTree<Key, Value, Alloc>::nodeSize() const
+{
+    return sizeof(Node<Key, Value>);
+}
+
+/**
+* Allocates and constructs a plain Node through the tree's allocator.
+*/
+template<class Key, class Value, class Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Alloc>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Node<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(alloc_);
+    Node<Key, Value> *n = NodeTraits::allocate(alloc, 1);
+    try
+    {
+        NodeTraits::construct(alloc, n, key, value, parent);
+    }
+    catch(...)
+    {
+        NodeTraits::deallocate(alloc, n, 1);
+        throw;
+    }
+    this->nodeAdded(sizeof(Node<Key, Value>));
+    return n;
+}
+
+/**
+* Destroys and frees a node made by createNode.
+*/
+template<class Key, class Value, class Alloc>
+void BinarySearchTree<Key, Value, Alloc>::destroyNode(Node<Key, Value>* n)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Node<Key, Value> > NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(alloc_);
+    this->nodeRemoved(sizeof(Node<Key, Value>));
+    NodeTraits::destroy(alloc, n);
+    NodeTraits::deallocate(alloc, n, 1);
+}
+
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Alloc>
+bool BinarySearchTree<Key, Value, Alloc>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -409,22 +526,22 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Alloc>::iterator begin(getSmallestNode());
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Alloc>::iterator end(NULL);
     return end;
 }
 
@@ -432,28 +549,79 @@ BinarySearchTree<Key, Value>::end() const
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Alloc>::iterator it(curr);
+    return it;
+}
+
+/**
+* Returns an iterator to the item with the smallest key that is not less
+* than k, or the end iterator if every key is less than k
+*/
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::lower_bound(const Key & k) const
+{
+    Node<Key, Value> *curr = root_;
+    Node<Key, Value> *best = NULL;
+    while(curr != nullptr)
+    {
+        if(curr->getKey() < k)
+        {
+            curr = curr->getRight();
+        }
+        else
+        {
+            best = curr;
+            curr = curr->getLeft();
+        }
+    }
+    BinarySearchTree<Key, Value, Alloc>::iterator it(best);
     return it;
 }
 
+/**
+* Returns an iterator to the item with the smallest key greater than k, or
+* the end iterator if no key is greater than k
+*/
+template<class Key, class Value, class Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::upper_bound(const Key & k) const
+{
+    Node<Key, Value> *curr = root_;
+    Node<Key, Value> *best = NULL;
+    while(curr != nullptr)
+    {
+        if(k < curr->getKey())
+        {
+            best = curr;
+            curr = curr->getLeft();
+        }
+        else
+        {
+            curr = curr->getRight();
+        }
+    }
+    return iterator(best);
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Alloc>
+Value& BinarySearchTree<Key, Value, Alloc>::operator[](const Key& key)
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Alloc>
+Value const & BinarySearchTree<Key, Value, Alloc>::operator[](const Key& key) const
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
@@ -466,11 +634,11 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 * Recall: If key is already in the tree, you should 
 * overwrite the current value with the updated value.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Alloc>
+void BinarySearchTree<Key, Value, Alloc>::insert(const std::pair<const Key, Value> &keyValuePair)
 {
     
-    Node<Key, Value> *key = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
+    Node<Key, Value> *key = createNode(keyValuePair.first, keyValuePair.second, nullptr);
     Node<Key, Value> *curr = root_;
     Node<Key, Value> *prev = nullptr;
     if(root_ == NULL)
@@ -499,7 +667,7 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
             }
             else{
                 curr->setValue(key->getValue());
-                delete key;
+                destroyNode(key);
                 return;
             }
             
@@ -528,18 +696,17 @@ void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &key
 /**
 * A remove method to remove a specific key from a Binary Search Tree.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::remove(const Key& key)
 {
     
     //no children
     Node<Key, Value> *curr = internalFind(key);
     removeHelp(curr);
-    this->printRoot(this->root_); 
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::removeHelp(Node<Key, Value>* curr)
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::removeHelp(Node<Key, Value>* curr)
 {
  if(curr != NULL){
         if(curr->getRight() == nullptr && curr->getLeft() == nullptr)
@@ -558,7 +725,7 @@ void BinarySearchTree<Key, Value>::removeHelp(Node<Key, Value>* curr)
             else{
                 root_ = nullptr;
             }
-            delete curr;
+            destroyNode(curr);
         }
         else if(curr->getRight() != nullptr && curr->getLeft() == nullptr)
         {
@@ -578,7 +745,7 @@ void BinarySearchTree<Key, Value>::removeHelp(Node<Key, Value>* curr)
                 root_ = child;
             }
             child->setParent(parent);
-            delete curr;
+            destroyNode(curr);
         }
         else if(curr->getRight() == nullptr && curr->getLeft() != nullptr)
         {
@@ -598,7 +765,7 @@ void BinarySearchTree<Key, Value>::removeHelp(Node<Key, Value>* curr)
                 root_ = child;
             }
             child->setParent(parent);
-            delete curr;
+            destroyNode(curr);
         }
         else{
             Node<Key, Value> *pred = this->predecessor(curr);
@@ -610,9 +777,9 @@ void BinarySearchTree<Key, Value>::removeHelp(Node<Key, Value>* curr)
 
 
 
-template<class Key, class Value>
+template<class Key, class Value, class Alloc>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Alloc>::predecessor(Node<Key, Value>* current)
 {
     
     if(current->getLeft() != nullptr)
@@ -646,33 +813,54 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 }
 
 
+/**
+* Returns the node with the next larger key, or NULL if current holds
+* the largest key.
+*/
+template<class Key, class Value, class Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Alloc>::successor(Node<Key, Value>* current)
+{
+    if(current->getRight() != nullptr)
+    {
+        Node<Key, Value> *curr = current->getRight();
+        while(curr->getLeft() != nullptr)
+            curr = curr->getLeft();
+        return curr;
+    }
+    Node<Key, Value> *curr = current;
+    while(curr->getParent() != nullptr && curr->getParent()->getRight() == curr)
+        curr = curr->getParent();
+    return curr->getParent();
+}
+
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::clear()
 {
     
     clearHelp(root_);
     root_ = nullptr;
 }
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelp(Node<Key, Value>* curr)
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::clearHelp(Node<Key, Value>* curr)
 {
     if(curr == nullptr)
         return;
     clearHelp(curr->getRight());
     clearHelp(curr->getLeft());
     //remove(curr->getKey());
-    delete curr;
+    destroyNode(curr);
 }
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Alloc>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Alloc>::getSmallestNode() const
 {
     
     if(root_ == NULL)
@@ -700,8 +888,8 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc>::internalFind(const Key& key) const
 {
     
     Node<Key, Value> *curr = root_;
@@ -728,18 +916,302 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
 
 }
 
+/**
+* Looks up count keys at once, storing the result for keys[i] in out[i]
+* (end() if the key is absent).
+*
+* Lookups are walked FIND_GROUP at a time in lockstep: each round moves
+* every unfinished lookup one level down and prefetches the node it lands
+* on, so the cache misses of the whole group overlap instead of queueing
+* one after another. Where the keys are ascending, each one is found by a
+* finger search from the previous hit instead, which costs O(1) amortized
+* for keys that sit close together in the tree.
+*/
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::find_many(const Key* keys, size_t count, iterator* out) const
+{
+    Node<Key, Value> *finger = NULL;
+    size_t i = 0;
+    while(i < count)
+    {
+        if(finger != NULL && keys[i - 1] < keys[i])
+        {
+            Node<Key, Value> *found = fingerFind(finger, keys[i]);
+            out[i] = iterator(found);
+            if(found != NULL)
+                finger = found;
+            ++i;
+            continue;
+        }
+
+        size_t n = count - i < FIND_GROUP ? count - i : FIND_GROUP;
+        groupFind(keys + i, n, out + i);
+        i += n;
+        finger = out[i - 1].current_;
+    }
+}
+
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::find_many(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    out.resize(keys.size());
+    if(!keys.empty())
+        find_many(&keys[0], keys.size(), &out[0]);
+}
+
+/**
+* Runs up to FIND_GROUP lookups in lockstep for find_many.
+*/
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::groupFind(const Key* keys, size_t count, iterator* out) const
+{
+    Node<Key, Value> *lane[FIND_GROUP];
+    for(size_t l = 0; l < count; ++l)
+    {
+        lane[l] = root_;
+        out[l] = iterator(NULL);
+    }
+
+    size_t active = root_ == NULL ? 0 : count;
+    while(active > 0)
+    {
+        active = 0;
+        for(size_t l = 0; l < count; ++l)
+        {
+            Node<Key, Value> *curr = lane[l];
+            if(curr == NULL)
+                continue;
+            if(keys[l] < curr->getKey())
+            {
+                curr = curr->getLeft();
+            }
+            else if(curr->getKey() < keys[l])
+            {
+                curr = curr->getRight();
+            }
+            else
+            {
+                out[l] = iterator(curr);
+                curr = NULL;
+            }
+            lane[l] = curr;
+            if(curr != NULL)
+            {
+#if defined(__GNUC__)
+                __builtin_prefetch(curr);
+#endif
+                ++active;
+            }
+        }
+    }
+}
+
+/**
+* Returns an iterator to key, or end() if it is absent, searching from
+* finger instead of from the root. See fingerClimb for the cost. An end()
+* finger searches from the root.
+*/
+template<typename Key, typename Value, typename Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::find_from(iterator finger, const Key& key) const
+{
+    if(finger.current_ == NULL)
+        return find(key);
+    return iterator(fingerFind(finger.current_, key));
+}
+
+/**
+* Copies the entries with lo <= key < hi into the arrays keyOut and
+* valueOut, in key order, stopping after capacity entries, and returns how
+* many were written. Either array may be NULL to skip that field. To
+* export a range larger than one buffer, start from lower_bound(lo) and
+* use the overload taking an iterator.
+*/
+template<typename Key, typename Value, typename Alloc>
+size_t BinarySearchTree<Key, Value, Alloc>::export_range(const Key& lo, const Key& hi, Key* keyOut,
+                                                        Value* valueOut, size_t capacity) const
+{
+    iterator from = lower_bound(lo);
+    return export_range(from, hi, keyOut, valueOut, capacity);
+}
+
+/**
+* Copies entries from from onwards whose keys are less than hi into keyOut
+* and valueOut, at most capacity of them, and leaves from at the first
+* entry not copied, so that repeated calls hand a range of any length over
+* one buffer at a time. Returns how many were written; 0 once the range
+* is exhausted.
+*/
+template<typename Key, typename Value, typename Alloc>
+size_t BinarySearchTree<Key, Value, Alloc>::export_range(iterator& from, const Key& hi, Key* keyOut,
+                                                        Value* valueOut, size_t capacity) const
+{
+    Node<Key, Value> *n = from.current_;
+    size_t count = 0;
+    for(; count < capacity && n != NULL && n->getKey() < hi; ++count, n = successor(n))
+    {
+        if(keyOut != NULL)
+            keyOut[count] = n->getKey();
+        if(valueOut != NULL)
+            valueOut[count] = n->getValue();
+    }
+    from.current_ = n;
+    return count;
+}
+
+/**
+* Splits the contents into about chunks contiguous key ranges for
+* independent traversal and fills bounds with the first entry of each, in
+* key order: range i runs from bounds[i] up to bounds[i + 1], the last one
+* up to end(). The ranges are the subtrees at depth log2(chunks) together
+* with the ancestors that fall between them, so their sizes are only as
+* even as the tree is balanced; a tree with fewer levels yields fewer
+* ranges. bounds is left empty for an empty tree.
+*/
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::chunk_bounds(size_t chunks, std::vector<iterator>& bounds) const
+{
+    bounds.clear();
+    if(root_ == NULL)
+        return;
+    size_t depth = 0;
+    while(depth + 1 < sizeof(size_t) * 8 && ((size_t)1 << depth) < chunks)
+        ++depth;
+    collectBounds(root_, depth, bounds);
+    // Ancestors left of the first deep subtree belong to the first range.
+    if(bounds.empty())
+        bounds.push_back(begin());
+    else
+        bounds[0] = begin();
+}
+
+/**
+* Appends the smallest entry of every subtree depth levels below curr.
+*/
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::collectBounds(Node<Key, Value>* curr, size_t depth,
+                                                      std::vector<iterator>& bounds) const
+{
+    if(curr == NULL)
+        return;
+    if(depth == 0)
+    {
+        while(curr->getLeft() != NULL)
+            curr = curr->getLeft();
+        bounds.push_back(iterator(curr));
+        return;
+    }
+    collectBounds(curr->getLeft(), depth - 1, bounds);
+    collectBounds(curr->getRight(), depth - 1, bounds);
+}
+
+/**
+* Returns an iterator to the smallest key not less than key, searching
+* from finger instead of from the root. An end() finger searches from the
+* root.
+*/
+template<typename Key, typename Value, typename Alloc>
+typename BinarySearchTree<Key, Value, Alloc>::iterator
+BinarySearchTree<Key, Value, Alloc>::lower_bound_from(iterator finger, const Key& key) const
+{
+    if(finger.current_ == NULL)
+        return lower_bound(key);
+    Node<Key, Value> *best = NULL;
+    Node<Key, Value> *curr = fingerClimb(finger.current_, key, best);
+    while(curr != nullptr)
+    {
+        if(curr->getKey() < key)
+        {
+            curr = curr->getRight();
+        }
+        else
+        {
+            best = curr;
+            curr = curr->getLeft();
+        }
+    }
+    return iterator(best);
+}
+
+/**
+* Climbs from finger to the lowest ancestor whose subtree must hold k if
+* k is in the tree at all. When k is above the finger, every key in an
+* ancestor's subtree is already known to be above its lower bound, so the
+* climb stops at the first left-child edge whose parent is greater than k.
+* When k is below the finger, the climb stops at the first right-child
+* edge whose parent is less than k. bound is set to the smallest key known
+* to be greater than k outside the returned subtree, or NULL.
+*
+* For keys close to the finger this touches O(log d) nodes, where d is
+* the rank distance. When finger and k fall on opposite sides of a high
+* ancestor the climb reaches that ancestor, which is no worse than a
+* search from the root.
+*/
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Alloc>::fingerClimb(Node<Key, Value>* finger, const Key& k, Node<Key, Value>*& bound) const
+{
+    Node<Key, Value> *curr = finger;
+    bound = NULL;
+    if(finger->getKey() < k)
+    {
+        while(curr->getParent() != nullptr)
+        {
+            Node<Key, Value> *parent = curr->getParent();
+            if(parent->getLeft() == curr && k < parent->getKey())
+            {
+                bound = parent;
+                break;
+            }
+            curr = parent;
+        }
+    }
+    else if(k < finger->getKey())
+    {
+        while(curr->getParent() != nullptr)
+        {
+            Node<Key, Value> *parent = curr->getParent();
+            if(parent->getRight() == curr && parent->getKey() < k)
+                break;
+            curr = parent;
+        }
+    }
+    return curr;
+}
+
+/**
+* Finds k by a finger search from finger.
+*/
+template<typename Key, typename Value, typename Alloc>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Alloc>::fingerFind(Node<Key, Value>* finger, const Key& k) const
+{
+    Node<Key, Value> *bound;
+    Node<Key, Value> *curr = fingerClimb(finger, k, bound);
+    while(curr != nullptr)
+    {
+        if(curr->getKey() < k)
+            curr = curr->getRight();
+        else if(k < curr->getKey())
+            curr = curr->getLeft();
+        else
+            return curr;
+    }
+    return NULL;
+}
+
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Alloc>
+bool BinarySearchTree<Key, Value, Alloc>::isBalanced() const
 {
     
     Node<Key, Value> *curr = root_;
     return isBalancedHelp(curr);
 }
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalancedHelp(Node<Key, Value>* curr) const
+template<typename Key, typename Value, typename Alloc>
+bool BinarySearchTree<Key, Value, Alloc>::isBalancedHelp(Node<Key, Value>* curr) const
 {
     
     if(curr == nullptr)
@@ -765,8 +1237,8 @@ bool BinarySearchTree<Key, Value>::isBalancedHelp(Node<Key, Value>* curr) const
     
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::height(Node<Key, Value>* curr) const
+template<typename Key, typename Value, typename Alloc>
+int BinarySearchTree<Key, Value, Alloc>::height(Node<Key, Value>* curr) const
 {
     if(curr == nullptr)
     {
@@ -786,8 +1258,8 @@ int BinarySearchTree<Key, Value>::height(Node<Key, Value>* curr) const
 }
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Alloc>
+void BinarySearchTree<Key, Value, Alloc>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
@@ -870,4 +1342,12 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
 
 }
 
+#if __cplusplus >= 201703L
+/**
+* A BinarySearchTree whose nodes come from a std::pmr::memory_resource.
+*/
+template <typename Key, typename Value>
+using PmrBinarySearchTree = BinarySearchTree<Key, Value, std::pmr::polymorphic_allocator<std::pair<const Key, Value> > >;
+#endif
+
 #endif
@@ -0,0 +1,109 @@
+#include <atomic>
+#include <memory>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+#include "concurrentavl.h"
+#include "epoch.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Multithreaded tests for ConcurrentAVLTree and the epoch domain under it.
+// Writers change disjoint keys while readers check that a key they find
+// maps to itself, and the final tree is compared with the writers' own
+// records. Most useful under -fsanitize=thread, run with
+// TSAN_OPTIONS=detect_deadlocks=0: ConcurrentAVLTree locks a parent before
+// its child, and rotations swap which node is the parent, which TSan's
+// lock-order check reports although the order always follows the tree.
+
+void testConcurrent(int readerCount)
+{
+    const char* name = "ConcurrentAVLTree";
+    ConcurrentAVLTree<int, int> tree;
+    atomic<bool> stop(false);
+    vector<thread> readers;
+    for(int r = 0; r < readerCount; ++r)
+    {
+        readers.push_back(thread([&tree, &stop, r, name]()
+        {
+            mt19937 rng(100 + r);
+            bool ok = true;
+            while(!stop.load())
+            {
+                int key = (int)(rng() % KEYS);
+                int value = -1;
+                if(tree.find(key, value))
+                    ok = ok && value == key;
+                // Leave the writers room when readers outnumber the cores.
+                this_thread::yield();
+            }
+            check(ok, name, "reader saw a value that was never written");
+        }));
+    }
+    vector<set<int> > present = runWriters(tree);
+    stop.store(true);
+    for(size_t t = 0; t < readers.size(); ++t)
+        readers[t].join();
+    checkFinal(name, tree, present);
+    check(tree.isBalanced(), name, "tree not balanced");
+}
+
+/**
+* More readers than one slot block holds, and more guards on one thread
+* than that, must all pin without waiting, and what they retire must be
+* freed once they let go.
+*/
+void testEpochReaders()
+{
+    const char* name = "EpochDomain";
+    const int READERS = 3 * EpochDomain::SLOTS_PER_BLOCK;
+    EpochDomain domain;
+
+    {
+        vector<unique_ptr<EpochGuard> > nested;
+        for(int i = 0; i < READERS; ++i)
+            nested.push_back(unique_ptr<EpochGuard>(new EpochGuard(domain)));
+        domain.retire(new int(1));
+        domain.collect();
+        check(domain.pending() == 1, name, "object freed while nested guards were held");
+        nested.resize(1);
+        domain.collect();
+        check(domain.pending() == 1, name, "object freed while the outermost guard was held");
+    }
+    domain.collect();
+    check(domain.pending() == 0, name, "object not freed after nested guards ended");
+
+    atomic<int> pinned(0);
+    atomic<bool> release(false);
+    vector<thread> threads;
+    for(int i = 0; i < READERS; ++i)
+    {
+        threads.push_back(thread([&domain, &pinned, &release]()
+        {
+            EpochGuard guard(domain);
+            ++pinned;
+            while(!release.load())
+                this_thread::yield();
+        }));
+    }
+    while(pinned.load() < READERS)
+        this_thread::yield();
+    domain.retire(new int(2));
+    domain.collect();
+    check(domain.pending() == 1, name, "object freed while readers were pinned");
+    release.store(true);
+    for(size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    domain.collect();
+    check(domain.pending() == 0, name, "object not freed after readers left");
+}
+
+int main()
+{
+    testConcurrent(2);
+    testConcurrent(EpochDomain::SLOTS_PER_BLOCK + 8);
+    testEpochReaders();
+    return testSummary("ConcurrentAVLTree");
+}
@@ -0,0 +1,974 @@
+#ifndef CONCURRENTAVL_H
+#define CONCURRENTAVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <stdint.h>
+#include "epoch.h"
+
+/**
+* A node of a ConcurrentAVLTree. Every field that is read without holding
+* the node's lock is atomic. The version number changes whenever a
+* rotation shrinks the node's subtree, which lets optimistic readers detect
+* that the key they are looking for may have moved out from under them.
+*
+* A node whose value is NULL is a routing node: its key is no longer in the
+* map but it is kept to route searches until it has fewer than two
+* children and can be unlinked.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLNode
+{
+public:
+    ConcurrentAVLNode(const Key& key, Value* value, ConcurrentAVLNode<Key, Value>* parent);
+
+    ConcurrentAVLNode<Key, Value>* child(int dir) const;
+    void setChild(int dir, ConcurrentAVLNode<Key, Value>* child);
+
+    const Key key_;
+    std::atomic<Value*> value_;
+    std::atomic<int> height_;
+    std::atomic<uint64_t> version_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> parent_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> left_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> right_;
+    std::mutex lock_;
+};
+
+template <typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>::ConcurrentAVLNode(const Key& key, Value* value,
+                                                 ConcurrentAVLNode<Key, Value>* parent) :
+    key_(key),
+    value_(value),
+    height_(1),
+    version_(0),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* Returns the left child for a negative direction, the right one otherwise.
+*/
+template <typename Key, typename Value>
+ConcurrentAVLNode<Key, Value>* ConcurrentAVLNode<Key, Value>::child(int dir) const
+{
+    return dir < 0 ? left_.load() : right_.load();
+}
+
+template <typename Key, typename Value>
+void ConcurrentAVLNode<Key, Value>::setChild(int dir, ConcurrentAVLNode<Key, Value>* child)
+{
+    if(dir < 0)
+        left_.store(child);
+    else
+        right_.store(child);
+}
+
+
+/**
+* A thread-safe AVL map following Bronson et al., "A Practical Concurrent
+* Binary Search Tree" (PPoPP 2010).
+*
+* Lookups take no locks: they descend optimistically and validate each
+* step against the per-node version numbers, retrying from the parent if a
+* rotation moved the subtree they were in. Writers lock only the nodes they
+* link, unlink or rotate, always top-down. Removing a node with two children
+* just clears its value, leaving a routing node that is unlinked by later
+* rebalancing once it has a free child slot, so removals never need the
+* predecessor swap used by AVLTree.
+*
+* Unlinked nodes and replaced values are reclaimed through an EpochDomain,
+* so readers never touch freed memory. Any number of threads may use the
+* tree at once: each one pins a reader slot per operation, and the domain
+* adds slots when more threads than its first block holds are inside.
+* Key must be default constructible (for the root holder) and copyable;
+* Value must be copyable.
+*/
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool empty() const;
+    size_t size() const;
+
+    // Only meaningful while no writer is running.
+    bool isBalanced() const;
+
+private:
+    typedef ConcurrentAVLNode<Key, Value> NodeT;
+
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+
+    // Results of the attempt* helpers.
+    static const int RETRY = 0;
+    static const int NOT_FOUND = 1;
+    static const int FOUND = 2;
+
+    // Version bits.
+    static const uint64_t UNLINKED = 1;
+    static const uint64_t SHRINKING = 2;
+    static const uint64_t SHRINK_COUNT_INCR = 4;
+
+    // nodeCondition() results other than a replacement height.
+    static const int NOTHING_REQUIRED = -1;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int UNLINK_REQUIRED = -3;
+
+    static const int SPIN_COUNT = 100;
+
+    // The entry count is split over SIZE_STRIPES counters, one cache line
+    // each, so writers on different threads do not all bounce the same
+    // line. size() adds them up.
+    static const size_t SIZE_STRIPES = 16;
+
+    struct SizeStripe
+    {
+        std::atomic<long> count;
+        char pad[64 - sizeof(std::atomic<long>)];
+    };
+
+    static int compare(const Key& a, const Key& b);
+    static int height(NodeT* n);
+    static bool canUnlink(NodeT* n);
+    static uint64_t beginChange(uint64_t version);
+    static uint64_t endChange(uint64_t version);
+    static void waitUntilNotChanging(NodeT* n);
+    static size_t sizeStripe();
+
+    void addSize(long delta);
+
+    int attemptGet(const Key& key, NodeT* node, int dir, uint64_t nodeV, Value& value) const;
+    int attemptPut(const Key& key, Value* box, NodeT* node, int dir, uint64_t nodeV);
+    int attemptInsertIntoEmpty(const Key& key, Value* box, NodeT* node, int dir, uint64_t nodeV);
+    int attemptUpdate(NodeT* node, Value* box);
+    int attemptRemove(const Key& key, NodeT* node, int dir, uint64_t nodeV);
+    int attemptRmNode(NodeT* parent, NodeT* n);
+    bool attemptUnlink_nl(NodeT* parent, NodeT* n);
+
+    void fixHeightAndRebalance(NodeT* node);
+    int nodeCondition(NodeT* node);
+    NodeT* fixHeight_nl(NodeT* node);
+    NodeT* rebalance_nl(NodeT* nParent, NodeT* n);
+    NodeT* rebalanceToRight_nl(NodeT* nParent, NodeT* n, NodeT* nL, int hR0);
+    NodeT* rebalanceToLeft_nl(NodeT* nParent, NodeT* n, NodeT* nR, int hL0);
+    NodeT* rotateRight_nl(NodeT* nParent, NodeT* n, NodeT* nL, int hR, int hLL, NodeT* nLR, int hLR);
+    NodeT* rotateLeft_nl(NodeT* nParent, NodeT* n, int hL, NodeT* nR, NodeT* nRL, int hRL, int hRR);
+    NodeT* rotateRightOverLeft_nl(NodeT* nParent, NodeT* n, NodeT* nL, int hR, int hLL, NodeT* nLR, int hLRL);
+    NodeT* rotateLeftOverRight_nl(NodeT* nParent, NodeT* n, int hL, NodeT* nR, NodeT* nRL, int hRR, int hRLR);
+
+    void retireNode(NodeT* n);
+    void retireValue(Value* v);
+    void clearHelp(NodeT* n);
+    int checkHeight(NodeT* n) const;
+
+    // Sentinel whose right child is the real root. It is never rotated or
+    // unlinked, so its version stays 0.
+    NodeT rootHolder_;
+    SizeStripe size_[SIZE_STRIPES];
+    mutable EpochDomain epoch_;
+};
+
+template <typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() :
+    rootHolder_(Key(), NULL, NULL)
+{
+    rootHolder_.height_.store(0);
+    for(size_t i = 0; i < SIZE_STRIPES; ++i)
+        size_[i].count.store(0);
+}
+
+/**
+* Frees every node still in the tree. Retired nodes are freed by the
+* epoch domain's destructor. No other thread may use the tree any more.
+*/
+template <typename Key, typename Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    clearHelp(rootHolder_.right_.load());
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template <typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    EpochGuard guard(epoch_);
+    Value* box = new Value(keyValuePair.second);
+    while(attemptPut(keyValuePair.first, box, &rootHolder_, 1, 0) == RETRY)
+    {
+    }
+}
+
+/**
+* Removes the key if it is present.
+*/
+template <typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    EpochGuard guard(epoch_);
+    while(attemptRemove(key, &rootHolder_, 1, 0) == RETRY)
+    {
+    }
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if the key is not present. Takes no locks.
+*/
+template <typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochGuard guard(epoch_);
+    NodeT* holder = const_cast<NodeT*>(&rootHolder_);
+    for(;;)
+    {
+        int result = attemptGet(key, holder, 1, 0, value);
+        if(result != RETRY)
+            return result == FOUND;
+    }
+}
+
+template <typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    Value ignored;
+    return find(key, ignored);
+}
+
+template <typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Sums the size stripes. While writers run, an entry added on one stripe
+* may already be counted out on another, so a negative total reads as 0.
+*/
+template <typename Key, typename Value>
+size_t ConcurrentAVLTree<Key, Value>::size() const
+{
+    long total = 0;
+    for(size_t i = 0; i < SIZE_STRIPES; ++i)
+        total += size_[i].count.load(std::memory_order_relaxed);
+    return total < 0 ? 0 : static_cast<size_t>(total);
+}
+
+/**
+* The stripe the calling thread counts on, picked once per thread from its
+* id.
+*/
+template <typename Key, typename Value>
+size_t ConcurrentAVLTree<Key, Value>::sizeStripe()
+{
+    static thread_local size_t stripe =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % SIZE_STRIPES;
+    return stripe;
+}
+
+template <typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::addSize(long delta)
+{
+    size_[sizeStripe()].count.fetch_add(delta, std::memory_order_relaxed);
+}
+
+/**
+* Return true iff every node's children differ in height by at most one.
+* Routing nodes count as ordinary nodes.
+*/
+template <typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::isBalanced() const
+{
+    return checkHeight(rootHolder_.right_.load()) >= 0;
+}
+
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::checkHeight(NodeT* n) const
+{
+    if(n == NULL)
+        return 0;
+    int left = checkHeight(n->left_.load());
+    int right = checkHeight(n->right_.load());
+    if(left < 0 || right < 0 || left - right > 1 || right - left > 1)
+        return -1;
+    return 1 + std::max(left, right);
+}
+
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::compare(const Key& a, const Key& b)
+{
+    if(a < b)
+        return -1;
+    if(b < a)
+        return 1;
+    return 0;
+}
+
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::height(NodeT* n)
+{
+    return n == NULL ? 0 : n->height_.load();
+}
+
+template <typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::canUnlink(NodeT* n)
+{
+    return n->left_.load() == NULL || n->right_.load() == NULL;
+}
+
+template <typename Key, typename Value>
+uint64_t ConcurrentAVLTree<Key, Value>::beginChange(uint64_t version)
+{
+    return version | SHRINKING;
+}
+
+template <typename Key, typename Value>
+uint64_t ConcurrentAVLTree<Key, Value>::endChange(uint64_t version)
+{
+    return (version & ~SHRINKING) + SHRINK_COUNT_INCR;
+}
+
+/**
+* Waits for a rotation that is shrinking n to finish. Rotations hold n's
+* lock, so after a short spin we simply wait for the lock.
+*/
+template <typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::waitUntilNotChanging(NodeT* n)
+{
+    uint64_t version = n->version_.load();
+    if((version & SHRINKING) == 0)
+        return;
+    for(int i = 0; i < SPIN_COUNT; ++i)
+    {
+        if(n->version_.load() != version)
+            return;
+    }
+    std::lock_guard<std::mutex> lock(n->lock_);
+}
+
+/**
+* Optimistic search below node in direction dir. nodeV is the version of
+* node observed when the caller decided to descend into it.
+*/
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::attemptGet(const Key& key, NodeT* node, int dir,
+                                              uint64_t nodeV, Value& value) const
+{
+    for(;;)
+    {
+        NodeT* child = node->child(dir);
+        if(node->version_.load() != nodeV)
+            return RETRY;
+        if(child == NULL)
+            return NOT_FOUND;
+
+        int nextD = compare(key, child->key_);
+        if(nextD == 0)
+        {
+            Value* box = child->value_.load();
+            if(box == NULL)
+                return NOT_FOUND;
+            value = *box;
+            return FOUND;
+        }
+
+        uint64_t chV = child->version_.load();
+        if(chV & SHRINKING)
+        {
+            waitUntilNotChanging(child);
+        }
+        else if((chV & UNLINKED) == 0 && child == node->child(dir))
+        {
+            if(node->version_.load() != nodeV)
+                return RETRY;
+            int result = attemptGet(key, child, nextD, chV, value);
+            if(result != RETRY)
+                return result;
+        }
+    }
+}
+
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::attemptPut(const Key& key, Value* box, NodeT* node,
+                                              int dir, uint64_t nodeV)
+{
+    int result = RETRY;
+    do
+    {
+        NodeT* child = node->child(dir);
+        if(node->version_.load() != nodeV)
+            return RETRY;
+
+        if(child == NULL)
+        {
+            result = attemptInsertIntoEmpty(key, box, node, dir, nodeV);
+        }
+        else
+        {
+            int nextD = compare(key, child->key_);
+            if(nextD == 0)
+            {
+                result = attemptUpdate(child, box);
+            }
+            else
+            {
+                uint64_t chV = child->version_.load();
+                if(chV & SHRINKING)
+                {
+                    waitUntilNotChanging(child);
+                }
+                else if((chV & UNLINKED) == 0 && child == node->child(dir))
+                {
+                    if(node->version_.load() != nodeV)
+                        return RETRY;
+                    result = attemptPut(key, box, child, nextD, chV);
+                }
+            }
+        }
+    } while(result == RETRY);
+    return result;
+}
+
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::attemptInsertIntoEmpty(const Key& key, Value* box, NodeT* node,
+                                                          int dir, uint64_t nodeV)
+{
+    {
+        std::lock_guard<std::mutex> lock(node->lock_);
+        if(node->version_.load() != nodeV || node->child(dir) != NULL)
+            return RETRY;
+        node->setChild(dir, new NodeT(key, box, node));
+    }
+    addSize(1);
+    fixHeightAndRebalance(node);
+    return NOT_FOUND;
+}
+
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::attemptUpdate(NodeT* node, Value* box)
+{
+    Value* prev;
+    {
+        std::lock_guard<std::mutex> lock(node->lock_);
+        if(node->version_.load() & UNLINKED)
+            return RETRY;
+        prev = node->value_.exchange(box);
+    }
+    if(prev == NULL)
+    {
+        // Revived a routing node.
+        addSize(1);
+        return NOT_FOUND;
+    }
+    retireValue(prev);
+    return FOUND;
+}
+
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::attemptRemove(const Key& key, NodeT* node, int dir, uint64_t nodeV)
+{
+    int result = RETRY;
+    do
+    {
+        NodeT* child = node->child(dir);
+        if(node->version_.load() != nodeV)
+            return RETRY;
+
+        if(child == NULL)
+            return NOT_FOUND;
+
+        int nextD = compare(key, child->key_);
+        if(nextD == 0)
+        {
+            result = attemptRmNode(node, child);
+        }
+        else
+        {
+            uint64_t chV = child->version_.load();
+            if(chV & SHRINKING)
+            {
+                waitUntilNotChanging(child);
+            }
+            else if((chV & UNLINKED) == 0 && child == node->child(dir))
+            {
+                if(node->version_.load() != nodeV)
+                    return RETRY;
+                result = attemptRemove(key, child, nextD, chV);
+            }
+        }
+    } while(result == RETRY);
+    return result;
+}
+
+/**
+* Removes n, a child of parent. A node with two children only loses its
+* value; otherwise it is spliced out under the locks of parent and n.
+*/
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::attemptRmNode(NodeT* parent, NodeT* n)
+{
+    if(n->value_.load() == NULL)
+        return NOT_FOUND;
+
+    Value* prev;
+    bool unlinked = false;
+    if(!canUnlink(n))
+    {
+        std::lock_guard<std::mutex> lock(n->lock_);
+        if((n->version_.load() & UNLINKED) || canUnlink(n))
+            return RETRY;
+        prev = n->value_.exchange(NULL);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> parentLock(parent->lock_);
+        if((parent->version_.load() & UNLINKED) || n->parent_.load() != parent)
+            return RETRY;
+        std::lock_guard<std::mutex> lock(n->lock_);
+        prev = n->value_.load();
+        if(prev == NULL)
+            return NOT_FOUND;
+        if(!attemptUnlink_nl(parent, n))
+            return RETRY;
+        unlinked = true;
+    }
+
+    if(prev == NULL)
+        return NOT_FOUND;
+    addSize(-1);
+    retireValue(prev);
+    if(unlinked)
+        fixHeightAndRebalance(parent);
+    return FOUND;
+}
+
+/**
+* Splices n out from under parent. Both must be locked by the caller.
+* Fails if n is no longer parent's child or has grown a second child.
+*/
+template <typename Key, typename Value>
+bool ConcurrentAVLTree<Key, Value>::attemptUnlink_nl(NodeT* parent, NodeT* n)
+{
+    NodeT* parentL = parent->left_.load();
+    NodeT* parentR = parent->right_.load();
+    if(parentL != n && parentR != n)
+        return false;
+
+    NodeT* left = n->left_.load();
+    NodeT* right = n->right_.load();
+    if(left != NULL && right != NULL)
+        return false;
+
+    NodeT* splice = left != NULL ? left : right;
+    if(parentL == n)
+        parent->left_.store(splice);
+    else
+        parent->right_.store(splice);
+    if(splice != NULL)
+        splice->parent_.store(parent);
+
+    n->version_.store(n->version_.load() | UNLINKED);
+    n->value_.store(NULL);
+    retireNode(n);
+    return true;
+}
+
+/**
+* Walks up from node to the root repairing heights, unlinking routing nodes
+* and rotating. The walk only takes locks where something has to change, so
+* when no writer is running every height is exact and the tree is a strict
+* AVL tree.
+*/
+template <typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::fixHeightAndRebalance(NodeT* node)
+{
+    while(node != NULL && node->parent_.load() != NULL)
+    {
+        int condition = nodeCondition(node);
+        if(node->version_.load() & UNLINKED)
+            return;
+
+        if(condition == NOTHING_REQUIRED)
+        {
+            // Keep climbing: a rotation below may have left an ancestor's
+            // height stale even though this node is fine.
+            node = node->parent_.load();
+        }
+        else if(condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED)
+        {
+            std::lock_guard<std::mutex> lock(node->lock_);
+            node = fixHeight_nl(node);
+        }
+        else
+        {
+            NodeT* nParent = node->parent_.load();
+            std::lock_guard<std::mutex> parentLock(nParent->lock_);
+            if((nParent->version_.load() & UNLINKED) == 0 && node->parent_.load() == nParent)
+            {
+                std::lock_guard<std::mutex> lock(node->lock_);
+                node = rebalance_nl(nParent, node);
+            }
+        }
+    }
+}
+
+/**
+* Returns the action node needs: UNLINK_REQUIRED, REBALANCE_REQUIRED,
+* NOTHING_REQUIRED, or the height it should have if only that is stale.
+*/
+template <typename Key, typename Value>
+int ConcurrentAVLTree<Key, Value>::nodeCondition(NodeT* node)
+{
+    NodeT* nL = node->left_.load();
+    NodeT* nR = node->right_.load();
+    if((nL == NULL || nR == NULL) && node->value_.load() == NULL)
+        return UNLINK_REQUIRED;
+
+    int hN = node->height_.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+    if(bal < -1 || bal > 1)
+        return REBALANCE_REQUIRED;
+    return hN != hNRepl ? hNRepl : NOTHING_REQUIRED;
+}
+
+template <typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeT*
+ConcurrentAVLTree<Key, Value>::fixHeight_nl(NodeT* node)
+{
+    int condition = nodeCondition(node);
+    switch(condition)
+    {
+    case REBALANCE_REQUIRED:
+    case UNLINK_REQUIRED:
+        return node;
+    case NOTHING_REQUIRED:
+        return node->parent_.load();
+    default:
+        node->height_.store(condition);
+        return node->parent_.load();
+    }
+}
+
+/**
+* Rebalances n, whose parent nParent is locked along with n. Returns the
+* next node to look at on the way up.
+*/
+template <typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeT*
+ConcurrentAVLTree<Key, Value>::rebalance_nl(NodeT* nParent, NodeT* n)
+{
+    NodeT* nL = n->left_.load();
+    NodeT* nR = n->right_.load();
+    if((nL == NULL || nR == NULL) && n->value_.load() == NULL)
+    {
+        if(attemptUnlink_nl(nParent, n))
+            return fixHeight_nl(nParent);
+        return n;
+    }
+
+    int hN = n->height_.load();
+    int hL0 = height(nL);
+    int hR0 = height(nR);
+    int hNRepl = 1 + std::max(hL0, hR0);
+    int bal = hL0 - hR0;
+
+    if(bal > 1)
+        return rebalanceToRight_nl(nParent, n, nL, hR0);
+    else if(bal < -1)
+        return rebalanceToLeft_nl(nParent, n, nR, hL0);
+    else if(hNRepl != hN)
+    {
+        n->height_.store(hNRepl);
+        return fixHeight_nl(nParent);
+    }
+    return nParent;
+}
+
+template <typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeT*
+ConcurrentAVLTree<Key, Value>::rebalanceToRight_nl(NodeT* nParent, NodeT* n, NodeT* nL, int hR0)
+{
+    std::unique_lock<std::mutex> leftLock(nL->lock_);
+    int hL = nL->height_.load();
+    if(hL - hR0 <= 1)
+        return n;
+
+    NodeT* nLR = nL->right_.load();
+    int hLL0 = height(nL->left_.load());
+    int hLR0 = height(nLR);
+    if(hLL0 >= hLR0)
+        return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR0);
+
+    {
+        std::lock_guard<std::mutex> leftRightLock(nLR->lock_);
+        int hLR = nLR->height_.load();
+        if(hLL0 >= hLR)
+            return rotateRight_nl(nParent, n, nL, hR0, hLL0, nLR, hLR);
+
+        int hLRL = height(nLR->left_.load());
+        int b = hLL0 - hLRL;
+        if(b >= -1 && b <= 1)
+            return rotateRightOverLeft_nl(nParent, n, nL, hR0, hLL0, nLR, hLRL);
+    }
+    // The double rotation would leave nL unbalanced, so fix nL first.
+    return rebalanceToLeft_nl(n, nL, nLR, hLL0);
+}
+
+template <typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeT*
+ConcurrentAVLTree<Key, Value>::rebalanceToLeft_nl(NodeT* nParent, NodeT* n, NodeT* nR, int hL0)
+{
+    std::unique_lock<std::mutex> rightLock(nR->lock_);
+    int hR = nR->height_.load();
+    if(hL0 - hR >= -1)
+        return n;
+
+    NodeT* nRL = nR->left_.load();
+    int hRL0 = height(nRL);
+    int hRR0 = height(nR->right_.load());
+    if(hRR0 >= hRL0)
+        return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL0, hRR0);
+
+    {
+        std::lock_guard<std::mutex> rightLeftLock(nRL->lock_);
+        int hRL = nRL->height_.load();
+        if(hRR0 >= hRL)
+            return rotateLeft_nl(nParent, n, hL0, nR, nRL, hRL, hRR0);
+
+        int hRLR = height(nRL->right_.load());
+        int b = hRR0 - hRLR;
+        if(b >= -1 && b <= 1)
+            return rotateLeftOverRight_nl(nParent, n, hL0, nR, nRL, hRR0, hRLR);
+    }
+    return rebalanceToRight_nl(n, nR, nRL, hRR0);
+}
+
+template <typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeT*
+ConcurrentAVLTree<Key, Value>::rotateRight_nl(NodeT* nParent, NodeT* n, NodeT* nL, int hR,
+                                              int hLL, NodeT* nLR, int hLR)
+{
+    uint64_t nodeOVL = n->version_.load();
+    NodeT* nPL = nParent->left_.load();
+
+    n->version_.store(beginChange(nodeOVL));
+
+    n->left_.store(nLR);
+    if(nLR != NULL)
+        nLR->parent_.store(n);
+    nL->right_.store(n);
+    n->parent_.store(nL);
+    if(nPL == n)
+        nParent->left_.store(nL);
+    else
+        nParent->right_.store(nL);
+    nL->parent_.store(nParent);
+
+    int hNRepl = 1 + std::max(hLR, hR);
+    n->height_.store(hNRepl);
+    nL->height_.store(1 + std::max(hLL, hNRepl));
+
+    n->version_.store(endChange(nodeOVL));
+
+    int balN = hLR - hR;
+    if(balN < -1 || balN > 1)
+        return n;
+    if((nLR == NULL || hR == 0) && n->value_.load() == NULL)
+        return n;
+    int balL = hLL - hNRepl;
+    if(balL < -1 || balL > 1)
+        return nL;
+    if(hLL == 0 && nL->value_.load() == NULL)
+        return nL;
+    return fixHeight_nl(nParent);
+}
+
+template <typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeT*
+ConcurrentAVLTree<Key, Value>::rotateLeft_nl(NodeT* nParent, NodeT* n, int hL, NodeT* nR,
+                                             NodeT* nRL, int hRL, int hRR)
+{
+    uint64_t nodeOVL = n->version_.load();
+    NodeT* nPL = nParent->left_.load();
+
+    n->version_.store(beginChange(nodeOVL));
+
+    n->right_.store(nRL);
+    if(nRL != NULL)
+        nRL->parent_.store(n);
+    nR->left_.store(n);
+    n->parent_.store(nR);
+    if(nPL == n)
+        nParent->left_.store(nR);
+    else
+        nParent->right_.store(nR);
+    nR->parent_.store(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRL);
+    n->height_.store(hNRepl);
+    nR->height_.store(1 + std::max(hNRepl, hRR));
+
+    n->version_.store(endChange(nodeOVL));
+
+    int balN = hRL - hL;
+    if(balN < -1 || balN > 1)
+        return n;
+    if((nRL == NULL || hL == 0) && n->value_.load() == NULL)
+        return n;
+    int balR = hRR - hNRepl;
+    if(balR < -1 || balR > 1)
+        return nR;
+    if(hRR == 0 && nR->value_.load() == NULL)
+        return nR;
+    return fixHeight_nl(nParent);
+}
+
+template <typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeT*
+ConcurrentAVLTree<Key, Value>::rotateRightOverLeft_nl(NodeT* nParent, NodeT* n, NodeT* nL, int hR,
+                                                      int hLL, NodeT* nLR, int hLRL)
+{
+    uint64_t nodeOVL = n->version_.load();
+    uint64_t leftOVL = nL->version_.load();
+    NodeT* nPL = nParent->left_.load();
+    NodeT* nLRL = nLR->left_.load();
+    NodeT* nLRR = nLR->right_.load();
+    int hLRR = height(nLRR);
+
+    n->version_.store(beginChange(nodeOVL));
+    nL->version_.store(beginChange(leftOVL));
+
+    n->left_.store(nLRR);
+    if(nLRR != NULL)
+        nLRR->parent_.store(n);
+    nL->right_.store(nLRL);
+    if(nLRL != NULL)
+        nLRL->parent_.store(nL);
+    nLR->left_.store(nL);
+    nL->parent_.store(nLR);
+    nLR->right_.store(n);
+    n->parent_.store(nLR);
+    if(nPL == n)
+        nParent->left_.store(nLR);
+    else
+        nParent->right_.store(nLR);
+    nLR->parent_.store(nParent);
+
+    int hNRepl = 1 + std::max(hLRR, hR);
+    n->height_.store(hNRepl);
+    int hLRepl = 1 + std::max(hLL, hLRL);
+    nL->height_.store(hLRepl);
+    nLR->height_.store(1 + std::max(hLRepl, hNRepl));
+
+    n->version_.store(endChange(nodeOVL));
+    nL->version_.store(endChange(leftOVL));
+
+    int balN = hLRR - hR;
+    if(balN < -1 || balN > 1)
+        return n;
+    if((nLRR == NULL || hR == 0) && n->value_.load() == NULL)
+        return n;
+    int balLR = hLRepl - hNRepl;
+    if(balLR < -1 || balLR > 1)
+        return nLR;
+    if((hLL == 0 || hLRL == 0) && nL->value_.load() == NULL)
+        return nL;
+    return fixHeight_nl(nParent);
+}
+
+template <typename Key, typename Value>
+typename ConcurrentAVLTree<Key, Value>::NodeT*
+ConcurrentAVLTree<Key, Value>::rotateLeftOverRight_nl(NodeT* nParent, NodeT* n, int hL, NodeT* nR,
+                                                      NodeT* nRL, int hRR, int hRLR)
+{
+    uint64_t nodeOVL = n->version_.load();
+    uint64_t rightOVL = nR->version_.load();
+    NodeT* nPL = nParent->left_.load();
+    NodeT* nRLL = nRL->left_.load();
+    NodeT* nRLR = nRL->right_.load();
+    int hRLL = height(nRLL);
+
+    n->version_.store(beginChange(nodeOVL));
+    nR->version_.store(beginChange(rightOVL));
+
+    n->right_.store(nRLL);
+    if(nRLL != NULL)
+        nRLL->parent_.store(n);
+    nR->left_.store(nRLR);
+    if(nRLR != NULL)
+        nRLR->parent_.store(nR);
+    nRL->right_.store(nR);
+    nR->parent_.store(nRL);
+    nRL->left_.store(n);
+    n->parent_.store(nRL);
+    if(nPL == n)
+        nParent->left_.store(nRL);
+    else
+        nParent->right_.store(nRL);
+    nRL->parent_.store(nParent);
+
+    int hNRepl = 1 + std::max(hL, hRLL);
+    n->height_.store(hNRepl);
+    int hRRepl = 1 + std::max(hRLR, hRR);
+    nR->height_.store(hRRepl);
+    nRL->height_.store(1 + std::max(hNRepl, hRRepl));
+
+    n->version_.store(endChange(nodeOVL));
+    nR->version_.store(endChange(rightOVL));
+
+    int balN = hRLL - hL;
+    if(balN < -1 || balN > 1)
+        return n;
+    if((nRLL == NULL || hL == 0) && n->value_.load() == NULL)
+        return n;
+    int balRL = hRRepl - hNRepl;
+    if(balRL < -1 || balRL > 1)
+        return nRL;
+    if((hRR == 0 || hRLR == 0) && nR->value_.load() == NULL)
+        return nR;
+    return fixHeight_nl(nParent);
+}
+
+template <typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::retireNode(NodeT* n)
+{
+    epoch_.retire(n);
+}
+
+template <typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::retireValue(Value* v)
+{
+    epoch_.retire(v);
+}
+
+template <typename Key, typename Value>
+void ConcurrentAVLTree<Key, Value>::clearHelp(NodeT* n)
+{
+    if(n == NULL)
+        return;
+    clearHelp(n->left_.load());
+    clearHelp(n->right_.load());
+    delete n->value_.load();
+    delete n;
+}
+
+#endif
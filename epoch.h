@@ -0,0 +1,385 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/**
+* Epoch-based memory reclamation.
+*
+* Readers that traverse a shared structure without locks pin the current
+* epoch for the duration of the traversal (see EpochGuard). Writers that
+* unlink an object hand it to retire() instead of deleting it, and the
+* object is freed once every pinned reader started after it was retired.
+* Readers never block; a slow reader only delays reclamation.
+*
+* Each pinned thread holds one reader slot. Slots come in blocks of
+* SLOTS_PER_BLOCK; when every slot is taken another block is linked in,
+* so any number of threads can pin at once. A thread that pins a domain
+* it has already pinned reuses its slot, so nested guards and any number
+* of guards held by one thread cost a single slot. A guard must be
+* released by the thread that took it.
+*/
+class EpochDomain
+{
+public:
+    // One cache line per slot so readers on different cores do not
+    // invalidate each other. A value of 0 marks the slot as free.
+    struct Slot
+    {
+        std::atomic<uint64_t> epoch;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    EpochDomain();
+    ~EpochDomain();
+
+    Slot* enter();
+    void exit(Slot* slot);
+
+    template <typename T>
+    void retire(T* ptr);
+    void retire(void* ptr, void (*deleter)(void*));
+    void reserve(size_t count);
+    void collect();
+
+    size_t pending() const;
+
+    // Reader slots allocated together; the first block is part of the
+    // domain, later ones are added as readers need them.
+    static const size_t SLOTS_PER_BLOCK = 128;
+
+private:
+    EpochDomain(const EpochDomain&);
+    EpochDomain& operator=(const EpochDomain&);
+
+    struct Retired
+    {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    struct SlotBlock
+    {
+        Slot slots[SLOTS_PER_BLOCK];
+        std::atomic<SlotBlock*> next;
+
+        SlotBlock();
+    };
+
+    // The slots this thread currently holds, so that nested pins of the
+    // same domain share one. Only a few domains are tracked per thread;
+    // pins of further domains each take a slot of their own.
+    struct HeldSlot
+    {
+        const EpochDomain* domain;
+        Slot* slot;
+        size_t depth;
+    };
+    static const size_t HELD_SLOTS = 4;
+
+    template <typename T>
+    static void deleteObject(void* ptr);
+    static HeldSlot* heldSlots();
+
+    bool claim(Slot& slot);
+    void collectLocked(std::vector<Retired>& freeable);
+
+    std::atomic<uint64_t> epoch_;
+    SlotBlock slots_;
+    mutable std::mutex retireLock_;
+    std::vector<Retired> retired_;
+    size_t collectThreshold_;
+};
+
+/**
+* RAII pin of the current epoch. Pointers loaded from the shared structure
+* while a guard is alive stay valid until the guard is destroyed.
+*/
+class EpochGuard
+{
+public:
+    explicit EpochGuard(EpochDomain& domain);
+    ~EpochGuard();
+
+private:
+    EpochGuard(const EpochGuard&);
+    EpochGuard& operator=(const EpochGuard&);
+
+    EpochDomain& domain_;
+    EpochDomain::Slot* slot_;
+};
+
+inline EpochDomain::SlotBlock::SlotBlock() :
+    next(NULL)
+{
+    for(size_t i = 0; i < SLOTS_PER_BLOCK; ++i)
+        slots[i].epoch.store(0);
+}
+
+/**
+* Starts in epoch 1 since 0 is reserved for free slots.
+*/
+inline EpochDomain::EpochDomain() :
+    epoch_(1),
+    collectThreshold_(64)
+{
+
+}
+
+/**
+* Frees everything still waiting for reclamation, and the slot blocks
+* added after the first. The caller guarantees that no reader is pinned
+* any more.
+*/
+inline EpochDomain::~EpochDomain()
+{
+    for(size_t i = 0; i < retired_.size(); ++i)
+        retired_[i].deleter(retired_[i].ptr);
+    SlotBlock* block = slots_.next.load();
+    while(block != NULL)
+    {
+        SlotBlock* next = block->next.load();
+        delete block;
+        block = next;
+    }
+}
+
+inline EpochDomain::HeldSlot* EpochDomain::heldSlots()
+{
+    static thread_local HeldSlot held[HELD_SLOTS] = {};
+    return held;
+}
+
+/**
+* Pins the current epoch and returns the slot that holds the pin. If this
+* thread already pins the domain, its slot is reused: the outer pin is at
+* least as old, so it already protects whatever the inner one would.
+* Otherwise a free slot is claimed, first in the block at a spot that
+* depends on the thread so that threads rarely contend for the same slot,
+* then anywhere, adding a block when all are taken.
+*/
+inline EpochDomain::Slot* EpochDomain::enter()
+{
+    HeldSlot* held = heldSlots();
+    HeldSlot* vacant = NULL;
+    for(size_t i = 0; i < HELD_SLOTS; ++i)
+    {
+        if(held[i].domain == this)
+        {
+            ++held[i].depth;
+            return held[i].slot;
+        }
+        if(held[i].domain == NULL && vacant == NULL)
+            vacant = &held[i];
+    }
+
+    size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % SLOTS_PER_BLOCK;
+    Slot* slot = NULL;
+    for(SlotBlock* block = &slots_; slot == NULL; )
+    {
+        for(size_t i = 0; i < SLOTS_PER_BLOCK && slot == NULL; ++i)
+        {
+            Slot& candidate = block->slots[(start + i) % SLOTS_PER_BLOCK];
+            if(claim(candidate))
+                slot = &candidate;
+        }
+        if(slot != NULL)
+            break;
+        SlotBlock* next = block->next.load();
+        if(next == NULL)
+        {
+            SlotBlock* added = new SlotBlock;
+            if(block->next.compare_exchange_strong(next, added))
+                next = added;
+            else
+                delete added;
+        }
+        block = next;
+    }
+
+    if(vacant != NULL)
+    {
+        vacant->domain = this;
+        vacant->slot = slot;
+        vacant->depth = 1;
+    }
+    return slot;
+}
+
+/**
+* Publishes the current epoch in slot if it is free. The epoch is re-read
+* after publishing so that a concurrent collect() either sees the slot or
+* this reader sees the advanced epoch.
+*/
+inline bool EpochDomain::claim(Slot& slot)
+{
+    uint64_t e = epoch_.load();
+    uint64_t expected = 0;
+    if(slot.epoch.load(std::memory_order_relaxed) != 0 ||
+       !slot.epoch.compare_exchange_strong(expected, e))
+        return false;
+    uint64_t now = epoch_.load();
+    while(now != e)
+    {
+        e = now;
+        slot.epoch.store(e);
+        now = epoch_.load();
+    }
+    return true;
+}
+
+/**
+* Drops a pin taken by enter() on this thread, releasing the slot with the
+* outermost one.
+*/
+inline void EpochDomain::exit(Slot* slot)
+{
+    HeldSlot* held = heldSlots();
+    for(size_t i = 0; i < HELD_SLOTS; ++i)
+    {
+        if(held[i].domain == this && held[i].slot == slot)
+        {
+            if(--held[i].depth != 0)
+                return;
+            held[i].domain = NULL;
+            break;
+        }
+    }
+    slot->epoch.store(0, std::memory_order_release);
+}
+
+/**
+* Schedules ptr for deletion once no reader can still hold it.
+*/
+template <typename T>
+void EpochDomain::retire(T* ptr)
+{
+    retire(ptr, &EpochDomain::deleteObject<T>);
+}
+
+template <typename T>
+void EpochDomain::deleteObject(void* ptr)
+{
+    delete static_cast<T*>(ptr);
+}
+
+/**
+* Type-erased form of retire(). The object must already be unreachable for
+* new readers. Every so often this also runs a collection pass; if that
+* pass cannot get memory it is left to a later call. Throws only if
+* recording ptr needs memory that reserve() did not set aside.
+*/
+inline void EpochDomain::retire(void* ptr, void (*deleter)(void*))
+{
+    std::vector<Retired> freeable;
+    {
+        std::lock_guard<std::mutex> lock(retireLock_);
+        Retired r;
+        r.ptr = ptr;
+        r.deleter = deleter;
+        r.epoch = epoch_.load();
+        retired_.push_back(r);
+        if(retired_.size() >= collectThreshold_)
+        {
+            try
+            {
+                collectLocked(freeable);
+            }
+            catch(std::bad_alloc&)
+            {
+            }
+        }
+    }
+    for(size_t i = 0; i < freeable.size(); ++i)
+        freeable[i].deleter(freeable[i].ptr);
+}
+
+/**
+* Makes room for count more retire() calls, so that a writer can prepare
+* before a step it cannot undo and then retire without failing.
+*/
+inline void EpochDomain::reserve(size_t count)
+{
+    std::lock_guard<std::mutex> lock(retireLock_);
+    if(retired_.capacity() - retired_.size() < count)
+        retired_.reserve(std::max(retired_.size() + count, 2 * retired_.capacity()));
+}
+
+/**
+* Advances the epoch and frees every retired object that is older than
+* the oldest pinned reader.
+*/
+inline void EpochDomain::collect()
+{
+    std::vector<Retired> freeable;
+    {
+        std::lock_guard<std::mutex> lock(retireLock_);
+        collectLocked(freeable);
+    }
+    for(size_t i = 0; i < freeable.size(); ++i)
+        freeable[i].deleter(freeable[i].ptr);
+}
+
+/**
+* Moves the retired objects no reader can hold any more to freeable. Room
+* for them is made first, so a failed allocation leaves retired_ intact.
+*/
+inline void EpochDomain::collectLocked(std::vector<Retired>& freeable)
+{
+    freeable.reserve(retired_.size());
+    uint64_t oldest = epoch_.fetch_add(1) + 1;
+    for(const SlotBlock* block = &slots_; block != NULL; block = block->next.load())
+    {
+        for(size_t i = 0; i < SLOTS_PER_BLOCK; ++i)
+        {
+            uint64_t e = block->slots[i].epoch.load();
+            if(e != 0 && e < oldest)
+                oldest = e;
+        }
+    }
+
+    size_t kept = 0;
+    for(size_t i = 0; i < retired_.size(); ++i)
+    {
+        if(retired_[i].epoch < oldest)
+            freeable.push_back(retired_[i]);
+        else
+            retired_[kept++] = retired_[i];
+    }
+    retired_.resize(kept);
+
+    // Avoid rescanning on every retire while a long reader pins old nodes.
+    collectThreshold_ = std::max<size_t>(64, 2 * kept);
+}
+
+/**
+* Number of retired objects that have not been freed yet.
+*/
+inline size_t EpochDomain::pending() const
+{
+    std::lock_guard<std::mutex> lock(retireLock_);
+    return retired_.size();
+}
+
+inline EpochGuard::EpochGuard(EpochDomain& domain) :
+    domain_(domain),
+    slot_(domain.enter())
+{
+
+}
+
+inline EpochGuard::~EpochGuard()
+{
+    domain_.exit(slot_);
+}
+
+#endif
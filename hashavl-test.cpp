@@ -0,0 +1,135 @@
+#include <cstddef>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "hashavl.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for HashIndexedAVLTree: the std::map comparison, and that the
+// index follows every path that adds, frees or moves a node.
+
+template <typename Tree>
+bool balancedOk(const Tree& tree)
+{
+    return tree.isBalanced();
+}
+
+/**
+* A hash that sends every key to one of four values, so that probing,
+* backward shifting and rehashing all run on long clusters.
+*/
+struct FewHashes
+{
+    size_t operator()(int key) const
+    {
+        return (size_t)(key % 4);
+    }
+};
+
+/**
+* True if exactly the keys in [0, count) that step divides are found, each
+* mapping to itself, and size() counts them.
+*/
+template <typename Tree>
+bool holdsMultiples(Tree& tree, int count, int step)
+{
+    size_t expected = 0;
+    for(int key = 0; key < count; ++key)
+    {
+        typename Tree::iterator it = tree.find(key);
+        if(key % step == 0)
+        {
+            ++expected;
+            if(it == tree.end() || it->second != key)
+                return false;
+        }
+        else if(it != tree.end())
+        {
+            return false;
+        }
+    }
+    return tree.size() == expected;
+}
+
+void testCollisions()
+{
+    const char* name = "HashIndexedAVLTree collisions";
+    HashIndexedAVLTree<int, int, FewHashes> tree;
+    for(int key = 0; key < 2000; ++key)
+        tree.insert(make_pair(key, key));
+    check(holdsMultiples(tree, 2000, 1), name, "keys lost from a crowded index");
+    for(int key = 0; key < 2000; ++key)
+    {
+        if(key % 3 != 0)
+            tree.remove(key);
+    }
+    check(holdsMultiples(tree, 2000, 3), name, "backward shifting lost or kept keys");
+    check(tree.isBalanced(), name, "tree not balanced");
+}
+
+/**
+* Compaction moves nodes, handles and merge carry them between trees, and
+* buildFromSorted and clear replace them wholesale; the index must point
+* at the live nodes after each.
+*/
+void testIndexFollowsNodes()
+{
+    const char* name = "HashIndexedAVLTree index";
+    HashIndexedAVLTree<int, int> tree;
+    vector<pair<int, int> > sorted;
+    for(int key = 0; key < 3000; key += 2)
+        sorted.push_back(make_pair(key, key));
+    tree.buildFromSorted(sorted.begin(), sorted.size());
+    check(holdsMultiples(tree, 3000, 2), name, "index wrong after buildFromSorted");
+    tree.compact();
+    check(holdsMultiples(tree, 3000, 2), name, "index wrong after compact");
+
+    HashIndexedAVLTree<int, int> other;
+    for(int key = 1; key < 3000; key += 2)
+        other.insert(make_pair(key, key));
+    HashIndexedAVLTree<int, int>::node_type handle = other.extract(1);
+    check(!handle.empty() && other.find(1) == other.end() && other.size() == 1499, name,
+          "extract left the key in the source index");
+    check(tree.insert(std::move(handle)) && tree.find(1) != tree.end() && tree.size() == 1501, name,
+          "inserted handle missing from the target index");
+    tree.merge(other);
+    check(holdsMultiples(tree, 3000, 1), name, "index wrong after merge");
+    check(other.size() == 0 && other.find(3) == other.end(), name, "merge left keys in the source index");
+
+    tree.clear();
+    check(tree.size() == 0 && tree.find(10) == tree.end(), name, "clear left keys in the index");
+    tree.insert(make_pair(10, 10));
+    check(tree.size() == 1 && tree.find(10) != tree.end(), name, "index unusable after clear");
+}
+
+/**
+* Draining the tree must give back most of the index, not keep its peak.
+*/
+void testShrink()
+{
+    const char* name = "HashIndexedAVLTree shrink";
+    HashIndexedAVLTree<int, int> tree;
+    for(int key = 0; key < 20000; ++key)
+        tree.insert(make_pair(key, key));
+    size_t peak = tree.memory_usage().auxiliaryBytes;
+    for(int key = 10; key < 20000; ++key)
+        tree.remove(key);
+    size_t drained = tree.memory_usage().auxiliaryBytes;
+    check(drained * 100 < peak, name, "index kept its peak size after removals");
+    check(tree.size() == 10, name, "wrong size after removals");
+    for(int key = 0; key < 10; ++key)
+        check(tree.find(key) != tree.end(), name, "key lost while the index shrank");
+}
+
+int main()
+{
+    HashIndexedAVLTree<int, int> hashed;
+    stressMap("HashIndexedAVLTree", hashed, 2, balancedOk<HashIndexedAVLTree<int, int> >);
+    testCollisions();
+    testIndexFollowsNodes();
+    testShrink();
+    return testSummary("HashIndexedAVLTree");
+}
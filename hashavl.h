@@ -0,0 +1,281 @@
+#ifndef HASHAVL_H
+#define HASHAVL_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* An AVLTree with an open-addressing hash index from keys to nodes beside
+* it. find, operator[] and remove go through the index in O(1) expected
+* time; iteration, lower_bound and the other ordered queries still walk
+* the tree. The index is maintained in createNode and destroyNode, which
+* every path that adds or frees a node goes through, including
+* buildFromSorted and clear, and in the hooks for nodes that compaction
+* moves or that node handles and merge carry between trees.
+*
+* The index is linear probing over a power-of-two table of node pointers
+* with each key's mixed hash cached beside it, so probing rarely touches
+* a node and growing the table never rehashes a key. Removal uses
+* backward shifting instead of tombstones. It costs 16 bytes per slot
+* instead of a second copy of every key. The table doubles when it would
+* pass 3/4 load and halves when removals take it below 1/4, so above
+* MIN_CAPACITY it holds between 4/3 and 4 slots per node, about 2.7 just
+* after growing.
+*
+* Hash must agree with the tree's ordering: keys that are neither less
+* nor greater than each other must hash alike.
+*/
+template <typename Key, typename Value, typename Hash = std::hash<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class HashIndexedAVLTree : public AVLTree<Key, Value, Alloc>
+{
+public:
+    explicit HashIndexedAVLTree(const Hash& hash = Hash(), const Alloc& alloc = Alloc());
+
+    size_t size() const;
+    void reserve(size_t count);
+    virtual TreeMemoryUsage memory_usage() const override;
+
+protected:
+    struct Slot
+    {
+        Node<Key, Value>* node;
+        size_t hash;
+    };
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Slot> SlotAlloc;
+
+    virtual Node<Key, Value>* createNode(const Key& key, const Value& value, Node<Key, Value>* parent) override;
+    virtual void destroyNode(Node<Key, Value>* n) override;
+    virtual Node<Key, Value>* internalFind(const Key& key) const override;
+    virtual void nodeMoved(AVLNode<Key, Value>* to) override;
+    virtual void adoptNode(AVLNode<Key, Value>* n) override;
+    virtual void disownNode(AVLNode<Key, Value>* n) override;
+
+    size_t hashOf(const Key& key) const;
+    void indexInsert(Node<Key, Value>* n, size_t hash);
+    void indexErase(Node<Key, Value>* n);
+    void shrinkIndex();
+    void rehash(size_t capacity);
+
+    static const size_t MIN_CAPACITY = 16;
+
+    Hash hash_;
+    std::vector<Slot, SlotAlloc> slots_;
+    size_t count_;
+};
+
+template <typename Key, typename Value, typename Hash, typename Alloc>
+HashIndexedAVLTree<Key, Value, Hash, Alloc>::HashIndexedAVLTree(const Hash& hash, const Alloc& alloc) :
+    AVLTree<Key, Value, Alloc>(alloc),
+    hash_(hash),
+    slots_(SlotAlloc(alloc)),
+    count_(0)
+{
+
+}
+
+/**
+* Number of keys in the tree.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+size_t HashIndexedAVLTree<Key, Value, Hash, Alloc>::size() const
+{
+    return count_;
+}
+
+/**
+* Sizes the index for count keys, so that loading a known number of keys
+* does not rehash along the way.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::reserve(size_t count)
+{
+    size_t capacity = MIN_CAPACITY;
+    while(capacity * 3 < count * 4)
+        capacity *= 2;
+    if(capacity > slots_.size())
+        rehash(capacity);
+}
+
+/**
+* Adds the index table to the tree's footprint.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+TreeMemoryUsage HashIndexedAVLTree<Key, Value, Hash, Alloc>::memory_usage() const
+{
+    TreeMemoryUsage usage = AVLTree<Key, Value, Alloc>::memory_usage();
+    usage.auxiliaryBytes += slots_.capacity() * sizeof(Slot);
+    return usage;
+}
+
+/**
+* Spreads the user hash over all bits; std::hash is the identity for
+* integers, which would put runs of keys in runs of slots.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+size_t HashIndexedAVLTree<Key, Value, Hash, Alloc>::hashOf(const Key& key) const
+{
+    uint64_t h = (uint64_t)hash_(key) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h ^ (h >> 32));
+}
+
+/**
+* Creates the node and records it in the index. If the index cannot grow
+* the node is freed again and the tree is unchanged.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+Node<Key, Value>*
+HashIndexedAVLTree<Key, Value, Hash, Alloc>::createNode(const Key& key, const Value& value, Node<Key, Value>* parent)
+{
+    Node<Key, Value> *n = AVLTree<Key, Value, Alloc>::createNode(key, value, parent);
+    try
+    {
+        if((count_ + 1) * 4 > slots_.size() * 3)
+            rehash(slots_.empty() ? MIN_CAPACITY : slots_.size() * 2);
+    }
+    catch(...)
+    {
+        AVLTree<Key, Value, Alloc>::destroyNode(n);
+        throw;
+    }
+    indexInsert(n, hashOf(key));
+    return n;
+}
+
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::destroyNode(Node<Key, Value>* n)
+{
+    indexErase(n);
+    AVLTree<Key, Value, Alloc>::destroyNode(n);
+    shrinkIndex();
+}
+
+/**
+* Compaction freed the old node, and with it its slot; index the copy.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::nodeMoved(AVLNode<Key, Value>* to)
+{
+    indexInsert(to, hashOf(to->getKey()));
+}
+
+/**
+* A node arriving through a node handle or merge; grows the index before
+* the node is linked, so a failure leaves both unchanged.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::adoptNode(AVLNode<Key, Value>* n)
+{
+    if((count_ + 1) * 4 > slots_.size() * 3)
+        rehash(slots_.empty() ? MIN_CAPACITY : slots_.size() * 2);
+    indexInsert(n, hashOf(n->getKey()));
+}
+
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::disownNode(AVLNode<Key, Value>* n)
+{
+    indexErase(n);
+    shrinkIndex();
+}
+
+/**
+* Looks the key up in the index instead of descending the tree.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+Node<Key, Value>* HashIndexedAVLTree<Key, Value, Hash, Alloc>::internalFind(const Key& key) const
+{
+    if(count_ == 0)
+        return NULL;
+    size_t mask = slots_.size() - 1;
+    size_t h = hashOf(key);
+    for(size_t i = h & mask; slots_[i].node != NULL; i = (i + 1) & mask)
+    {
+        const Slot& slot = slots_[i];
+        if(slot.hash == h && !(slot.node->getKey() < key) && !(key < slot.node->getKey()))
+            return slot.node;
+    }
+    return NULL;
+}
+
+/**
+* @precondition The table has a free slot
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::indexInsert(Node<Key, Value>* n, size_t hash)
+{
+    size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    while(slots_[i].node != NULL)
+        i = (i + 1) & mask;
+    slots_[i].node = n;
+    slots_[i].hash = hash;
+    ++count_;
+}
+
+/**
+* Removes n's slot, then shifts later entries of the probe run back so
+* that no lookup stops early at the hole.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::indexErase(Node<Key, Value>* n)
+{
+    size_t mask = slots_.size() - 1;
+    size_t i = hashOf(n->getKey()) & mask;
+    while(slots_[i].node != n)
+        i = (i + 1) & mask;
+
+    for(size_t j = (i + 1) & mask; slots_[j].node != NULL; j = (j + 1) & mask)
+    {
+        // Move the entry at j back to the hole unless its home slot lies
+        // between the hole and j.
+        size_t home = slots_[j].hash & mask;
+        if(((j - home) & mask) >= ((j - i) & mask))
+        {
+            slots_[i] = slots_[j];
+            i = j;
+        }
+    }
+    slots_[i].node = NULL;
+    --count_;
+}
+
+/**
+* Halves the table once it falls below 1/4 load, so a drained tree does
+* not keep its peak index. Runs on paths that must not throw, so if the
+* smaller table cannot be allocated the current one is simply kept.
+*/
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::shrinkIndex()
+{
+    if(slots_.size() <= MIN_CAPACITY || count_ * 4 >= slots_.size())
+        return;
+    try
+    {
+        rehash(slots_.size() / 2);
+    }
+    catch(...)
+    {
+    }
+}
+
+template <typename Key, typename Value, typename Hash, typename Alloc>
+void HashIndexedAVLTree<Key, Value, Hash, Alloc>::rehash(size_t capacity)
+{
+    Slot empty = { NULL, 0 };
+    std::vector<Slot, SlotAlloc> old(capacity, empty, slots_.get_allocator());
+    old.swap(slots_);
+    count_ = 0;
+    for(size_t i = 0; i < old.size(); ++i)
+    {
+        if(old[i].node != NULL)
+            indexInsert(old[i].node, old[i].hash);
+    }
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include <cstdlib>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "intervaltree.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for IntervalTree: overlap queries against a brute-force scan of a
+// std::map while the tree changes, with the balance and subtree maxima
+// checked along the way.
+
+typedef map<pair<int, int>, int> Reference;
+
+/**
+* Checks that the intervals overlap_begin(lo, hi) yields are exactly those
+* of ref that overlap [lo, hi], in key order.
+*/
+void checkQuery(const char* name, const IntervalTree<int, int>& tree, const Reference& ref, int lo, int hi)
+{
+    IntervalTree<int, int>::overlap_iterator it = tree.overlap_begin(lo, hi);
+    bool same = true;
+    for(Reference::const_iterator r = ref.begin(); r != ref.end() && same; ++r)
+    {
+        if(r->first.first > hi || r->first.second < lo)
+            continue;
+        same = it != tree.overlap_end() && it->first.lo == r->first.first &&
+               it->first.hi == r->first.second && it->second == r->second;
+        if(same)
+            ++it;
+    }
+    check(same && it == tree.overlap_end(), name, "overlap query differs from brute force");
+}
+
+void testRandom()
+{
+    const char* name = "IntervalTree";
+    IntervalTree<int, int> tree;
+    Reference ref;
+    srand(13);
+    for(int i = 0; i < 20000; ++i)
+    {
+        int lo = rand() % 1000;
+        int hi = lo + rand() % 50;
+        if(rand() % 3 != 0)
+        {
+            tree.insert(make_pair(Interval<int>(lo, hi), i));
+            ref[make_pair(lo, hi)] = i;
+        }
+        else
+        {
+            Reference::iterator r = ref.lower_bound(make_pair(lo, 0));
+            if(r == ref.end())
+                continue;
+            tree.remove(Interval<int>(r->first.first, r->first.second));
+            ref.erase(r);
+        }
+        if(i % 500 != 0)
+            continue;
+        check(tree.isBalanced() && tree.checkMaxima(), name, "balance or subtree maxima broken");
+        int qlo = rand() % 1000;
+        checkQuery(name, tree, ref, qlo, qlo + rand() % 30);
+        checkQuery(name, tree, ref, qlo, qlo);
+    }
+    tree.compact();
+    check(tree.isBalanced() && tree.checkMaxima(), name, "compact broke subtree maxima");
+    checkQuery(name, tree, ref, 0, 2000);
+}
+
+/**
+* buildFromSorted must leave correct maxima, stab must find the intervals
+* holding a point, and node handles must be refused.
+*/
+void testBuildAndStab()
+{
+    const char* name = "IntervalTree build";
+    // [i, i + 10] for i = 0, 3, 6, ...: each point lies in three or four.
+    vector<pair<Interval<int>, int> > sorted;
+    Reference ref;
+    for(int i = 0; i < 3000; i += 3)
+    {
+        sorted.push_back(make_pair(Interval<int>(i, i + 10), i));
+        ref[make_pair(i, i + 10)] = i;
+    }
+    IntervalTree<int, int> tree;
+    tree.buildFromSorted(sorted.begin(), sorted.size());
+    check(tree.isBalanced() && tree.checkMaxima(), name, "buildFromSorted left wrong maxima");
+    for(int point = 0; point < 3020; point += 7)
+    {
+        size_t found = 0;
+        bool holds = true;
+        for(IntervalTree<int, int>::overlap_iterator it = tree.stab(point); it != tree.overlap_end(); ++it)
+        {
+            holds = holds && it->first.lo <= point && point <= it->first.hi;
+            ++found;
+        }
+        size_t expected = 0;
+        for(int i = 0; i < 3000; i += 3)
+            expected += (i <= point && point <= i + 10) ? 1 : 0;
+        check(holds && found == expected, name, "stab differs from brute force");
+    }
+    check(tree.overlap_begin(5000, 6000) == tree.overlap_end(), name, "query past every interval matched");
+
+    bool refused = false;
+    try
+    {
+        tree.extract(Interval<int>(0, 10));
+    }
+    catch(logic_error&)
+    {
+        refused = true;
+    }
+    check(refused && tree.find(Interval<int>(0, 10)) != tree.end(), name, "interval node left in a handle");
+}
+
+int main()
+{
+    testRandom();
+    testBuildAndStab();
+    return testSummary("IntervalTree");
+}
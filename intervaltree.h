@@ -0,0 +1,592 @@
+#ifndef INTERVALTREE_H
+#define INTERVALTREE_H
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* A closed interval [lo, hi], ordered by lo and then by hi.
+*/
+template <typename T>
+struct Interval
+{
+    T lo;
+    T hi;
+
+    Interval() : lo(), hi() { }
+    Interval(const T& l, const T& h) : lo(l), hi(h) { }
+};
+
+template <typename T>
+bool operator<(const Interval<T>& a, const Interval<T>& b)
+{
+    return a.lo < b.lo || (!(b.lo < a.lo) && a.hi < b.hi);
+}
+
+template <typename T>
+bool operator>(const Interval<T>& a, const Interval<T>& b)
+{
+    return b < a;
+}
+
+template <typename T>
+bool operator==(const Interval<T>& a, const Interval<T>& b)
+{
+    return !(a < b) && !(b < a);
+}
+
+template <typename T>
+std::ostream& operator<<(std::ostream& out, const Interval<T>& interval)
+{
+    return out << '[' << interval.lo << ", " << interval.hi << ']';
+}
+
+/**
+* An AVLNode keyed by a closed interval [lo, hi] that also holds the
+* largest hi anywhere in its subtree.
+*/
+template <typename T, typename Value>
+class IntervalNode : public AVLNode<Interval<T>, Value>
+{
+public:
+    IntervalNode(const Interval<T>& key, const Value& value, IntervalNode<T, Value>* parent);
+    virtual ~IntervalNode();
+
+    const T& getMaxHi() const;
+    void setMaxHi(const T& maxHi);
+
+    virtual IntervalNode<T, Value>* getParent() const override;
+    virtual IntervalNode<T, Value>* getLeft() const override;
+    virtual IntervalNode<T, Value>* getRight() const override;
+
+protected:
+    T maxHi_;
+};
+
+template <typename T, typename Value>
+IntervalNode<T, Value>::IntervalNode(const Interval<T>& key, const Value& value, IntervalNode<T, Value>* parent) :
+    AVLNode<Interval<T>, Value>(key, value, parent),
+    maxHi_(key.hi)
+{
+
+}
+
+template <typename T, typename Value>
+IntervalNode<T, Value>::~IntervalNode()
+{
+
+}
+
+template <typename T, typename Value>
+const T& IntervalNode<T, Value>::getMaxHi() const
+{
+    return maxHi_;
+}
+
+template <typename T, typename Value>
+void IntervalNode<T, Value>::setMaxHi(const T& maxHi)
+{
+    maxHi_ = maxHi;
+}
+
+template <typename T, typename Value>
+IntervalNode<T, Value>* IntervalNode<T, Value>::getParent() const
+{
+    return static_cast<IntervalNode<T, Value>*>(this->parent_);
+}
+
+template <typename T, typename Value>
+IntervalNode<T, Value>* IntervalNode<T, Value>::getLeft() const
+{
+    return static_cast<IntervalNode<T, Value>*>(this->left_);
+}
+
+template <typename T, typename Value>
+IntervalNode<T, Value>* IntervalNode<T, Value>::getRight() const
+{
+    return static_cast<IntervalNode<T, Value>*>(this->right_);
+}
+
+
+/**
+* An AVL tree of closed intervals [lo, hi], ordered by (lo, hi), that
+* answers "which intervals overlap [a, b]" without a scan. Every node
+* carries the largest hi in its subtree; a query skips any subtree whose
+* maximum is below a, and stops at the first interval in key order whose
+* lo is past b. The maxima are refreshed by the rotations, by nodeSwap and
+* by a walk to the root after each insert and remove.
+*
+* A query costs O(log n) to reach the first match and visits only nodes
+* on the paths to the matches it reports, so O(min(n, k log n)) for k
+* matches and much less when the matches are clustered in key order.
+* overlap_iterator walks the tree through parent links and allocates
+* nothing.
+*
+* Intervals are keys: inserting an interval that is already present
+* overwrites its value.
+*/
+template <typename T, typename Value,
+          typename Alloc = std::allocator<std::pair<const Interval<T>, Value> > >
+class IntervalTree : public AVLTree<Interval<T>, Value, Alloc>
+{
+public:
+    typedef IntervalNode<T, Value> NodeT;
+
+    /**
+    * Visits, in key order, the intervals that overlap a query range.
+    */
+    class overlap_iterator
+    {
+    public:
+        overlap_iterator();
+
+        std::pair<const Interval<T>, Value>& operator*() const;
+        std::pair<const Interval<T>, Value>* operator->() const;
+
+        bool operator==(const overlap_iterator& rhs) const;
+        bool operator!=(const overlap_iterator& rhs) const;
+
+        overlap_iterator& operator++();
+
+    protected:
+        friend class IntervalTree<T, Value, Alloc>;
+        overlap_iterator(NodeT* root, const T& lo, const T& hi);
+
+        NodeT* leftmost(NodeT* n) const;
+        void advance();
+        void settle();
+
+        NodeT *current_;
+        T lo_;
+        T hi_;
+    };
+
+    explicit IntervalTree(const Alloc& alloc = Alloc());
+    virtual ~IntervalTree();
+
+    virtual void insert(const std::pair<const Interval<T>, Value>& new_item);
+    virtual void remove(const Interval<T>& key);
+    template <typename InputIt>
+    void buildFromSorted(InputIt first, size_t count);
+    virtual void compact() override;
+
+    overlap_iterator overlap_begin(const T& lo, const T& hi) const;
+    overlap_iterator stab(const T& point) const;
+    overlap_iterator overlap_end() const;
+    bool checkMaxima() const;
+
+protected:
+    virtual Node<Interval<T>, Value>* createNode(const Interval<T>& key, const Value& value, Node<Interval<T>, Value>* parent) override;
+    virtual void destroyNode(Node<Interval<T>, Value>* n) override;
+    virtual size_t nodeSize() const override;
+    virtual bool plainNodes() const override;
+    virtual AVLNode<Interval<T>, Value>* copyNodeTo(void* where, AVLNode<Interval<T>, Value>* from) override;
+    virtual void nodeSwap(AVLNode<Interval<T>, Value>* n1, AVLNode<Interval<T>, Value>* n2) override;
+    virtual void rotateRight(AVLNode<Interval<T>, Value>* x) override;
+    virtual void rotateLeft(AVLNode<Interval<T>, Value>* x) override;
+
+    NodeT* root() const;
+    static void update(NodeT* n);
+    static void updateToRoot(NodeT* n);
+    static void updateAll(NodeT* n);
+    static bool checkHelp(const NodeT* n);
+};
+
+template <typename T, typename Value, typename Alloc>
+IntervalTree<T, Value, Alloc>::overlap_iterator::overlap_iterator() :
+    current_(NULL),
+    lo_(),
+    hi_()
+{
+
+}
+
+/**
+* Positions the iterator on the first interval overlapping [lo, hi].
+*/
+template <typename T, typename Value, typename Alloc>
+IntervalTree<T, Value, Alloc>::overlap_iterator::overlap_iterator(NodeT* root, const T& lo, const T& hi) :
+    current_(NULL),
+    lo_(lo),
+    hi_(hi)
+{
+    if(root != NULL && !(root->getMaxHi() < lo_))
+    {
+        current_ = leftmost(root);
+        settle();
+    }
+}
+
+template <typename T, typename Value, typename Alloc>
+std::pair<const Interval<T>, Value>&
+IntervalTree<T, Value, Alloc>::overlap_iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+template <typename T, typename Value, typename Alloc>
+std::pair<const Interval<T>, Value>*
+IntervalTree<T, Value, Alloc>::overlap_iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+template <typename T, typename Value, typename Alloc>
+bool IntervalTree<T, Value, Alloc>::overlap_iterator::operator==(const overlap_iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template <typename T, typename Value, typename Alloc>
+bool IntervalTree<T, Value, Alloc>::overlap_iterator::operator!=(const overlap_iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+/**
+* The first node of n's subtree in key order, skipping left subtrees that
+* end before the query starts.
+*/
+template <typename T, typename Value, typename Alloc>
+typename IntervalTree<T, Value, Alloc>::NodeT*
+IntervalTree<T, Value, Alloc>::overlap_iterator::leftmost(NodeT* n) const
+{
+    while(n->getLeft() != NULL && !(n->getLeft()->getMaxHi() < lo_))
+        n = n->getLeft();
+    return n;
+}
+
+/**
+* Moves forward from current_, in key order and skipping subtrees that end
+* before the query, until current_ overlaps the query. Ends at the first
+* interval that starts after it.
+*/
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::overlap_iterator::settle()
+{
+    while(current_ != NULL)
+    {
+        const Interval<T>& key = current_->getKey();
+        if(hi_ < key.lo)
+        {
+            current_ = NULL;
+            return;
+        }
+        if(!(key.hi < lo_))
+            return;
+
+        advance();
+    }
+}
+
+/**
+* Steps to the next node in key order, skipping right subtrees that end
+* before the query starts.
+*/
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::overlap_iterator::advance()
+{
+    NodeT *right = current_->getRight();
+    if(right != NULL && !(right->getMaxHi() < lo_))
+    {
+        current_ = leftmost(right);
+    }
+    else
+    {
+        while(current_->getParent() != NULL && current_ == current_->getParent()->getRight())
+            current_ = current_->getParent();
+        current_ = current_->getParent();
+    }
+}
+
+template <typename T, typename Value, typename Alloc>
+typename IntervalTree<T, Value, Alloc>::overlap_iterator&
+IntervalTree<T, Value, Alloc>::overlap_iterator::operator++()
+{
+    advance();
+    settle();
+    return *this;
+}
+
+
+template <typename T, typename Value, typename Alloc>
+IntervalTree<T, Value, Alloc>::IntervalTree(const Alloc& alloc) :
+    AVLTree<Interval<T>, Value, Alloc>(alloc)
+{
+
+}
+
+/**
+* Frees the nodes here, while destroyNode still resolves to this class.
+*/
+template <typename T, typename Value, typename Alloc>
+IntervalTree<T, Value, Alloc>::~IntervalTree()
+{
+    this->clear();
+}
+
+template <typename T, typename Value, typename Alloc>
+Node<Interval<T>, Value>*
+IntervalTree<T, Value, Alloc>::createNode(const Interval<T>& key, const Value& value, Node<Interval<T>, Value>* parent)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    NodeT *n = NodeTraits::allocate(alloc, 1);
+    try
+    {
+        NodeTraits::construct(alloc, n, key, value, static_cast<NodeT*>(parent));
+    }
+    catch(...)
+    {
+        NodeTraits::deallocate(alloc, n, 1);
+        throw;
+    }
+    this->nodeAdded(sizeof(NodeT));
+    return n;
+}
+
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::destroyNode(Node<Interval<T>, Value>* n)
+{
+    this->nodeRemoved(sizeof(NodeT));
+    if(this->releaseNode(n))
+        return;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    NodeT *node = static_cast<NodeT*>(n);
+    NodeTraits::destroy(alloc, node);
+    NodeTraits::deallocate(alloc, node, 1);
+}
+
+template <typename T, typename Value, typename Alloc>
+size_t IntervalTree<T, Value, Alloc>::nodeSize() const
+{
+    return sizeof(NodeT);
+}
+
+/**
+* IntervalNodes carry the subtree maximum, so they cannot travel in node
+* handles.
+*/
+template <typename T, typename Value, typename Alloc>
+bool IntervalTree<T, Value, Alloc>::plainNodes() const
+{
+    return false;
+}
+
+/**
+* Compaction copies carry the maximum along with the balance.
+*/
+template <typename T, typename Value, typename Alloc>
+AVLNode<Interval<T>, Value>*
+IntervalTree<T, Value, Alloc>::copyNodeTo(void* where, AVLNode<Interval<T>, Value>* from)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc alloc(this->alloc_);
+    NodeT *source = static_cast<NodeT*>(from);
+    NodeT *n = static_cast<NodeT*>(where);
+    NodeTraits::construct(alloc, n, source->getKey(), source->getValue(), source->getParent());
+    n->setBalance(source->getBalance());
+    n->setMaxHi(source->getMaxHi());
+    return n;
+}
+
+/**
+* The maxima describe subtrees, which stay where they are when two nodes
+* trade places, so they are swapped back like the balances.
+*/
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::nodeSwap(AVLNode<Interval<T>, Value>* n1, AVLNode<Interval<T>, Value>* n2)
+{
+    AVLTree<Interval<T>, Value, Alloc>::nodeSwap(n1, n2);
+    NodeT *a = static_cast<NodeT*>(n1);
+    NodeT *b = static_cast<NodeT*>(n2);
+    T maxHi = a->getMaxHi();
+    a->setMaxHi(b->getMaxHi());
+    b->setMaxHi(maxHi);
+}
+
+/**
+* After the rotation x is the child of its old left child; only those two
+* subtrees changed.
+*/
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::rotateRight(AVLNode<Interval<T>, Value>* x)
+{
+    AVLTree<Interval<T>, Value, Alloc>::rotateRight(x);
+    NodeT *n = static_cast<NodeT*>(x);
+    update(n);
+    update(n->getParent());
+}
+
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::rotateLeft(AVLNode<Interval<T>, Value>* x)
+{
+    AVLTree<Interval<T>, Value, Alloc>::rotateLeft(x);
+    NodeT *n = static_cast<NodeT*>(x);
+    update(n);
+    update(n->getParent());
+}
+
+/**
+* Overwriting an existing interval changes no maxima; a new one raises
+* them along its path to the root.
+*/
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::insert(const std::pair<const Interval<T>, Value>& new_item)
+{
+    AVLTree<Interval<T>, Value, Alloc>::insert(new_item);
+    updateToRoot(static_cast<NodeT*>(this->internalFind(new_item.first)));
+}
+
+/**
+* Works out which node loses a descendant before the AVL removal runs, so
+* the maxima can be refreshed from there afterwards. Rotations during the
+* removal keep that node's ancestors above it.
+*/
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::remove(const Interval<T>& key)
+{
+    NodeT *n = static_cast<NodeT*>(this->internalFind(key));
+    if(n == NULL)
+        return;
+
+    // AVLTree::remove swaps n with its predecessor, or with its right
+    // child when it has no left, and unlinks it from that position.
+    NodeT *target = NULL;
+    if(n->getLeft() != NULL)
+        target = static_cast<NodeT*>(this->predecessor(n));
+    else if(n->getRight() != NULL)
+        target = n->getRight();
+
+    NodeT *start;
+    if(target == NULL)
+        start = n->getParent();
+    else if(target->getParent() == n)
+        start = target;
+    else
+        start = target->getParent();
+
+    AVLTree<Interval<T>, Value, Alloc>::remove(key);
+    updateToRoot(start);
+}
+
+/**
+* Builds the tree as AVLTree::buildFromSorted does, then computes every
+* maximum in one post-order pass.
+*/
+template <typename T, typename Value, typename Alloc>
+template <typename InputIt>
+void IntervalTree<T, Value, Alloc>::buildFromSorted(InputIt first, size_t count)
+{
+    AVLTree<Interval<T>, Value, Alloc>::buildFromSorted(first, count);
+    updateAll(root());
+}
+
+/**
+* A full compaction reshapes the tree, so every maximum is recomputed.
+*/
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::compact()
+{
+    AVLTree<Interval<T>, Value, Alloc>::compact();
+    updateAll(root());
+}
+
+/**
+* Returns an iterator over the intervals overlapping [lo, hi] in key
+* order. Intervals that only touch the query at an endpoint overlap it.
+*/
+template <typename T, typename Value, typename Alloc>
+typename IntervalTree<T, Value, Alloc>::overlap_iterator
+IntervalTree<T, Value, Alloc>::overlap_begin(const T& lo, const T& hi) const
+{
+    return overlap_iterator(root(), lo, hi);
+}
+
+/**
+* Returns an iterator over the intervals that contain point.
+*/
+template <typename T, typename Value, typename Alloc>
+typename IntervalTree<T, Value, Alloc>::overlap_iterator
+IntervalTree<T, Value, Alloc>::stab(const T& point) const
+{
+    return overlap_iterator(root(), point, point);
+}
+
+template <typename T, typename Value, typename Alloc>
+typename IntervalTree<T, Value, Alloc>::overlap_iterator
+IntervalTree<T, Value, Alloc>::overlap_end() const
+{
+    return overlap_iterator();
+}
+
+/**
+* Checks every stored maximum against its subtree.
+*/
+template <typename T, typename Value, typename Alloc>
+bool IntervalTree<T, Value, Alloc>::checkMaxima() const
+{
+    return checkHelp(root());
+}
+
+template <typename T, typename Value, typename Alloc>
+typename IntervalTree<T, Value, Alloc>::NodeT* IntervalTree<T, Value, Alloc>::root() const
+{
+    return static_cast<NodeT*>(this->root_);
+}
+
+/**
+* Recomputes n's maximum from its own hi and its children's maxima.
+*/
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::update(NodeT* n)
+{
+    const T *best = &n->getKey().hi;
+    if(n->getLeft() != NULL && *best < n->getLeft()->getMaxHi())
+        best = &n->getLeft()->getMaxHi();
+    if(n->getRight() != NULL && *best < n->getRight()->getMaxHi())
+        best = &n->getRight()->getMaxHi();
+    n->setMaxHi(*best);
+}
+
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::updateToRoot(NodeT* n)
+{
+    for(; n != NULL; n = n->getParent())
+        update(n);
+}
+
+template <typename T, typename Value, typename Alloc>
+void IntervalTree<T, Value, Alloc>::updateAll(NodeT* n)
+{
+    if(n == NULL)
+        return;
+    updateAll(n->getLeft());
+    updateAll(n->getRight());
+    update(n);
+}
+
+template <typename T, typename Value, typename Alloc>
+bool IntervalTree<T, Value, Alloc>::checkHelp(const NodeT* n)
+{
+    if(n == NULL)
+        return true;
+    const T *best = &n->getKey().hi;
+    if(n->getLeft() != NULL && *best < n->getLeft()->getMaxHi())
+        best = &n->getLeft()->getMaxHi();
+    if(n->getRight() != NULL && *best < n->getRight()->getMaxHi())
+        best = &n->getRight()->getMaxHi();
+    if(*best < n->getMaxHi() || n->getMaxHi() < *best)
+        return false;
+    return checkHelp(n->getLeft()) && checkHelp(n->getRight());
+}
+
+#endif
@@ -0,0 +1,166 @@
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include "persistentavl.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for PersistentAVLTree: every version keeps its own contents while
+// later versions are derived from it, and an update that throws, whether
+// copying a value or allocating a node, leaves its source version intact
+// and leaks no node.
+
+/**
+* True if version holds exactly the pairs of ref, in order.
+*/
+template <typename Value>
+bool sameVersion(const PersistentAVLTree<int, Value>& version, const map<int, int>& ref)
+{
+    typename PersistentAVLTree<int, Value>::iterator it = version.begin();
+    map<int, int>::const_iterator r = ref.begin();
+    for(; r != ref.end() && it != version.end(); ++r, ++it)
+    {
+        if(it->first != r->first || !(it->second == Value(r->second)))
+            return false;
+    }
+    return r == ref.end() && it == version.end() && version.size() == ref.size();
+}
+
+/**
+* Derives each version from a random earlier one and checks all of them
+* against the std::map they should equal.
+*/
+void testVersions()
+{
+    const char* name = "PersistentAVLTree";
+    vector<PersistentAVLTree<int, int> > versions(1);
+    vector<map<int, int> > refs(1);
+    srand(21);
+    for(int i = 0; i < 3000; ++i)
+    {
+        size_t from = rand() % versions.size();
+        int key = rand() % 400;
+        PersistentAVLTree<int, int> next;
+        map<int, int> ref = refs[from];
+        if(rand() % 3 != 0)
+        {
+            next = versions[from].insert(make_pair(key, i));
+            ref[key] = i;
+        }
+        else
+        {
+            next = versions[from].remove(key);
+            ref.erase(key);
+        }
+        versions.push_back(next);
+        refs.push_back(ref);
+        if(versions.size() > 64)
+        {
+            size_t drop = rand() % versions.size();
+            versions.erase(versions.begin() + drop);
+            refs.erase(refs.begin() + drop);
+        }
+    }
+    bool same = true;
+    bool balanced = true;
+    for(size_t v = 0; v < versions.size(); ++v)
+    {
+        same = same && sameVersion(versions[v], refs[v]);
+        balanced = balanced && versions[v].isBalanced();
+    }
+    check(same, name, "a version differs from its std::map");
+    check(balanced, name, "a version is not balanced");
+
+    const PersistentAVLTree<int, int>& last = versions.back();
+    const map<int, int>& ref = refs.back();
+    bool lookups = true;
+    for(int key = -1; key < 401; ++key)
+    {
+        PersistentAVLTree<int, int>::iterator it = last.find(key);
+        map<int, int>::const_iterator r = ref.find(key);
+        lookups = lookups && (r == ref.end() ? it == last.end() : (it != last.end() && it->second == r->second));
+        PersistentAVLTree<int, int>::iterator lb = last.lower_bound(key);
+        r = ref.lower_bound(key);
+        lookups = lookups && (r == ref.end() ? lb == last.end() : (lb != last.end() && lb->first == r->first));
+    }
+    check(lookups, name, "find or lower_bound differs from std::map");
+}
+
+/**
+* Fails some updates through fail(), which arms a fault that disarm()
+* undoes. A failed update must leave the source version as it was, and
+* once every version is gone no value may be left alive.
+*/
+template <typename Arm, typename Disarm>
+void checkRollback(const char* name, Arm fail, Disarm disarm, unsigned seed)
+{
+    int thrown = 0;
+    {
+        PersistentAVLTree<int, ThrowingValue> tree;
+        map<int, int> ref;
+        srand(seed);
+        for(int i = 0; i < 20000; ++i)
+        {
+            int key = rand() % 500;
+            bool insert = rand() % 3 != 0;
+            pair<const int, ThrowingValue> item(key, ThrowingValue(i));
+            fail();
+            try
+            {
+                PersistentAVLTree<int, ThrowingValue> next = insert ? tree.insert(item) : tree.remove(key);
+                disarm();
+                tree = next;
+                if(insert)
+                    ref[key] = i;
+                else
+                    ref.erase(key);
+            }
+            catch(runtime_error&)
+            {
+                disarm();
+                ++thrown;
+            }
+            catch(bad_alloc&)
+            {
+                disarm();
+                ++thrown;
+            }
+            if(i % 1000 == 0)
+                check(sameVersion(tree, ref) && tree.isBalanced(), name, "failed update changed the tree");
+        }
+        check(sameVersion(tree, ref) && tree.isBalanced(), name, "failed update changed the tree");
+    }
+    check(ThrowingValue::live().load() == 0, name, "failed updates leaked nodes");
+    check(thrown > 0, name, "no update threw, so rollback went untested");
+}
+
+void armCopyFailure()
+{
+    ThrowingValue::copiesLeft() = rand() % 4 == 0 ? rand() % 6 : -1;
+}
+
+void disarmCopyFailure()
+{
+    ThrowingValue::copiesLeft() = -1;
+}
+
+void armAllocationFailure()
+{
+    allocationsLeft() = rand() % 4 == 0 ? rand() % 6 : -1;
+}
+
+void disarmAllocationFailure()
+{
+    allocationsLeft() = -1;
+}
+
+int main()
+{
+    testVersions();
+    checkRollback("PersistentAVLTree copy failure", armCopyFailure, disarmCopyFailure, 23);
+    checkRollback("PersistentAVLTree allocation failure", armAllocationFailure, disarmAllocationFailure, 24);
+    return testSummary("PersistentAVLTree");
+}
@@ -0,0 +1,601 @@
+#ifndef PERSISTENTAVL_H
+#define PERSISTENTAVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+/**
+* A node of a PersistentAVLTree. Nodes are immutable and shared between
+* every version that contains them, so they carry a reference count
+* instead of a parent pointer.
+*/
+template <typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    PersistentAVLNode(const std::pair<const Key, Value>& item,
+                      const PersistentAVLNode<Key, Value>* left,
+                      const PersistentAVLNode<Key, Value>* right);
+
+    const std::pair<const Key, Value> item_;
+    const PersistentAVLNode<Key, Value>* const left_;
+    const PersistentAVLNode<Key, Value>* const right_;
+    const int height_;
+    mutable std::atomic<size_t> refs_;
+};
+
+/**
+* Builds a node that takes over one reference to each child.
+*/
+template <typename Key, typename Value>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(const std::pair<const Key, Value>& item,
+                                                 const PersistentAVLNode<Key, Value>* left,
+                                                 const PersistentAVLNode<Key, Value>* right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_(1 + std::max(left == NULL ? 0 : left->height_, right == NULL ? 0 : right->height_)),
+    refs_(1)
+{
+
+}
+
+
+/**
+* A persistent (fully functional) AVL map. insert and remove leave the
+* tree they are called on untouched and return a new version that shares
+* every subtree off the update path with the old one, so each update
+* costs O(log n) time and O(log n) new nodes. Versions are cheap values:
+* copying one just bumps the root's reference count, and a node is freed
+* when the last version that reaches it goes away.
+*
+* Keeping k versions of an n-entry map costs O(n + k log n) nodes instead
+* of k full copies. Reference counts are atomic, so versions may be shared
+* across threads; everything else is immutable.
+*/
+template <typename Key, typename Value>
+class PersistentAVLTree
+{
+public:
+    typedef PersistentAVLNode<Key, Value> NodeT;
+
+    PersistentAVLTree();
+    PersistentAVLTree(const PersistentAVLTree<Key, Value>& other);
+    PersistentAVLTree<Key, Value>& operator=(const PersistentAVLTree<Key, Value>& other);
+    ~PersistentAVLTree();
+
+    PersistentAVLTree<Key, Value> insert(const std::pair<const Key, Value>& keyValuePair) const;
+    PersistentAVLTree<Key, Value> remove(const Key& key) const;
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+
+    /**
+    * An in-order iterator. It is only valid while some version that
+    * contains its nodes is alive. The path is kept in a fixed array, so
+    * iterating never allocates.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class PersistentAVLTree<Key, Value>;
+        static const int MAX_DEPTH = 96;
+
+        void pushLeft(const NodeT* n);
+
+        const NodeT* stack_[MAX_DEPTH];
+        int depth_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    const Value& operator[](const Key& key) const;
+
+private:
+    // Holds one node reference and drops it when destroyed unless take()
+    // handed it on first. Every reference an update gathers sits in one of
+    // these until a node owns it, so a throwing Value copy or allocation
+    // cannot leak it.
+    class Ref
+    {
+    public:
+        explicit Ref(const NodeT* n);
+        ~Ref();
+
+        const NodeT* get() const;
+        const NodeT* take();
+
+    private:
+        Ref(const Ref&);
+        Ref& operator=(const Ref&);
+
+        const NodeT* n_;
+    };
+
+    PersistentAVLTree(const NodeT* root, size_t size);
+
+    static int height(const NodeT* n);
+    static const NodeT* acquire(const NodeT* n);
+    static void release(const NodeT* n);
+    static const NodeT* make(const std::pair<const Key, Value>& item, Ref& left, Ref& right);
+    static const NodeT* balance(const std::pair<const Key, Value>& item, Ref& left, Ref& right);
+    static const NodeT* insertHelp(const NodeT* n, const std::pair<const Key, Value>& item, bool& added);
+    static const NodeT* removeHelp(const NodeT* n, const Key& key, bool& removed);
+    static const NodeT* removeMin(const NodeT* n);
+    static int checkHeight(const NodeT* n);
+
+    const NodeT* root_;
+    size_t size_;
+};
+
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree() :
+    root_(NULL),
+    size_(0)
+{
+
+}
+
+/**
+* Takes over one reference to root.
+*/
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree(const NodeT* root, size_t size) :
+    root_(root),
+    size_(size)
+{
+
+}
+
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>::PersistentAVLTree(const PersistentAVLTree<Key, Value>& other) :
+    root_(acquire(other.root_)),
+    size_(other.size_)
+{
+
+}
+
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>&
+PersistentAVLTree<Key, Value>::operator=(const PersistentAVLTree<Key, Value>& other)
+{
+    const NodeT* root = acquire(other.root_);
+    release(root_);
+    root_ = root;
+    size_ = other.size_;
+    return *this;
+}
+
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* Returns a version with the pair added, or with the value replaced if the
+* key is already present.
+*/
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>
+PersistentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair) const
+{
+    bool added = false;
+    const NodeT* root = insertHelp(root_, keyValuePair, added);
+    return PersistentAVLTree<Key, Value>(root, size_ + (added ? 1 : 0));
+}
+
+/**
+* Returns a version without key. If key is absent the result shares the
+* whole tree with this one.
+*/
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>
+PersistentAVLTree<Key, Value>::remove(const Key& key) const
+{
+    bool removed = false;
+    const NodeT* root = removeHelp(root_, key, removed);
+    return PersistentAVLTree<Key, Value>(root, size_ - (removed ? 1 : 0));
+}
+
+template <typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::empty() const
+{
+    return root_ == NULL;
+}
+
+template <typename Key, typename Value>
+size_t PersistentAVLTree<Key, Value>::size() const
+{
+    return size_;
+}
+
+template <typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::isBalanced() const
+{
+    return checkHeight(root_) >= 0;
+}
+
+template <typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::checkHeight(const NodeT* n)
+{
+    if(n == NULL)
+        return 0;
+    int left = checkHeight(n->left_);
+    int right = checkHeight(n->right_);
+    if(left < 0 || right < 0 || left - right > 1 || right - left > 1 || n->height_ != 1 + std::max(left, right))
+        return -1;
+    return n->height_;
+}
+
+template <typename Key, typename Value>
+int PersistentAVLTree<Key, Value>::height(const NodeT* n)
+{
+    return n == NULL ? 0 : n->height_;
+}
+
+/**
+* Adds a reference to n and returns it.
+*/
+template <typename Key, typename Value>
+const typename PersistentAVLTree<Key, Value>::NodeT*
+PersistentAVLTree<Key, Value>::acquire(const NodeT* n)
+{
+    if(n != NULL)
+        n->refs_.fetch_add(1, std::memory_order_relaxed);
+    return n;
+}
+
+/**
+* Drops a reference to n, freeing it and releasing its children when it
+* was the last one.
+*/
+template <typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::release(const NodeT* n)
+{
+    while(n != NULL && n->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        const NodeT* right = n->right_;
+        release(n->left_);
+        delete n;
+        n = right;
+    }
+}
+
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Ref::Ref(const NodeT* n) :
+    n_(n)
+{
+
+}
+
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>::Ref::~Ref()
+{
+    release(n_);
+}
+
+template <typename Key, typename Value>
+const typename PersistentAVLTree<Key, Value>::NodeT*
+PersistentAVLTree<Key, Value>::Ref::get() const
+{
+    return n_;
+}
+
+/**
+* Hands the reference to the caller.
+*/
+template <typename Key, typename Value>
+const typename PersistentAVLTree<Key, Value>::NodeT*
+PersistentAVLTree<Key, Value>::Ref::take()
+{
+    const NodeT* n = n_;
+    n_ = NULL;
+    return n;
+}
+
+/**
+* Builds a node that takes over the references held by left and right. If
+* building it throws, they stay with their holders.
+*/
+template <typename Key, typename Value>
+const typename PersistentAVLTree<Key, Value>::NodeT*
+PersistentAVLTree<Key, Value>::make(const std::pair<const Key, Value>& item, Ref& left, Ref& right)
+{
+    const NodeT* n = new NodeT(item, left.get(), right.get());
+    left.take();
+    right.take();
+    return n;
+}
+
+/**
+* Builds a balanced subtree from item and two held subtrees whose heights
+* differ by at most two, rotating by building new nodes where needed.
+* Nodes are built one at a time, each from references that are already
+* held, so if one throws every reference gathered so far is dropped by
+* its holder.
+*/
+template <typename Key, typename Value>
+const typename PersistentAVLTree<Key, Value>::NodeT*
+PersistentAVLTree<Key, Value>::balance(const std::pair<const Key, Value>& item, Ref& left, Ref& right)
+{
+    const NodeT* l = left.get();
+    const NodeT* r = right.get();
+    int hl = height(l);
+    int hr = height(r);
+    if(hl > hr + 1)
+    {
+        const NodeT* result;
+        if(height(l->left_) >= height(l->right_))
+        {
+            Ref ll(acquire(l->left_));
+            Ref lr(acquire(l->right_));
+            Ref lower(make(item, lr, right));
+            result = make(l->item_, ll, lower);
+        }
+        else
+        {
+            const NodeT* lr = l->right_;
+            Ref ll(acquire(l->left_));
+            Ref lrl(acquire(lr->left_));
+            Ref lrr(acquire(lr->right_));
+            Ref lower(make(l->item_, ll, lrl));
+            Ref upper(make(item, lrr, right));
+            result = make(lr->item_, lower, upper);
+        }
+        release(left.take());
+        return result;
+    }
+    if(hr > hl + 1)
+    {
+        const NodeT* result;
+        if(height(r->right_) >= height(r->left_))
+        {
+            Ref rl(acquire(r->left_));
+            Ref rr(acquire(r->right_));
+            Ref lower(make(item, left, rl));
+            result = make(r->item_, lower, rr);
+        }
+        else
+        {
+            const NodeT* rl = r->left_;
+            Ref rll(acquire(rl->left_));
+            Ref rlr(acquire(rl->right_));
+            Ref rr(acquire(r->right_));
+            Ref lower(make(item, left, rll));
+            Ref upper(make(r->item_, rlr, rr));
+            result = make(rl->item_, lower, upper);
+        }
+        release(right.take());
+        return result;
+    }
+    return make(item, left, right);
+}
+
+/**
+* Returns an owned reference to the subtree n with item inserted.
+*/
+template <typename Key, typename Value>
+const typename PersistentAVLTree<Key, Value>::NodeT*
+PersistentAVLTree<Key, Value>::insertHelp(const NodeT* n, const std::pair<const Key, Value>& item, bool& added)
+{
+    if(n == NULL)
+    {
+        added = true;
+        Ref left(NULL);
+        Ref right(NULL);
+        return make(item, left, right);
+    }
+    if(item.first < n->item_.first)
+    {
+        Ref left(insertHelp(n->left_, item, added));
+        Ref right(acquire(n->right_));
+        return balance(n->item_, left, right);
+    }
+    if(n->item_.first < item.first)
+    {
+        Ref right(insertHelp(n->right_, item, added));
+        Ref left(acquire(n->left_));
+        return balance(n->item_, left, right);
+    }
+    Ref left(acquire(n->left_));
+    Ref right(acquire(n->right_));
+    return make(item, left, right);
+}
+
+/**
+* Returns an owned reference to the subtree n without key. Nothing is
+* copied when key is absent.
+*/
+template <typename Key, typename Value>
+const typename PersistentAVLTree<Key, Value>::NodeT*
+PersistentAVLTree<Key, Value>::removeHelp(const NodeT* n, const Key& key, bool& removed)
+{
+    if(n == NULL)
+        return NULL;
+    if(key < n->item_.first)
+    {
+        Ref left(removeHelp(n->left_, key, removed));
+        if(!removed)
+            return acquire(n);
+        Ref right(acquire(n->right_));
+        return balance(n->item_, left, right);
+    }
+    if(n->item_.first < key)
+    {
+        Ref right(removeHelp(n->right_, key, removed));
+        if(!removed)
+            return acquire(n);
+        Ref left(acquire(n->left_));
+        return balance(n->item_, left, right);
+    }
+
+    removed = true;
+    if(n->left_ == NULL)
+        return acquire(n->right_);
+    if(n->right_ == NULL)
+        return acquire(n->left_);
+
+    // Replace n by its successor.
+    const NodeT* min = n->right_;
+    while(min->left_ != NULL)
+        min = min->left_;
+    Ref right(removeMin(n->right_));
+    Ref left(acquire(n->left_));
+    return balance(min->item_, left, right);
+}
+
+/**
+* Returns an owned reference to the subtree n without its smallest node.
+*/
+template <typename Key, typename Value>
+const typename PersistentAVLTree<Key, Value>::NodeT*
+PersistentAVLTree<Key, Value>::removeMin(const NodeT* n)
+{
+    if(n->left_ == NULL)
+        return acquire(n->right_);
+    Ref left(removeMin(n->left_));
+    Ref right(acquire(n->right_));
+    return balance(n->item_, left, right);
+}
+
+template <typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::begin() const
+{
+    iterator it;
+    it.pushLeft(root_);
+    return it;
+}
+
+template <typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to key in this version, or end() if it is absent.
+*/
+template <typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::find(const Key& key) const
+{
+    iterator it = lower_bound(key);
+    if(it != end() && key < it->first)
+        return end();
+    return it;
+}
+
+/**
+* Returns an iterator to the smallest key not less than key.
+*/
+template <typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator
+PersistentAVLTree<Key, Value>::lower_bound(const Key& key) const
+{
+    iterator it;
+    const NodeT* n = root_;
+    while(n != NULL)
+    {
+        if(n->item_.first < key)
+        {
+            n = n->right_;
+        }
+        else
+        {
+            it.stack_[it.depth_++] = n;
+            n = n->left_;
+        }
+    }
+    return it;
+}
+
+/**
+* @precondition The key exists in this version
+* Returns the value associated with the key
+*/
+template <typename Key, typename Value>
+const Value& PersistentAVLTree<Key, Value>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template <typename Key, typename Value>
+PersistentAVLTree<Key, Value>::iterator::iterator() :
+    depth_(0)
+{
+
+}
+
+template <typename Key, typename Value>
+const std::pair<const Key, Value>&
+PersistentAVLTree<Key, Value>::iterator::operator*() const
+{
+    return stack_[depth_ - 1]->item_;
+}
+
+template <typename Key, typename Value>
+const std::pair<const Key, Value>*
+PersistentAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &(stack_[depth_ - 1]->item_);
+}
+
+template <typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(depth_ == 0 || rhs.depth_ == 0)
+        return depth_ == rhs.depth_;
+    return stack_[depth_ - 1] == rhs.stack_[rhs.depth_ - 1];
+}
+
+template <typename Key, typename Value>
+bool PersistentAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the in-order successor: the leftmost node of the right
+* subtree, or else the nearest stacked ancestor.
+*/
+template <typename Key, typename Value>
+typename PersistentAVLTree<Key, Value>::iterator&
+PersistentAVLTree<Key, Value>::iterator::operator++()
+{
+    const NodeT* curr = stack_[--depth_];
+    pushLeft(curr->right_);
+    return *this;
+}
+
+template <typename Key, typename Value>
+void PersistentAVLTree<Key, Value>::iterator::pushLeft(const NodeT* n)
+{
+    while(n != NULL)
+    {
+        stack_[depth_++] = n;
+        n = n->left_;
+    }
+}
+
+#endif
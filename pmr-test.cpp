@@ -0,0 +1,158 @@
+#include <cstddef>
+#include <map>
+#include <memory_resource>
+#include <stdexcept>
+#include <utility>
+#include "bst.h"
+#include "avlbst.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for the std::pmr tree aliases: every node comes from the tree's
+// memory resource and goes back to it, and node handles only move between
+// trees that share a resource. Needs C++17 (see the pmr-test rule in the
+// Makefile).
+
+/**
+* Forwards to another resource and counts the blocks outstanding.
+*/
+class CountingResource : public pmr::memory_resource
+{
+public:
+    explicit CountingResource(pmr::memory_resource* upstream = pmr::new_delete_resource()) :
+        upstream_(upstream),
+        live_(0),
+        total_(0)
+    {
+    }
+
+    long live() const
+    {
+        return live_;
+    }
+
+    long total() const
+    {
+        return total_;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        void* p = upstream_->allocate(bytes, alignment);
+        ++live_;
+        ++total_;
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        --live_;
+        upstream_->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    pmr::memory_resource* upstream_;
+    long live_;
+    long total_;
+};
+
+template <typename Tree>
+size_t entries(const Tree& tree)
+{
+    size_t count = 0;
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it)
+        ++count;
+    return count;
+}
+
+template <typename Tree>
+void checkResource(const char* name)
+{
+    CountingResource resource;
+    map<int, int> ref;
+    {
+        Tree tree(&resource);
+        srand(61);
+        for(int i = 0; i < 5000; ++i)
+        {
+            int key = rand() % 1000;
+            if(rand() % 3 != 0)
+            {
+                tree.insert(make_pair(key, i));
+                ref[key] = i;
+            }
+            else
+            {
+                tree.remove(key);
+                ref.erase(key);
+            }
+        }
+        check(sameContents(tree, ref), name, "contents differ from std::map");
+        check(resource.live() == (long)ref.size(), name, "live nodes differ from the resource's blocks");
+        tree.clear();
+        check(resource.live() == 0, name, "clear did not return every node to the resource");
+        tree.insert(make_pair(1, 1));
+    }
+    check(resource.live() == 0, name, "destruction did not return every node to the resource");
+    check(resource.total() > 0, name, "no node came from the resource");
+}
+
+/**
+* Node handles and merge move nodes between trees that share a resource
+* and refuse to mix resources.
+*/
+void testHandles()
+{
+    const char* name = "PmrAVLTree node handles";
+    CountingResource shared;
+    CountingResource other;
+    PmrAVLTree<int, int> a(&shared);
+    PmrAVLTree<int, int> b(&shared);
+    PmrAVLTree<int, int> c(&other);
+    for(int i = 0; i < 100; ++i)
+    {
+        a.insert(make_pair(i, i));
+        c.insert(make_pair(i + 1000, i));
+    }
+    long before = shared.total();
+    for(int i = 0; i < 100; i += 2)
+        b.insert(a.extract(i));
+    b.merge(a);
+    check(shared.total() == before, name, "moving nodes within a resource allocated");
+    check(a.empty() && entries(b) == 100 && b.isBalanced(), name, "nodes were lost moving within a resource");
+
+    bool refused = false;
+    try
+    {
+        b.merge(c);
+    }
+    catch(logic_error&)
+    {
+        refused = true;
+    }
+    check(refused && entries(c) == 100 && entries(b) == 100, name, "merge across resources was not refused");
+
+    // A monotonic buffer serves a short-lived tree without touching the
+    // heap; releasing nodes into it is a no-op.
+    char buffer[1 << 16];
+    pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), pmr::null_memory_resource());
+    PmrAVLTree<int, int> scratch(&arena);
+    for(int i = 0; i < 200; ++i)
+        scratch.insert(make_pair(i, i));
+    check(entries(scratch) == 200 && scratch.isBalanced(), "PmrAVLTree arena", "tree in a monotonic buffer is wrong");
+}
+
+int main()
+{
+    checkResource<PmrBinarySearchTree<int, int> >("PmrBinarySearchTree");
+    checkResource<PmrAVLTree<int, int> >("PmrAVLTree");
+    testHandles();
+    return testSummary("pmr");
+}
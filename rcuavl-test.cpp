@@ -0,0 +1,145 @@
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "rcuavl.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for RCUAVLTree: snapshots taken while writers run are consistent
+// trees, and a write that fails, whether copying a value or allocating,
+// is neither published nor leaves an earlier snapshot changed.
+
+void testSnapshots()
+{
+    const char* name = "RCUAVLTree";
+    RCUAVLTree<int, int> tree;
+    atomic<bool> stop(false);
+    vector<thread> readers;
+    for(int r = 0; r < 2; ++r)
+    {
+        readers.push_back(thread([&tree, &stop, name]()
+        {
+            bool ok = true;
+            while(!stop.load())
+            {
+                RCUAVLTree<int, int>::Snapshot snapshot(tree);
+                size_t count = 0;
+                int prev = -1;
+                for(RCUAVLTree<int, int>::iterator it = snapshot.begin(); it != snapshot.end(); ++it, ++count)
+                {
+                    ok = ok && it->first > prev && it->second == it->first;
+                    prev = it->first;
+                }
+                ok = ok && count == snapshot.size();
+            }
+            check(ok, name, "snapshot was not a consistent tree");
+        }));
+    }
+    vector<set<int> > present = runWriters(tree);
+    stop.store(true);
+    for(size_t t = 0; t < readers.size(); ++t)
+        readers[t].join();
+    checkFinal(name, tree, present);
+    check(tree.isBalanced(), name, "tree not balanced");
+}
+
+/**
+* True if snapshot holds exactly the keys and values of ref.
+*/
+template <typename Value>
+bool sameSnapshot(const typename RCUAVLTree<int, Value>::Snapshot& snapshot, const map<int, int>& ref)
+{
+    typename RCUAVLTree<int, Value>::iterator it = snapshot.begin();
+    map<int, int>::const_iterator r = ref.begin();
+    for(; r != ref.end() && it != snapshot.end(); ++r, ++it)
+    {
+        if(it->first != r->first || !(it->second == Value(r->second)))
+            return false;
+    }
+    return r == ref.end() && it == snapshot.end() && snapshot.size() == ref.size();
+}
+
+/**
+* Runs random writes against tree, failing some of them through fail(),
+* which arms a fault and is undone by disarm(). A write that throws must
+* leave the tree as it was, and no write may change a snapshot taken
+* before it.
+*/
+template <typename Value, typename Arm, typename Disarm>
+void checkRollback(const char* name, Arm fail, Disarm disarm, unsigned seed)
+{
+    RCUAVLTree<int, Value> tree;
+    map<int, int> ref;
+    srand(seed);
+    int thrown = 0;
+    for(int i = 0; i < 20000; ++i)
+    {
+        int key = rand() % 500;
+        bool insert = rand() % 3 != 0;
+        typename RCUAVLTree<int, Value>::Snapshot before(tree);
+        map<int, int> refBefore = ref;
+        pair<const int, Value> item(key, Value(i));
+        fail();
+        try
+        {
+            if(insert)
+                tree.insert(item);
+            else
+                tree.remove(key);
+            disarm();
+            if(insert)
+                ref[key] = i;
+            else
+                ref.erase(key);
+        }
+        catch(runtime_error&)
+        {
+            disarm();
+            ++thrown;
+        }
+        catch(bad_alloc&)
+        {
+            disarm();
+            ++thrown;
+        }
+        check(tree.size() == ref.size() && tree.isBalanced(), name, "failed write changed the tree");
+        check(sameSnapshot<Value>(before, refBefore), name, "write changed an earlier snapshot");
+    }
+    typename RCUAVLTree<int, Value>::Snapshot snapshot(tree);
+    check(sameSnapshot<Value>(snapshot, ref), name, "contents differ from std::map");
+    check(thrown > 0, name, "no write threw, so rollback went untested");
+}
+
+void armCopyFailure()
+{
+    ThrowingValue::copiesLeft() = rand() % 4 == 0 ? rand() % 6 : -1;
+}
+
+void disarmCopyFailure()
+{
+    ThrowingValue::copiesLeft() = -1;
+}
+
+void armAllocationFailure()
+{
+    allocationsLeft() = rand() % 4 == 0 ? rand() % 8 : -1;
+}
+
+void disarmAllocationFailure()
+{
+    allocationsLeft() = -1;
+}
+
+int main()
+{
+    testSnapshots();
+    checkRollback<ThrowingValue>("RCUAVLTree copy failure", armCopyFailure, disarmCopyFailure, 5);
+    checkRollback<int>("RCUAVLTree allocation failure", armAllocationFailure, disarmAllocationFailure, 6);
+    return testSummary("RCUAVLTree");
+}
@@ -0,0 +1,700 @@
+#ifndef RCUAVL_H
+#define RCUAVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "epoch.h"
+
+/**
+* A node of an RCUAVLTree. Once a node is reachable from a published root
+* it is never modified again; writers copy it instead. Nodes have no
+* parent pointer, since a shared node can sit under many different copies
+* of its parent across snapshots.
+*/
+template <typename Key, typename Value>
+class RCUAVLNode
+{
+public:
+    RCUAVLNode(const std::pair<const Key, Value>& item, uint64_t generation);
+    RCUAVLNode(const RCUAVLNode<Key, Value>& other, uint64_t generation);
+
+    std::pair<const Key, Value> item_;
+    RCUAVLNode<Key, Value>* left_;
+    RCUAVLNode<Key, Value>* right_;
+    int height_;
+
+    // Write generation that created the node. Only nodes of the writer's
+    // current generation are unpublished and may be changed in place.
+    uint64_t generation_;
+};
+
+template <typename Key, typename Value>
+RCUAVLNode<Key, Value>::RCUAVLNode(const std::pair<const Key, Value>& item, uint64_t generation) :
+    item_(item),
+    left_(NULL),
+    right_(NULL),
+    height_(1),
+    generation_(generation)
+{
+
+}
+
+/**
+* Copy of a published node for the given write generation.
+*/
+template <typename Key, typename Value>
+RCUAVLNode<Key, Value>::RCUAVLNode(const RCUAVLNode<Key, Value>& other, uint64_t generation) :
+    item_(other.item_),
+    left_(other.left_),
+    right_(other.right_),
+    height_(other.height_),
+    generation_(generation)
+{
+
+}
+
+
+/**
+* A read-mostly AVL map with one writer at a time and lock-free readers.
+*
+* The writer never changes a published node. Each insert or remove copies
+* the nodes on its path (and those it rotates), links the copies into a new
+* root and publishes that root with a single atomic store. A reader that
+* opens a Snapshot pins an epoch and sees one published root for as long as
+* the snapshot lives, so it can iterate a consistent view without taking
+* any lock while the writer carries on. Nodes replaced by the writer are
+* freed through the epoch domain once no snapshot can still reach them.
+* There is no limit on open snapshots: one thread's snapshots share a
+* single reader slot, and the domain adds slots as more threads read. A
+* snapshot must be closed on the thread that opened it.
+*
+* Writers are serialized by an internal mutex that readers never touch.
+*/
+template <typename Key, typename Value>
+class RCUAVLTree
+{
+public:
+    typedef RCUAVLNode<Key, Value> NodeT;
+
+    RCUAVLTree();
+    ~RCUAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+
+    /**
+    * An in-order iterator over the snapshot it came from. It keeps the
+    * path to the current node in a fixed array (AVL trees of any size
+    * that fits in memory are far shallower than MAX_DEPTH), so iterating
+    * never allocates.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class RCUAVLTree<Key, Value>;
+        static const int MAX_DEPTH = 96;
+
+        void pushLeft(const NodeT* n);
+
+        const NodeT* stack_[MAX_DEPTH];
+        int depth_;
+    };
+
+    /**
+    * A consistent read-only view of the tree. Constructing a snapshot pins
+    * the current epoch; everything reachable from it stays valid until the
+    * snapshot is destroyed. Keep snapshots short-lived where possible,
+    * since they hold back reclamation of replaced nodes.
+    */
+    class Snapshot
+    {
+    public:
+        explicit Snapshot(const RCUAVLTree<Key, Value>& tree);
+
+        iterator begin() const;
+        iterator end() const;
+        iterator find(const Key& key) const;
+        size_t size() const;
+
+    private:
+        Snapshot(const Snapshot&);
+        Snapshot& operator=(const Snapshot&);
+
+        EpochGuard guard_;
+        const NodeT* root_;
+        size_t size_;
+    };
+
+private:
+    RCUAVLTree(const RCUAVLTree&);
+    RCUAVLTree& operator=(const RCUAVLTree&);
+
+    // Root and size are published together so a snapshot's size matches
+    // its contents.
+    struct Version
+    {
+        NodeT* root;
+        size_t size;
+    };
+
+    static int height(const NodeT* n);
+    static const NodeT* findNode(const NodeT* n, const Key& key);
+
+    template <typename Source>
+    NodeT* createNode(const Source& source);
+    NodeT* writable(NodeT* n);
+    void discard(NodeT* n);
+    void abandon(size_t replacedMark);
+    void fixHeight(NodeT* n);
+    NodeT* rotateRight(NodeT* n);
+    NodeT* rotateLeft(NodeT* n);
+    NodeT* balance(NodeT* n);
+    NodeT* insertHelp(NodeT* n, const std::pair<const Key, Value>& item, bool& added);
+    NodeT* removeHelp(NodeT* n, const Key& key, bool& removed);
+    NodeT* removeMin(NodeT* n, NodeT*& min);
+    void publish(NodeT* root, size_t size);
+    void clearHelp(NodeT* n);
+    int checkHeight(const NodeT* n) const;
+
+    std::atomic<Version*> version_;
+    std::mutex writeLock_;
+    uint64_t generation_;
+    std::vector<NodeT*> replaced_;
+    // Nodes allocated by the write in progress, freed if it throws.
+    std::vector<NodeT*> created_;
+    mutable EpochDomain epoch_;
+};
+
+template <typename Key, typename Value>
+RCUAVLTree<Key, Value>::RCUAVLTree() :
+    generation_(0)
+{
+    Version* v = new Version;
+    v->root = NULL;
+    v->size = 0;
+    version_.store(v);
+}
+
+/**
+* Frees the current version. Replaced nodes are freed by the epoch domain.
+* No snapshot may outlive the tree.
+*/
+template <typename Key, typename Value>
+RCUAVLTree<Key, Value>::~RCUAVLTree()
+{
+    Version* v = version_.load();
+    clearHelp(v->root);
+    delete v;
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present,
+* and publishes the result. If copying a node or the value throws, the
+* published version is left as it was.
+*/
+template <typename Key, typename Value>
+void RCUAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    ++generation_;
+    Version* current = version_.load();
+    size_t mark = replaced_.size();
+    try
+    {
+        bool added = false;
+        NodeT* root = insertHelp(current->root, keyValuePair, added);
+        publish(root, current->size + (added ? 1 : 0));
+    }
+    catch(...)
+    {
+        abandon(mark);
+        throw;
+    }
+}
+
+/**
+* Removes the key if present and publishes the result. Like insert, a
+* throwing copy leaves the published version unchanged.
+*/
+template <typename Key, typename Value>
+void RCUAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(writeLock_);
+    ++generation_;
+    Version* current = version_.load();
+    size_t mark = replaced_.size();
+    try
+    {
+        bool removed = false;
+        NodeT* root = removeHelp(current->root, key, removed);
+        if(!removed)
+            return;
+        publish(root, current->size - 1);
+    }
+    catch(...)
+    {
+        abandon(mark);
+        throw;
+    }
+}
+
+/**
+* Copies the current value for key into value. Takes no locks.
+*/
+template <typename Key, typename Value>
+bool RCUAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochGuard guard(epoch_);
+    const NodeT* n = findNode(version_.load()->root, key);
+    if(n == NULL)
+        return false;
+    value = n->item_.second;
+    return true;
+}
+
+template <typename Key, typename Value>
+bool RCUAVLTree<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+template <typename Key, typename Value>
+size_t RCUAVLTree<Key, Value>::size() const
+{
+    EpochGuard guard(epoch_);
+    return version_.load()->size;
+}
+
+/**
+* Return true iff the current version is a valid AVL tree.
+*/
+template <typename Key, typename Value>
+bool RCUAVLTree<Key, Value>::isBalanced() const
+{
+    EpochGuard guard(epoch_);
+    return checkHeight(version_.load()->root) >= 0;
+}
+
+template <typename Key, typename Value>
+int RCUAVLTree<Key, Value>::checkHeight(const NodeT* n) const
+{
+    if(n == NULL)
+        return 0;
+    int left = checkHeight(n->left_);
+    int right = checkHeight(n->right_);
+    if(left < 0 || right < 0 || left - right > 1 || right - left > 1 || n->height_ != 1 + std::max(left, right))
+        return -1;
+    return n->height_;
+}
+
+template <typename Key, typename Value>
+int RCUAVLTree<Key, Value>::height(const NodeT* n)
+{
+    return n == NULL ? 0 : n->height_;
+}
+
+template <typename Key, typename Value>
+const typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::findNode(const NodeT* n, const Key& key)
+{
+    while(n != NULL)
+    {
+        if(key < n->item_.first)
+            n = n->left_;
+        else if(n->item_.first < key)
+            n = n->right_;
+        else
+            return n;
+    }
+    return NULL;
+}
+
+/**
+* Allocates a node of the current generation from an item or a node to
+* copy, and remembers it so that a failed write can free it. The slot is
+* reserved first so that remembering it cannot throw once the node exists.
+*/
+template <typename Key, typename Value>
+template <typename Source>
+typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::createNode(const Source& source)
+{
+    created_.push_back(NULL);
+    NodeT* n = new NodeT(source, generation_);
+    created_.back() = n;
+    return n;
+}
+
+/**
+* Returns a node the writer may change: n itself if it was created by the
+* current write, otherwise a copy, in which case n is scheduled for
+* reclamation once the new root is published.
+*/
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::writable(NodeT* n)
+{
+    if(n->generation_ == generation_)
+        return n;
+    replaced_.push_back(n);
+    return createNode(*n);
+}
+
+/**
+* Drops a node that is not part of the new version.
+*/
+template <typename Key, typename Value>
+void RCUAVLTree<Key, Value>::discard(NodeT* n)
+{
+    if(n->generation_ == generation_)
+    {
+        created_.erase(std::find(created_.begin(), created_.end(), n));
+        delete n;
+    }
+    else
+    {
+        replaced_.push_back(n);
+    }
+}
+
+/**
+* Undoes a write that threw before publishing: the nodes it meant to
+* replace are still published and must not be retired, and the nodes it
+* built are unreachable.
+*/
+template <typename Key, typename Value>
+void RCUAVLTree<Key, Value>::abandon(size_t replacedMark)
+{
+    replaced_.resize(replacedMark);
+    for(size_t i = 0; i < created_.size(); ++i)
+        delete created_[i];
+    created_.clear();
+}
+
+template <typename Key, typename Value>
+void RCUAVLTree<Key, Value>::fixHeight(NodeT* n)
+{
+    n->height_ = 1 + std::max(height(n->left_), height(n->right_));
+}
+
+/**
+* Rotates the writable node n to the right and returns the new subtree
+* root. The rising child is made writable first.
+*/
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::rotateRight(NodeT* n)
+{
+    NodeT* l = writable(n->left_);
+    n->left_ = l->right_;
+    l->right_ = n;
+    fixHeight(n);
+    fixHeight(l);
+    return l;
+}
+
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::rotateLeft(NodeT* n)
+{
+    NodeT* r = writable(n->right_);
+    n->right_ = r->left_;
+    r->left_ = n;
+    fixHeight(n);
+    fixHeight(r);
+    return r;
+}
+
+/**
+* Restores the AVL property at the writable node n, whose children are
+* already balanced, and returns the subtree root.
+*/
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::balance(NodeT* n)
+{
+    fixHeight(n);
+    int bal = height(n->left_) - height(n->right_);
+    if(bal > 1)
+    {
+        if(height(n->left_->left_) < height(n->left_->right_))
+            n->left_ = rotateLeft(writable(n->left_));
+        return rotateRight(n);
+    }
+    if(bal < -1)
+    {
+        if(height(n->right_->right_) < height(n->right_->left_))
+            n->right_ = rotateRight(writable(n->right_));
+        return rotateLeft(n);
+    }
+    return n;
+}
+
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::insertHelp(NodeT* n, const std::pair<const Key, Value>& item, bool& added)
+{
+    if(n == NULL)
+    {
+        added = true;
+        return createNode(item);
+    }
+    if(item.first < n->item_.first)
+    {
+        NodeT* left = insertHelp(n->left_, item, added);
+        n = writable(n);
+        n->left_ = left;
+    }
+    else if(n->item_.first < item.first)
+    {
+        NodeT* right = insertHelp(n->right_, item, added);
+        n = writable(n);
+        n->right_ = right;
+    }
+    else
+    {
+        // The key is const inside the pair, so a new value means a new node.
+        NodeT* replacement = createNode(item);
+        replacement->left_ = n->left_;
+        replacement->right_ = n->right_;
+        replacement->height_ = n->height_;
+        discard(n);
+        return replacement;
+    }
+    return balance(n);
+}
+
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::removeHelp(NodeT* n, const Key& key, bool& removed)
+{
+    if(n == NULL)
+        return NULL;
+    if(key < n->item_.first)
+    {
+        NodeT* left = removeHelp(n->left_, key, removed);
+        if(!removed)
+            return n;
+        n = writable(n);
+        n->left_ = left;
+    }
+    else if(n->item_.first < key)
+    {
+        NodeT* right = removeHelp(n->right_, key, removed);
+        if(!removed)
+            return n;
+        n = writable(n);
+        n->right_ = right;
+    }
+    else
+    {
+        removed = true;
+        NodeT* left = n->left_;
+        NodeT* right = n->right_;
+        discard(n);
+        if(left == NULL)
+            return right;
+        if(right == NULL)
+            return left;
+
+        // Replace n by its successor.
+        NodeT* min = NULL;
+        right = removeMin(right, min);
+        n = writable(min);
+        n->left_ = left;
+        n->right_ = right;
+    }
+    return balance(n);
+}
+
+/**
+* Detaches the smallest node below n, returning it through min, and
+* returns the rebalanced remainder of the subtree.
+*/
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::NodeT*
+RCUAVLTree<Key, Value>::removeMin(NodeT* n, NodeT*& min)
+{
+    if(n->left_ == NULL)
+    {
+        min = n;
+        return n->right_;
+    }
+    NodeT* left = removeMin(n->left_, min);
+    n = writable(n);
+    n->left_ = left;
+    return balance(n);
+}
+
+/**
+* Atomically installs the new root and hands everything it replaced to
+* the epoch domain. Once the root is installed the new nodes belong to
+* the published version. Everything that can fail happens before the
+* root is installed, so a write that throws was never published.
+*/
+template <typename Key, typename Value>
+void RCUAVLTree<Key, Value>::publish(NodeT* root, size_t size)
+{
+    epoch_.reserve(replaced_.size() + 1);
+    Version* v = new Version;
+    v->root = root;
+    v->size = size;
+    Version* old = version_.exchange(v);
+    created_.clear();
+    epoch_.retire(old);
+    for(size_t i = 0; i < replaced_.size(); ++i)
+        epoch_.retire(replaced_[i]);
+    replaced_.clear();
+}
+
+template <typename Key, typename Value>
+void RCUAVLTree<Key, Value>::clearHelp(NodeT* n)
+{
+    if(n == NULL)
+        return;
+    clearHelp(n->left_);
+    clearHelp(n->right_);
+    delete n;
+}
+
+template <typename Key, typename Value>
+RCUAVLTree<Key, Value>::iterator::iterator() :
+    depth_(0)
+{
+
+}
+
+template <typename Key, typename Value>
+const std::pair<const Key, Value>&
+RCUAVLTree<Key, Value>::iterator::operator*() const
+{
+    return stack_[depth_ - 1]->item_;
+}
+
+template <typename Key, typename Value>
+const std::pair<const Key, Value>*
+RCUAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &(stack_[depth_ - 1]->item_);
+}
+
+template <typename Key, typename Value>
+bool RCUAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(depth_ == 0 || rhs.depth_ == 0)
+        return depth_ == rhs.depth_;
+    return stack_[depth_ - 1] == rhs.stack_[rhs.depth_ - 1];
+}
+
+template <typename Key, typename Value>
+bool RCUAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the in-order successor. The stack holds the current node and
+* every ancestor whose left subtree we are in, so the successor is either
+* the leftmost node of the right subtree or the next stacked ancestor.
+*/
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::iterator&
+RCUAVLTree<Key, Value>::iterator::operator++()
+{
+    const NodeT* curr = stack_[--depth_];
+    pushLeft(curr->right_);
+    return *this;
+}
+
+template <typename Key, typename Value>
+void RCUAVLTree<Key, Value>::iterator::pushLeft(const NodeT* n)
+{
+    while(n != NULL)
+    {
+        stack_[depth_++] = n;
+        n = n->left_;
+    }
+}
+
+template <typename Key, typename Value>
+RCUAVLTree<Key, Value>::Snapshot::Snapshot(const RCUAVLTree<Key, Value>& tree) :
+    guard_(tree.epoch_)
+{
+    Version* v = tree.version_.load();
+    root_ = v->root;
+    size_ = v->size;
+}
+
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::iterator
+RCUAVLTree<Key, Value>::Snapshot::begin() const
+{
+    iterator it;
+    it.pushLeft(root_);
+    return it;
+}
+
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::iterator
+RCUAVLTree<Key, Value>::Snapshot::end() const
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator positioned at key, or end() if it is not in the
+* snapshot. Iterating from there continues in key order.
+*/
+template <typename Key, typename Value>
+typename RCUAVLTree<Key, Value>::iterator
+RCUAVLTree<Key, Value>::Snapshot::find(const Key& key) const
+{
+    iterator it;
+    const NodeT* n = root_;
+    while(n != NULL)
+    {
+        if(key < n->item_.first)
+        {
+            it.stack_[it.depth_++] = n;
+            n = n->left_;
+        }
+        else if(n->item_.first < key)
+        {
+            n = n->right_;
+        }
+        else
+        {
+            it.stack_[it.depth_++] = n;
+            return it;
+        }
+    }
+    return iterator();
+}
+
+template <typename Key, typename Value>
+size_t RCUAVLTree<Key, Value>::Snapshot::size() const
+{
+    return size_;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#include <atomic>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+#include "shardedavl.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Multithreaded tests for ShardedAVLTree. Writers change disjoint keys
+// while a scanner checks what it sees against invariants every writer
+// keeps (a key present always maps to itself), and the final tree is
+// compared with the writers' own records. Build with -pthread; the
+// tests are most useful under -fsanitize=thread.
+
+void testSharded()
+{
+    const char* name = "ShardedAVLTree";
+    {
+        // Sorted inserts skew the shards and trigger rebalancing.
+        ShardedAVLTree<int, int> tree(8);
+        map<int, int> ref;
+        mt19937 rng(3);
+        for(int i = 0; i < 60000; ++i)
+        {
+            int key = i < 20000 ? i : (int)(rng() % 20000);
+            if(i < 20000 || rng() % 2 == 0)
+            {
+                tree.insert(make_pair(key, i));
+                ref[key] = i;
+            }
+            else
+            {
+                tree.remove(key);
+                ref.erase(key);
+            }
+        }
+        ShardedAVLTree<int, int>::iterator it = tree.begin();
+        map<int, int>::iterator r = ref.begin();
+        for(; r != ref.end() && it != tree.end(); ++r, ++it)
+        {
+            if(it->first != r->first || it->second != r->second)
+                break;
+        }
+        check(r == ref.end() && it == tree.end(), name, "contents differ from std::map");
+        check(tree.size() == ref.size(), name, "size differs from std::map");
+        bool bounds = true;
+        for(int key = 0; key < 21000; key += 37)
+        {
+            ShardedAVLTree<int, int>::iterator lb = tree.lower_bound(key);
+            map<int, int>::iterator rb = ref.lower_bound(key);
+            bounds = bounds && (rb == ref.end() ? lb == tree.end() : (lb != tree.end() && lb->first == rb->first));
+        }
+        check(bounds, name, "lower_bound differs from std::map");
+    }
+
+    ShardedAVLTree<int, int> tree(4);
+    atomic<bool> stop(false);
+    thread scanner([&tree, &stop, name]()
+    {
+        bool ok = true;
+        while(!stop.load())
+        {
+            int prev = -1;
+            for(ShardedAVLTree<int, int>::iterator it = tree.begin(); it != tree.end(); ++it)
+            {
+                ok = ok && it->first > prev && it->second == it->first;
+                prev = it->first;
+            }
+        }
+        check(ok, name, "scan went out of order during writes");
+    });
+    thread rebalancer([&tree, &stop]()
+    {
+        while(!stop.load())
+        {
+            tree.rebalance();
+            this_thread::yield();
+        }
+    });
+    vector<set<int> > present = runWriters(tree);
+    stop.store(true);
+    scanner.join();
+    rebalancer.join();
+    checkFinal(name, tree, present);
+}
+
+int main()
+{
+    testSharded();
+    return testSummary("ShardedAVLTree");
+}
@@ -0,0 +1,641 @@
+#ifndef SHARDEDAVL_H
+#define SHARDEDAVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "epoch.h"
+
+/**
+* A map that splits the key space into range partitions, each an
+* independent AVLTree guarded by its own mutex. Operations on different
+* shards never contend, so write-heavy workloads with spread-out keys scale
+* with the number of cores without any fine-grained locking inside a tree.
+*
+* Shard boundaries are chosen from the data. When one shard grows to more
+* than SKEW_FACTOR times the average, the tree recomputes the boundaries
+* from the key quantiles and moves the entries that changed shard. Every
+* operation validates the layout it used against its shard under the
+* shard's lock and retries if a rebalance got in between. The layout is
+* read through an epoch-protected pointer and sizes are kept per shard,
+* so the only shared state an operation writes is its own shard.
+*
+* Iteration and lower_bound are globally ordered: shards cover consecutive
+* key ranges, so an iterator walks one shard at a time, holding that
+* shard's lock while it is positioned there. Do not modify the tree from a
+* thread that holds an iterator, and do not keep iterators alive longer
+* than needed since they block writers to their current shard. Key must be
+* default constructible.
+*/
+template <typename Key, typename Value>
+class ShardedAVLTree
+{
+private:
+    struct Shard;
+    struct Layout;
+
+public:
+    explicit ShardedAVLTree(size_t shardCount = 16);
+    ~ShardedAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool empty() const;
+    size_t size() const;
+    size_t shardCount() const;
+    std::vector<size_t> shardSizes() const;
+    void rebalance();
+
+    /**
+    * A forward iterator across all shards in key order. It is movable but
+    * not copyable because it owns the lock of the shard it is in.
+    */
+    class iterator
+    {
+    public:
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class ShardedAVLTree<Key, Value>;
+
+        void skipEmpty();
+
+        ShardedAVLTree<Key, Value>* owner_;
+        uint64_t layoutVersion_;
+        size_t shard_;
+        std::unique_lock<std::mutex> lock_;
+        typename AVLTree<Key, Value>::iterator it_;
+        Key resume_;
+        bool resumeInclusive_;
+        bool hasResume_;
+    };
+
+    iterator begin();
+    iterator end();
+    iterator lower_bound(const Key& key);
+
+    // Rebalance once a shard exceeds this multiple of the average size...
+    static const size_t SKEW_FACTOR = 2;
+    // ...and the tree holds at least this many entries per shard.
+    static const size_t MIN_REBALANCE_PER_SHARD = 256;
+    // Inserts into a shard between two skew checks, which sum all shards.
+    static const size_t SKEW_CHECK_INTERVAL = 64;
+
+private:
+    ShardedAVLTree(const ShardedAVLTree&);
+    ShardedAVLTree& operator=(const ShardedAVLTree&);
+
+    // The tree of one shard. Its insert and remove descend once and
+    // report whether the key count changed.
+    class ShardTree : public AVLTree<Key, Value>
+    {
+    public:
+        bool assign(const std::pair<const Key, Value>& item);
+        bool erase(const Key& key);
+    };
+
+    // Aligned to and padded out to whole cache lines, so that writers on
+    // different shards never share one; separate heap allocations alone
+    // may well be packed into the same line. operator new provides the
+    // alignment, which plain new only honours from C++17 on. size is only
+    // written under lock but read without it by size().
+    struct alignas(64) Shard
+    {
+        Shard() : size(0), layoutVersion(0) { }
+
+        static void* operator new(size_t bytes)
+        {
+            void* p = NULL;
+            if(posix_memalign(&p, alignof(Shard), bytes) != 0)
+                throw std::bad_alloc();
+            return p;
+        }
+
+        static void operator delete(void* p)
+        {
+            free(p);
+        }
+
+        std::mutex lock;
+        ShardTree tree;
+        std::atomic<size_t> size;
+        uint64_t layoutVersion;
+    };
+
+    // Immutable once published. bounds[i] is the smallest key of shard
+    // i + 1; an empty bounds vector sends every key to shard 0.
+    struct Layout
+    {
+        uint64_t version;
+        std::vector<Key> bounds;
+
+        size_t shardFor(const Key& key) const;
+    };
+
+    uint64_t locate(const Key& key, size_t& shard) const;
+    uint64_t currentVersion() const;
+    Shard& lockShard(const Key& key, std::unique_lock<std::mutex>& lock) const;
+    void maybeRebalance(size_t shardSize);
+    void rebalance(bool onlyIfSkewed);
+    void seek(iterator& it, const Key& key, bool inclusive);
+
+    std::vector<Shard*> shards_;
+    // Replaced only by rebalance, which retires the old layout to epoch_.
+    std::atomic<const Layout*> layout_;
+    mutable EpochDomain epoch_;
+    std::mutex rebalanceLock_;
+};
+
+/**
+* Returns the index of the shard whose range contains key.
+*/
+template <typename Key, typename Value>
+size_t ShardedAVLTree<Key, Value>::Layout::shardFor(const Key& key) const
+{
+    return std::upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin();
+}
+
+/**
+* Inserts key with value unless it is present, in which case only the
+* value is replaced. Returns true if a node was added.
+*/
+template <typename Key, typename Value>
+bool ShardedAVLTree<Key, Value>::ShardTree::assign(const std::pair<const Key, Value>& item)
+{
+    AVLNode<Key, Value> *curr = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value> *parent = NULL;
+    bool left = false;
+    while(curr != NULL)
+    {
+        if(item.first < curr->getKey())
+        {
+            parent = curr;
+            curr = curr->getLeft();
+            left = true;
+        }
+        else if(curr->getKey() < item.first)
+        {
+            parent = curr;
+            curr = curr->getRight();
+            left = false;
+        }
+        else
+        {
+            curr->setValue(item.second);
+            return false;
+        }
+    }
+    AVLNode<Key, Value> *n = static_cast<AVLNode<Key, Value>*>(this->createNode(item.first, item.second, NULL));
+    this->linkLeaf(parent, n, left);
+    return true;
+}
+
+/**
+* Removes key if present and returns whether it was.
+*/
+template <typename Key, typename Value>
+bool ShardedAVLTree<Key, Value>::ShardTree::erase(const Key& key)
+{
+    AVLNode<Key, Value> *n = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
+    if(n == NULL)
+        return false;
+    this->removeNode(n);
+    return true;
+}
+
+template <typename Key, typename Value>
+ShardedAVLTree<Key, Value>::ShardedAVLTree(size_t shardCount)
+{
+    if(shardCount == 0)
+        shardCount = 1;
+    for(size_t i = 0; i < shardCount; ++i)
+        shards_.push_back(new Shard);
+    Layout* layout = new Layout;
+    layout->version = 0;
+    layout_.store(layout);
+}
+
+template <typename Key, typename Value>
+ShardedAVLTree<Key, Value>::~ShardedAVLTree()
+{
+    for(size_t i = 0; i < shards_.size(); ++i)
+        delete shards_[i];
+    delete layout_.load();
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+*/
+template <typename Key, typename Value>
+void ShardedAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    size_t shardSize;
+    {
+        std::unique_lock<std::mutex> lock;
+        Shard& shard = lockShard(keyValuePair.first, lock);
+        if(!shard.tree.assign(keyValuePair))
+            return;
+        shardSize = shard.size.load(std::memory_order_relaxed) + 1;
+        shard.size.store(shardSize, std::memory_order_relaxed);
+    }
+    maybeRebalance(shardSize);
+}
+
+/**
+* Removes the key if it is present.
+*/
+template <typename Key, typename Value>
+void ShardedAVLTree<Key, Value>::remove(const Key& key)
+{
+    std::unique_lock<std::mutex> lock;
+    Shard& shard = lockShard(key, lock);
+    if(shard.tree.erase(key))
+        shard.size.store(shard.size.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if the key is not present.
+*/
+template <typename Key, typename Value>
+bool ShardedAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    std::unique_lock<std::mutex> lock;
+    Shard& shard = lockShard(key, lock);
+    typename AVLTree<Key, Value>::iterator it = shard.tree.find(key);
+    if(it == shard.tree.end())
+        return false;
+    value = it->second;
+    return true;
+}
+
+template <typename Key, typename Value>
+bool ShardedAVLTree<Key, Value>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Sums the shard sizes without locking, so under concurrent writes the
+* result is only approximate.
+*/
+template <typename Key, typename Value>
+size_t ShardedAVLTree<Key, Value>::size() const
+{
+    size_t total = 0;
+    for(size_t i = 0; i < shards_.size(); ++i)
+        total += shards_[i]->size.load(std::memory_order_relaxed);
+    return total;
+}
+
+template <typename Key, typename Value>
+size_t ShardedAVLTree<Key, Value>::shardCount() const
+{
+    return shards_.size();
+}
+
+/**
+* Returns the number of entries in each shard, for monitoring skew.
+*/
+template <typename Key, typename Value>
+std::vector<size_t> ShardedAVLTree<Key, Value>::shardSizes() const
+{
+    std::vector<size_t> sizes;
+    for(size_t i = 0; i < shards_.size(); ++i)
+    {
+        std::lock_guard<std::mutex> lock(shards_[i]->lock);
+        sizes.push_back(shards_[i]->size.load());
+    }
+    return sizes;
+}
+
+/**
+* Sets shard to the shard that owns key under the current layout and
+* returns that layout's version. The epoch pin keeps the layout alive
+* while it is read; the caller validates the version under the shard lock.
+*/
+template <typename Key, typename Value>
+uint64_t ShardedAVLTree<Key, Value>::locate(const Key& key, size_t& shard) const
+{
+    EpochGuard guard(epoch_);
+    const Layout* layout = layout_.load();
+    shard = layout->shardFor(key);
+    return layout->version;
+}
+
+template <typename Key, typename Value>
+uint64_t ShardedAVLTree<Key, Value>::currentVersion() const
+{
+    EpochGuard guard(epoch_);
+    return layout_.load()->version;
+}
+
+/**
+* Locks and returns the shard that owns key, retrying if the layout
+* changed between choosing the shard and locking it.
+*/
+template <typename Key, typename Value>
+typename ShardedAVLTree<Key, Value>::Shard&
+ShardedAVLTree<Key, Value>::lockShard(const Key& key, std::unique_lock<std::mutex>& lock) const
+{
+    for(;;)
+    {
+        size_t index;
+        uint64_t version = locate(key, index);
+        Shard& shard = *shards_[index];
+        lock = std::unique_lock<std::mutex>(shard.lock);
+        if(shard.layoutVersion == version)
+            return shard;
+        lock.unlock();
+    }
+}
+
+/**
+* Starts a rebalance if a shard that just grew to shardSize is skewed.
+* The shards are only summed every SKEW_CHECK_INTERVAL inserts into a
+* shard, and not before it can be skewed at all. Only one thread
+* rebalances at a time; the others carry on.
+*/
+template <typename Key, typename Value>
+void ShardedAVLTree<Key, Value>::maybeRebalance(size_t shardSize)
+{
+    if(shardSize % SKEW_CHECK_INTERVAL != 0 || shardSize <= SKEW_FACTOR * MIN_REBALANCE_PER_SHARD)
+        return;
+    size_t total = size();
+    if(total < MIN_REBALANCE_PER_SHARD * shards_.size())
+        return;
+    if(shardSize * shards_.size() <= SKEW_FACTOR * total)
+        return;
+    std::unique_lock<std::mutex> lock(rebalanceLock_, std::try_to_lock);
+    if(!lock.owns_lock())
+        return;
+    rebalance(true);
+}
+
+/**
+* Recomputes the shard boundaries so that every shard holds about the
+* same number of keys, and moves entries to their new shards. Blocks all
+* operations while it runs.
+*/
+template <typename Key, typename Value>
+void ShardedAVLTree<Key, Value>::rebalance()
+{
+    rebalance(false);
+}
+
+/**
+* Does the work of rebalance(). With onlyIfSkewed it first re-checks the
+* skew under the shard locks, since another thread may have fixed it.
+*/
+template <typename Key, typename Value>
+void ShardedAVLTree<Key, Value>::rebalance(bool onlyIfSkewed)
+{
+    std::vector<std::unique_lock<std::mutex> > locks;
+    for(size_t i = 0; i < shards_.size(); ++i)
+        locks.push_back(std::unique_lock<std::mutex>(shards_[i]->lock));
+
+    const Layout* old = layout_.load();
+    size_t total = 0;
+    size_t largest = 0;
+    for(size_t i = 0; i < shards_.size(); ++i)
+    {
+        size_t shardSize = shards_[i]->size.load();
+        total += shardSize;
+        largest = std::max(largest, shardSize);
+    }
+    if(onlyIfSkewed && largest * shards_.size() <= SKEW_FACTOR * total)
+        return;
+
+    // Walk all keys in order and pick the ones at each shard quantile.
+    std::unique_ptr<Layout> layout(new Layout);
+    layout->version = old->version + 1;
+    size_t rank = 0;
+    size_t next = 1;
+    for(size_t i = 0; i < shards_.size() && next < shards_.size(); ++i)
+    {
+        AVLTree<Key, Value>& tree = shards_[i]->tree;
+        for(typename AVLTree<Key, Value>::iterator it = tree.begin(); it != tree.end(); ++it, ++rank)
+        {
+            if(next < shards_.size() && rank == next * total / shards_.size())
+            {
+                if(layout->bounds.empty() || layout->bounds.back() < it->first)
+                    layout->bounds.push_back(it->first);
+                ++next;
+            }
+        }
+    }
+
+    // Pull out the entries that no longer belong to their shard...
+    std::vector<std::pair<Key, Value> > moved;
+    for(size_t i = 0; i < shards_.size(); ++i)
+    {
+        Shard& shard = *shards_[i];
+        std::vector<Key> leaving;
+        for(typename AVLTree<Key, Value>::iterator it = shard.tree.begin(); it != shard.tree.end(); ++it)
+        {
+            if(layout->shardFor(it->first) != i)
+            {
+                leaving.push_back(it->first);
+                moved.push_back(std::make_pair(it->first, it->second));
+            }
+        }
+        for(size_t j = 0; j < leaving.size(); ++j)
+            shard.tree.remove(leaving[j]);
+        shard.size.store(shard.size.load() - leaving.size());
+    }
+
+    // ...and put them where they belong now.
+    for(size_t j = 0; j < moved.size(); ++j)
+    {
+        Shard& shard = *shards_[layout->shardFor(moved[j].first)];
+        shard.tree.insert(moved[j]);
+        shard.size.store(shard.size.load() + 1);
+    }
+
+    for(size_t i = 0; i < shards_.size(); ++i)
+        shards_[i]->layoutVersion = layout->version;
+    layout_.store(layout.release());
+    epoch_.retire(const_cast<Layout*>(old));
+}
+
+template <typename Key, typename Value>
+typename ShardedAVLTree<Key, Value>::iterator
+ShardedAVLTree<Key, Value>::begin()
+{
+    iterator it;
+    it.owner_ = this;
+    for(;;)
+    {
+        it.layoutVersion_ = currentVersion();
+        it.shard_ = 0;
+        it.lock_ = std::unique_lock<std::mutex>(shards_[0]->lock);
+        if(shards_[0]->layoutVersion == it.layoutVersion_)
+            break;
+        it.lock_.unlock();
+    }
+    it.it_ = shards_[0]->tree.begin();
+    it.skipEmpty();
+    return it;
+}
+
+template <typename Key, typename Value>
+typename ShardedAVLTree<Key, Value>::iterator
+ShardedAVLTree<Key, Value>::end()
+{
+    return iterator();
+}
+
+/**
+* Returns an iterator to the first entry whose key is not less than key.
+*/
+template <typename Key, typename Value>
+typename ShardedAVLTree<Key, Value>::iterator
+ShardedAVLTree<Key, Value>::lower_bound(const Key& key)
+{
+    iterator it;
+    seek(it, key, true);
+    return it;
+}
+
+/**
+* Positions it at the first key >= key (inclusive) or > key (otherwise),
+* starting from the shard that owns key under the current layout.
+*/
+template <typename Key, typename Value>
+void ShardedAVLTree<Key, Value>::seek(iterator& it, const Key& key, bool inclusive)
+{
+    it.owner_ = this;
+    if(it.lock_.owns_lock())
+        it.lock_.unlock();
+    for(;;)
+    {
+        it.layoutVersion_ = locate(key, it.shard_);
+        it.lock_ = std::unique_lock<std::mutex>(shards_[it.shard_]->lock);
+        if(shards_[it.shard_]->layoutVersion == it.layoutVersion_)
+            break;
+        it.lock_.unlock();
+    }
+    it.resume_ = key;
+    it.resumeInclusive_ = inclusive;
+    it.hasResume_ = true;
+    AVLTree<Key, Value>& tree = shards_[it.shard_]->tree;
+    it.it_ = tree.lower_bound(key);
+    if(!inclusive && it.it_ != tree.end() && !(key < it.it_->first))
+        ++it.it_;
+    it.skipEmpty();
+}
+
+template <typename Key, typename Value>
+ShardedAVLTree<Key, Value>::iterator::iterator() :
+    owner_(NULL),
+    layoutVersion_(0),
+    shard_(0),
+    resume_(),
+    resumeInclusive_(false),
+    hasResume_(false)
+{
+
+}
+
+template <typename Key, typename Value>
+std::pair<const Key, Value>&
+ShardedAVLTree<Key, Value>::iterator::operator*() const
+{
+    return *it_;
+}
+
+template <typename Key, typename Value>
+std::pair<const Key, Value>*
+ShardedAVLTree<Key, Value>::iterator::operator->() const
+{
+    return &(*it_);
+}
+
+/**
+* Two iterators are equal if both are at the end or both are at the
+* same entry.
+*/
+template <typename Key, typename Value>
+bool ShardedAVLTree<Key, Value>::iterator::operator==(const iterator& rhs) const
+{
+    if(owner_ == NULL || rhs.owner_ == NULL)
+        return owner_ == rhs.owner_;
+    return shard_ == rhs.shard_ && it_ == rhs.it_;
+}
+
+template <typename Key, typename Value>
+bool ShardedAVLTree<Key, Value>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next key. The key is remembered when leaving a shard so
+* the iterator can find its place again if a rebalance moves boundaries.
+*/
+template <typename Key, typename Value>
+typename ShardedAVLTree<Key, Value>::iterator&
+ShardedAVLTree<Key, Value>::iterator::operator++()
+{
+    typename AVLTree<Key, Value>::iterator prev = it_;
+    ++it_;
+    if(it_ == owner_->shards_[shard_]->tree.end())
+    {
+        resume_ = prev->first;
+        resumeInclusive_ = false;
+        hasResume_ = true;
+    }
+    skipEmpty();
+    return *this;
+}
+
+/**
+* Moves on to the next shard while the current one is exhausted. If the
+* layout changed while the iterator was between shards, it re-seeks from
+* the last key it returned, or restarts if it has not returned any yet.
+*/
+template <typename Key, typename Value>
+void ShardedAVLTree<Key, Value>::iterator::skipEmpty()
+{
+    std::vector<Shard*>& shards = owner_->shards_;
+    while(it_ == shards[shard_]->tree.end())
+    {
+        lock_.unlock();
+        if(shard_ + 1 >= shards.size())
+        {
+            owner_ = NULL;
+            return;
+        }
+        ++shard_;
+        lock_ = std::unique_lock<std::mutex>(shards[shard_]->lock);
+        if(shards[shard_]->layoutVersion != layoutVersion_)
+        {
+            lock_.unlock();
+            if(hasResume_)
+                owner_->seek(*this, resume_, resumeInclusive_);
+            else
+                *this = owner_->begin();
+            return;
+        }
+        it_ = shards[shard_]->tree.begin();
+    }
+}
+
+#endif
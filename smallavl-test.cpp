@@ -0,0 +1,172 @@
+#include <map>
+#include <new>
+#include <stdexcept>
+#include "bst.h"
+#include "avlbst.h"
+#include "smallavl.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for SmallAVLMap: the std::map comparison in both representations,
+// the switch between them, and what is left after a throwing copy.
+
+typedef SmallAVLMap<int, int, 16> Small;
+
+/**
+* The map is in the array up to 16 entries and in the tree above 8.
+*/
+bool representationOk(const Small& map)
+{
+    return map.promoted() ? map.size() > 8 : map.size() <= 16;
+}
+
+/**
+* True if iterating the map visits size() entries in increasing key order.
+*/
+template <typename Map>
+bool consistent(const Map& map)
+{
+    size_t count = 0;
+    typename Map::iterator prev = map.end();
+    for(typename Map::iterator it = map.begin(); it != map.end(); ++it, ++count)
+    {
+        if(prev != map.end() && !(prev->first < it->first))
+            return false;
+        prev = it;
+    }
+    return count == map.size();
+}
+
+/**
+* Keys drawn from 0..23 keep the map crossing between the array and the
+* tree, checking every step against std::map.
+*/
+void testSwitching()
+{
+    const char* name = "SmallAVLMap switching";
+    Small map;
+    std::map<int, int> ref;
+    int promotions = 0;
+    int demotions = 0;
+    srand(71);
+    for(int i = 0; i < 20000; ++i)
+    {
+        int key = rand() % 24;
+        bool wasPromoted = map.promoted();
+        if(rand() % 2 == 0)
+        {
+            map.insert(make_pair(key, i));
+            ref[key] = i;
+        }
+        else
+        {
+            map.remove(key);
+            ref.erase(key);
+        }
+        promotions += !wasPromoted && map.promoted();
+        demotions += wasPromoted && !map.promoted();
+        check(representationOk(map) && map.size() == ref.size(), name, "wrong representation or size");
+        Small::iterator it = map.lower_bound(key);
+        std::map<int, int>::iterator r = ref.lower_bound(key);
+        check(r == ref.end() ? it == map.end() : (it != map.end() && it->first == r->first && it->second == r->second),
+              name, "lower_bound disagrees with std::map");
+    }
+    check(promotions > 0 && demotions > 0, name, "map never switched representation");
+    check(sameContents(map, ref), name, "contents differ from std::map");
+}
+
+/**
+* Up to 16 entries live in the object itself.
+*/
+void testNoAllocation()
+{
+    const char* name = "SmallAVLMap array";
+    Small map;
+    allocationsLeft() = 0;
+    bool allocated = false;
+    try
+    {
+        for(int key = 16; key > 0; --key)
+            map.insert(make_pair(key, key));
+        map.remove(3);
+        map[4] = 40;
+    }
+    catch(bad_alloc&)
+    {
+        allocated = true;
+    }
+    allocationsLeft() = -1;
+    check(!allocated && !map.promoted() && map.size() == 15 && map[4] == 40, name, "small map allocated");
+
+    bool thrown = false;
+    try
+    {
+        map[3];
+    }
+    catch(out_of_range&)
+    {
+        thrown = true;
+    }
+    check(thrown, name, "subscript of a missing key did not throw");
+}
+
+/**
+* A value copy that throws while the array is shifted empties the map
+* without leaking; one that throws while the tree is copied back keeps
+* the tree.
+*/
+void testThrowingCopies()
+{
+    const char* name = "SmallAVLMap throwing copies";
+    {
+        SmallAVLMap<int, ThrowingValue, 16> map;
+        for(int key = 1; key <= 10; ++key)
+            map.insert(make_pair(key, ThrowingValue(key)));
+        ThrowingValue::copiesLeft() = 3;
+        bool thrown = false;
+        try
+        {
+            map.insert(make_pair(0, ThrowingValue(0)));
+        }
+        catch(runtime_error&)
+        {
+            thrown = true;
+        }
+        ThrowingValue::copiesLeft() = -1;
+        check(thrown && map.empty() && consistent(map), name, "failed shift did not leave the map empty");
+        map.insert(make_pair(5, ThrowingValue(5)));
+        check(map.size() == 1 && map[5].v == 5, name, "map unusable after a failed shift");
+
+        for(int key = 10; key < 30; ++key)
+            map.insert(make_pair(key, ThrowingValue(key)));
+        for(int key = 10; key < 22; ++key)
+            map.remove(key);
+        check(map.promoted() && map.size() == 9, name, "map not in the tree before the demotion");
+        ThrowingValue::copiesLeft() = 2;
+        thrown = false;
+        try
+        {
+            map.remove(22);
+        }
+        catch(runtime_error&)
+        {
+            thrown = true;
+        }
+        ThrowingValue::copiesLeft() = -1;
+        check(thrown && map.promoted() && map.size() == 8 && consistent(map), name,
+              "failed demotion did not keep the tree");
+    }
+    check(ThrowingValue::live() == 0, name, "values leaked");
+}
+
+int main()
+{
+    Small map;
+    stressMap("SmallAVLMap", map, 72, representationOk);
+    testSwitching();
+    testNoAllocation();
+    testThrowingCopies();
+    return testSummary("SmallAVLMap");
+}
@@ -0,0 +1,437 @@
+#ifndef SMALLAVL_H
+#define SMALLAVL_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* A map that keeps up to N entries in a sorted array inside the object
+* and switches to an AVLTree when it grows past N. A small map costs no
+* allocation at all and a lookup scans one contiguous array; a large map
+* behaves like the AVLTree it holds. It goes back to the array once it
+* shrinks to N/2 entries, so a map hovering around N does not rebuild on
+* every insert and remove.
+*
+* The API follows BinarySearchTree. Iterators visit entries in key order
+* in either representation and are invalidated by any insert or remove.
+* If copying a key or moving a value throws while entries of the array
+* are being shifted, the map is left empty.
+*/
+template <typename Key, typename Value, size_t N = 16,
+          typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class SmallAVLMap
+{
+public:
+    typedef std::pair<const Key, Value> Item;
+    typedef AVLTree<Key, Value, Alloc> TreeT;
+
+    class iterator
+    {
+    public:
+        iterator();
+
+        Item& operator*() const;
+        Item* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class SmallAVLMap<Key, Value, N, Alloc>;
+        iterator(Item* item, Item* last);
+        iterator(const typename TreeT::iterator& it);
+
+        Item *item_;
+        Item *last_;
+        typename TreeT::iterator tree_;
+    };
+
+    explicit SmallAVLMap(const Alloc& alloc = Alloc());
+    ~SmallAVLMap();
+
+    void insert(const Item& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    bool promoted() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+private:
+    SmallAVLMap(const SmallAVLMap&);
+    SmallAVLMap& operator=(const SmallAVLMap&);
+
+    Item* items() const;
+    size_t position(const Key& key) const;
+    void destroyItems(size_t hole);
+    void promote();
+    void demote();
+
+    typename std::aligned_storage<sizeof(Item), alignof(Item)>::type storage_[N];
+    TreeT* tree_;
+    size_t size_;
+    Alloc alloc_;
+};
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+SmallAVLMap<Key, Value, N, Alloc>::iterator::iterator() :
+    item_(NULL),
+    last_(NULL),
+    tree_()
+{
+
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+SmallAVLMap<Key, Value, N, Alloc>::iterator::iterator(Item* item, Item* last) :
+    item_(item),
+    last_(last),
+    tree_()
+{
+
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+SmallAVLMap<Key, Value, N, Alloc>::iterator::iterator(const typename TreeT::iterator& it) :
+    item_(NULL),
+    last_(NULL),
+    tree_(it)
+{
+
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+typename SmallAVLMap<Key, Value, N, Alloc>::Item&
+SmallAVLMap<Key, Value, N, Alloc>::iterator::operator*() const
+{
+    return item_ != NULL ? *item_ : *tree_;
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+typename SmallAVLMap<Key, Value, N, Alloc>::Item*
+SmallAVLMap<Key, Value, N, Alloc>::iterator::operator->() const
+{
+    return &(**this);
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+bool SmallAVLMap<Key, Value, N, Alloc>::iterator::operator==(const iterator& rhs) const
+{
+    return item_ == rhs.item_ && tree_ == rhs.tree_;
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+bool SmallAVLMap<Key, Value, N, Alloc>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+typename SmallAVLMap<Key, Value, N, Alloc>::iterator&
+SmallAVLMap<Key, Value, N, Alloc>::iterator::operator++()
+{
+    if(item_ == NULL)
+        ++tree_;
+    else if(item_ == last_)
+        item_ = NULL;
+    else
+        ++item_;
+    return *this;
+}
+
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+SmallAVLMap<Key, Value, N, Alloc>::SmallAVLMap(const Alloc& alloc) :
+    tree_(NULL),
+    size_(0),
+    alloc_(alloc)
+{
+
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+SmallAVLMap<Key, Value, N, Alloc>::~SmallAVLMap()
+{
+    clear();
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+typename SmallAVLMap<Key, Value, N, Alloc>::Item* SmallAVLMap<Key, Value, N, Alloc>::items() const
+{
+    return reinterpret_cast<Item*>(const_cast<typename std::aligned_storage<sizeof(Item), alignof(Item)>::type*>(storage_));
+}
+
+/**
+* Index of the first entry whose key is not less than key. Counts instead
+* of stopping at the first match, which keeps the loop free of branches
+* the predictor could miss and lets the compiler vectorize it for
+* arithmetic keys.
+*/
+template <typename Key, typename Value, size_t N, typename Alloc>
+size_t SmallAVLMap<Key, Value, N, Alloc>::position(const Key& key) const
+{
+    const Item *a = items();
+    size_t pos = 0;
+    for(size_t i = 0; i < size_; ++i)
+        pos += (a[i].first < key) ? 1 : 0;
+    return pos;
+}
+
+/**
+* Destroys the array entries in [0, size_], except the one at hole, after
+* a shift failed part way, and leaves the map empty.
+*/
+template <typename Key, typename Value, size_t N, typename Alloc>
+void SmallAVLMap<Key, Value, N, Alloc>::destroyItems(size_t hole)
+{
+    Item *a = items();
+    for(size_t j = 0; j <= size_ && j < N; ++j)
+    {
+        if(j != hole)
+            a[j].~Item();
+    }
+    size_ = 0;
+}
+
+/**
+* Inserts or overwrites. The N+1th key moves every entry into an AVLTree.
+*/
+template <typename Key, typename Value, size_t N, typename Alloc>
+void SmallAVLMap<Key, Value, N, Alloc>::insert(const Item& keyValuePair)
+{
+    if(tree_ == NULL)
+    {
+        Item *a = items();
+        size_t i = position(keyValuePair.first);
+        if(i < size_ && !(keyValuePair.first < a[i].first))
+        {
+            a[i].second = keyValuePair.second;
+            return;
+        }
+        if(size_ < N)
+        {
+            size_t hole = size_;
+            try
+            {
+                for(; hole > i; --hole)
+                {
+                    ::new (static_cast<void*>(a + hole)) Item(std::move(a[hole - 1]));
+                    a[hole - 1].~Item();
+                }
+                ::new (static_cast<void*>(a + i)) Item(keyValuePair);
+            }
+            catch(...)
+            {
+                destroyItems(hole);
+                throw;
+            }
+            ++size_;
+            return;
+        }
+        promote();
+    }
+    typename TreeT::iterator it = tree_->find(keyValuePair.first);
+    if(it != tree_->end())
+    {
+        it->second = keyValuePair.second;
+        return;
+    }
+    tree_->insert(keyValuePair);
+    ++size_;
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+void SmallAVLMap<Key, Value, N, Alloc>::remove(const Key& key)
+{
+    if(tree_ != NULL)
+    {
+        if(tree_->find(key) == tree_->end())
+            return;
+        tree_->remove(key);
+        --size_;
+        if(size_ <= N / 2)
+            demote();
+        return;
+    }
+
+    Item *a = items();
+    size_t i = position(key);
+    if(i == size_ || key < a[i].first)
+        return;
+    a[i].~Item();
+    size_t hole = i;
+    try
+    {
+        for(; hole + 1 < size_; ++hole)
+        {
+            ::new (static_cast<void*>(a + hole)) Item(std::move(a[hole + 1]));
+            a[hole + 1].~Item();
+        }
+    }
+    catch(...)
+    {
+        --size_;
+        destroyItems(hole);
+        throw;
+    }
+    --size_;
+}
+
+/**
+* Moves the entries into a new AVLTree in linear time. The array is only
+* torn down once the tree is complete.
+*/
+template <typename Key, typename Value, size_t N, typename Alloc>
+void SmallAVLMap<Key, Value, N, Alloc>::promote()
+{
+    TreeT *tree = new TreeT(alloc_);
+    try
+    {
+        tree->buildFromSorted(items(), size_);
+    }
+    catch(...)
+    {
+        delete tree;
+        throw;
+    }
+    Item *a = items();
+    for(size_t i = 0; i < size_; ++i)
+        a[i].~Item();
+    tree_ = tree;
+}
+
+/**
+* Copies the entries back into the array and frees the tree. If a copy
+* throws, the tree is kept.
+*/
+template <typename Key, typename Value, size_t N, typename Alloc>
+void SmallAVLMap<Key, Value, N, Alloc>::demote()
+{
+    Item *a = items();
+    size_t n = 0;
+    try
+    {
+        for(typename TreeT::iterator it = tree_->begin(); it != tree_->end(); ++it, ++n)
+            ::new (static_cast<void*>(a + n)) Item(*it);
+    }
+    catch(...)
+    {
+        for(size_t i = 0; i < n; ++i)
+            a[i].~Item();
+        throw;
+    }
+    delete tree_;
+    tree_ = NULL;
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+void SmallAVLMap<Key, Value, N, Alloc>::clear()
+{
+    if(tree_ != NULL)
+    {
+        delete tree_;
+        tree_ = NULL;
+    }
+    else
+    {
+        Item *a = items();
+        for(size_t i = 0; i < size_; ++i)
+            a[i].~Item();
+    }
+    size_ = 0;
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+bool SmallAVLMap<Key, Value, N, Alloc>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+size_t SmallAVLMap<Key, Value, N, Alloc>::size() const
+{
+    return size_;
+}
+
+/**
+* True while the entries live in an AVLTree rather than the array.
+*/
+template <typename Key, typename Value, size_t N, typename Alloc>
+bool SmallAVLMap<Key, Value, N, Alloc>::promoted() const
+{
+    return tree_ != NULL;
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+typename SmallAVLMap<Key, Value, N, Alloc>::iterator SmallAVLMap<Key, Value, N, Alloc>::begin() const
+{
+    if(tree_ != NULL)
+        return iterator(tree_->begin());
+    if(size_ == 0)
+        return end();
+    return iterator(items(), items() + size_ - 1);
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+typename SmallAVLMap<Key, Value, N, Alloc>::iterator SmallAVLMap<Key, Value, N, Alloc>::end() const
+{
+    return iterator();
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+typename SmallAVLMap<Key, Value, N, Alloc>::iterator SmallAVLMap<Key, Value, N, Alloc>::find(const Key& key) const
+{
+    if(tree_ != NULL)
+        return iterator(tree_->find(key));
+    size_t i = position(key);
+    if(i == size_ || key < items()[i].first)
+        return end();
+    return iterator(items() + i, items() + size_ - 1);
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+typename SmallAVLMap<Key, Value, N, Alloc>::iterator SmallAVLMap<Key, Value, N, Alloc>::lower_bound(const Key& key) const
+{
+    if(tree_ != NULL)
+        return iterator(tree_->lower_bound(key));
+    size_t i = position(key);
+    if(i == size_)
+        return end();
+    return iterator(items() + i, items() + size_ - 1);
+}
+
+/**
+* @precondition The key exists in the map
+* Returns the value associated with the key
+*/
+template <typename Key, typename Value, size_t N, typename Alloc>
+Value& SmallAVLMap<Key, Value, N, Alloc>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template <typename Key, typename Value, size_t N, typename Alloc>
+Value const & SmallAVLMap<Key, Value, N, Alloc>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+#endif
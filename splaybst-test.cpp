@@ -0,0 +1,77 @@
+#include <stdexcept>
+#include "bst.h"
+#include "splaybst.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for SplayTree: the std::map comparison, and that non-const access
+// brings the key touched to the root while const access leaves the shape
+// alone.
+
+template <typename Tree>
+bool invariantsOk(const Tree& tree)
+{
+    return tree.checkInvariants();
+}
+
+/**
+* Exposes the root so that tests can see where splaying left a key.
+*/
+class PeekSplayTree : public SplayTree<int, int>
+{
+public:
+    const NodeT* top() const
+    {
+        return this->root();
+    }
+
+    int topKey() const
+    {
+        return top() == nullptr ? -1 : top()->getKey();
+    }
+};
+
+void testSplaying()
+{
+    const char* name = "SplayTree splaying";
+    PeekSplayTree tree;
+    for(int key = 0; key < 1000; ++key)
+        tree.insert(make_pair(key, key));
+    check(tree.topKey() == 999, name, "inserted key not at the root");
+
+    check(tree.find(3) != tree.end() && tree.topKey() == 3, name, "found key not at the root");
+    check(tree[500] == 500 && tree.topKey() == 500, name, "subscripted key not at the root");
+    tree.insert(make_pair(7, -7));
+    check(tree.topKey() == 7 && tree.find(7)->second == -7, name, "overwritten key not at the root");
+
+    // A miss splays the last node on the search path, a neighbour.
+    tree.remove(250);
+    check(tree.find(250) == tree.end(), name, "removed key still found");
+    check(tree.topKey() == 249 || tree.topKey() == 251, name, "a miss did not splay a neighbour");
+    bool thrown = false;
+    try
+    {
+        tree[250];
+    }
+    catch(out_of_range&)
+    {
+        thrown = true;
+    }
+    check(thrown, name, "subscript of a missing key did not throw");
+
+    const PeekSplayTree& constTree = tree;
+    int before = tree.topKey();
+    check(constTree.find(900) != constTree.end() && constTree[10] == 10, name, "const lookups failed");
+    check(tree.topKey() == before, name, "const lookups changed the shape");
+    check(tree.checkInvariants(), name, "structure invariants broken");
+}
+
+int main()
+{
+    SplayTree<int, int> splay;
+    stressMap("SplayTree", splay, 7, invariantsOk<SplayTree<int, int> >);
+    testSplaying();
+    return testSummary("SplayTree");
+}
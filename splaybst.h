@@ -0,0 +1,169 @@
+#ifndef SPLAYBST_H
+#define SPLAYBST_H
+
+#include "bst.h"
+#include "balancedbst.h"
+
+/**
+* Self-adjusting policy for BalancedTree: every touched node is rotated
+* to the root by zig-zig/zig-zag steps. There is no invariant to keep, so
+* rank is unused. Operations are O(log n) amortized, and a key accessed
+* often stays within a few levels of the root, so a skewed workload costs
+* close to the entropy of its access distribution rather than log n.
+*/
+struct SplayPolicy
+{
+    template <typename Tree, typename NodeT>
+    static void splay(Tree& t, NodeT* x)
+    {
+        while(x->getParent() != nullptr)
+        {
+            NodeT *p = x->getParent();
+            NodeT *g = p->getParent();
+            if(g == nullptr)
+            {
+                t.rotateUp(x);
+            }
+            else if((g->getLeft() == p) == (p->getLeft() == x))
+            {
+                t.rotateUp(p);
+                t.rotateUp(x);
+            }
+            else
+            {
+                t.rotateUp(x);
+                t.rotateUp(x);
+            }
+        }
+    }
+
+    template <typename NodeT>
+    static void init(NodeT* n)
+    {
+        n->setRank(0);
+    }
+
+    template <typename Tree, typename NodeT>
+    static void inserted(Tree& t, NodeT* n)
+    {
+        splay(t, n);
+    }
+
+    template <typename Tree, typename NodeT>
+    static void erase(Tree& t, NodeT* n)
+    {
+        if(n->getLeft() != nullptr && n->getRight() != nullptr)
+            t.swapWithPredecessor(n);
+        NodeT *parent = n->getParent();
+        t.splice(n);
+        if(parent != nullptr)
+            splay(t, parent);
+    }
+
+    template <typename NodeT>
+    static bool check(const NodeT*)
+    {
+        return true;
+    }
+};
+
+/**
+* A splay tree: a BalancedTree under SplayPolicy whose non-const lookups
+* also splay, so that hot keys migrate to the top of the tree. Lookups
+* through a const reference use the inherited searches and leave the
+* shape alone.
+*
+* Splaying writes to the tree on every lookup, so a SplayTree must not be
+* read from several threads at once, even through const member functions
+* that only see a non-const object.
+*/
+template <typename Key, typename Value, typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class SplayTree : public BalancedTree<Key, Value, SplayPolicy, Alloc>
+{
+public:
+    typedef BalancedTree<Key, Value, SplayPolicy, Alloc> Base;
+    typedef typename Base::NodeT NodeT;
+    typedef typename Base::iterator iterator;
+
+    explicit SplayTree(const Alloc& alloc = Alloc());
+
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+
+    using Base::find;
+    using Base::operator[];
+    iterator find(const Key& key);
+    Value& operator[](const Key& key);
+
+protected:
+    bool splayTo(const Key& key);
+};
+
+template <typename Key, typename Value, typename Alloc>
+SplayTree<Key, Value, Alloc>::SplayTree(const Alloc& alloc) :
+    Base(alloc)
+{
+
+}
+
+/**
+* Searches for key and splays the last node on the search path, the match
+* if there is one. Splaying on a miss too keeps the amortized bound.
+* Returns true if key is now at the root.
+*/
+template <typename Key, typename Value, typename Alloc>
+bool SplayTree<Key, Value, Alloc>::splayTo(const Key& key)
+{
+    NodeT *curr = this->root();
+    NodeT *last = nullptr;
+    while(curr != nullptr)
+    {
+        last = curr;
+        if(key < curr->getKey())
+            curr = curr->getLeft();
+        else if(curr->getKey() < key)
+            curr = curr->getRight();
+        else
+            break;
+    }
+    if(last == nullptr)
+        return false;
+    SplayPolicy::splay(*this, last);
+    return curr != nullptr;
+}
+
+/**
+* Overwrites in place if the key exists, which also splays it.
+*/
+template <typename Key, typename Value, typename Alloc>
+void SplayTree<Key, Value, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if(splayTo(keyValuePair.first))
+        this->root()->setValue(keyValuePair.second);
+    else
+        Base::insert(keyValuePair);
+}
+
+/**
+* Finds key and moves it to the root. The inherited find is then
+* answered by the root in one comparison.
+*/
+template <typename Key, typename Value, typename Alloc>
+typename SplayTree<Key, Value, Alloc>::iterator SplayTree<Key, Value, Alloc>::find(const Key& key)
+{
+    if(!splayTo(key))
+        return this->end();
+    return Base::find(key);
+}
+
+/**
+* @precondition The key exists in the map
+* Returns the value associated with the key, after splaying it
+*/
+template <typename Key, typename Value, typename Alloc>
+Value& SplayTree<Key, Value, Alloc>::operator[](const Key& key)
+{
+    splayTo(key);
+    return Base::operator[](key);
+}
+
+#endif
@@ -0,0 +1,229 @@
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include "bst.h"
+#include "avlbst.h"
+#include "splitavl.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for SplitAVLTree: the std::map comparison through compaction, the
+// stability of value references, slot reuse, export_range, and the
+// rollback of inserts and compactions that throw.
+
+void testRandom()
+{
+    const char* name = "SplitAVLTree";
+    SplitAVLTree<int, int> tree;
+    map<int, int> ref;
+    srand(19);
+    for(int i = 0; i < 30000; ++i)
+    {
+        int key = rand() % 2000;
+        int op = rand() % 6;
+        if(op < 4)
+        {
+            tree.insert(make_pair(key, i));
+            ref[key] = i;
+        }
+        else if(op == 4)
+        {
+            tree.remove(key);
+            ref.erase(key);
+        }
+        else
+        {
+            SplitAVLTree<int, int>::iterator it = tree.lower_bound(key);
+            map<int, int>::iterator r = ref.lower_bound(key);
+            check(r == ref.end() ? it == tree.end() : (it != tree.end() && it->first == r->first && it->second == r->second),
+                  name, "lower_bound disagrees with std::map");
+        }
+        if(i % 10000 == 0)
+            tree.compact();
+    }
+    check(tree.size() == ref.size() && sameContents(tree, ref), name, "contents differ from std::map");
+    for(map<int, int>::iterator r = ref.begin(); r != ref.end(); ++r)
+        tree[r->first] += 1;
+    bool bumped = true;
+    for(map<int, int>::iterator r = ref.begin(); r != ref.end(); ++r)
+        bumped = bumped && tree.find(r->first)->second == r->second + 1;
+    check(bumped, name, "values written through operator[] were lost");
+}
+
+/**
+* Values never move on insert, removed slots are reused and release what
+* their values owned, and compact leaves the store in key order.
+*/
+void testValueStore()
+{
+    const char* name = "SplitAVLTree values";
+    SplitAVLTree<int, string> tree;
+    tree.insert(make_pair(0, string("zero")));
+    string* first = &tree[0];
+    for(int key = 1; key < 5000; ++key)
+        tree.insert(make_pair(key, string(100, 'a' + key % 26)));
+    check(&tree[0] == first && *first == "zero", name, "insert moved a value");
+
+    TreeMemoryUsage full = tree.memory_usage();
+    for(int key = 1; key < 5000; key += 2)
+        tree.remove(key);
+    TreeMemoryUsage half = tree.memory_usage();
+    check(half.ownedBytes * 3 < full.ownedBytes * 2, name, "removed values kept their memory");
+    for(int key = 1; key < 5000; key += 2)
+        tree.insert(make_pair(key, string("back")));
+    check(tree.memory_usage().auxiliaryBytes == half.auxiliaryBytes, name, "freed slots were not reused");
+
+    tree.compact();
+    const string* prev = NULL;
+    bool ordered = true;
+    int count = 0;
+    for(SplitAVLTree<int, string>::iterator it = tree.begin(); it != tree.end(); ++it, ++count)
+    {
+        const string* at = &it->second;
+        ordered = ordered && (count % (int)SplitAVLTree<int, string>::ValueStore::BLOCK_SLOTS == 0 || at == prev + 1);
+        prev = at;
+    }
+    check(ordered && count == 5000 && tree[1] == "back" && tree[2] == string(100, 'c'), name,
+          "compact did not store the values in key order");
+
+    bool thrown = false;
+    try
+    {
+        tree[5000];
+    }
+    catch(out_of_range&)
+    {
+        thrown = true;
+    }
+    check(thrown, name, "subscript of a missing key did not throw");
+    tree.clear();
+    TreeMemoryUsage cleared = tree.memory_usage();
+    check(tree.empty() && tree.begin() == tree.end() && cleared.nodes == 0 && cleared.ownedBytes == 0, name,
+          "clear left values behind");
+}
+
+/**
+* export_range copies values a run of slots at a time: check it while
+* removals and reinsertions have broken the slots into short runs, and
+* after compact() has made them one.
+*/
+void testExport()
+{
+    const char* name = "SplitAVLTree export_range";
+    SplitAVLTree<int, int> tree;
+    map<int, int> ref;
+    srand(23);
+    for(int i = 0; i < 8000; ++i)
+    {
+        int key = rand() % 4000;
+        if(rand() % 4 == 0)
+        {
+            tree.remove(key);
+            ref.erase(key);
+        }
+        else
+        {
+            tree.insert(make_pair(key, i));
+            ref[key] = i;
+        }
+    }
+    const size_t capacities[] = { 1, 5, 300, 5000 };
+    for(int pass = 0; pass < 2; ++pass)
+    {
+        for(size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); ++c)
+        {
+            checkExport(name, tree, ref, 0, 4000, capacities[c]);
+            checkExport(name, tree, ref, 1000, 1100, capacities[c]);
+            checkExport(name, tree, ref, 3990, 5000, capacities[c]);
+        }
+        tree.compact();
+    }
+
+    SplitAVLTree<int, string> strings;
+    map<int, string> stringRef;
+    for(int key = 0; key < 200; key += 2)
+    {
+        strings.insert(make_pair(key, string(key, 'x')));
+        stringRef[key] = string(key, 'x');
+    }
+    checkExport(name, strings, stringRef, 10, 150, 16);
+}
+
+/**
+* An insert whose value copy or node allocation fails leaves the map as
+* it was, as does a compaction whose value copy fails.
+*/
+void testRollback()
+{
+    const char* name = "SplitAVLTree rollback";
+    {
+        SplitAVLTree<int, ThrowingValue> tree;
+        map<int, ThrowingValue> ref;
+        for(int key = 0; key < 100; ++key)
+        {
+            tree.insert(make_pair(key, ThrowingValue(key)));
+            ref[key] = ThrowingValue(key);
+        }
+        tree.remove(50);
+        ref.erase(50);
+
+        ThrowingValue::copiesLeft() = 0;
+        bool thrown = false;
+        try
+        {
+            tree.insert(make_pair(200, ThrowingValue(200)));
+        }
+        catch(runtime_error&)
+        {
+            thrown = true;
+        }
+        ThrowingValue::copiesLeft() = -1;
+        check(thrown && tree.size() == 99 && sameContents(tree, ref), name, "failed value copy changed the map");
+
+        for(int reuse = 0; reuse < 2; ++reuse)
+        {
+            allocationsLeft() = 0;
+            thrown = false;
+            try
+            {
+                tree.insert(make_pair(300 + reuse, ThrowingValue(300)));
+            }
+            catch(bad_alloc&)
+            {
+                thrown = true;
+            }
+            allocationsLeft() = -1;
+            check(thrown && tree.size() == 99 && sameContents(tree, ref), name, "failed node allocation changed the map");
+        }
+        tree.insert(make_pair(50, ThrowingValue(50)));
+        ref[50] = ThrowingValue(50);
+        check(sameContents(tree, ref), name, "freed slot unusable after a failed insert");
+
+        ThrowingValue::copiesLeft() = 10;
+        thrown = false;
+        try
+        {
+            tree.compact();
+        }
+        catch(runtime_error&)
+        {
+            thrown = true;
+        }
+        ThrowingValue::copiesLeft() = -1;
+        check(thrown && tree.size() == 100 && sameContents(tree, ref), name, "failed compact changed the map");
+    }
+    check(ThrowingValue::live() == 0, name, "values leaked");
+}
+
+int main()
+{
+    testRandom();
+    testValueStore();
+    testExport();
+    testRollback();
+    return testSummary("SplitAVLTree");
+}
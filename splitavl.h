@@ -0,0 +1,604 @@
+#ifndef SPLITAVL_H
+#define SPLITAVL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* Storage for SplitAVLTree's values: slots in fixed-size blocks that are
+* allocated as the store grows and never moved, so a reference to a slot
+* stays valid until the slot itself is popped, the store is cleared or it
+* is swapped away. Slot i lives at index i % BLOCK_SLOTS of block
+* i / BLOCK_SLOTS, so consecutive slots are contiguous within a block.
+*/
+template <typename Value, typename Alloc>
+class ValueBlocks
+{
+public:
+    // Slots per block: about BLOCK_BYTES worth, at least one.
+    static const size_t BLOCK_BYTES = 16384;
+    static const size_t BLOCK_SLOTS = sizeof(Value) >= BLOCK_BYTES ? 1 : BLOCK_BYTES / sizeof(Value);
+
+    explicit ValueBlocks(const Alloc& alloc = Alloc());
+    ~ValueBlocks();
+
+    Value& operator[](size_t slot);
+    const Value& operator[](size_t slot) const;
+    size_t size() const;
+    size_t capacity() const;
+    size_t memory_bytes() const;
+    Alloc get_allocator() const;
+
+    template <typename V>
+    void push_back(V&& value);
+    void pop_back();
+    void reserve(size_t slots);
+    void clear();
+    void swap(ValueBlocks& other);
+    void copy_out(size_t first, size_t count, Value* out) const;
+
+private:
+    ValueBlocks(const ValueBlocks&);
+    ValueBlocks& operator=(const ValueBlocks&);
+
+    void addBlock();
+
+    std::vector<Value*> blocks_;
+    size_t size_;
+    Alloc alloc_;
+};
+
+template <typename Value, typename Alloc>
+ValueBlocks<Value, Alloc>::ValueBlocks(const Alloc& alloc) :
+    size_(0),
+    alloc_(alloc)
+{
+
+}
+
+template <typename Value, typename Alloc>
+ValueBlocks<Value, Alloc>::~ValueBlocks()
+{
+    clear();
+}
+
+template <typename Value, typename Alloc>
+Value& ValueBlocks<Value, Alloc>::operator[](size_t slot)
+{
+    return blocks_[slot / BLOCK_SLOTS][slot % BLOCK_SLOTS];
+}
+
+template <typename Value, typename Alloc>
+const Value& ValueBlocks<Value, Alloc>::operator[](size_t slot) const
+{
+    return blocks_[slot / BLOCK_SLOTS][slot % BLOCK_SLOTS];
+}
+
+template <typename Value, typename Alloc>
+size_t ValueBlocks<Value, Alloc>::size() const
+{
+    return size_;
+}
+
+template <typename Value, typename Alloc>
+size_t ValueBlocks<Value, Alloc>::capacity() const
+{
+    return blocks_.size() * BLOCK_SLOTS;
+}
+
+/**
+* Bytes held by the blocks and the table that points at them.
+*/
+template <typename Value, typename Alloc>
+size_t ValueBlocks<Value, Alloc>::memory_bytes() const
+{
+    return capacity() * sizeof(Value) + blocks_.capacity() * sizeof(Value*);
+}
+
+template <typename Value, typename Alloc>
+Alloc ValueBlocks<Value, Alloc>::get_allocator() const
+{
+    return alloc_;
+}
+
+/**
+* Constructs a new last slot from value, adding a block if the last one
+* is full. If the construction throws, the store is unchanged apart from
+* the possibly added, still empty block.
+*/
+template <typename Value, typename Alloc>
+template <typename V>
+void ValueBlocks<Value, Alloc>::push_back(V&& value)
+{
+    if(size_ == capacity())
+        addBlock();
+    std::allocator_traits<Alloc>::construct(alloc_, &(*this)[size_], std::forward<V>(value));
+    ++size_;
+}
+
+template <typename Value, typename Alloc>
+void ValueBlocks<Value, Alloc>::pop_back()
+{
+    --size_;
+    std::allocator_traits<Alloc>::destroy(alloc_, &(*this)[size_]);
+}
+
+/**
+* Allocates blocks until slots values fit without further allocation.
+*/
+template <typename Value, typename Alloc>
+void ValueBlocks<Value, Alloc>::reserve(size_t slots)
+{
+    blocks_.reserve((slots + BLOCK_SLOTS - 1) / BLOCK_SLOTS);
+    while(capacity() < slots)
+        addBlock();
+}
+
+/**
+* Destroys every value and frees every block.
+*/
+template <typename Value, typename Alloc>
+void ValueBlocks<Value, Alloc>::clear()
+{
+    while(size_ > 0)
+        pop_back();
+    for(size_t i = 0; i < blocks_.size(); ++i)
+        std::allocator_traits<Alloc>::deallocate(alloc_, blocks_[i], BLOCK_SLOTS);
+    blocks_.clear();
+}
+
+template <typename Value, typename Alloc>
+void ValueBlocks<Value, Alloc>::swap(ValueBlocks& other)
+{
+    blocks_.swap(other.blocks_);
+    std::swap(size_, other.size_);
+    std::swap(alloc_, other.alloc_);
+}
+
+/**
+* Copies count values starting at slot first to out, one block-sized
+* run at a time.
+*/
+template <typename Value, typename Alloc>
+void ValueBlocks<Value, Alloc>::copy_out(size_t first, size_t count, Value* out) const
+{
+    while(count > 0)
+    {
+        size_t offset = first % BLOCK_SLOTS;
+        size_t run = BLOCK_SLOTS - offset < count ? BLOCK_SLOTS - offset : count;
+        const Value* block = blocks_[first / BLOCK_SLOTS];
+        out = std::copy(block + offset, block + offset + run, out);
+        first += run;
+        count -= run;
+    }
+}
+
+/**
+* The table entry comes first so that a failed allocation of either
+* leaves nothing behind.
+*/
+template <typename Value, typename Alloc>
+void ValueBlocks<Value, Alloc>::addBlock()
+{
+    blocks_.push_back(NULL);
+    try
+    {
+        blocks_.back() = std::allocator_traits<Alloc>::allocate(alloc_, BLOCK_SLOTS);
+    }
+    catch(...)
+    {
+        blocks_.pop_back();
+        throw;
+    }
+}
+
+/**
+* A map whose search nodes hold only links, balance, the key and the
+* index of the value's slot in a separate value store. A lookup touches
+* one small node per level and then the one slot it wants, instead of
+* pulling every visited value through the cache. This pays off once values
+* are much larger than keys; for small values it only adds an indirection.
+*
+* The index is an AVLTree<Key, size_t>, so balancing, compaction and the
+* memory registry all come from there. It is a protected base so that the
+* tree's own insert cannot bypass the value store. Slots freed by
+* remove are reused by later inserts, and compact() rewrites the store
+* in key order without holes, so that a full scan reads it sequentially.
+*
+* The store is a ValueBlocks, so growing it never moves a value: references
+* from operator[] and iterators stay valid across insert. Value must be
+* default constructible: a removed slot is reset to Value() so that it
+* releases whatever it owns. Iterators and references are invalidated by
+* remove of their key, clear and compaction.
+*/
+template <typename Key, typename Value, typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class SplitAVLTree : protected AVLTree<Key, size_t,
+    typename std::allocator_traits<Alloc>::template rebind_alloc<std::pair<const Key, size_t> > >
+{
+public:
+    typedef AVLTree<Key, size_t,
+        typename std::allocator_traits<Alloc>::template rebind_alloc<std::pair<const Key, size_t> > > IndexTree;
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Value> ValueAlloc;
+    typedef ValueBlocks<Value, ValueAlloc> ValueStore;
+
+    class iterator
+    {
+    public:
+        typedef std::pair<const Key&, Value&> Ref;
+
+        /**
+        * What operator-> returns, so that it->first and it->second work
+        * although no pair of key and value exists in memory.
+        */
+        struct Arrow
+        {
+            Ref ref;
+            const Ref* operator->() const
+            {
+                return &ref;
+            }
+        };
+
+        iterator();
+
+        Ref operator*() const;
+        Arrow operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+
+    protected:
+        friend class SplitAVLTree<Key, Value, Alloc>;
+        iterator(const typename IndexTree::iterator& it, ValueStore* values);
+
+        typename IndexTree::iterator it_;
+        ValueStore* values_;
+    };
+
+    explicit SplitAVLTree(const Alloc& alloc = Alloc());
+    virtual ~SplitAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    size_t export_range(const Key& lo, const Key& hi, Key* keyOut, Value* valueOut, size_t capacity) const;
+    size_t export_range(iterator& from, const Key& hi, Key* keyOut, Value* valueOut, size_t capacity) const;
+
+    virtual void compact() override;
+    virtual TreeMemoryUsage memory_usage() const override;
+    using IndexTree::compact_step;
+    using IndexTree::memory_label;
+    using IndexTree::set_memory_label;
+    using IndexTree::track_memory;
+    using IndexTree::untrack_memory;
+    using IndexTree::memory_tracked;
+
+protected:
+    iterator wrap(const typename IndexTree::iterator& it) const;
+    AVLNode<Key, size_t>* findNode(const Key& key) const;
+
+    ValueStore values_;
+    std::vector<size_t> free_;
+    size_t count_;
+
+private:
+    SplitAVLTree(const SplitAVLTree&);
+    SplitAVLTree& operator=(const SplitAVLTree&);
+};
+
+template <typename Key, typename Value, typename Alloc>
+SplitAVLTree<Key, Value, Alloc>::iterator::iterator() :
+    it_(),
+    values_(NULL)
+{
+
+}
+
+template <typename Key, typename Value, typename Alloc>
+SplitAVLTree<Key, Value, Alloc>::iterator::iterator(const typename IndexTree::iterator& it, ValueStore* values) :
+    it_(it),
+    values_(values)
+{
+
+}
+
+template <typename Key, typename Value, typename Alloc>
+typename SplitAVLTree<Key, Value, Alloc>::iterator::Ref
+SplitAVLTree<Key, Value, Alloc>::iterator::operator*() const
+{
+    return Ref(it_->first, (*values_)[it_->second]);
+}
+
+template <typename Key, typename Value, typename Alloc>
+typename SplitAVLTree<Key, Value, Alloc>::iterator::Arrow
+SplitAVLTree<Key, Value, Alloc>::iterator::operator->() const
+{
+    Arrow arrow = { **this };
+    return arrow;
+}
+
+template <typename Key, typename Value, typename Alloc>
+bool SplitAVLTree<Key, Value, Alloc>::iterator::operator==(const iterator& rhs) const
+{
+    return it_ == rhs.it_;
+}
+
+template <typename Key, typename Value, typename Alloc>
+bool SplitAVLTree<Key, Value, Alloc>::iterator::operator!=(const iterator& rhs) const
+{
+    return it_ != rhs.it_;
+}
+
+template <typename Key, typename Value, typename Alloc>
+typename SplitAVLTree<Key, Value, Alloc>::iterator&
+SplitAVLTree<Key, Value, Alloc>::iterator::operator++()
+{
+    ++it_;
+    return *this;
+}
+
+template <typename Key, typename Value, typename Alloc>
+SplitAVLTree<Key, Value, Alloc>::SplitAVLTree(const Alloc& alloc) :
+    IndexTree(typename IndexTree::allocator_type(alloc)),
+    values_(ValueAlloc(alloc)),
+    count_(0)
+{
+
+}
+
+template <typename Key, typename Value, typename Alloc>
+SplitAVLTree<Key, Value, Alloc>::~SplitAVLTree()
+{
+
+}
+
+/**
+* Inserts the pair, or overwrites the value if the key is present. The
+* value goes into a free slot if there is one. If storing the value or
+* creating the node throws, the map is unchanged.
+*/
+template <typename Key, typename Value, typename Alloc>
+void SplitAVLTree<Key, Value, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    AVLNode<Key, size_t> *curr = static_cast<AVLNode<Key, size_t>*>(this->root_);
+    AVLNode<Key, size_t> *parent = NULL;
+    bool left = false;
+    while(curr != NULL)
+    {
+        parent = curr;
+        if(keyValuePair.first < curr->getKey())
+        {
+            curr = curr->getLeft();
+            left = true;
+        }
+        else if(curr->getKey() < keyValuePair.first)
+        {
+            curr = curr->getRight();
+            left = false;
+        }
+        else
+        {
+            values_[curr->getValue()] = keyValuePair.second;
+            return;
+        }
+    }
+
+    size_t slot;
+    bool appended = free_.empty();
+    if(!appended)
+    {
+        slot = free_.back();
+        values_[slot] = keyValuePair.second;
+        free_.pop_back();
+    }
+    else
+    {
+        slot = values_.size();
+        values_.push_back(keyValuePair.second);
+    }
+    try
+    {
+        // remove() pushes onto free_ before it unlinks anything, so make
+        // room for every slot now.
+        free_.reserve(values_.size());
+        AVLNode<Key, size_t> *n = static_cast<AVLNode<Key, size_t>*>(this->createNode(keyValuePair.first, slot, NULL));
+        this->linkLeaf(parent, n, left);
+    }
+    catch(...)
+    {
+        if(appended)
+        {
+            values_.pop_back();
+        }
+        else
+        {
+            values_[slot] = Value();
+            free_.push_back(slot);
+        }
+        throw;
+    }
+    ++count_;
+}
+
+/**
+* Removes the key and frees its slot for reuse.
+*/
+template <typename Key, typename Value, typename Alloc>
+void SplitAVLTree<Key, Value, Alloc>::remove(const Key& key)
+{
+    AVLNode<Key, size_t> *n = findNode(key);
+    if(n == NULL)
+        return;
+    size_t slot = n->getValue();
+    free_.push_back(slot);
+    values_[slot] = Value();
+    this->removeNode(n);
+    --count_;
+}
+
+template <typename Key, typename Value, typename Alloc>
+void SplitAVLTree<Key, Value, Alloc>::clear()
+{
+    IndexTree::clear();
+    values_.clear();
+    free_.clear();
+    count_ = 0;
+}
+
+template <typename Key, typename Value, typename Alloc>
+bool SplitAVLTree<Key, Value, Alloc>::empty() const
+{
+    return count_ == 0;
+}
+
+template <typename Key, typename Value, typename Alloc>
+size_t SplitAVLTree<Key, Value, Alloc>::size() const
+{
+    return count_;
+}
+
+template <typename Key, typename Value, typename Alloc>
+typename SplitAVLTree<Key, Value, Alloc>::iterator SplitAVLTree<Key, Value, Alloc>::begin() const
+{
+    return wrap(IndexTree::begin());
+}
+
+template <typename Key, typename Value, typename Alloc>
+typename SplitAVLTree<Key, Value, Alloc>::iterator SplitAVLTree<Key, Value, Alloc>::end() const
+{
+    return wrap(IndexTree::end());
+}
+
+template <typename Key, typename Value, typename Alloc>
+typename SplitAVLTree<Key, Value, Alloc>::iterator SplitAVLTree<Key, Value, Alloc>::find(const Key& key) const
+{
+    return wrap(IndexTree::find(key));
+}
+
+template <typename Key, typename Value, typename Alloc>
+typename SplitAVLTree<Key, Value, Alloc>::iterator SplitAVLTree<Key, Value, Alloc>::lower_bound(const Key& key) const
+{
+    return wrap(IndexTree::lower_bound(key));
+}
+
+template <typename Key, typename Value, typename Alloc>
+Value& SplitAVLTree<Key, Value, Alloc>::operator[](const Key& key)
+{
+    AVLNode<Key, size_t> *n = findNode(key);
+    if(n == NULL) throw std::out_of_range("Invalid key");
+    return values_[n->getValue()];
+}
+
+template <typename Key, typename Value, typename Alloc>
+Value const & SplitAVLTree<Key, Value, Alloc>::operator[](const Key& key) const
+{
+    AVLNode<Key, size_t> *n = findNode(key);
+    if(n == NULL) throw std::out_of_range("Invalid key");
+    return values_[n->getValue()];
+}
+
+/**
+* As BinarySearchTree::export_range. Values of consecutive keys that sit
+* in consecutive slots, as they all do after compact(), are copied a
+* block at a time.
+*/
+template <typename Key, typename Value, typename Alloc>
+size_t SplitAVLTree<Key, Value, Alloc>::export_range(const Key& lo, const Key& hi, Key* keyOut,
+                                                     Value* valueOut, size_t capacity) const
+{
+    iterator from = lower_bound(lo);
+    return export_range(from, hi, keyOut, valueOut, capacity);
+}
+
+template <typename Key, typename Value, typename Alloc>
+size_t SplitAVLTree<Key, Value, Alloc>::export_range(iterator& from, const Key& hi, Key* keyOut,
+                                                     Value* valueOut, size_t capacity) const
+{
+    typename IndexTree::iterator end = IndexTree::end();
+    size_t count = 0;
+    size_t runSlot = 0;
+    size_t runStart = 0;
+    for(; count < capacity && from.it_ != end && from.it_->first < hi; ++count, ++from.it_)
+    {
+        if(keyOut != NULL)
+            keyOut[count] = from.it_->first;
+        size_t slot = from.it_->second;
+        if(slot != runSlot + (count - runStart))
+        {
+            if(valueOut != NULL)
+                values_.copy_out(runSlot, count - runStart, valueOut + runStart);
+            runSlot = slot;
+            runStart = count;
+        }
+    }
+    if(valueOut != NULL)
+        values_.copy_out(runSlot, count - runStart, valueOut + runStart);
+    return count;
+}
+
+/**
+* Compacts the index as AVLTree::compact does, then rewrites the value
+* store in key order without the freed slots. If moving a value throws,
+* the store is left as it was.
+*/
+template <typename Key, typename Value, typename Alloc>
+void SplitAVLTree<Key, Value, Alloc>::compact()
+{
+    IndexTree::compact();
+
+    ValueStore packed(values_.get_allocator());
+    packed.reserve(count_);
+    for(typename IndexTree::iterator it = IndexTree::begin(); it != IndexTree::end(); ++it)
+        packed.push_back(std::move_if_noexcept(values_[it->second]));
+    size_t slot = 0;
+    for(typename IndexTree::iterator it = IndexTree::begin(); it != IndexTree::end(); ++it)
+        it->second = slot++;
+    values_.swap(packed);
+    free_.clear();
+}
+
+/**
+* The index as AVLTree reports it, plus the value store as auxiliary
+* bytes and whatever the live values own.
+*/
+template <typename Key, typename Value, typename Alloc>
+TreeMemoryUsage SplitAVLTree<Key, Value, Alloc>::memory_usage() const
+{
+    TreeMemoryUsage usage = IndexTree::memory_usage();
+    usage.auxiliaryBytes += values_.memory_bytes() + free_.capacity() * sizeof(size_t);
+    for(typename IndexTree::iterator it = IndexTree::begin(); it != IndexTree::end(); ++it)
+        usage.ownedBytes += OwnedBytes<Value>::bytes(values_[it->second]);
+    return usage;
+}
+
+template <typename Key, typename Value, typename Alloc>
+typename SplitAVLTree<Key, Value, Alloc>::iterator
+SplitAVLTree<Key, Value, Alloc>::wrap(const typename IndexTree::iterator& it) const
+{
+    return iterator(it, const_cast<ValueStore*>(&values_));
+}
+
+template <typename Key, typename Value, typename Alloc>
+AVLNode<Key, size_t>* SplitAVLTree<Key, Value, Alloc>::findNode(const Key& key) const
+{
+    return static_cast<AVLNode<Key, size_t>*>(this->internalFind(key));
+}
+
+#endif
@@ -0,0 +1,116 @@
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "stringavl.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for string keys: PrefixedKey orders like std::string, including
+// keys that share their whole prefix, contain NUL or high bytes or are
+// empty, and StringAVLTree behaves like std::map<string, int> through
+// removals and arena compaction.
+
+/**
+* A random key from a small alphabet that includes NUL and bytes above
+* 127, so that keys often share long prefixes and differ only past them.
+*/
+static string randomKey()
+{
+    static const char alphabet[] = { 'a', 'b', '\0', (char)0xff, (char)0x80 };
+    string key = rand() % 2 == 0 ? "commonprefix" : "";
+    size_t len = rand() % 12;
+    for(size_t i = 0; i < len; ++i)
+        key += alphabet[rand() % sizeof(alphabet)];
+    return key;
+}
+
+void testPrefixedKey()
+{
+    const char* name = "PrefixedKey";
+    srand(71);
+    vector<string> keys;
+    for(int i = 0; i < 400; ++i)
+        keys.push_back(randomKey());
+    bool ordered = true;
+    bool roundTrip = true;
+    for(size_t i = 0; i < keys.size(); ++i)
+    {
+        PrefixedKey a(keys[i].data(), keys[i].size());
+        roundTrip = roundTrip && a.str() == keys[i] && a.size() == keys[i].size() &&
+                    a.inlined() == (keys[i].size() <= PrefixedKey::PREFIX_BYTES);
+        for(size_t j = 0; j < keys.size(); ++j)
+        {
+            PrefixedKey b(keys[j].data(), keys[j].size());
+            ordered = ordered && (a < b) == (keys[i] < keys[j]) && (a > b) == (keys[i] > keys[j]) &&
+                      (a == b) == (keys[i] == keys[j]);
+        }
+    }
+    check(ordered, name, "comparison differs from std::string");
+    check(roundTrip, name, "key does not read back as its string");
+}
+
+void testTree()
+{
+    const char* name = "StringAVLTree";
+    StringAVLTree<int> tree;
+    map<string, int> ref;
+    srand(73);
+    for(int i = 0; i < 30000; ++i)
+    {
+        string key = randomKey();
+        int op = rand() % 10;
+        if(op < 5)
+        {
+            tree.insert(make_pair(key, i));
+            ref[key] = i;
+        }
+        else if(op < 8)
+        {
+            tree.remove(key);
+            ref.erase(key);
+        }
+        else if(op == 8)
+        {
+            StringAVLTree<int>::iterator it = tree.find(key);
+            map<string, int>::iterator r = ref.find(key);
+            check(r == ref.end() ? it == tree.end() : (it != tree.end() && it->second == r->second),
+                  name, "find differs from std::map");
+        }
+        else
+        {
+            StringAVLTree<int>::iterator it = tree.lower_bound(key);
+            map<string, int>::iterator r = ref.lower_bound(key);
+            check(r == ref.end() ? it == tree.end() : (it != tree.end() && it->first.str() == r->first),
+                  name, "lower_bound differs from std::map");
+        }
+    }
+
+    bool same = tree.size() == ref.size() && tree.isBalanced();
+    StringAVLTree<int>::iterator it = tree.begin();
+    for(map<string, int>::iterator r = ref.begin(); same && r != ref.end(); ++r, ++it)
+        same = it != tree.end() && it->first.str() == r->first && it->second == r->second;
+    check(same && it == tree.end(), name, "contents differ from std::map");
+
+    size_t before = tree.arenaBytes();
+    tree.compactKeys();
+    check(tree.arenaBytes() <= before, name, "compactKeys grew the arena");
+    same = tree.size() == ref.size() && tree.isBalanced();
+    for(map<string, int>::iterator r = ref.begin(); same && r != ref.end(); ++r)
+        same = tree[r->first] == r->second;
+    check(same, name, "compactKeys changed the contents");
+
+    tree.clear();
+    check(tree.empty() && tree.size() == 0 && tree.begin() == tree.end(), name, "clear left entries behind");
+}
+
+int main()
+{
+    testPrefixedKey();
+    testTree();
+    return testSummary("StringAVLTree");
+}
@@ -0,0 +1,496 @@
+#ifndef STRINGAVL_H
+#define STRINGAVL_H
+
+#include <cstring>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+#include "bst.h"
+#include "avlbst.h"
+
+/**
+* A string key split into an inline 8-byte prefix and a pointer to the
+* full bytes. The prefix holds the first eight bytes big-endian and
+* zero-padded, so comparing two prefixes as integers orders them like the
+* strings they start; only keys that share all eight bytes have to look
+* at the rest. Keys of eight bytes or fewer are held entirely in the
+* prefix and keep no pointer at all, so data() is NULL for them.
+*
+* A longer PrefixedKey does not own its bytes. Keys stored in a
+* StringAVLTree point into the tree's arena; probe keys built for a lookup
+* point into the caller's string. Keys are limited to UINT32_MAX bytes.
+*/
+class PrefixedKey
+{
+public:
+    static const size_t PREFIX_BYTES = 8;
+
+    PrefixedKey();
+    PrefixedKey(const char* data, size_t len);
+
+    size_t size() const;
+    bool inlined() const;
+    const char* data() const;
+    std::string str() const;
+
+    friend bool operator<(const PrefixedKey& a, const PrefixedKey& b);
+    friend bool operator>(const PrefixedKey& a, const PrefixedKey& b);
+    friend bool operator==(const PrefixedKey& a, const PrefixedKey& b);
+
+private:
+    int compareTail(const PrefixedKey& other) const;
+
+    uint64_t prefix_;
+    const char* data_;
+    uint32_t len_;
+};
+
+inline PrefixedKey::PrefixedKey() :
+    prefix_(0),
+    data_(NULL),
+    len_(0)
+{
+
+}
+
+/**
+* Throws std::length_error if len does not fit in 32 bits.
+*/
+inline PrefixedKey::PrefixedKey(const char* data, size_t len) :
+    prefix_(0),
+    data_(len <= PREFIX_BYTES ? NULL : data),
+    len_((uint32_t)len)
+{
+    if(len > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("PrefixedKey longer than 4 GiB");
+    size_t n = len < PREFIX_BYTES ? len : PREFIX_BYTES;
+    for(size_t i = 0; i < PREFIX_BYTES; ++i)
+        prefix_ = (prefix_ << 8) | (i < n ? (unsigned char)data[i] : 0);
+}
+
+inline size_t PrefixedKey::size() const
+{
+    return len_;
+}
+
+/**
+* True if the whole key lives in the prefix.
+*/
+inline bool PrefixedKey::inlined() const
+{
+    return len_ <= PREFIX_BYTES;
+}
+
+/**
+* The full key bytes, or NULL for an inlined key; use str() to read any
+* key.
+*/
+inline const char* PrefixedKey::data() const
+{
+    return data_;
+}
+
+/**
+* Copies the key out as a std::string.
+*/
+inline std::string PrefixedKey::str() const
+{
+    if(!inlined())
+        return std::string(data_, len_);
+    std::string s(len_, '\0');
+    for(size_t i = 0; i < len_; ++i)
+        s[i] = (char)(prefix_ >> (8 * (PREFIX_BYTES - 1 - i)));
+    return s;
+}
+
+/**
+* Orders two keys whose prefixes are equal.
+*/
+inline int PrefixedKey::compareTail(const PrefixedKey& other) const
+{
+    if(!inlined() && !other.inlined())
+    {
+        size_t n = (len_ < other.len_ ? len_ : other.len_) - PREFIX_BYTES;
+        int r = std::memcmp(data_ + PREFIX_BYTES, other.data_ + PREFIX_BYTES, n);
+        if(r != 0)
+            return r;
+    }
+    return len_ < other.len_ ? -1 : (len_ > other.len_ ? 1 : 0);
+}
+
+inline bool operator<(const PrefixedKey& a, const PrefixedKey& b)
+{
+    if(a.prefix_ != b.prefix_)
+        return a.prefix_ < b.prefix_;
+    return a.compareTail(b) < 0;
+}
+
+inline bool operator>(const PrefixedKey& a, const PrefixedKey& b)
+{
+    return b < a;
+}
+
+inline bool operator==(const PrefixedKey& a, const PrefixedKey& b)
+{
+    return a.prefix_ == b.prefix_ && a.compareTail(b) == 0;
+}
+
+inline std::ostream& operator<<(std::ostream& out, const PrefixedKey& key)
+{
+    return out << key.str();
+}
+
+/**
+* Append-only storage for key bytes. Strings are packed back to back in
+* large blocks, so keys cost no per-key allocation or allocator header and
+* neighbouring inserts land close together in memory. Nothing is freed
+* until the arena is destroyed.
+*/
+class StringArena
+{
+public:
+    StringArena();
+    ~StringArena();
+
+    const char* store(const char* data, size_t len);
+    size_t bytes() const;
+    size_t reserved() const;
+
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+private:
+    StringArena(const StringArena&);
+    StringArena& operator=(const StringArena&);
+
+    std::vector<char*> blocks_;
+    char* next_;
+    size_t left_;
+    size_t bytes_;
+    size_t reserved_;
+};
+
+inline StringArena::StringArena() :
+    next_(NULL),
+    left_(0),
+    bytes_(0),
+    reserved_(0)
+{
+
+}
+
+inline StringArena::~StringArena()
+{
+    for(size_t i = 0; i < blocks_.size(); ++i)
+        delete [] blocks_[i];
+}
+
+/**
+* Copies len bytes into the arena and returns where they now live. Keys
+* larger than a quarter block get a block of their own, so they neither
+* waste the tail of the current block nor force a new one.
+*/
+inline const char* StringArena::store(const char* data, size_t len)
+{
+    bytes_ += len;
+    if(len > BLOCK_SIZE / 4)
+    {
+        blocks_.reserve(blocks_.size() + 1);
+        char* block = new char[len];
+        blocks_.push_back(block);
+        reserved_ += len;
+        std::memcpy(block, data, len);
+        return block;
+    }
+    if(len > left_)
+    {
+        blocks_.reserve(blocks_.size() + 1);
+        blocks_.push_back(new char[BLOCK_SIZE]);
+        next_ = blocks_.back();
+        left_ = BLOCK_SIZE;
+        reserved_ += BLOCK_SIZE;
+    }
+    char* out = next_;
+    std::memcpy(out, data, len);
+    next_ += len;
+    left_ -= len;
+    return out;
+}
+
+/**
+* Number of key bytes stored so far.
+*/
+inline size_t StringArena::bytes() const
+{
+    return bytes_;
+}
+
+/**
+* Bytes allocated for blocks, including the unused tail of the current one.
+*/
+inline size_t StringArena::reserved() const
+{
+    return reserved_;
+}
+
+/**
+* An AVL map keyed by strings that keeps an inline prefix of every key in
+* its node and the rest of the key in a shared arena. Most comparisons in
+* a lookup are settled by the prefixes alone, and each entry costs one
+* 24-byte key instead of a std::string plus its own heap block.
+*
+* Removing a key leaves its bytes in the arena. Once the dead bytes
+* outnumber the live ones the keys are copied to a fresh arena and the
+* tree is rebuilt in linear time, which invalidates iterators.
+*/
+template <typename Value>
+class StringAVLTree
+{
+public:
+    typedef AVLTree<PrefixedKey, Value> TreeT;
+    typedef typename TreeT::iterator iterator;
+
+    StringAVLTree();
+    ~StringAVLTree();
+
+    void insert(const std::pair<const std::string, Value>& keyValuePair);
+    void remove(const std::string& key);
+    void clear();
+    bool empty() const;
+    size_t size() const;
+    bool isBalanced() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const std::string& key) const;
+    iterator lower_bound(const std::string& key) const;
+    Value& operator[](const std::string& key);
+    Value const & operator[](const std::string& key) const;
+
+    size_t arenaBytes() const;
+    void compactKeys();
+    TreeMemoryUsage memory_usage() const;
+
+private:
+    StringAVLTree(const StringAVLTree&);
+    StringAVLTree& operator=(const StringAVLTree&);
+
+    static PrefixedKey probe(const std::string& key);
+    PrefixedKey intern(const std::string& key);
+
+    /**
+    * Feeds the entries of an old tree to buildFromSorted with their keys
+    * moved into a new arena.
+    */
+    struct Rekey
+    {
+        iterator it;
+        StringArena* arena;
+
+        std::pair<const PrefixedKey, Value> operator*() const
+        {
+            const PrefixedKey& key = it->first;
+            if(key.inlined())
+                return std::pair<const PrefixedKey, Value>(key, it->second);
+            return std::pair<const PrefixedKey, Value>(
+                PrefixedKey(arena->store(key.data(), key.size()), key.size()), it->second);
+        }
+        Rekey& operator++() { ++it; return *this; }
+    };
+
+    TreeT* tree_;
+    StringArena* arena_;
+    size_t size_;
+    size_t liveBytes_;
+};
+
+template <typename Value>
+StringAVLTree<Value>::StringAVLTree() :
+    tree_(new TreeT()),
+    arena_(new StringArena()),
+    size_(0),
+    liveBytes_(0)
+{
+
+}
+
+template <typename Value>
+StringAVLTree<Value>::~StringAVLTree()
+{
+    delete tree_;
+    delete arena_;
+}
+
+/**
+* Builds a key that points into key itself, for lookups.
+*/
+template <typename Value>
+PrefixedKey StringAVLTree<Value>::probe(const std::string& key)
+{
+    return PrefixedKey(key.data(), key.size());
+}
+
+/**
+* Builds a key whose bytes are owned by the arena. Short keys fit in the
+* prefix and take no arena space.
+*/
+template <typename Value>
+PrefixedKey StringAVLTree<Value>::intern(const std::string& key)
+{
+    if(key.size() <= PrefixedKey::PREFIX_BYTES)
+        return PrefixedKey(key.data(), key.size());
+    liveBytes_ += key.size();
+    return PrefixedKey(arena_->store(key.data(), key.size()), key.size());
+}
+
+/**
+* Inserts or overwrites. The key is only copied into the arena when it is
+* new.
+*/
+template <typename Value>
+void StringAVLTree<Value>::insert(const std::pair<const std::string, Value>& keyValuePair)
+{
+    iterator it = tree_->find(probe(keyValuePair.first));
+    if(it != tree_->end())
+    {
+        it->second = keyValuePair.second;
+        return;
+    }
+    tree_->insert(std::pair<const PrefixedKey, Value>(intern(keyValuePair.first), keyValuePair.second));
+    ++size_;
+}
+
+template <typename Value>
+void StringAVLTree<Value>::remove(const std::string& key)
+{
+    iterator it = tree_->find(probe(key));
+    if(it == tree_->end())
+        return;
+    tree_->remove(probe(key));
+    --size_;
+    if(key.size() > PrefixedKey::PREFIX_BYTES)
+        liveBytes_ -= key.size();
+    size_t dead = arena_->bytes() - liveBytes_;
+    if(dead > liveBytes_ && dead >= StringArena::BLOCK_SIZE)
+        compactKeys();
+}
+
+/**
+* Copies the live keys into a fresh arena and rebuilds the tree around
+* them in linear time, dropping the bytes of removed keys.
+*/
+template <typename Value>
+void StringAVLTree<Value>::compactKeys()
+{
+    StringArena* arena = new StringArena();
+    TreeT* tree = new TreeT();
+    try
+    {
+        Rekey first = { tree_->begin(), arena };
+        tree->buildFromSorted(first, size_);
+    }
+    catch(...)
+    {
+        delete tree;
+        delete arena;
+        throw;
+    }
+    delete tree_;
+    delete arena_;
+    tree_ = tree;
+    arena_ = arena;
+}
+
+template <typename Value>
+void StringAVLTree<Value>::clear()
+{
+    tree_->clear();
+    delete arena_;
+    arena_ = new StringArena();
+    size_ = 0;
+    liveBytes_ = 0;
+}
+
+template <typename Value>
+bool StringAVLTree<Value>::empty() const
+{
+    return size_ == 0;
+}
+
+template <typename Value>
+size_t StringAVLTree<Value>::size() const
+{
+    return size_;
+}
+
+template <typename Value>
+bool StringAVLTree<Value>::isBalanced() const
+{
+    return tree_->isBalanced();
+}
+
+template <typename Value>
+typename StringAVLTree<Value>::iterator StringAVLTree<Value>::begin() const
+{
+    return tree_->begin();
+}
+
+template <typename Value>
+typename StringAVLTree<Value>::iterator StringAVLTree<Value>::end() const
+{
+    return tree_->end();
+}
+
+template <typename Value>
+typename StringAVLTree<Value>::iterator StringAVLTree<Value>::find(const std::string& key) const
+{
+    return tree_->find(probe(key));
+}
+
+template <typename Value>
+typename StringAVLTree<Value>::iterator StringAVLTree<Value>::lower_bound(const std::string& key) const
+{
+    return tree_->lower_bound(probe(key));
+}
+
+/**
+* @precondition The key exists in the map
+* Returns the value associated with the key
+*/
+template <typename Value>
+Value& StringAVLTree<Value>::operator[](const std::string& key)
+{
+    return (*tree_)[probe(key)];
+}
+
+template <typename Value>
+Value const & StringAVLTree<Value>::operator[](const std::string& key) const
+{
+    return (*static_cast<const TreeT*>(tree_))[probe(key)];
+}
+
+/**
+* Bytes held by the key arena, including those of removed keys.
+*/
+template <typename Value>
+size_t StringAVLTree<Value>::arenaBytes() const
+{
+    return arena_->bytes();
+}
+
+/**
+* The tree's own usage plus the key arena, which is counted as auxiliary
+* memory in full, dead keys and unused block space included.
+*/
+template <typename Value>
+TreeMemoryUsage StringAVLTree<Value>::memory_usage() const
+{
+    TreeMemoryUsage usage = tree_->memory_usage();
+    usage.auxiliaryBytes += arena_->reserved();
+    return usage;
+}
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef TESTCHECK_H
+#define TESTCHECK_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+/**
+* Shared plumbing for the *-test programs. Each program calls check() for
+* every expectation and returns testSummary() from main, which is non-zero
+* if any check failed. Including this header also replaces the global
+* operator new so that tests can make allocations fail on cue (see
+* allocationsLeft()); it must be included by one source file only.
+*/
+inline std::atomic<int>& testFailures()
+{
+    static std::atomic<int> failures(0);
+    return failures;
+}
+
+/**
+* Reports a failed expectation. Safe to call from several threads.
+*/
+inline void check(bool ok, const char* test, const char* what)
+{
+    if(!ok)
+    {
+        std::cout << "FAIL " << test << ": " << what << std::endl;
+        ++testFailures();
+    }
+}
+
+/**
+* Allocations the calling thread may still make before operator new throws
+* std::bad_alloc; negative, the default, means unlimited. Per thread, so
+* helper threads of the code under test are never hit.
+*/
+inline int& allocationsLeft()
+{
+    static thread_local int left = -1;
+    return left;
+}
+
+void* operator new(size_t size)
+{
+    if(allocationsLeft() == 0)
+        throw std::bad_alloc();
+    if(allocationsLeft() > 0)
+        --allocationsLeft();
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if(p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+inline int testSummary(const char* suite)
+{
+    int failed = testFailures().load();
+    if(failed != 0)
+    {
+        std::cout << suite << ": " << failed << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All " << suite << " tests passed" << std::endl;
+    return 0;
+}
+
+/**
+* True if iterating tree yields exactly the pairs of ref, in order. Tree
+* is anything whose iterator has first and second, Ref a std::map or
+* std::multimap.
+*/
+template <typename Tree, typename Ref>
+bool sameContents(const Tree& tree, const Ref& ref)
+{
+    typename Tree::iterator it = tree.begin();
+    for(typename Ref::const_iterator r = ref.begin(); r != ref.end(); ++r, ++it)
+    {
+        if(it == tree.end() || !(it->first == r->first) || !(it->second == r->second))
+            return false;
+    }
+    return it == tree.end();
+}
+
+/**
+* Drives tree and a std::map through the same fixed-seed random inserts,
+* removes, finds and lower_bounds, comparing results and contents and
+* calling structureOk(tree) along the way.
+*/
+template <typename Tree, typename Check>
+void stressMap(const char* name, Tree& tree, unsigned seed, Check structureOk)
+{
+    std::map<int, int> ref;
+    std::srand(seed);
+    for(int i = 0; i < 40000; ++i)
+    {
+        int key = std::rand() % 2000;
+        int op = std::rand() % 10;
+        if(op < 5)
+        {
+            tree.insert(std::make_pair(key, i));
+            ref[key] = i;
+        }
+        else if(op < 8)
+        {
+            tree.remove(key);
+            ref.erase(key);
+        }
+        else if(op == 8)
+        {
+            typename Tree::iterator it = tree.find(key);
+            std::map<int, int>::iterator r = ref.find(key);
+            check(r == ref.end() ? it == tree.end() : (it != tree.end() && it->second == r->second),
+                  name, "find disagrees with std::map");
+        }
+        else
+        {
+            typename Tree::iterator it = tree.lower_bound(key);
+            std::map<int, int>::iterator r = ref.lower_bound(key);
+            check(r == ref.end() ? it == tree.end() : (it != tree.end() && it->first == r->first),
+                  name, "lower_bound disagrees with std::map");
+        }
+        if(i % 5000 == 0)
+        {
+            check(structureOk(tree), name, "structure invariants broken");
+            check(sameContents(tree, ref), name, "contents differ from std::map");
+        }
+    }
+    check(structureOk(tree), name, "structure invariants broken");
+    check(sameContents(tree, ref), name, "contents differ from std::map");
+    tree.clear();
+    check(tree.empty(), name, "clear left entries behind");
+}
+
+/**
+* Exports the entries of tree with lo <= key < hi through buffers of
+* capacity entries, resuming from the iterator each time, and compares
+* what arrives with ref. Also checks the counts the lo/hi overload returns
+* when the buffer is too small and when both arrays are NULL.
+*/
+template <typename Tree, typename Ref>
+void checkExport(const char* name, const Tree& tree, const Ref& ref, typename Ref::key_type lo,
+                 typename Ref::key_type hi, size_t capacity)
+{
+    std::vector<typename Ref::key_type> keys(capacity);
+    std::vector<typename Ref::mapped_type> values(capacity);
+    typename Ref::const_iterator r = ref.lower_bound(lo);
+    typename Tree::iterator from = tree.lower_bound(lo);
+    size_t total = 0;
+    size_t n;
+    bool same = true;
+    do
+    {
+        n = tree.export_range(from, hi, keys.data(), values.data(), capacity);
+        for(size_t i = 0; i < n && same; ++i, ++r)
+            same = r != ref.end() && r->first < hi && keys[i] == r->first && values[i] == r->second;
+        total += n;
+    }
+    while(n == capacity && same);
+    check(same && (r == ref.end() || !(r->first < hi)), name, "export_range differs from std::map");
+    check(tree.export_range(from, hi, keys.data(), values.data(), capacity) == 0, name,
+          "export_range went on past the end of the range");
+
+    size_t first = tree.export_range(lo, hi, keys.data(), NULL, capacity);
+    r = ref.lower_bound(lo);
+    same = first == std::min(capacity, total);
+    for(size_t i = 0; i < first && same; ++i, ++r)
+        same = keys[i] == r->first;
+    check(same, name, "export_range did not stop at the capacity");
+    check(tree.export_range(lo, hi, (typename Ref::key_type*)NULL, NULL, total + 1) == total, name,
+          "export_range without buffers miscounted");
+}
+
+// Shape of the multithreaded workload run by runWriters().
+static const int WRITERS = 3;
+static const int KEYS = 3000;
+static const int OPS = 30000;
+
+/**
+* Runs WRITERS threads that each insert and remove their own keys (those
+* equal to their index modulo WRITERS) with the key as value, and returns
+* the keys each one left in the tree. Readers running alongside can rely
+* on a key present always mapping to itself.
+*/
+template <typename Tree>
+std::vector<std::set<int> > runWriters(Tree& tree)
+{
+    std::vector<std::set<int> > present(WRITERS);
+    std::vector<std::thread> threads;
+    for(int w = 0; w < WRITERS; ++w)
+    {
+        threads.push_back(std::thread([&tree, &present, w]()
+        {
+            std::mt19937 rng(w + 1);
+            for(int i = 0; i < OPS; ++i)
+            {
+                int key = (int)(rng() % (KEYS / WRITERS)) * WRITERS + w;
+                if(rng() % 3 != 0)
+                {
+                    tree.insert(std::make_pair(key, key));
+                    present[w].insert(key);
+                }
+                else
+                {
+                    tree.remove(key);
+                    present[w].erase(key);
+                }
+            }
+        }));
+    }
+    for(size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    return present;
+}
+
+/**
+* Checks that tree holds exactly the keys the writers recorded.
+*/
+template <typename Tree>
+void checkFinal(const char* name, const Tree& tree, const std::vector<std::set<int> >& present)
+{
+    size_t total = 0;
+    bool agree = true;
+    for(int w = 0; w < WRITERS; ++w)
+    {
+        total += present[w].size();
+        for(int key = w; key < KEYS; key += WRITERS)
+        {
+            int value = -1;
+            bool found = tree.find(key, value);
+            agree = agree && found == (present[w].count(key) == 1) && (!found || value == key);
+        }
+    }
+    check(agree, name, "final contents differ from the writers' records");
+    check(tree.size() == total, name, "size differs from the writers' records");
+}
+
+/**
+* A fresh directory under /tmp for a test's files, removed with the files
+* handed out by file() when it goes out of scope.
+*/
+class TestDir
+{
+public:
+    TestDir()
+    {
+        char path[] = "/tmp/avl-test-XXXXXX";
+        if(mkdtemp(path) == NULL)
+            throw std::runtime_error("cannot create a temporary directory");
+        path_ = path;
+    }
+
+    ~TestDir()
+    {
+        for(size_t i = 0; i < files_.size(); ++i)
+            std::remove(files_[i].c_str());
+        rmdir(path_.c_str());
+    }
+
+    std::string file(const std::string& name)
+    {
+        files_.push_back(path_ + "/" + name);
+        return files_.back();
+    }
+
+private:
+    TestDir(const TestDir&);
+    TestDir& operator=(const TestDir&);
+
+    std::string path_;
+    std::vector<std::string> files_;
+};
+
+/**
+* A value whose copy constructor throws once copiesLeft() reaches zero,
+* for exercising the rollback paths of trees that copy values. A negative
+* copiesLeft() never throws. The countdown is per thread. live() counts
+* the instances in existence, so tests can check that nothing leaked.
+*/
+struct ThrowingValue
+{
+    int v;
+
+    static int& copiesLeft()
+    {
+        static thread_local int left = -1;
+        return left;
+    }
+
+    static std::atomic<long>& live()
+    {
+        static std::atomic<long> count(0);
+        return count;
+    }
+
+    ThrowingValue(int x = 0) : v(x)
+    {
+        ++live();
+    }
+
+    ThrowingValue(const ThrowingValue& other) : v(other.v)
+    {
+        if(copiesLeft() == 0)
+            throw std::runtime_error("value copy failed");
+        if(copiesLeft() > 0)
+            --copiesLeft();
+        ++live();
+    }
+
+    ~ThrowingValue()
+    {
+        --live();
+    }
+
+    ThrowingValue& operator=(const ThrowingValue& other)
+    {
+        v = other.v;
+        return *this;
+    }
+
+    bool operator==(const ThrowingValue& other) const
+    {
+        return v == other.v;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const ThrowingValue& value)
+{
+    return out << value.v;
+}
+
+#endif
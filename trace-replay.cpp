@@ -0,0 +1,155 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "print_bst.h"
+#include "avltrace.h"
+
+using namespace std;
+
+typedef TraceRecord<int, int> Record;
+
+/**
+* Replays a sequence of records against a fresh tree and returns a checksum
+* of the values it read, so the lookups cannot be optimized away.
+*/
+static long long replay(const vector<Record>& records)
+{
+    AVLTree<int, int> tree;
+    long long checksum = 0;
+    for(size_t i = 0; i < records.size(); ++i)
+    {
+        const Record& rec = records[i];
+        switch(rec.op)
+        {
+        case TRACE_INSERT:
+            tree.insert(std::make_pair(rec.key, rec.value));
+            break;
+        case TRACE_REMOVE:
+            tree.remove(rec.key);
+            break;
+        case TRACE_FIND:
+        {
+            AVLTree<int, int>::iterator it = tree.find(rec.key);
+            if(it != tree.end())
+                checksum += it->second;
+            break;
+        }
+        case TRACE_SUBSCRIPT:
+            try {
+                checksum += tree[rec.key];
+            }
+            catch(const std::out_of_range&) {
+            }
+            break;
+        }
+    }
+    return checksum;
+}
+
+/**
+* Writes a synthetic trace with a mix of 50% finds, 10% operator[],
+* 30% inserts and 10% removes over a key space of ops/4 keys.
+*/
+static void generate(const string& path, size_t ops)
+{
+    RecordingAVLTree<int, int> tree(path);
+    int keySpace = static_cast<int>(ops / 4 + 1);
+    srand(1);
+    for(size_t i = 0; i < ops; ++i)
+    {
+        int key = rand() % keySpace;
+        int dice = rand() % 10;
+        if(dice < 5)
+            tree.find(key);
+        else if(dice < 6)
+        {
+            try {
+                tree[key];
+            }
+            catch(const std::out_of_range&) {
+            }
+        }
+        else if(dice < 9)
+            tree.insert(std::make_pair(key, static_cast<int>(i)));
+        else
+            tree.remove(key);
+    }
+}
+
+static void usage(const char* prog)
+{
+    cerr << "usage: " << prog << " <trace-file> [threads]" << endl;
+    cerr << "       " << prog << " -g <trace-file> <ops>" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc == 4 && string(argv[1]) == "-g")
+    {
+        generate(argv[2], strtoul(argv[3], NULL, 10));
+        return 0;
+    }
+    if(argc < 2 || argc > 3)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t threads = argc == 3 ? strtoul(argv[2], NULL, 10) : 1;
+    if(threads == 0)
+        threads = 1;
+
+    vector<Record> records;
+    try {
+        records = loadTrace<int, int>(argv[1]);
+    }
+    catch(const std::exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    // Shard by key so every key's operations stay in their recorded order
+    // on a single thread; each shard replays against its own tree.
+    vector<vector<Record> > shards(threads);
+    for(size_t i = 0; i < records.size(); ++i)
+    {
+        size_t shard = static_cast<unsigned int>(records[i].key) % threads;
+        shards[shard].push_back(records[i]);
+    }
+
+    vector<long long> checksums(threads, 0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if(threads == 1)
+    {
+        checksums[0] = replay(shards[0]);
+    }
+    else
+    {
+        vector<thread> workers;
+        for(size_t t = 0; t < threads; ++t)
+        {
+            workers.push_back(thread([&shards, &checksums, t]() {
+                checksums[t] = replay(shards[t]);
+            }));
+        }
+        for(size_t t = 0; t < threads; ++t)
+            workers[t].join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    long long checksum = 0;
+    for(size_t t = 0; t < threads; ++t)
+        checksum += checksums[t];
+
+    cout << "ops:      " << records.size() << endl;
+    cout << "threads:  " << threads << endl;
+    cout << "seconds:  " << elapsed.count() << endl;
+    cout << "ops/sec:  " << (elapsed.count() > 0 ? records.size() / elapsed.count() : 0) << endl;
+    cout << "checksum: " << checksum << endl;
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "avlset.h"
+#include "treememory.h"
+#include "print_bst.h"
+#include "testcheck.h"
+
+using namespace std;
+
+// Tests for memory accounting: the per-tree node counters, what
+// memory_usage() reports, and the registry of tracked trees.
+
+void testCounters()
+{
+    const char* name = "TrackedTree counters";
+    AVLTree<int, int> tree;
+    for(int key = 0; key < 1000; ++key)
+        tree.insert(make_pair(key, key));
+    for(int key = 0; key < 1000; key += 4)
+        tree.remove(key);
+    check(tree.live_nodes() == 750, name, "live_nodes wrong after inserts and removes");
+    check(tree.live_node_bytes() == 750 * sizeof(AVLNode<int, int>), name, "live_node_bytes wrong");
+
+    AVLTree<int, int> other;
+    other.insert(make_pair(0, 0));
+    other.insert(make_pair(1, 1));
+    tree.merge(other);
+    check(tree.live_nodes() == 751 && other.live_nodes() == 1, name, "merge did not move the counts");
+    AVLTree<int, int>::node_type handle = tree.extract(2);
+    check(tree.live_nodes() == 750, name, "extract did not leave the count");
+    check(other.insert(std::move(handle)) && other.live_nodes() == 2, name, "handle insert not counted");
+
+    TreeMemoryUsage usage = tree.memory_usage();
+    check(usage.nodes == tree.live_nodes() && usage.nodeBytes == tree.live_node_bytes(), name,
+          "memory_usage disagrees with the counters");
+    check(usage.allocatorOverhead > 0 && usage.bytesPerEntry() > sizeof(AVLNode<int, int>), name,
+          "std::allocator overhead not counted");
+
+    tree.clear();
+    check(tree.live_nodes() == 0 && tree.live_node_bytes() == 0, name, "clear left counts behind");
+}
+
+void testOwnedBytes()
+{
+    const char* name = "OwnedBytes";
+    string small = "ab";
+    string large(1000, 'x');
+    check(OwnedBytes<string>::bytes(small) == 0, name, "short string counted as owning memory");
+    check(OwnedBytes<string>::bytes(large) > 1000, name, "long string's buffer not counted");
+    vector<string> strings(2, large);
+    check(OwnedBytes<vector<string> >::bytes(strings) >= 2 * sizeof(string) + 2000, name,
+          "vector elements' memory not counted");
+
+    AVLTree<int, string> tree;
+    tree.insert(make_pair(1, large));
+    tree.insert(make_pair(2, small));
+    check(tree.memory_usage().ownedBytes == OwnedBytes<string>::bytes(large), name,
+          "tree did not add up its values' memory");
+}
+
+void testRegistry()
+{
+    const char* name = "TreeRegistry";
+    TreeRegistry& registry = TreeRegistry::instance();
+    size_t before = registry.size();
+    {
+        AVLTree<int, int> a;
+        AVLSet<int> b;
+        AVLTree<int, int> quiet;
+        a.set_memory_label("a");
+        b.set_memory_label("b");
+        for(int key = 0; key < 100; ++key)
+        {
+            a.insert(make_pair(key, key));
+            b.insert(key);
+            quiet.insert(make_pair(key, key));
+        }
+        a.track_memory();
+        b.track_memory();
+        b.track_memory();
+        check(registry.size() == before + 2 && a.memory_tracked() && !quiet.memory_tracked(), name,
+              "tracked trees not registered exactly once");
+        TreeMemoryUsage total = registry.total();
+        check(total.nodes == 200 && total.nodeBytes == a.live_node_bytes() + b.live_node_bytes(), name,
+              "total does not sum the tracked trees");
+
+        vector<string> labels;
+        registry.for_each([&labels](const TrackedTree& tree)
+        {
+            labels.push_back(tree.memory_label());
+        });
+        check(labels.size() == 2 && labels[0] == "b" && labels[1] == "a", name,
+              "for_each did not visit the trees newest first");
+
+        AVLSet<int> copy(b);
+        check(!copy.memory_tracked() && copy.memory_label() == b.memory_label(), name,
+              "copy registered or lost the label");
+        check(copy.live_nodes() == b.live_nodes() && registry.total().nodes == 200, name,
+              "copy's nodes not counted as its own");
+        b.untrack_memory();
+        check(registry.size() == before + 1 && registry.total().nodes == 100, name, "untrack left the tree listed");
+    }
+    check(registry.size() == before, name, "destroyed tree still registered");
+}
+
+/**
+* total() may run while the owners change their trees; under
+* -fsanitize=thread this checks the counters are read without a race.
+*/
+void testConcurrentTotal()
+{
+    const char* name = "TreeRegistry total";
+    AVLTree<int, int> tree;
+    tree.track_memory();
+    atomic<bool> stop(false);
+    atomic<bool> sane(true);
+    thread reader([&stop, &sane]()
+    {
+        while(!stop.load())
+        {
+            if(TreeRegistry::instance().total().nodes > 5000)
+                sane.store(false);
+            this_thread::yield();
+        }
+    });
+    for(int round = 0; round < 5; ++round)
+    {
+        for(int key = 0; key < 5000; ++key)
+            tree.insert(make_pair(key, key));
+        for(int key = 0; key < 5000; ++key)
+            tree.remove(key);
+    }
+    stop.store(true);
+    reader.join();
+    check(sane.load(), name, "total saw more nodes than the tree ever held");
+    check(TreeRegistry::instance().total().nodes == 0, name, "counters not back to zero");
+}
+
+int main()
+{
+    testCounters();
+    testOwnedBytes();
+    testRegistry();
+    testConcurrentTotal();
+    return testSummary("memory accounting");
+}
@@ -0,0 +1,415 @@
+#ifndef TREEMEMORY_H
+#define TREEMEMORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+* What a tree's memory_usage() reports. total() is everything attributable
+* to the tree; bytesPerEntry() is the figure to plan capacity with.
+*/
+struct TreeMemoryUsage
+{
+    size_t nodes;               // entries in the tree
+    size_t nodeBytes;           // nodes * sizeof(node type)
+    size_t allocatorOverhead;   // estimated headers and padding per allocation
+    size_t ownedBytes;          // heap memory owned by keys and values
+    size_t auxiliaryBytes;      // side structures such as indexes
+
+    TreeMemoryUsage() :
+        nodes(0), nodeBytes(0), allocatorOverhead(0), ownedBytes(0), auxiliaryBytes(0)
+    {
+    }
+
+    size_t total() const
+    {
+        return nodeBytes + allocatorOverhead + ownedBytes + auxiliaryBytes;
+    }
+
+    double bytesPerEntry() const
+    {
+        return nodes == 0 ? 0.0 : (double)total() / (double)nodes;
+    }
+
+    TreeMemoryUsage& operator+=(const TreeMemoryUsage& other)
+    {
+        nodes += other.nodes;
+        nodeBytes += other.nodeBytes;
+        allocatorOverhead += other.allocatorOverhead;
+        ownedBytes += other.ownedBytes;
+        auxiliaryBytes += other.auxiliaryBytes;
+        return *this;
+    }
+};
+
+/**
+* Customization point for the heap memory a key or value owns beyond its
+* own sizeof, which the node already accounts for. The default is zero;
+* specialize it for types that hold pointers to memory of their own.
+*/
+template <typename T>
+struct OwnedBytes
+{
+    static size_t bytes(const T&)
+    {
+        return 0;
+    }
+};
+
+/**
+* Strings short enough for the small-string buffer own nothing.
+*/
+template <typename CharT, typename Traits, typename A>
+struct OwnedBytes<std::basic_string<CharT, Traits, A> >
+{
+    static size_t bytes(const std::basic_string<CharT, Traits, A>& s)
+    {
+        const char *data = reinterpret_cast<const char*>(s.data());
+        const char *self = reinterpret_cast<const char*>(&s);
+        if(data >= self && data < self + sizeof(s))
+            return 0;
+        return (s.capacity() + 1) * sizeof(CharT);
+    }
+};
+
+template <typename T, typename A>
+struct OwnedBytes<std::vector<T, A> >
+{
+    static size_t bytes(const std::vector<T, A>& v)
+    {
+        size_t total = v.capacity() * sizeof(T);
+        for(size_t i = 0; i < v.size(); ++i)
+            total += OwnedBytes<T>::bytes(v[i]);
+        return total;
+    }
+};
+
+template <typename A, typename B>
+struct OwnedBytes<std::pair<A, B> >
+{
+    static size_t bytes(const std::pair<A, B>& p)
+    {
+        return OwnedBytes<A>::bytes(p.first) + OwnedBytes<B>::bytes(p.second);
+    }
+};
+
+/**
+* Customization point for what an allocator spends on one allocation of
+* size bytes beyond the bytes themselves. Unknown allocators are assumed
+* to pack tightly, as pools and arenas do; specialize for others.
+*/
+template <typename Alloc>
+struct AllocatorOverhead
+{
+    static size_t perAllocation(size_t)
+    {
+        return 0;
+    }
+};
+
+/**
+* std::allocator goes to malloc, estimated here after glibc: a one-word
+* header, rounded up to two words, with a four-word minimum chunk.
+*/
+template <typename T>
+struct AllocatorOverhead<std::allocator<T> >
+{
+    static size_t perAllocation(size_t size)
+    {
+        const size_t word = sizeof(size_t);
+        size_t chunk = (size + word + 2 * word - 1) & ~(2 * word - 1);
+        if(chunk < 4 * word)
+            chunk = 4 * word;
+        return chunk - size;
+    }
+};
+
+
+class TreeRegistry;
+
+/**
+* Base of every BinarySearchTree. Keeps O(1) counts of the tree's nodes,
+* maintained wherever nodes are allocated, freed or moved between trees,
+* and, for trees that opt in with track_memory(), links the tree into the
+* TreeRegistry so that a process can enumerate them. Untracked trees never
+* touch the registry. Copies start untracked.
+*/
+class TrackedTree
+{
+public:
+    TrackedTree();
+    TrackedTree(const TrackedTree& other);
+    TrackedTree& operator=(const TrackedTree& other);
+    virtual ~TrackedTree();
+
+    virtual TreeMemoryUsage memory_usage() const;
+    size_t live_nodes() const;
+    size_t live_node_bytes() const;
+
+    const char* memory_label() const;
+    void set_memory_label(const char* label);
+
+    void track_memory();
+    void untrack_memory();
+    bool memory_tracked() const;
+
+protected:
+    void nodeAdded(size_t bytes);
+    void nodeRemoved(size_t bytes);
+
+private:
+    friend class TreeRegistry;
+
+    TrackedTree* prev_;
+    TrackedTree* next_;
+    const char* label_;
+    bool tracked_;
+    // Written by the owning tree, read by TreeRegistry::total() from other
+    // threads, so relaxed atomics rather than plain counters.
+    std::atomic<size_t> liveNodes_;
+    std::atomic<size_t> liveNodeBytes_;
+};
+
+/**
+* The process-wide list of trees that called track_memory().
+*
+* total() only reads the trees' node counters, which stay valid while a
+* tree is being constructed, mutated or destroyed, so it is safe at any
+* time and never walks a tree. for_each hands out the trees themselves
+* with the registry locked; calling memory_usage() on one walks it, so
+* the caller must make sure that tree is not modified or destroyed
+* meanwhile, for instance by holding the lock that guards it, and should
+* keep f short since the registry is locked.
+*/
+class TreeRegistry
+{
+public:
+    static TreeRegistry& instance();
+
+    template <typename F>
+    void for_each(F f) const;
+    size_t size() const;
+    TreeMemoryUsage total() const;
+
+private:
+    friend class TrackedTree;
+
+    TreeRegistry();
+    TreeRegistry(const TreeRegistry&);
+    TreeRegistry& operator=(const TreeRegistry&);
+
+    void link(TrackedTree* tree);
+    void unlink(TrackedTree* tree);
+
+    mutable std::mutex lock_;
+    TrackedTree* head_;
+    size_t size_;
+};
+
+inline TrackedTree::TrackedTree() :
+    prev_(NULL),
+    next_(NULL),
+    label_(NULL),
+    tracked_(false),
+    liveNodes_(0),
+    liveNodeBytes_(0)
+{
+
+}
+
+/**
+* The copy's nodes are counted as the copy creates them.
+*/
+inline TrackedTree::TrackedTree(const TrackedTree& other) :
+    prev_(NULL),
+    next_(NULL),
+    label_(other.label_),
+    tracked_(false),
+    liveNodes_(0),
+    liveNodeBytes_(0)
+{
+
+}
+
+/**
+* Registration and node counts belong to the object, so assignment copies
+* only the label.
+*/
+inline TrackedTree& TrackedTree::operator=(const TrackedTree& other)
+{
+    label_ = other.label_;
+    return *this;
+}
+
+inline TrackedTree::~TrackedTree()
+{
+    untrack_memory();
+}
+
+/**
+* Overridden by BinarySearchTree. The base version reports nothing, which
+* is what a tree mid-construction or mid-destruction shows.
+*/
+inline TreeMemoryUsage TrackedTree::memory_usage() const
+{
+    return TreeMemoryUsage();
+}
+
+/**
+* Number of nodes the tree holds, in O(1).
+*/
+inline size_t TrackedTree::live_nodes() const
+{
+    return liveNodes_.load(std::memory_order_relaxed);
+}
+
+/**
+* Bytes of node storage the tree holds, in O(1); the node-only part of
+* memory_usage(), without allocator overhead or owned and side memory.
+*/
+inline size_t TrackedTree::live_node_bytes() const
+{
+    return liveNodeBytes_.load(std::memory_order_relaxed);
+}
+
+/**
+* Adds the tree to the registry. Call it once the tree is fully
+* constructed; it is removed again by untrack_memory() or on destruction.
+*/
+inline void TrackedTree::track_memory()
+{
+    if(!tracked_)
+    {
+        TreeRegistry::instance().link(this);
+        tracked_ = true;
+    }
+}
+
+inline void TrackedTree::untrack_memory()
+{
+    if(tracked_)
+    {
+        TreeRegistry::instance().unlink(this);
+        tracked_ = false;
+    }
+}
+
+inline bool TrackedTree::memory_tracked() const
+{
+    return tracked_;
+}
+
+/**
+* Called by trees for every node that joins them, whether newly allocated
+* or moved in from elsewhere, with the node's size. Only the owning tree
+* writes the counters, and never from two threads at once, so a relaxed
+* load and store do without the locked read-modify-write of fetch_add.
+*/
+inline void TrackedTree::nodeAdded(size_t bytes)
+{
+    liveNodes_.store(liveNodes_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    liveNodeBytes_.store(liveNodeBytes_.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+}
+
+/**
+* Counterpart of nodeAdded for every node that is freed or leaves.
+*/
+inline void TrackedTree::nodeRemoved(size_t bytes)
+{
+    liveNodes_.store(liveNodes_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    liveNodeBytes_.store(liveNodeBytes_.load(std::memory_order_relaxed) - bytes, std::memory_order_relaxed);
+}
+
+inline const char* TrackedTree::memory_label() const
+{
+    return label_;
+}
+
+/**
+* Names the tree in reports. The string is not copied, so it must outlive
+* the tree; a string literal is the usual choice.
+*/
+inline void TrackedTree::set_memory_label(const char* label)
+{
+    label_ = label;
+}
+
+/**
+* The registry is never destroyed, so trees with static storage duration
+* can unregister at exit in any order.
+*/
+inline TreeRegistry& TreeRegistry::instance()
+{
+    static TreeRegistry* registry = new TreeRegistry();
+    return *registry;
+}
+
+inline TreeRegistry::TreeRegistry() :
+    head_(NULL),
+    size_(0)
+{
+
+}
+
+inline void TreeRegistry::link(TrackedTree* tree)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    tree->next_ = head_;
+    if(head_ != NULL)
+        head_->prev_ = tree;
+    head_ = tree;
+    ++size_;
+}
+
+inline void TreeRegistry::unlink(TrackedTree* tree)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    if(tree->prev_ != NULL)
+        tree->prev_->next_ = tree->next_;
+    else
+        head_ = tree->next_;
+    if(tree->next_ != NULL)
+        tree->next_->prev_ = tree->prev_;
+    --size_;
+}
+
+/**
+* Calls f(const TrackedTree&) for every tracked tree, newest first, with
+* the registry locked; f must not track or untrack trees.
+*/
+template <typename F>
+void TreeRegistry::for_each(F f) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    for(const TrackedTree* tree = head_; tree != NULL; tree = tree->next_)
+        f(*tree);
+}
+
+inline size_t TreeRegistry::size() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return size_;
+}
+
+/**
+* Sums the node counters of every tracked tree in time linear in the
+* number of trees. Only nodes and nodeBytes are filled in; for the full
+* breakdown of a tree call its memory_usage().
+*/
+inline TreeMemoryUsage TreeRegistry::total() const
+{
+    TreeMemoryUsage sum;
+    std::lock_guard<std::mutex> guard(lock_);
+    for(const TrackedTree* tree = head_; tree != NULL; tree = tree->next_)
+    {
+        sum.nodes += tree->live_nodes();
+        sum.nodeBytes += tree->live_node_bytes();
+    }
+    return sum;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "bst.h"
+#include "avlbst.h"
+#include "print_bst.h"
+#include "balancedbst.h"
+#include "splaybst.h"
+
+using namespace std;
+
+/**
+* An int key that counts every comparison made on it, so the benchmark can
+* report how deep lookups go independently of timer noise.
+*/
+struct CountedKey
+{
+    int key;
+    static unsigned long long comparisons;
+
+    CountedKey(int k = 0) : key(k) { }
+};
+
+unsigned long long CountedKey::comparisons = 0;
+
+static bool operator<(const CountedKey& a, const CountedKey& b)
+{
+    ++CountedKey::comparisons;
+    return a.key < b.key;
+}
+
+static bool operator>(const CountedKey& a, const CountedKey& b)
+{
+    ++CountedKey::comparisons;
+    return a.key > b.key;
+}
+
+static ostream& operator<<(ostream& out, const CountedKey& k)
+{
+    return out << k.key;
+}
+
+/**
+* Draws n samples of ranks 0..keys-1 from a Zipf distribution with
+* exponent s, using the inverse of the cumulative distribution.
+*/
+static vector<int> zipfRanks(size_t keys, double s, size_t n, unsigned seed)
+{
+    vector<double> cdf(keys);
+    double sum = 0;
+    for(size_t i = 0; i < keys; ++i)
+    {
+        sum += 1.0 / pow((double)(i + 1), s);
+        cdf[i] = sum;
+    }
+    srand(seed);
+    vector<int> ranks(n);
+    for(size_t i = 0; i < n; ++i)
+    {
+        double u = sum * ((double)rand() / ((double)RAND_MAX + 1.0));
+        ranks[i] = (int)(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+    }
+    return ranks;
+}
+
+/**
+* Times the lookups against a tree holding every key and returns the
+* elapsed seconds. The checksum keeps the lookups from being optimized
+* away.
+*/
+template <typename Tree>
+static double timeLookups(Tree& tree, const vector<int>& lookups, long long& checksum)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < lookups.size(); ++i)
+    {
+        typename Tree::iterator it = tree.find(lookups[i]);
+        if(it != tree.end())
+            checksum += it->second;
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+* Returns the average number of key comparisons per lookup, measured on a
+* fresh tree so that self-adjusting trees start from the same shape as in
+* the timed runs.
+*/
+template <typename CountedTree>
+static double comparisonsPerLookup(const vector<int>& keys, const vector<int>& lookups)
+{
+    CountedTree tree;
+    for(size_t i = 0; i < keys.size(); ++i)
+        tree.insert(std::make_pair(CountedKey(keys[i]), (int)i));
+    CountedKey::comparisons = 0;
+    for(size_t i = 0; i < lookups.size(); ++i)
+        tree.find(CountedKey(lookups[i]));
+    return (double)CountedKey::comparisons / lookups.size();
+}
+
+/**
+* Builds a fresh tree and times the lookups reps times after one
+* discarded warm-up run, then reports the median time together with the
+* comparisons per lookup.
+*/
+template <typename IntTree, typename CountedTree>
+static void run(const char* name, const vector<int>& keys, const vector<int>& lookups, size_t reps)
+{
+    vector<double> times;
+    long long checksum = 0;
+    for(size_t r = 0; r <= reps; ++r)
+    {
+        IntTree tree;
+        for(size_t i = 0; i < keys.size(); ++i)
+            tree.insert(std::make_pair(keys[i], (int)i));
+        checksum = 0;
+        double secs = timeLookups(tree, lookups, checksum);
+        if(r > 0)
+            times.push_back(secs);
+    }
+    sort(times.begin(), times.end());
+    double median = times[times.size() / 2];
+    cout << name << ": median " << median << " s of " << reps << " (range " << times.front()
+         << " - " << times.back() << "), " << (lookups.size() / median / 1e6) << " M lookups/s, "
+         << comparisonsPerLookup<CountedTree>(keys, lookups) << " comparisons/lookup (checksum "
+         << checksum << ")" << endl;
+}
+
+/**
+* Usage: zipf-bench [keys] [lookups] [exponent] [reps]
+*
+* Looks up Zipf-distributed keys in an AVLTree, a red-black tree and a
+* splay tree built over the same shuffled keys. Key ranks are shuffled
+* so that popularity is unrelated to key order. Each tree is timed reps
+* times (default 5) and the median is reported next to the number of key
+* comparisons per lookup, which shows the depth saved by splaying
+* without timer noise.
+*/
+int main(int argc, char* argv[])
+{
+    size_t keys = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    size_t count = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000000;
+    double s = argc > 3 ? atof(argv[3]) : 1.1;
+    size_t reps = argc > 4 ? strtoul(argv[4], NULL, 10) : 5;
+    if(reps == 0)
+        reps = 1;
+
+    vector<int> keyOf(keys);
+    for(size_t i = 0; i < keys; ++i)
+        keyOf[i] = (int)(i * 2);
+    srand(1);
+    for(size_t i = keys; i > 1; --i)
+        swap(keyOf[i - 1], keyOf[rand() % i]);
+
+    vector<int> ranks = zipfRanks(keys, s, count, 2);
+    vector<int> lookups(count);
+    size_t hot = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        lookups[i] = keyOf[ranks[i]];
+        if((size_t)ranks[i] < keys / 100)
+            ++hot;
+    }
+    cout << keys << " keys, " << count << " lookups, exponent " << s << ": "
+         << (100.0 * hot / count) << "% of lookups hit the hottest 1% of keys" << endl;
+
+    vector<int> insertOrder(keyOf);
+    sort(insertOrder.begin(), insertOrder.end());
+    run<AVLTree<int, int>, AVLTree<CountedKey, int> >("AVLTree", insertOrder, lookups, reps);
+    run<RedBlackTree<int, int>, RedBlackTree<CountedKey, int> >("RedBlackTree", insertOrder, lookups, reps);
+    run<SplayTree<int, int>, SplayTree<CountedKey, int> >("SplayTree", insertOrder, lookups, reps);
+    return 0;
+}